@@ -12,7 +12,22 @@
 #include <nspk_control_lcore.h>
 #include <nspk_rtp_lcore.h>
 #include <nspk_avio.h>
+#include <nspk_av_ingest.h>
 #include <nspk_tldk.h>
+#include <nspk_rtp_pktzr.h>
+#include <nspk_pacer.h>
+#include <nspk_rtcp.h>
+#include <nspk_cc.h>
+#include <nspk_rtx.h>
+#include <nspk_fec.h>
+#include <nspk_fanout.h>
+#include <nspk_ladder.h>
+#include <nspk_bufpool.h>
+#include <nspk_rtp_tcp.h>
+#include <nspk_cpu.h>
+#include <nspk_sched.h>
+#include <nspk_rtsp.h>
+#include <nspk_http.h>
 
 #define	MAX_RULES	0x100
 #define	MAX_TBL8	0x800
@@ -34,6 +49,10 @@
 
 RTE_DECLARE_PER_LCORE(struct netbe_lcore *, _be);
 RTE_DECLARE_PER_LCORE(struct netfe_lcore *, _fe);
+/* RTP session being stepped by the scheduler of this lcore, if any. */
+RTE_DECLARE_PER_LCORE(struct nspk_rtp_session_ctx_t *, _rtp_sess);
+/* Scheduler running on this lcore, NULL outside nspk_sched_run(). */
+RTE_DECLARE_PER_LCORE(struct nspk_sched_t *, _sched);
 
 extern volatile int force_quit;
 
@@ -54,8 +73,6 @@ extern TLE_STREAM_CLOSE_FUNCTYPE tle_stream_close;
 
 extern LCORE_MAIN_FUNCTYPE lcore_main;
 
-extern struct nspk_rtp_session_ctx_t *g_rtp_sess;
-
 /**
  * Location to be modified to create the IPv4 hash key which helps
  * to distribute packets based on the destination TCP/UDP port.
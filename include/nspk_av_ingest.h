@@ -0,0 +1,18 @@
+#pragma once
+
+#include <libavformat/avformat.h>
+
+/**
+ * \brief Demuxer of MPEG-TS contribution feeds received through TLDK, from
+ *        tldk_udp://host:port (raw TS) or tldk_rtp://host:port (TS over RTP)
+ *        URLs. Datagrams come as mbuf backed AVBufferRefs and the TS packets
+ *        are demuxed in place, the only copy left is the reassembly of the
+ *        PES payloads into AVPackets.
+ *        Must be opened from the lcore which runs the session.
+ */
+extern AVInputFormat nspk_ingest_demuxer;
+
+/**
+ * \brief Whether a URL is read by nspk_ingest_demuxer.
+ */
+int nspk_ingest_supported(const char *url);
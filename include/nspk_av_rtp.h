@@ -1,5 +1,20 @@
 #pragma once
 
 #include <libavformat/url.h>
+#include <libavutil/buffer.h>
+#include <rte_mbuf.h>
 
 extern const URLProtocol tldk_rtp_protocol;
+
+/**
+ * \brief Take the next RTCP or RTP datagram of a tldk_rtp input, RTCP
+ *        first, without copying it. See nspk_udp_read_buffer().
+ * \return Size of the datagram, or a negative AVERROR.
+ */
+int nspk_rtp_read_buffer(URLContext *h, AVBufferRef **pbuf);
+
+/**
+ * \brief Take the next RTCP or RTP datagram of a tldk_rtp input as is.
+ * \return Size of the datagram, or a negative AVERROR.
+ */
+int nspk_rtp_read_mbuf(URLContext *h, struct rte_mbuf **pm);
@@ -1,15 +1,21 @@
 #pragma once
 
-#include <libavutil/fifo.h>
+#include <sys/queue.h>
+#include <rte_ring.h>
 #include <libavformat/url.h>
 #include <libavformat/os_support.h>
 #include <libavformat/ip.h>
+#include <libavutil/buffer.h>
+#include <tldk_utils/netbe.h>
 
 #define UDP_TX_BUF_SIZE 32768
 #define UDP_RX_BUF_SIZE 393216
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
 
+/* Ring size of input contexts which do not set fifo_size. */
+#define UDP_RING_DEFAULT_SIZE 4096
+
 typedef struct UDPTldkContext {
     const AVClass *class;
     int udp_fd;
@@ -27,22 +33,29 @@ typedef struct UDPTldkContext {
 
     /* TLDK FE stream */
     struct netfe_stream *tldk_udp_stream;
-    struct netfe_sprm *tldk_stream_prm;
+    struct netfe_sprm tldk_stream_prm;
+    /* Set on output with a bitrate, shapes the stream on the lcore. */
+    struct nspk_pacer_t *pacer;
 
-    /* Circular Buffer variables for use in UDP receive code */
+    /*
+     * SP/SC ring of mbufs between the lcore owning the stream and the
+     * FFmpeg caller, which may run on another thread. The lcore fills it
+     * from TLDK when the stream's RX event fires on input, see
+     * nspk_tldk_lcore_rx(), and drains it in bursts on output, see
+     * nspk_udp_lcore_run().
+     */
     int circular_buffer_size;
-    AVFifoBuffer *fifo;
+    struct rte_ring *ring;
+    uint32_t lcore;
+    int is_output;
     int circular_buffer_error;
+    uint64_t ring_drops;
+    /* Output contexts with a ring, input ones are found through the RX event queue. */
+    LIST_ENTRY(UDPTldkContext) link;
+    /* Source of the last datagram read. */
+    struct sockaddr_storage last_source;
     int64_t bitrate; /* number of bits to send per second */
     int64_t burst_bits;
-    int close_req;
-#if HAVE_PTHREAD_CANCEL
-    pthread_t circular_buffer_thread;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    int thread_started;
-#endif
-    uint8_t tmp[UDP_MAX_PKT_SIZE+4];
     int remaining_in_dg;
     char *localaddr;
     int timeout;
@@ -50,6 +63,39 @@ typedef struct UDPTldkContext {
     char *sources;
     char *block;
     IPSourceFilters filters;
+    /* Group joined on the BE by an input context, family 0 if none. */
+    struct sockaddr_storage mcast_group;
 } UDPTldkContext;
 
 extern const URLProtocol tldk_udp_protocol;
+
+/**
+ * \brief Move written datagrams from the rings of the tldk_udp contexts
+ *        opened on the calling lcore to TLDK, in bursts. Input rings are
+ *        filled by nspk_tldk_lcore_rx() when their stream receives.
+ * \return Number of datagrams moved.
+ */
+uint32_t nspk_udp_lcore_run(void);
+
+/**
+ * \brief Take the next datagram of an input context without copying it.
+ *        *pbuf references the payload in place in its rte_mbuf, which
+ *        goes back to its pool when the last reference is dropped, from
+ *        any thread. Waits like url_read() unless AVIO_FLAG_NONBLOCK is set.
+ * \return Size of the datagram, or a negative AVERROR.
+ */
+int nspk_udp_read_buffer(URLContext *h, AVBufferRef **pbuf);
+
+/**
+ * \brief Take the next datagram of an input context as is.
+ *        Waits like nspk_udp_read_buffer().
+ * \return Size of the datagram, or a negative AVERROR.
+ */
+int nspk_udp_read_mbuf(URLContext *h, struct rte_mbuf **pm);
+
+/**
+ * \brief Wrap a received datagram in an AVBufferRef, see
+ *        nspk_udp_read_buffer(). Ownership of the mbuf passes to the
+ *        buffer, it is freed if NULL is returned.
+ */
+AVBufferRef *nspk_udp_mbuf_to_buffer(struct rte_mbuf *m);
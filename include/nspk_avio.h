@@ -9,9 +9,39 @@
 #include <nspk_av_udp.h>
 #include <nspk_av_rtp.h>
 
+/**
+ * \brief Default RTP datagram size, same as the UDP protocol's pkt_size.
+ */
+#define NSPK_RTP_DEFAULT_PKT_SIZE 1472
+
 int nspk_ffurl_open_whitelist(URLContext **puc, const char *filename, int flags,
                              const AVIOInterruptCB *int_cb, AVDictionary **options,
                              const char *whitelist, const char* blacklist,
                              URLContext *parent, const URLProtocol *tldk_protocol);
 
 int nspk_avio_open(struct nspk_rtp_session_ctx_t *rtp_sess, AVIOContext **s, const char *filename, int flags);
+
+/**
+ * \brief Fill TLDK stream params from an
+ *        rtp://host:port[?rtcpport=n&pkt_size=n&localport=n&localrtcpport=n] URL.
+ *        host must be numeric. Local addresses are wildcard, with an
+ *        ephemeral port unless localport/localrtcpport say otherwise.
+ *        rtcp_sprm and pkt_size may be NULL.
+ * \return 0 on success, negative AVERROR on failure.
+ */
+int nspk_rtp_url_parse(const char *url, struct netfe_sprm *rtp_sprm,
+                       struct netfe_sprm *rtcp_sprm, int *pkt_size);
+
+/**
+ * \brief Open a write-only AVIOContext for an rtp:// URL whose buffer is the
+ *        data room of an rte_mbuf. The muxer builds each RTP/RTCP packet in
+ *        place and the mbuf is queued on a TLDK UDP stream without copying.
+ *        Must be called from the lcore which owns the session's FE.
+ *        Must be released with nspk_avio_close_mbuf(), never avio_close().
+ */
+int nspk_avio_open_mbuf(struct nspk_rtp_session_ctx_t *rtp_sess, AVIOContext **s, const char *filename);
+
+/**
+ * \brief Flush and free an AVIOContext opened by nspk_avio_open_mbuf().
+ */
+void nspk_avio_close_mbuf(AVIOContext **s);
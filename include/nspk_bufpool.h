@@ -0,0 +1,92 @@
+#pragma once
+
+#include <pthread.h>
+#include <rte_mbuf.h>
+#include <libavcodec/avcodec.h>
+
+/**
+ * Encoded packets are served from size classes of 4 KiB up to 16 MiB,
+ * larger ones from the default allocator.
+ */
+#define NSPK_BUFPOOL_PKT_MIN_SHIFT  12
+#define NSPK_BUFPOOL_PKT_CLASSES    13
+
+/**
+ * \brief Header in front of each packet buffer of an encoder pool, which
+ *        makes the buffer rte_mbuf external buffer memory: slices of the
+ *        packet can be attached to mbufs with rte_pktmbuf_attach_extbuf()
+ *        and sent without a copy.
+ */
+struct nspk_bufpool_ext_t
+{
+    /* One reference per attached mbuf, plus the attacher's own while it attaches. */
+    struct rte_mbuf_ext_shared_info shinfo;
+    /* Held while mbufs are attached, so the buffer does not go back to the pool. */
+    AVBufferRef *ref;
+    uint64_t magic;
+} __rte_cache_aligned;
+
+/**
+ * \brief Recycled buffers of one codec context, in hugepage memory of a
+ *        NUMA node: the frames a decoder decodes into, or the packets an
+ *        encoder encodes into. A buffer goes back to its pool once the last
+ *        reference to it is dropped, wherever that happens, so the steady
+ *        state allocates no frame or packet data at all.
+ */
+struct nspk_bufpool_t
+{
+    int socket;
+    /* Codec threads may ask for buffers concurrently. */
+    pthread_mutex_t lock;
+
+    /* Decoders: the pools of the current frame geometry, recreated when it changes. */
+    int format;
+    int width;
+    int height;
+    int channels;
+    int nb_samples;
+    int planes;
+    int linesize[4];
+    AVBufferPool *pools[4];
+
+    /* Encoders, created on first use. */
+    AVBufferPool *pkt_pools[NSPK_BUFPOOL_PKT_CLASSES];
+
+    uint64_t gets;
+    /* Buffers the pools could not serve, taken from the default allocator. */
+    uint64_t fallbacks;
+};
+
+/**
+ * \brief Serve the buffers of ctx from a pool on NUMA node socket, before
+ *        it is opened: get_buffer2() for decoders, get_encode_buffer() for
+ *        encoders. Codecs which cannot take user buffers (no
+ *        AV_CODEC_CAP_DR1) and hardware frames keep the default allocator.
+ * \return the pool, to free once ctx is, or NULL if out of memory.
+ */
+struct nspk_bufpool_t *nspk_bufpool_attach(AVCodecContext *ctx, int socket);
+
+/**
+ * \brief The extbuf header of a packet encoded into an encoder pool, NULL
+ *        for packets from anywhere else.
+ */
+struct nspk_bufpool_ext_t *nspk_bufpool_ext(const AVPacket *pkt);
+
+/**
+ * \brief Take a reference on the buffer of pkt for the mbufs about to be
+ *        attached to it, and one on ext->shinfo for the caller.
+ * \return 0, or negative AVERROR if pkt cannot be held.
+ */
+int nspk_bufpool_ext_hold(struct nspk_bufpool_ext_t *ext, const AVPacket *pkt);
+
+/**
+ * \brief Drop the caller's reference taken by nspk_bufpool_ext_hold(). The
+ *        buffer goes back to its pool once the last attached mbuf is freed.
+ */
+void nspk_bufpool_ext_release(struct nspk_bufpool_ext_t *ext);
+
+/**
+ * \brief Release the pools. The buffers still referenced, e.g. packets
+ *        queued for the lcore, are freed when they are unreferenced.
+ */
+void nspk_bufpool_free(struct nspk_bufpool_t **pool);
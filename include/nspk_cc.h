@@ -0,0 +1,106 @@
+#pragma once
+
+#include <libavcodec/avcodec.h>
+
+/**
+ * How often the lcore revisits the target bitrate of a stream.
+ */
+#define NSPK_CC_INTERVAL_MS     100
+
+/**
+ * Fraction lost, in 1/256, above which the rate is cut (about 10%) and
+ * below which it may grow (about 2%).
+ */
+#define NSPK_CC_LOSS_HIGH       26
+#define NSPK_CC_LOSS_LOW        5
+
+/**
+ * Rise of the interarrival jitter between two reports which is taken for
+ * a queue building up on the path, before any loss.
+ */
+#define NSPK_CC_JITTER_RISE_US  10000
+
+/**
+ * Number of samples in a row the pacer queue must grow for frames to be
+ * held back.
+ */
+#define NSPK_CC_QUEUE_SAMPLES   5
+
+#define NSPK_CC_MIN_BPS         64000
+
+/**
+ * VBV buffer of the retuned encoders, in milliseconds at the target rate.
+ */
+#define NSPK_CC_VBV_MS          500
+
+struct nspk_rtcp_t;
+struct nspk_pacer_t;
+
+/**
+ * \brief Congestion controller of one transcoded native stream.
+ *        The lcore moves the target bitrate from the receiver reports of
+ *        the stream's RTCP (loss first, then jitter growth) and the queue
+ *        of its pacer, see nspk_cc_run(). The thread owning the encoder
+ *        picks the target up before each frame with nspk_cc_apply(), which
+ *        retunes bit_rate and the VBV of the AVCodecContext, and skips
+ *        frames while the pacer queue keeps growing.
+ */
+struct nspk_cc_t
+{
+    const struct nspk_rtcp_t *rtcp;
+    /* NULL if the session is not paced. */
+    const struct nspk_pacer_t *pacer;
+    /* NSPK_CC_INTERVAL_MS in TSC cycles. */
+    uint64_t interval;
+    uint64_t next_tsc;
+
+    /* Arrival TSC of the last report acted upon. */
+    uint64_t rr_tsc;
+    uint32_t jitter_us;
+    uint64_t q_bytes;
+    uint32_t q_growth;
+
+    int64_t min_bps;
+    int64_t max_bps;
+    /* Lcore side estimate, published through target_bps and hold. */
+    int64_t bps;
+    int lcore_hold;
+
+    /*
+     * Written by the lcore, read by the thread owning the encoder. Only
+     * accessed with __atomic builtins.
+     */
+    int64_t target_bps;
+    int hold;
+
+    /* Encoder side. */
+    int64_t applied_bps;
+    uint64_t retunes;
+    uint64_t skipped;
+
+    /* Lcore side. */
+    uint64_t increases;
+    uint64_t decreases;
+    uint64_t holds;
+};
+
+/**
+ * \brief Set up a controller starting, and capped, at max_bps, the rate the
+ *        encoder was opened with.
+ */
+void nspk_cc_init(struct nspk_cc_t *cc, const struct nspk_rtcp_t *rtcp,
+                  const struct nspk_pacer_t *pacer, int64_t max_bps);
+
+/**
+ * \brief Update the target from the latest report and the pacer queue.
+ *        Run on the lcore which owns the stream, at most once per interval.
+ * \return 1 if the target or the hold state changed, 0 otherwise.
+ */
+int nspk_cc_run(struct nspk_cc_t *cc, uint64_t now);
+
+/**
+ * \brief Retune the encoder to the current target. Run by the thread
+ *        owning the encoder before a frame is sent to it.
+ * \return 1 if the frame must be skipped, 0 if it may be encoded.
+ */
+int nspk_cc_apply(struct nspk_cc_t *cc, AVCodecContext *enc_ctx);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <rte_lcore.h>
+#include <libavcodec/avcodec.h>
+
+/**
+ * Threads of a video codec when the session does not set codec_threads,
+ * at most one per codec CPU.
+ */
+#define NSPK_CPU_CODEC_THREADS  4
+
+struct nspk_rtp_session_ctx_t;
+
+/**
+ * \brief Plan where codec threads run, once after rte_eal_init(): the
+ *        online CPUs but those of the EAL lcores and their hyperthread
+ *        siblings, which busy-poll, split by NUMA node. If that leaves no
+ *        CPU the siblings are taken back; if none is left at all, codecs
+ *        run single threaded in the thread which opens them.
+ */
+void nspk_cpu_plan_init(void);
+
+/**
+ * \brief CPUs a helper thread of the calling lcore may run on: those of
+ *        the plan on the lcore's NUMA node, or on any node if it has none.
+ *        Empty if the plan has no CPU.
+ */
+void nspk_cpu_worker_set(rte_cpuset_t *cpuset);
+
+/**
+ * \brief CPUs the codec threads of a session may run on: codec_cpu if set,
+ *        else those of the plan on the NUMA node of the calling lcore, or
+ *        on any node if it has none. Empty if the plan has no CPU.
+ */
+void nspk_cpu_codec_set(const struct nspk_rtp_session_ctx_t *rtp_sess, rte_cpuset_t *cpuset);
+
+/**
+ * \brief avcodec_open2() with the threading of the session. Video codecs
+ *        get codec_threads threads of codec_thread_type, audio codecs
+ *        none. The threads the codec starts while it opens, its own or
+ *        those of an external library such as x264, are started on the
+ *        CPUs of nspk_cpu_codec_set() instead of the caller's lcore and
+ *        pinned one CPU each as they are created, round robin over all
+ *        sessions. Lcores open codecs concurrently.
+ * \return avcodec_open2()'s.
+ */
+int nspk_cpu_codec_open(const struct nspk_rtp_session_ctx_t *rtp_sess, AVCodecContext *ctx,
+                        const AVCodec *codec, AVDictionary **options);
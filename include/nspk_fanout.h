@@ -0,0 +1,77 @@
+#pragma once
+
+#include <rte_mbuf.h>
+#include <tldk_utils/netbe.h>
+
+/**
+ * \brief One unicast receiver of a fanned out stream, with its own TLDK
+ *        stream, SSRC and sequence number space.
+ */
+struct nspk_fanout_dst_t
+{
+    struct netfe_stream *fs;
+    uint32_t ssrc;
+    /* Added to the sequence number of the source stream. */
+    uint16_t seq_off;
+    uint64_t packets;
+    uint64_t drops;
+};
+
+/**
+ * \brief Copies of one native RTP stream sent to many unicast receivers.
+ *        The payload of each packet leaving on the source stream is
+ *        attached once to an indirect mbuf, and every receiver gets a
+ *        12 byte header mbuf of its own chained to it: a header write and
+ *        a reference on the shared payload per receiver, no copy.
+ *        Runs on the lcore owning the streams.
+ */
+struct nspk_fanout_t
+{
+    /* Source SSRC, its retransmissions in RTX format are not fanned out. */
+    uint32_t ssrc;
+    int started;
+    /* Sequence number after the last packet fanned out. */
+    uint16_t next;
+
+    uint32_t num;
+    uint32_t size;
+    struct nspk_fanout_dst_t *dst;
+
+    uint64_t packets;
+    uint64_t copies;
+    uint64_t drops;
+};
+
+/**
+ * \brief Set up an empty fan-out of the stream with SSRC ssrc.
+ */
+void nspk_fanout_init(struct nspk_fanout_t *f, uint32_t ssrc);
+
+/**
+ * \brief Close the streams of all receivers and free them.
+ */
+void nspk_fanout_fini(struct nspk_fanout_t *f);
+
+/**
+ * \brief Add a receiver, on a new TXONLY FE stream of the calling lcore.
+ *        It gets the packets sent from then on.
+ * \return 0 on success, negative AVERROR on failure.
+ */
+int nspk_fanout_add(struct nspk_fanout_t *f, struct lcore_prm *lcore_prm,
+                    const struct netfe_sprm *sprm);
+
+/**
+ * \brief Add the receivers listed in a file, one "host:port" per line,
+ *        '#' starting a comment. port_off is added to each port.
+ * \return Number of receivers added, negative AVERROR on failure.
+ */
+int nspk_fanout_load(struct nspk_fanout_t *f, struct lcore_prm *lcore_prm,
+                     const char *path, int port_off);
+
+/**
+ * \brief Copy packets about to be handed to TLDK on the source stream,
+ *        from its tx_cb. Packets offered again after a partial send and
+ *        retransmissions are not copied. The copies are queued on the
+ *        receivers' FE streams for the next nspk_tldk_lcore_flush().
+ */
+void nspk_fanout_sent(struct nspk_fanout_t *f, struct rte_mbuf *pkt[], uint32_t num);
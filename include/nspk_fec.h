@@ -0,0 +1,95 @@
+#pragma once
+
+#include <rte_mbuf.h>
+#include <tldk_utils/netbe.h>
+
+/**
+ * Matrix bounds of SMPTE 2022-1: L columns by D rows.
+ */
+#define NSPK_FEC_MIN_L          4
+#define NSPK_FEC_MAX_L          20
+#define NSPK_FEC_MIN_D          4
+#define NSPK_FEC_MAX_D          20
+#define NSPK_FEC_MAX_LD         100
+
+/**
+ * The column FEC stream goes to the media port + 2, the row one to + 4.
+ */
+#define NSPK_FEC_COL_PORT_OFF   2
+#define NSPK_FEC_ROW_PORT_OFF   4
+
+/**
+ * \brief XOR of the media packets of one row or column, built in the mbuf
+ *        of the FEC packet which carries it.
+ */
+struct nspk_fec_acc_t
+{
+    struct rte_mbuf *m;
+    /* Longest payload XORed in so far, the rest of the buffer is zero. */
+    uint16_t len;
+    uint16_t snbase;
+    uint16_t len_rec;
+    uint8_t pt_rec;
+    uint32_t ts_rec;
+    uint32_t ts;
+};
+
+/**
+ * \brief SMPTE 2022-1 (Pro-MPEG COP3) FEC generator of one RTP stream.
+ *        The media packets are XORed, as they leave, into one row
+ *        accumulator and one per column, each held in the mbuf of the FEC
+ *        packet it becomes. A row is sent once its L packets are in, each
+ *        column on the last row of the matrix, so the column packets are
+ *        spread over a row instead of bursting. The XOR runs with AVX-512
+ *        or AVX2 when the CPU has them.
+ *        Runs on the lcore owning the FE streams.
+ */
+struct nspk_fec_t
+{
+    struct netfe_stream *col_fs;
+    struct netfe_stream *row_fs;
+    uint8_t l;
+    uint8_t d;
+
+    int started;
+    /* First sequence number of the matrix, and the next one expected. */
+    uint16_t base;
+    uint16_t next;
+    uint16_t col_seq;
+    uint16_t row_seq;
+    struct nspk_fec_acc_t row;
+    struct nspk_fec_acc_t col[NSPK_FEC_MAX_L];
+
+    uint64_t packets;
+    uint64_t col_sent;
+    uint64_t row_sent;
+    /* Matrices given up on a sequence number jump. */
+    uint64_t resets;
+    uint64_t drops;
+};
+
+/**
+ * \brief Parse FFmpeg's fec option, "prompeg=l=<L>:d=<D>".
+ * \return 0 on success, negative AVERROR on failure.
+ */
+int nspk_fec_parse(const char *str, int *l, int *d);
+
+/**
+ * \brief Open the column and row FE streams next to the media stream
+ *        described by rtp_sprm, on the calling lcore.
+ * \return 0 on success, negative AVERROR on failure.
+ */
+int nspk_fec_init(struct nspk_fec_t *f, struct lcore_prm *lcore_prm,
+                  const struct netfe_sprm *rtp_sprm, int l, int d);
+
+/**
+ * \brief Drop the partial matrix and close the FE streams.
+ */
+void nspk_fec_fini(struct nspk_fec_t *f);
+
+/**
+ * \brief Protect a media RTP packet. Packets older than the last one, e.g.
+ *        retransmissions, are ignored. The FEC packets it completes are
+ *        queued on their FE streams for the next nspk_tldk_lcore_flush().
+ */
+void nspk_fec_add(struct nspk_fec_t *f, const uint8_t *pkt, int len);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <limits.h>
+#include <tldk_utils/netbe.h>
+
+#define NSPK_HTTP_DEFAULT_PORT      80
+#define NSPK_HTTP_DEFAULT_MAX_CONN  1024
+/* Bytes of file bodies each lcore keeps, in MiB. */
+#define NSPK_HTTP_DEFAULT_CACHE_MB  256
+
+/**
+ * Max number of listening ports, see nspk_http_prm.nb_port.
+ */
+#define NSPK_HTTP_MAX_LISTEN        16
+
+/**
+ * Max size of a request line and its headers.
+ */
+#define NSPK_HTTP_REQ_SIZE          4096
+
+/**
+ * Number of files whose body each lcore keeps.
+ */
+#define NSPK_HTTP_MAX_BODY          1024
+
+/**
+ * Number of files each lcore reads at once, requests for more get a 503.
+ */
+#define NSPK_HTTP_MAX_LOAD          64
+
+/**
+ * \brief HTTP/1.1 origin, set from --http. It runs on the TCP context next
+ *        to the UDP one of each worker BE lcore and serves GET and HEAD of
+ *        the files of root, e.g. the playlists and segments of an HLS or
+ *        DASH packager: http://<addr>:<port>/<file>.
+ *        File bodies are read once into hugepage memory, by a thread of
+ *        each lcore off its CPU while the requests for them wait, and sent
+ *        as mbufs attached to it as external buffers, one segment each, so
+ *        a reply only costs its header however many clients fetch the same
+ *        file.
+ *        A file is read again once its size or mtime changes, replies in
+ *        flight keep the previous body until TCP is done with it.
+ */
+struct nspk_http_prm
+{
+    int enable;
+
+    /**
+     * Listen on port to port + nb_port - 1, as nspk_rtsp_prm.port: the
+     * NIC spreads connections over the queues by destination port only.
+     */
+    uint16_t port;
+    uint16_t nb_port;
+
+    /* Connections of one lcore. */
+    uint32_t max_conn;
+
+    /* Bytes of file bodies one lcore keeps, the least recently used go first. */
+    uint64_t cache_size;
+
+    char root[PATH_MAX];
+};
+
+extern struct nspk_http_prm nspk_http_prm;
+
+/**
+ * \brief Open the listening streams of the calling lcore, on the ports
+ *        its queues own, and start the thread which reads its files if it
+ *        has any. Must run on a worker lcore with its FE and BE set
+ *        up, before nspk_sched_run().
+ * \return 0 on success, negative AVERROR on failure.
+ */
+int nspk_http_lcore_init(struct lcore_prm *lcore_prm);
+
+/**
+ * \brief Close the connections and listening streams of the calling lcore,
+ *        stop its loader and drop its cache. Bodies still in flight are freed by the last
+ *        mbuf attached to them.
+ */
+void nspk_http_lcore_fini(void);
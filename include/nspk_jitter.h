@@ -0,0 +1,101 @@
+#pragma once
+
+#include <rte_mbuf.h>
+
+/**
+ * Defaults of nspk_jitter_init(). The size must cover the packets received
+ * over the playout delay, a power of 2 up to NSPK_JITTER_MAX_SIZE.
+ */
+#define NSPK_JITTER_DEFAULT_SIZE        4096
+#define NSPK_JITTER_DEFAULT_DELAY_US    20000
+#define NSPK_JITTER_MAX_SIZE            32768
+
+struct nspk_jitter_slot_t
+{
+    struct rte_mbuf *m;
+    /*
+     * TSC at which the packet arrived or, while it is missing, at which the
+     * first packet after it did: the wait for it starts then.
+     */
+    uint64_t tsc;
+};
+
+/**
+ * \brief Reorder and jitter buffer of one RTP source (SSRC).
+ *        A ring indexed by sequence number modulo its size holds the
+ *        received mbufs until they are played out in sequence order,
+ *        a playout delay after their arrival. Playout and the loss checks
+ *        are O(1), insertion too but for the missing slots a gap stamps.
+ *        Used by one thread at a time, the one reading the input.
+ */
+struct nspk_jitter_t
+{
+    uint32_t ssrc;
+    uint32_t size;
+    uint32_t mask;
+    /* Playout delay in TSC cycles. */
+    uint64_t delay;
+
+    int started;
+    /* Next sequence number to play out. */
+    uint16_t head;
+    /* Highest sequence number received. */
+    uint16_t max_seq;
+    uint32_t count;
+    struct nspk_jitter_slot_t *slot;
+
+    uint64_t received;
+    uint64_t played;
+    /* Sequence numbers given up at playout. */
+    uint64_t lost;
+    /* Packets which came after their slot was played out or given up. */
+    uint64_t late;
+    uint64_t dups;
+    /* Sequence number jumps beyond the ring, which restart the buffer. */
+    uint64_t resyncs;
+};
+
+/**
+ * \brief Set up an empty buffer.
+ * \param size      Number of slots, 0 for the default.
+ * \param delay_us  Playout delay in microseconds.
+ * \return 0 on success, negative AVERROR on failure.
+ */
+int nspk_jitter_init(struct nspk_jitter_t *jb, uint32_t ssrc, uint32_t size, uint32_t delay_us);
+
+/**
+ * \brief Drop the packets still held and free the ring.
+ */
+void nspk_jitter_fini(struct nspk_jitter_t *jb);
+
+/**
+ * \brief Hold a received packet. Ownership of the mbuf always passes to
+ *        the buffer, late and duplicate packets are freed.
+ * \param now        TSC of the arrival.
+ * \param gap_first  Set to the first sequence number found missing, if any.
+ * \return Number of sequence numbers this packet shows missing, i.e. the
+ *         gap it opens after the highest one received so far. Each lost
+ *         packet is reported once, at the first packet after it.
+ */
+uint32_t nspk_jitter_insert(struct nspk_jitter_t *jb, struct rte_mbuf *m, uint16_t seq,
+                            uint64_t now, uint16_t *gap_first);
+
+/**
+ * \brief Take the next packet in sequence order whose playout time has
+ *        come. Missing packets are given up once the packets behind them
+ *        have waited for the playout delay.
+ * \return The packet, owned by the caller, or NULL if none is due.
+ */
+struct rte_mbuf *nspk_jitter_pop(struct nspk_jitter_t *jb, uint64_t now);
+
+/**
+ * \brief Whether a sequence number is still missing and may be played out
+ *        if it arrives in time, e.g. worth a NACK.
+ */
+static inline int nspk_jitter_missing(const struct nspk_jitter_t *jb, uint16_t seq)
+{
+    int16_t d = (int16_t)(seq - jb->head);
+
+    return jb->started && d >= 0 && (int16_t)(seq - jb->max_seq) < 0 &&
+           jb->slot[seq & jb->mask].m == NULL;
+}
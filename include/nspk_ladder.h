@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdio.h>
+#include <libavutil/rational.h>
+
+/**
+ * Max number of rungs of a ladder, on top of the session's own video.
+ */
+#define NSPK_LADDER_MAX_RUNGS   8
+
+/**
+ * \brief One rendition of an ABR ladder: the source video scaled to
+ *        width x height, at fps, encoded at kbps and sent to url.
+ */
+struct nspk_ladder_rung_t
+{
+    int width;
+    int height;
+    /* {0, 1} keeps the source frame rate. */
+    AVRational fps;
+    int kbps;
+    /* Native RTP destination, its query tags (rtcpport, fec, fanout...) apply to this rung only. */
+    char url[FILENAME_MAX];
+};
+
+/**
+ * \brief Renditions a session encodes from the frames it decodes for its
+ *        own video, see ?ladder=<file> in the destination URL.
+ */
+struct nspk_ladder_t
+{
+    int nb_rungs;
+    struct nspk_ladder_rung_t rung[NSPK_LADDER_MAX_RUNGS];
+};
+
+/**
+ * \brief Read a ladder file, one rung per line:
+ *        <width>x<height>[@<fps>] <kbps> <rtp_url>
+ *        '#' starts a comment.
+ * \return the number of rungs, negative AVERROR on failure.
+ */
+int nspk_ladder_load(struct nspk_ladder_t *ladder, const char *path);
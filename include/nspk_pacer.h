@@ -0,0 +1,110 @@
+#pragma once
+
+#include <sys/queue.h>
+#include <rte_mbuf.h>
+#include <tldk_utils/netbe.h>
+
+/**
+ * Max number of packets a pacer holds back, a power of 2.
+ */
+#define NSPK_PACER_QUEUE_SIZE       1024
+
+/**
+ * Depth of the token bucket in packets of NSPK_PACER_MTU bytes: how far a
+ * stream may run ahead of its rate after being idle.
+ */
+#define NSPK_PACER_BURST_PKTS       4
+#define NSPK_PACER_MTU              1500
+
+/**
+ * Interval a frame is spread over when its duration is unknown.
+ */
+#define NSPK_PACER_DEFAULT_FRAME_US 33333
+
+/**
+ * \brief Per stream RTP pacer. Runs on the lcore which owns the FE stream.
+ *        Packets are queued by nspk_pacer_enqueue() and released to the FE
+ *        stream by a token bucket clocked by the TSC. The rate is either
+ *        fixed, or set per frame by nspk_pacer_spread() so that the packets
+ *        of a frame leave evenly over the frame interval.
+ *        All pacers of an lcore are serviced by nspk_pacer_lcore_run(), so
+ *        the packets due on many streams go out in one BE burst.
+ */
+struct nspk_pacer_t
+{
+    LIST_ENTRY(nspk_pacer_t) link;
+    struct netfe_stream *fs;
+
+    /* Free running indexes into q. */
+    uint32_t head;
+    uint32_t tail;
+    uint64_t q_bytes;
+    struct rte_mbuf *q[NSPK_PACER_QUEUE_SIZE];
+
+    /* Rate in bytes per second, 0 sends unpaced. Never below min_rate. */
+    uint64_t rate;
+    uint64_t min_rate;
+    /* Tokens in bytes scaled by the TSC frequency, so no refill is lost to rounding. */
+    uint64_t credit;
+    uint64_t depth;
+    uint64_t last_tsc;
+
+    uint64_t packets;
+    uint64_t octets;
+    /* Packets released early because the queue was full. */
+    uint64_t overflows;
+    uint64_t drops;
+};
+
+LIST_HEAD(nspk_pacer_list, nspk_pacer_t);
+
+/**
+ * \brief Set up a pacer for a FE stream and attach it to the calling lcore.
+ * \param min_rate  Floor of the rate in bytes per second, 0 for none.
+ * \param depth     Bucket depth in bytes, 0 for the default.
+ */
+void nspk_pacer_init(struct nspk_pacer_t *p, struct netfe_stream *fs,
+                     uint64_t min_rate, uint64_t depth);
+
+/**
+ * \brief Detach a pacer from its lcore. Packets still queued are dropped.
+ */
+void nspk_pacer_fini(struct nspk_pacer_t *p);
+
+/**
+ * \brief Queue a packet. Ownership of the mbuf passes to the pacer.
+ *        If the queue is full the oldest packet is released unpaced.
+ * \return Number of bytes queued.
+ */
+int nspk_pacer_enqueue(struct nspk_pacer_t *p, struct rte_mbuf *m);
+
+/**
+ * \brief Packetizer sink, opaque is the struct nspk_pacer_t.
+ */
+int nspk_pacer_sink(void *opaque, struct rte_mbuf *m);
+
+/**
+ * \brief Set the rate so that the queue drains over the next interval.
+ *        Called once the packets of a frame have been queued.
+ * \param interval  Frame interval in TSC cycles, 0 for the default.
+ */
+void nspk_pacer_spread(struct nspk_pacer_t *p, uint64_t interval);
+
+/**
+ * \brief Release the packets of one pacer which are due at TSC now.
+ *        They are queued on the FE stream, not flushed.
+ * \return Number of packets released.
+ */
+uint32_t nspk_pacer_run(struct nspk_pacer_t *p, uint64_t now);
+
+/**
+ * \brief Release all queued packets of one pacer and flush its FE stream.
+ */
+void nspk_pacer_flush(struct nspk_pacer_t *p);
+
+/**
+ * \brief Run every pacer of the calling lcore. nspk_tldk_lcore_flush()
+ *        then sends what they released.
+ * \return Number of packets released.
+ */
+uint32_t nspk_pacer_lcore_run(void);
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <rte_timer.h>
+#include <tldk_utils/netbe.h>
+
+/**
+ * Mean interval between two reports of a stream. Each interval is drawn
+ * uniformly from [0.5, 1.5] times this, as in RFC 3550 6.3.1.
+ */
+#define NSPK_RTCP_INTERVAL_MS   5000
+
+#define NSPK_RTCP_CNAME_SIZE    32
+
+struct nspk_rtp_pktzr_t;
+struct nspk_rtx_t;
+struct nspk_rtp_tcp_chan_t;
+
+/**
+ * \brief Last reception report a receiver sent about a stream.
+ */
+struct nspk_rtcp_report_t
+{
+    /* SSRC of the receiver. */
+    uint32_t ssrc;
+    /* Packets lost since the previous report, in 1/256. */
+    uint8_t fraction_lost;
+    int32_t cum_lost;
+    uint32_t ext_max_seq;
+    uint32_t jitter_us;
+    /* 0 until the receiver has seen one of our SRs. */
+    uint32_t rtt_us;
+    /* TSC at which the report arrived, 0 if none has. */
+    uint64_t tsc;
+};
+
+/**
+ * \brief RTCP of one native RTP stream, run by the lcore owning it.
+ *        Sends a Sender Report, with an SDES CNAME, at randomized
+ *        intervals from an rte_timer. The NTP and RTP timestamps come from
+ *        the TSC, the counters from the stat of the RTP FE stream. Reports
+ *        received on the RTCP stream are parsed as they arrive, through
+ *        nspk_tldk_lcore_rx(), into the stream's loss, jitter and RTT,
+ *        and the NACKs among them are passed to the retransmission history.
+ *        Over TCP the reports are framed on the RTCP channel of the
+ *        connection instead, and the owner of the connection passes what
+ *        the client sends on it to nspk_rtcp_input().
+ */
+struct nspk_rtcp_t
+{
+    struct rte_timer timer;
+    /* Sends the reports and receives the receivers' ones. */
+    struct netfe_stream *fs;
+    struct netfe_stream *rtp_fs;
+    /* Over TCP only, fs and rtp_fs are then NULL. */
+    struct nspk_rtp_tcp_chan_t *tcp;
+    const struct nspk_rtp_tcp_chan_t *tcp_rtp;
+    const struct nspk_rtp_pktzr_t *pktzr;
+    /* Mean report interval in TSC cycles. */
+    uint64_t interval;
+
+    uint8_t cname[NSPK_RTCP_CNAME_SIZE];
+    uint8_t cname_len;
+
+    struct nspk_rtcp_report_t rr;
+    /* Serves the Generic NACKs about the stream, NULL to ignore them. */
+    struct nspk_rtx_t *rtx;
+
+    uint64_t srs;
+    uint64_t rrs;
+    uint64_t nacks;
+    uint64_t invalid;
+    /* Reports not sent for want of an mbuf or room on fs. */
+    uint64_t drops;
+};
+
+/**
+ * \brief Attach RTCP to a native stream and schedule its first report.
+ *        fs must be able to receive, i.e. not opened TXONLY, and is used
+ *        by the engine alone until nspk_rtcp_fini().
+ */
+void nspk_rtcp_init(struct nspk_rtcp_t *r, struct netfe_stream *fs, struct netfe_stream *rtp_fs,
+                    const struct nspk_rtp_pktzr_t *pktzr);
+
+/**
+ * \brief Attach RTCP to a native stream sent on the TCP channel rtp_chan,
+ *        the reports going to rtcp_chan, and schedule its first report.
+ *        rtcp_chan->rtcp is set until nspk_rtcp_fini().
+ */
+void nspk_rtcp_init_tcp(struct nspk_rtcp_t *r, struct nspk_rtp_tcp_chan_t *rtcp_chan,
+                        const struct nspk_rtp_tcp_chan_t *rtp_chan, const struct nspk_rtp_pktzr_t *pktzr);
+
+/**
+ * \brief Parse a compound RTCP packet a receiver sent about the stream.
+ */
+void nspk_rtcp_input(struct nspk_rtcp_t *r, const uint8_t *buf, int len);
+
+/**
+ * \brief Stop the reports and send a BYE. The caller closes fs afterwards.
+ */
+void nspk_rtcp_fini(struct nspk_rtcp_t *r);
+
+/**
+ * \brief Send the reports which are due on the calling lcore. They leave
+ *        with the next nspk_tldk_lcore_flush().
+ */
+void nspk_rtcp_lcore_run(void);
+
+/**
+ * \brief NTP timestamp of a TSC value.
+ */
+uint64_t nspk_rtcp_ntp_time(uint64_t tsc);
@@ -1,8 +1,33 @@
 #pragma once
 
+#include <pthread.h>
+#include <rte_ring.h>
 #include <libavfilter/avfilter.h>
+#include <libavcodec/bsf.h>
 #include <nspk_avio.h>
 
+/**
+ * Encoded packets queued between the codec worker and the lcore of a
+ * pipelined session. Must be a power of 2.
+ */
+#define NSPK_MEDIA_RING_SIZE        512
+
+/**
+ * How long the codec worker sleeps when it has no input or the ring is full.
+ */
+#define NSPK_MEDIA_WORKER_WAIT_US   1000
+
+/**
+ * nspk_av_ctx_t.worker_stop: stop reading the input and flush the encoders,
+ * the lcore keeps sending what the worker queues until it is done.
+ */
+#define NSPK_MEDIA_WORKER_DRAIN     1
+/**
+ * nspk_av_ctx_t.worker_stop: the lcore no longer dequeues, the worker
+ * drops what it would queue.
+ */
+#define NSPK_MEDIA_WORKER_ABORT     2
+
 struct filtering_ctx_t
 {
     AVFilterContext *buffersink_ctx;
@@ -15,19 +40,104 @@ struct filtering_ctx_t
 struct stream_ctx_t
 {
     AVCodecContext *dec_ctx;
+    /* NULL if the stream is remuxed. */
     AVCodecContext *enc_ctx;
+    /* Buffers of dec_ctx and enc_ctx, see nspk_bufpool_attach(). */
+    struct nspk_bufpool_t *dec_pool;
+    struct nspk_bufpool_t *enc_pool;
     AVFrame *dec_frame;
+    /* NULL if the input stream is not sent. */
+    AVStream *out_stream;
+
+    /* Remuxed streams only, NULL if the packets fit the RTP stage as they are. */
+    AVBSFContext *bsf;
+    AVPacket *bsf_pkt;
+
+    /* Native egress only. */
+    struct nspk_rtp_pktzr_t *pktzr;
+    struct netfe_stream *rtp_fs;
+    /* Destination URL and RTP port of the UDP outputs, for the SDP. */
+    const char *sdp_url;
+    int sdp_port;
+    /* NULL if the session is not paced. */
+    struct nspk_pacer_t *pacer;
+    /* NULL if the session sends no RTCP. */
+    struct nspk_rtcp_t *rtcp;
+    struct netfe_stream *rtcp_fs;
+    /* Transcoded video with RTCP only, NULL otherwise. */
+    struct nspk_cc_t *cc;
+    /* NULL without RTCP or if the session keeps no history. */
+    struct nspk_rtx_t *rtx;
+    /* Video with ?fec=prompeg=l=<L>:d=<D> in the destination URL only. */
+    struct nspk_fec_t *fec;
+    /* With ?fanout=<file> in the destination URL only. */
+    struct nspk_fanout_t *fanout;
 };
 
 /**
- * \brief Context for libav elements.
+ * \brief Context for libav elements. One per session.
  */
 struct nspk_av_ctx_t
 {
     AVFormatContext *ifmt_ctx;
     AVFormatContext *ofmt_ctx;
+    /**
+     * nb_out entries each: one per input stream, indexed as the input
+     * streams, then one per rung of the ladder.
+     */
     struct filtering_ctx_t *filter_ctx;
     struct stream_ctx_t *stream_ctx;
+    unsigned int nb_out;
+
+    /**
+     * With ?ladder=<file> in the destination URL only. The frames decoded
+     * from input stream ladder_src go through a single filter graph, split
+     * by reference into a scaled branch and an encoder per rung.
+     */
+    struct nspk_ladder_t *ladder;
+    unsigned int ladder_src;
+
+    /* Input packet read but not processed yet, see nspk_media_step(). */
+    AVPacket *in_pkt;
+    int in_pkt_pending;
+
+    /* Wall clock (av_gettime_relative()) and input dts, both in AV_TIME_BASE, of the first packet. */
+    int64_t start_time;
+    int64_t start_dts;
+
+    /* Pipelined sessions only. The worker owns the input, decoders, filters and encoders. */
+    pthread_t worker;
+    int worker_started;
+    int worker_stop;            /* Written by the lcore, NSPK_MEDIA_WORKER_DRAIN or _ABORT. */
+    int worker_done;            /* Written by the worker, after its last enqueue. */
+    int worker_ret;
+    /* Encoded AVPackets, stream_index is the input stream index. */
+    struct rte_ring *ring;
+    /* Dequeued packet which is not due yet. */
+    AVPacket *out_pkt;
+    /* Empty AVPackets the lcore hands back to the worker. */
+    struct rte_ring *pkt_free;
+};
+
+/**
+ * \brief Life cycle of a session, driven by nspk_media_step().
+ */
+enum nspk_rtp_sess_state
+{
+    NSPK_RTP_SESS_INIT = 0,
+    NSPK_RTP_SESS_RUNNING,      /**< Reading, transcoding and sending. */
+    NSPK_RTP_SESS_DRAINING,     /**< Input ended or stop requested, flushing filters and encoders. */
+    NSPK_RTP_SESS_DONE,
+};
+
+/**
+ * \brief How encoded RTP packets leave the session.
+ */
+enum nspk_rtp_egress
+{
+    NSPK_RTP_EGRESS_URL = 0,    /**< rtpenc -> tldk_rtp_protocol -> tldk_udp_protocol, copies the payload. */
+    NSPK_RTP_EGRESS_MBUF,       /**< rtpenc writes straight into rte_mbufs, see nspk_avio_open_mbuf(). */
+    NSPK_RTP_EGRESS_NATIVE,     /**< No muxer, see nspk_rtp_pktzr. Falls back to MBUF for unsupported codecs. */
 };
 
 /**
@@ -39,12 +149,90 @@ struct nspk_rtp_session_ctx_t
     struct lcore_prm *lcore_prm;
     struct netfe_stream *fe_stream;
     struct nspk_av_ctx_t *av_ctx;
+    enum nspk_rtp_egress egress;
+    enum nspk_rtp_sess_state state;
+
+    /* Send input packets no faster than their dts, like ffmpeg -re. */
+    int readrate;
+
+    /**
+     * Demux, decode, filter and encode on a non-EAL worker thread, so the
+     * lcore only packetizes, paces and transmits. The worker is pinned to
+     * codec_cpu, or to the codec CPUs of nspk_cpu_plan_init() if codec_cpu < 0.
+     */
+    int pipeline;
+    int codec_cpu;
+
+    /**
+     * Threads of each video codec and their FF_THREAD_* type, started on
+     * the CPUs the worker may use, see nspk_cpu_codec_open(). 0 picks up to
+     * NSPK_CPU_CODEC_THREADS threads and slice threading.
+     */
+    int codec_threads;
+    int codec_thread_type;
+
+    /**
+     * Send streams whose input codec is already the output codec without
+     * decoding and encoding them, through a bitstream filter if needed.
+     */
+    int passthrough;
+
+    /**
+     * Spread the packets of each frame over the frame interval instead of
+     * sending them in one burst. Native egress only.
+     */
+    int pace;
+
+    /**
+     * Send RTCP Sender Reports and take in the receivers' reports, from
+     * the lcore. Native egress only.
+     */
+    int rtcp;
+
+    /**
+     * Adapt the video encoder bitrate to the receiver reports and the
+     * pacer queue. Native egress with RTCP only.
+     */
+    int cc;
+
+    /* Video encoder bitrate in kbit/s, the ceiling of cc. 0 keeps the encoder default. */
+    int video_kbps;
+
+    /**
+     * Keep the packets sent for rtx_ms milliseconds and resend them on
+     * RTCP NACK, as RFC 4588 RTX with payload type rtx_pt unless it is 0.
+     * 0 keeps no history. Native egress with RTCP only.
+     */
+    int rtx_ms;
+    int rtx_pt;
+
+    /**
+     * Output codecs. AV_CODEC_ID_NONE lets the rtp muxer pick one.
+     * Native egress sends both the video and the audio stream.
+     */
+    enum AVCodecID video_codec;
+    enum AVCodecID audio_codec;
 
     /**
      * Source and destination file/network URLs
      * These must be set and passed as input to the RTP lcore thread.
      */
     char src_url[FILENAME_MAX], dst_url[FILENAME_MAX];
+
+    /**
+     * Send native output stream N on tcp_chan[2N] and its RTCP on
+     * tcp_chan[2N + 1] instead of UDP, e.g. RTSP interleaved. dst_url
+     * still picks the streams, its ports are not used. No pacing, FEC,
+     * fan-out or retransmission then. NULL sends over UDP.
+     */
+    struct nspk_rtp_tcp_chan_t *tcp_chan;
+
+    /**
+     * Run by the scheduler once the session is done, right before it is
+     * freed, e.g. to release what the RTSP server reserved for it.
+     */
+    void (*done_cb)(struct nspk_rtp_session_ctx_t *rtp_sess, void *arg);
+    void *done_arg;
 };
 
 /**
@@ -54,11 +242,30 @@ struct nspk_rtp_session_ctx_t
 int nspk_media_init(struct nspk_rtp_session_ctx_t *rtp_sess);
 
 /**
- * \brief Starts the transcoder loop.
+ * \brief Advance a session by at most one input packet. Never waits for
+ *        input, packets that are not due yet are kept for the next step.
+ * \return 1 if some work was done, 0 if the session is idle,
+ *         AVERROR_EOF once the session is done, other negative AVERROR on failure.
+ */
+int nspk_media_step(struct nspk_rtp_session_ctx_t *rtp_sess);
+
+/**
+ * \brief Stop reading input. The following steps drain the session.
+ */
+void nspk_media_stop(struct nspk_rtp_session_ctx_t *rtp_sess);
+
+/**
+ * \brief Release the libav context of a session.
+ */
+void nspk_media_close(struct nspk_rtp_session_ctx_t *rtp_sess);
+
+/**
+ * \brief Run a session to completion by stepping it in a loop.
  */
 int nspk_media_start(struct nspk_rtp_session_ctx_t *rtp_sess);
 
 /**
  * \brief DPDK LCore thread for processing RTP sessions.
+ *        arg is the struct nspk_sched_t of the lcore.
  */
 int nspk_lcore_main_rtp(void *arg);
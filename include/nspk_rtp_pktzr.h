@@ -0,0 +1,198 @@
+#pragma once
+
+#include <libavcodec/avcodec.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#define NSPK_RTP_HDR_SIZE       12
+#define NSPK_RTP_VERSION        2
+
+/**
+ * Max number of NAL units aggregated in one STAP-A (H.264) or AP (HEVC)
+ * packet, and of audio frames aggregated in one AAC or Opus packet.
+ */
+#define NSPK_RTP_PKTZR_MAX_AGG  16
+
+/**
+ * Audio frames are aggregated until the packet spans this many milliseconds.
+ */
+#define NSPK_RTP_PKTZR_AUDIO_AGG_MS 40
+
+/**
+ * Payloads of at least this many bytes are attached to the encoded packet
+ * rather than copied, when it allows it. Below, the extra mbuf costs more
+ * than the copy.
+ */
+#define NSPK_RTP_PKTZR_ATTACH_MIN   256
+
+/**
+ * \brief Consumer of the RTP packets built by a packetizer.
+ *        On success the sink owns the mbuf. On failure (< 0) the packetizer
+ *        frees it and accounts it as a drop.
+ */
+typedef int (*nspk_rtp_pktzr_sink_fn)(void *opaque, struct rte_mbuf *m);
+
+struct nspk_rtp_pktzr_t;
+
+typedef int (*nspk_rtp_pktzr_packetize_fn)(struct nspk_rtp_pktzr_t *p,
+                                           const uint8_t *buf, int size);
+
+struct nspk_rtp_pktzr_nal_t
+{
+    const uint8_t *data;
+    int size;
+};
+
+/**
+ * \brief Native RTP packetizer. Builds RTP packets from AVPackets straight
+ *        into rte_mbufs and hands them to a sink, bypassing the rtp muxer
+ *        and the URLProtocol stack.
+ */
+struct nspk_rtp_pktzr_t
+{
+    enum AVCodecID codec_id;
+    nspk_rtp_pktzr_packetize_fn packetize;
+
+    /**
+     * RTP fixed header with V, PT and SSRC filled in once. Per packet
+     * only M, sequence number and timestamp are patched.
+     */
+    uint8_t hdr_tmpl[NSPK_RTP_HDR_SIZE];
+    uint8_t payload_type;
+    uint16_t seq;
+    uint32_t ssrc;
+    uint32_t ts_offset;
+    uint32_t clock_rate;
+    uint32_t cur_ts;
+    /** TSC at which cur_ts was taken, for the RTCP SR. 0 until the first packet. */
+    uint64_t cur_tsc;
+    /** Duration of the last packet in clock_rate units. */
+    uint32_t frame_ts;
+    AVRational time_base;
+
+    /** Max bytes after the RTP header. */
+    int max_payload;
+    /** 0 for Annex B input, otherwise the NAL length prefix size (avcC/hvcC). */
+    int nal_length_size;
+    /**
+     * Annex B parameter sets sent in front of every keyframe, see
+     * nspk_rtp_pktzr_repeat_ps(). NULL if the stream carries its own.
+     */
+    const uint8_t *ps;
+    int ps_size;
+
+    /** NAL units pending aggregation, all from the current access unit. */
+    struct nspk_rtp_pktzr_nal_t agg[NSPK_RTP_PKTZR_MAX_AGG];
+    int agg_num;
+    int agg_len;
+
+    /**
+     * Audio frames pending aggregation. They are copied into `pend` at a
+     * reserved offset so the per-frame headers can be prepended on flush.
+     */
+    struct rte_mbuf *pend;
+    uint16_t pend_size[NSPK_RTP_PKTZR_MAX_AGG];
+    int pend_num;
+    uint32_t pend_ts;
+    uint32_t max_agg_ts;
+    /** TOC byte shared by the pending Opus frames. */
+    uint8_t opus_toc;
+
+    /**
+     * Attach the video payloads to the packet encoded into an encoder
+     * pool instead of copying them, see nspk_bufpool_ext(): a header mbuf
+     * chained to an mbuf on the encoded frame. Only for outputs whose
+     * packets are not read back as a single segment (FEC, fan-out, RTX).
+     */
+    int attach;
+    /** Encoded packet being packetized, if its payloads can be attached. */
+    struct nspk_bufpool_ext_t *ext;
+
+    struct rte_mempool *mp;
+    /** mbufs from mp with the header template already written. */
+    struct pkt_mag mag;
+    nspk_rtp_pktzr_sink_fn sink;
+    void *sink_opaque;
+
+    uint64_t packets;
+    uint64_t octets;
+    uint64_t drops;
+    /** Payload octets attached rather than copied. */
+    uint64_t attached;
+};
+
+/**
+ * \brief Whether a native packetizer exists for this codec.
+ */
+int nspk_rtp_pktzr_supported(enum AVCodecID codec_id);
+
+/**
+ * \brief Initialize a packetizer for one stream.
+ * \param par        Codec parameters of the stream. extradata selects
+ *                   between Annex B and length-prefixed NAL units.
+ * \param time_base  Time base of the AVPackets that will be sent.
+ * \param pkt_size   Max RTP packet size, header included.
+ * \return 0 on success, negative AVERROR on failure.
+ */
+int nspk_rtp_pktzr_init(struct nspk_rtp_pktzr_t *p, const AVCodecParameters *par,
+                        AVRational time_base, uint8_t payload_type, int pkt_size,
+                        struct rte_mempool *mp, nspk_rtp_pktzr_sink_fn sink, void *sink_opaque);
+
+/**
+ * \brief Send the parameter sets of the Annex B extradata of par in front
+ *        of every keyframe. For encoders opened with global headers,
+ *        which leave them out of the stream once they are in extradata.
+ *        par must outlive the packetizer, its extradata is not copied.
+ * \return 0 on success, negative AVERROR on failure.
+ */
+int nspk_rtp_pktzr_repeat_ps(struct nspk_rtp_pktzr_t *p, const AVCodecParameters *par);
+
+/**
+ * \brief Packetize one AVPacket. The packet is not consumed.
+ * \return 0 on success, negative AVERROR on failure. Packets refused by
+ *         the sink are dropped and counted, not reported.
+ */
+int nspk_rtp_pktzr_send(struct nspk_rtp_pktzr_t *p, const AVPacket *pkt);
+
+/**
+ * \brief Emit anything the packetizer still holds back.
+ */
+int nspk_rtp_pktzr_flush(struct nspk_rtp_pktzr_t *p);
+
+/**
+ * \brief Release what the packetizer holds. Pending frames are dropped.
+ */
+void nspk_rtp_pktzr_uninit(struct nspk_rtp_pktzr_t *p);
+
+/**
+ * \brief Sink which queues the packets on a TLDK UDP stream.
+ *        opaque is the struct netfe_stream.
+ */
+int nspk_rtp_pktzr_sink_udp(void *opaque, struct rte_mbuf *m);
+
+/**
+ * \brief Take an mbuf holding the RTP header template from the magazine.
+ * \return Pointer to the first payload byte, or NULL if the pool is empty.
+ */
+uint8_t *nspk_rtp_pktzr_begin(struct nspk_rtp_pktzr_t *p, struct rte_mbuf **pm);
+
+/**
+ * \brief Finalize the header of a packet started by nspk_rtp_pktzr_begin()
+ *        and pass it to the sink. A packet with payload chained to its
+ *        header mbuf keeps the lengths already set.
+ */
+int nspk_rtp_pktzr_commit(struct nspk_rtp_pktzr_t *p, struct rte_mbuf *m,
+                          int payload_len, int marker);
+
+int nspk_rtp_pktzr_h264(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size);
+
+int nspk_rtp_pktzr_hevc(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size);
+
+int nspk_rtp_pktzr_aac(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size);
+
+int nspk_rtp_pktzr_opus(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size);
+
+/**
+ * \brief Emit the pending audio frames, if any.
+ */
+int nspk_rtp_pktzr_audio_flush(struct nspk_rtp_pktzr_t *p);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <rte_mbuf.h>
+#include <tldk_utils/netbe.h>
+
+/**
+ * Channel of the RFC 4571 framing: a 16 bit length only, no '$' and channel.
+ */
+#define NSPK_RTP_TCP_RFC4571    -1
+
+/* '$', channel and length of an RTSP interleaved frame (RFC 2326 10.12). */
+#define NSPK_RTP_TCP_HDR_SIZE   4
+
+struct nspk_rtcp_t;
+
+/**
+ * \brief TCP connection RTP and RTCP packets are framed onto, e.g. the one
+ *        of an RTSP client. Packets are whole or not at all in the byte
+ *        stream: one refused by TLDK is dropped before any of it is queued.
+ */
+struct nspk_rtp_tcp_t
+{
+    /* NULL once the connection is gone, the packets are then dropped. */
+    struct netfe_stream *fs;
+
+    uint64_t packets;
+    uint64_t octets;
+    uint64_t drops;
+};
+
+/**
+ * \brief One RTP or RTCP flow of a connection.
+ */
+struct nspk_rtp_tcp_chan_t
+{
+    struct nspk_rtp_tcp_t *tcp;
+    /* Interleaved channel, or NSPK_RTP_TCP_RFC4571. */
+    int channel;
+
+    uint64_t packets;
+    /* Payload octets of the RTP packets, as the SR counts them. */
+    uint64_t octets;
+
+    /* RTCP channels only: parses what the client sends on it, NULL to discard. */
+    struct nspk_rtcp_t *rtcp;
+};
+
+/**
+ * \brief Bind a channel to a connection.
+ */
+void nspk_rtp_tcp_chan_init(struct nspk_rtp_tcp_chan_t *chan, struct nspk_rtp_tcp_t *tcp, int channel);
+
+/**
+ * \brief Frame a packet and hand it to the connection. The framing goes in
+ *        a small mbuf of the connection's magazine chained in front of m,
+ *        the packet itself is not copied. On success m belongs to TLDK,
+ *        which frees it once acknowledged.
+ * \return 0 on success, negative AVERROR if the packet was not sent, m
+ *         is then untouched and still the caller's.
+ */
+int nspk_rtp_tcp_send(struct nspk_rtp_tcp_chan_t *chan, struct rte_mbuf *m);
+
+/**
+ * \brief Packetizer sink sending on a channel. opaque is the struct
+ *        nspk_rtp_tcp_chan_t.
+ */
+int nspk_rtp_tcp_sink(void *opaque, struct rte_mbuf *m);
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <limits.h>
+#include <tldk_utils/netbe.h>
+#include <nspk_rtp_lcore.h>
+
+#define NSPK_RTSP_DEFAULT_PORT      554
+#define NSPK_RTSP_DEFAULT_MAX_CONN  256
+/* First server port of the RTP/RTCP pairs, they stay below the ephemeral ports. */
+#define NSPK_RTSP_DEFAULT_RTP_PORT  20000
+
+/**
+ * Max number of listening ports, see nspk_rtsp_prm.nb_port.
+ */
+#define NSPK_RTSP_MAX_LISTEN        16
+
+/**
+ * Max size of a request, headers and body.
+ */
+#define NSPK_RTSP_REQ_SIZE          4096
+
+/**
+ * Number of files whose SDP each lcore keeps.
+ */
+#define NSPK_RTSP_MAX_MOUNT         64
+
+/**
+ * Session timeout announced to the clients, in seconds. A connection whose
+ * client sends neither a request nor RTCP for that long is closed.
+ */
+#define NSPK_RTSP_TIMEOUT_S         60
+
+/**
+ * \brief RTSP server, set from --rtsp. It runs on the TCP context next to
+ *        the UDP one of each worker BE lcore and serves the files of root:
+ *        rtsp://<addr>:<port>/<file>. Each PLAY spawns a native RTP session
+ *        on the lcore of the connection.
+ */
+struct nspk_rtsp_prm
+{
+    int enable;
+
+    /**
+     * Listen on port to port + nb_port - 1. The NIC spreads connections over
+     * the queues by destination port only, each lcore listens on the ports
+     * its queues own, so nb_port sets how many lcores take connections.
+     */
+    uint16_t port;
+    uint16_t nb_port;
+
+    /* Connections of one lcore. */
+    uint32_t max_conn;
+
+    /* Server ports of the sessions are taken from rtp_port up to FIRST_PORT. */
+    uint16_t rtp_port;
+
+    char root[PATH_MAX];
+
+    /* Spawned sessions start as a copy of it. */
+    struct nspk_rtp_session_ctx_t tmpl;
+};
+
+extern struct nspk_rtsp_prm nspk_rtsp_prm;
+
+/**
+ * \brief Open the listening streams of the calling lcore, on the ports
+ *        its queues own, and start the thread which probes its files if
+ *        it has any. Must run on a worker lcore with its FE and BE set
+ *        up, before nspk_sched_run().
+ * \return 0 on success, negative AVERROR on failure.
+ */
+int nspk_rtsp_lcore_init(struct lcore_prm *lcore_prm);
+
+/**
+ * \brief Close the connections and listening streams of the calling lcore
+ *        and stop its prober.
+ *        Must run after nspk_sched_run(), once the sessions are done.
+ */
+void nspk_rtsp_lcore_fini(void);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <rte_mbuf.h>
+#include <libavutil/bprint.h>
+#include <tldk_utils/netbe.h>
+
+/**
+ * Number of packets a history holds at most, a power of 2. The time window
+ * usually evicts them well before.
+ */
+#define NSPK_RTX_RING_SIZE      8192
+
+struct nspk_rtx_slot_t
+{
+    struct rte_mbuf *m;
+    /* TSC at which the packet was handed to TLDK. */
+    uint64_t tsc;
+    /* RTP packet length, TLDK's headers are in front of it once sent. */
+    uint16_t len;
+    uint16_t seq;
+};
+
+/**
+ * \brief Retransmission history of a native RTP stream.
+ *        Every packet sent on the RTP FE stream is kept, by one more
+ *        reference on its mbuf, in a ring indexed by sequence number until
+ *        it is older than the window. Generic NACKs received by the
+ *        stream's RTCP resend the packets still held: the same mbuf as is,
+ *        or behind an RFC 4588 RTX header in a chain with an indirect mbuf
+ *        when an RTX payload type is set. The payload is never copied.
+ *        Runs on the lcore owning the stream.
+ */
+struct nspk_rtx_t
+{
+    struct netfe_stream *fs;
+    uint32_t ssrc;
+    /* Window in TSC cycles. */
+    uint64_t window;
+
+    /* RFC 4588 stream, rtx_pt 0 resends the original packets. */
+    uint8_t rtx_pt;
+    uint32_t rtx_ssrc;
+    uint16_t rtx_seq;
+
+    /* Oldest sequence number which may be held, and the one after the newest. */
+    uint16_t head;
+    uint16_t tail;
+    int started;
+    struct nspk_rtx_slot_t slot[NSPK_RTX_RING_SIZE];
+
+    uint64_t held;
+    uint64_t nacked;
+    uint64_t resent;
+    /* Requested packets which are gone from the window. */
+    uint64_t misses;
+    /* Requested packets still on their way out. */
+    uint64_t busy;
+    uint64_t drops;
+};
+
+/**
+ * \brief Set up the history of the packets sent on fs, which must stay
+ *        open until nspk_rtx_fini(). The owner of fs feeds it through
+ *        nspk_rtx_sent().
+ * \param window_ms  How long packets are kept.
+ * \param rtx_pt     RFC 4588 payload type, 0 to resend packets unchanged.
+ */
+void nspk_rtx_init(struct nspk_rtx_t *rtx, struct netfe_stream *fs, uint32_t ssrc,
+                   uint32_t window_ms, uint8_t rtx_pt);
+
+/**
+ * \brief Release every packet held.
+ */
+void nspk_rtx_fini(struct nspk_rtx_t *rtx);
+
+/**
+ * \brief Keep packets about to be handed to TLDK, from the tx_cb of the RTP
+ *        FE stream. Packets offered again after a partial send are held once.
+ */
+void nspk_rtx_sent(struct nspk_rtx_t *rtx, struct rte_mbuf *pkt[], uint32_t num);
+
+/**
+ * \brief Resend the packets of a Generic NACK entry (RFC 4585 6.2.1):
+ *        pid and those of the bitmask blp following it. They leave with
+ *        the next nspk_tldk_lcore_flush().
+ * \return Number of packets queued.
+ */
+uint32_t nspk_rtx_nack(struct nspk_rtx_t *rtx, uint16_t pid, uint16_t blp);
+
+/**
+ * \brief Append to bp the SDP media section of a stream with a history,
+ *        as written by ff_sdp_write_media(), announcing the Generic NACK
+ *        feedback for pt (RFC 4585 4.2) and, with an rtx_pt, the RFC 4588
+ *        stream: rtx_pt on the m= line, its rtpmap and its apt.
+ */
+void nspk_rtx_sdp(AVBPrint *bp, const char *media, uint8_t pt, uint8_t rtx_pt, uint32_t clock_rate);
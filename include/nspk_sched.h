@@ -0,0 +1,55 @@
+#pragma once
+
+#include <nspk_rtp_lcore.h>
+
+/**
+ * Max number of RTP sessions one lcore can serve.
+ */
+#define NSPK_SCHED_MAX_SESSIONS 512
+
+/**
+ * \brief Cooperative scheduler of the RTP sessions of one lcore.
+ *        Sessions are advanced round robin by nspk_media_step(), so none of
+ *        them may block. The tldk_udp rings, the pacers, the TLDK FE streams
+ *        and the BE of the lcore are serviced once per round.
+ */
+struct nspk_sched_t
+{
+    uint32_t lcore;
+    struct lcore_prm *lcore_prm;
+
+    /* Sessions owned by the scheduler, freed once done. */
+    uint32_t nb_sess;
+    struct nspk_rtp_session_ctx_t *sess[NSPK_SCHED_MAX_SESSIONS];
+
+    /* Keep running without sessions until force_quit, for sessions spawned later. */
+    int persist;
+
+    uint64_t rounds;
+    uint64_t idle_rounds;
+};
+
+/**
+ * \brief Hand a session over to the scheduler before it is launched.
+ *        The session must be allocated with malloc() and its lcore_prm set.
+ * \return 0 on success, -ENOSPC if the scheduler is full.
+ */
+int nspk_sched_add(struct nspk_sched_t *sched, struct nspk_rtp_session_ctx_t *rtp_sess);
+
+/**
+ * \brief Add a session to the running scheduler of the calling lcore and open it.
+ *        Unlike the sessions added before nspk_sched_run(), its input is opened
+ *        between two rounds. On failure the session is freed without its done_cb.
+ * \return 0 on success, -ENOSPC if the scheduler is full, another non-zero
+ *         code if the session failed to open.
+ */
+int nspk_sched_spawn(struct nspk_sched_t *sched, struct nspk_rtp_session_ctx_t *rtp_sess);
+
+/**
+ * \brief Open all sessions, then step them until each of them is done.
+ *        Must run on sched->lcore, with its FE and BE set up.
+ *        A persistent scheduler then waits for spawned sessions until force_quit,
+ *        which drains the sessions that are still running.
+ * \return 0, or the number of sessions which failed.
+ */
+int nspk_sched_run(struct nspk_sched_t *sched);
@@ -1,5 +1,42 @@
 #pragma once
 
+/**
+ * \brief Capacity of struct pkt_buf, the upper bound of the flush high-water mark.
+ */
+#define NSPK_TLDK_FLUSH_HWM_MAX     (2 * MAX_PKT_BURST)
+
+/**
+ * \brief Defaults of struct nspk_tldk_flush_prm.
+ */
+#define NSPK_TLDK_FLUSH_HWM         MAX_PKT_BURST
+#define NSPK_TLDK_FLUSH_DELAY_US    200
+
+/**
+ * \brief When the packets queued on a FE stream are pushed to the BE.
+ *        A stream is flushed as soon as one of the conditions holds, by one
+ *        tle_udp_stream_send() followed by one TX burst of the BE.
+ */
+struct nspk_tldk_flush_prm
+{
+    /* Number of queued packets, 1 to NSPK_TLDK_FLUSH_HWM_MAX. */
+    uint32_t hwm;
+    /* Max wait of the oldest queued packet in microseconds, 0 for once per scheduler round. */
+    uint32_t delay_us;
+    /* Flush on an RTP packet with the marker bit set, i.e. the end of a frame. */
+    uint32_t marker;
+};
+
+/**
+ * \brief Flush policy of all FE streams, set from --txflush.
+ */
+extern struct nspk_tldk_flush_prm nspk_tldk_flush_prm;
+
+/**
+ * \brief Headroom reserved in front of payload mbufs so that TLDK can
+ *        prepend L2/L3/L4 headers without chaining a header segment.
+ */
+#define NSPK_MBUF_TX_HEADROOM RTE_MAX(RTE_PKTMBUF_HEADROOM, TLE_DST_MAX_HDR)
+
 int nspk_tldk_udp_stream_new(UDPTldkContext *udp_ctx);
 
 int nspk_tldk_udp_stream_send(UDPTldkContext *udp_ctx, void *data, int dlen);
@@ -9,3 +46,121 @@ int nspk_tldk_udp_stream_recv(UDPTldkContext *udp_ctx, void *data, int *dlen);
 int nspk_tldk_udp_stream_delete(UDPTldkContext *udp_ctx);
 
 void print_stream_addresses(struct netfe_sprm *sprm);
+
+/**
+ * \brief Fill a sockaddr_storage from a numeric host and a port.
+ *        An empty or NULL host yields INADDR_ANY.
+ * \return 0 on success, -EINVAL if host is not a numeric address.
+ */
+int nspk_tldk_sockaddr_fill(struct sockaddr_storage *ss, const char *host, int port);
+
+int nspk_tldk_sockaddr_get_port(const struct sockaddr_storage *ss);
+
+void nspk_tldk_sockaddr_set_port(struct sockaddr_storage *ss, int port);
+
+/**
+ * \brief Whether the RSS of every port of a BE lcore steers the local
+ *        port to its queue, i.e. traffic to it reaches this lcore.
+ */
+int nspk_tldk_port_owned(const struct netbe_lcore *lc, uint16_t port);
+
+/**
+ * \brief Open a TLDK UDP stream on the calling lcore.
+ * \param op  TXONLY or RXONLY.
+ * \return The stream, or NULL with rte_errno set.
+ */
+struct netfe_stream *nspk_tldk_udp_stream_open(struct lcore_prm *lcore_prm,
+                                               struct netfe_sprm *sprm, uint16_t op);
+
+/**
+ * \brief Queue an mbuf carrying a complete datagram payload on a FE stream,
+ *        then flush the stream if the flush policy says so.
+ *        Ownership of the mbuf passes to the stream on success only.
+ * \return Number of payload bytes queued, or -ENOBUFS if the stream's
+ *         packet buffer stays full after a flush.
+ */
+int nspk_tldk_udp_stream_send_mbuf(struct netfe_stream *fs, struct rte_mbuf *m);
+
+/**
+ * \brief Queue an mbuf on a FE stream like nspk_tldk_udp_stream_send_mbuf(),
+ *        but leave it to the next nspk_tldk_lcore_flush() whatever the
+ *        flush policy, so that the packets of many streams leave in one
+ *        BE burst.
+ */
+int nspk_tldk_udp_stream_queue_mbuf(struct netfe_stream *fs, struct rte_mbuf *m);
+
+/**
+ * \brief Push all packets queued on a FE stream through TLDK and the BE.
+ */
+void nspk_tldk_udp_stream_flush(struct netfe_stream *fs);
+
+/**
+ * \brief Push the packets queued on the FE streams of the calling lcore
+ *        whose flush deadline has passed, and those TCP streams still hold,
+ *        then run the BE once.
+ */
+void nspk_tldk_lcore_flush(void);
+
+/**
+ * \brief Run the rx_cb of the FE streams of the calling lcore which have
+ *        received something, as reported by the lcore's RX event queue,
+ *        and with a TCP context those of the SYN and error queues too.
+ * \return Sum of what the callbacks return, e.g. datagrams handled.
+ */
+uint32_t nspk_tldk_lcore_rx(void);
+
+/**
+ * \brief Flush and close a stream opened by nspk_tldk_udp_stream_open().
+ *        Packets TLDK does not take are dropped. NULL is ignored.
+ */
+void nspk_tldk_udp_stream_close(struct netfe_stream *fs);
+
+/**
+ * \brief Join an IPv4 multicast group on the ports of the calling lcore's
+ *        BE, sending IGMP and programming the NIC MAC filters. Datagrams
+ *        from sources the filters reject are dropped before TLDK, include
+ *        sources taking precedence over exclude ones. Each join takes a
+ *        reference on the group, the filters of the first one apply.
+ * \return 0 on success, -ENOSYS for IPv6, another negative errno on failure.
+ */
+int nspk_tldk_mcast_join(const struct sockaddr_storage *group,
+                         const IPSourceFilters *filters);
+
+/**
+ * \brief Drop a reference taken by nspk_tldk_mcast_join(), the group is left
+ *        with the last one.
+ */
+int nspk_tldk_mcast_leave(const struct sockaddr_storage *group);
+
+/**
+ * \brief Open a TLDK TCP stream listening on the local address of sprm,
+ *        on the TCP context of the calling lcore's BE. Its rx_cb is run by
+ *        nspk_tldk_lcore_rx() when connection requests are pending.
+ * \return The stream, or NULL with rte_errno set, ENOTSUP without a TCP context.
+ */
+struct netfe_stream *nspk_tldk_tcp_stream_listen(struct lcore_prm *lcore_prm, struct netfe_sprm *sprm);
+
+/**
+ * \brief Accept up to num connections pending on a listening stream.
+ *        Each gets a FE stream whose rx_cb, err_cb and send_cb are left to
+ *        the caller.
+ *        Connections over the stream limit of the lcore are closed.
+ * \return Number of streams stored in fs.
+ */
+uint32_t nspk_tldk_tcp_stream_accept(struct lcore_prm *lcore_prm, struct netfe_stream *ls,
+                                     struct netfe_stream *fs[], uint32_t num);
+
+/**
+ * \brief Send an mbuf, possibly chained, on a TCP stream. What the send
+ *        buffer does not take stays queued for nspk_tldk_lcore_flush().
+ *        Ownership of the mbuf passes to the stream on success only.
+ * \return Number of bytes queued, or -ENOBUFS if the stream's queue is full.
+ */
+int nspk_tldk_tcp_stream_send_mbuf(struct netfe_stream *fs, struct rte_mbuf *m);
+
+/**
+ * \brief Close a stream of nspk_tldk_tcp_stream_listen() or _accept(),
+ *        sending what the send buffer still holds before the FIN.
+ *        Data still queued on the FE stream is dropped. NULL is ignored.
+ */
+void nspk_tldk_tcp_stream_close(struct netfe_stream *fs);
@@ -42,7 +42,32 @@ void
 pkt_buf_fill(uint32_t lcore, struct pkt_buf *pb, uint32_t dlen);
 
 int
-pkt_buf_fill_data(uint32_t lcore, struct pkt_buf *pb, void *data, int dlen);
+pkt_buf_fill_data(struct pkt_mag *mg, struct pkt_buf *pb, void *data,
+	int dlen);
+
+void
+pkt_mag_init(struct pkt_mag *mg, struct rte_mempool *mp, uint16_t data_off,
+	const void *tmpl, uint16_t tmpl_len);
+
+uint32_t
+pkt_mag_refill(struct pkt_mag *mg);
+
+void
+pkt_mag_put(struct pkt_mag *mg, struct rte_mbuf *m);
+
+void
+pkt_mag_fini(struct pkt_mag *mg);
+
+/*
+ * Take an mbuf from the magazine, refilling it first if empty.
+ */
+static inline struct rte_mbuf *
+pkt_mag_get(struct pkt_mag *mg)
+{
+	if (mg->num == 0 && pkt_mag_refill(mg) == 0)
+		return NULL;
+	return mg->pkt[--mg->num];
+}
 
 int
 netbe_lcore_setup(struct netbe_lcore *lc);
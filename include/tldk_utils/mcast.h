@@ -0,0 +1,85 @@
+#ifndef MCAST_H_
+#define MCAST_H_
+
+#include <rte_timer.h>
+#include <tldk_utils/netbe.h>
+
+/* IPv4 groups one BE lcore may join. */
+#define	NETBE_MCAST_MAX_GROUP	1024
+/* Sources of the include or exclude list of a group. */
+#define	NETBE_MCAST_MAX_SRC	8
+/* Interval of the unsolicited membership reports. */
+#define	NETBE_MCAST_REPORT_MS	60000
+
+enum {
+	NETBE_MCAST_EXCLUDE,
+	NETBE_MCAST_INCLUDE,
+};
+
+struct netbe_mcast_group {
+	struct in_addr addr;
+	uint32_t ref;
+	/* Datagrams from the listed sources are kept (INCLUDE) or dropped. */
+	uint32_t mode;
+	uint32_t nb_src;
+	struct in_addr src[NETBE_MCAST_MAX_SRC];
+	uint64_t rx;
+	uint64_t drop;
+};
+
+/*
+ * IPv4 multicast membership of a BE lcore. Joins and leaves send IGMP
+ * from the BE (v2, or v3 for groups with a source list), program the
+ * multicast MAC lists of the ports and are refreshed from an rte_timer
+ * and on queries. Multicast datagrams are filtered by group and source
+ * in an RX callback, before TLDK sees them.
+ */
+struct netbe_mcast {
+	struct rte_timer timer;
+	uint64_t next_report;
+	uint32_t nb_group;
+	/* Open addressing index into group by address, UINT16_MAX is free. */
+	uint16_t idx[2 * NETBE_MCAST_MAX_GROUP];
+	struct netbe_mcast_group group[NETBE_MCAST_MAX_GROUP];
+	struct {
+		uint64_t report;
+		uint64_t leave;
+		uint64_t query;
+		uint64_t drop;
+	} stat;
+};
+
+/*
+ * Join an IPv4 group on all ports of the BE lcore, or take one more
+ * reference on it. The source list of the first join applies.
+ */
+int
+netbe_mcast_join(struct netbe_lcore *lc, const struct in_addr *grp,
+	uint32_t mode, const struct in_addr *src, uint32_t nb_src);
+
+/*
+ * Drop a reference on a group, leave it with the last one.
+ */
+int
+netbe_mcast_leave(struct netbe_lcore *lc, const struct in_addr *grp);
+
+/*
+ * Ethernet address of an IPv4 group (network order), RFC 1112.
+ */
+void
+netbe_mcast_ether_addr(uint32_t addr, struct rte_ether_addr *mac);
+
+/*
+ * Install the multicast RX callback after the packet type one.
+ */
+int
+netbe_mcast_setup_rx_cb(const struct netbe_port *uprt,
+	struct netbe_lcore *lc, uint16_t qid);
+
+/*
+ * Leave all groups and free the membership of the BE lcore.
+ */
+void
+netbe_mcast_fini(struct netbe_lcore *lc);
+
+#endif /* MCAST_H_ */
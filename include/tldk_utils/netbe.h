@@ -88,11 +88,31 @@ struct pkt_buf {
 	struct rte_mbuf *pkt[2 * MAX_PKT_BURST];
 };
 
+#define	PKT_MAG_SIZE	(2 * MAX_PKT_BURST)
+#define	PKT_MAG_BATCH	MAX_PKT_BURST
+#define	PKT_MAG_TMPL_MAX	16
+
+/*
+ * Cache of mbufs ready to be written, refilled from the mempool in
+ * bursts of PKT_MAG_BATCH. Cached mbufs have data_off set to @data_off
+ * and, if @tmpl_len != 0, their first @tmpl_len data bytes set to @tmpl.
+ * data_len is 0, the caller sets it once the payload is written.
+ */
+struct pkt_mag {
+	struct rte_mempool *mp;
+	uint16_t data_off;
+	uint16_t tmpl_len;
+	uint8_t tmpl[PKT_MAG_TMPL_MAX];
+	uint32_t num;
+	struct rte_mbuf *pkt[PKT_MAG_SIZE];
+};
+
 struct netbe_dev {
 	uint16_t rxqid;
 	uint16_t txqid;
 	struct netbe_port port;
 	struct tle_dev *dev;
+	struct tle_dev *tcp_dev; /* on the lcore's tcp_ctx, if any. */
 	struct {
 		uint64_t in;
 		uint64_t up;
@@ -110,6 +130,8 @@ struct netbe_dev {
 /* 8 bit LPM user data. */
 #define	LCORE_MAX_DST	(UINT8_MAX + 1)
 
+struct netbe_mcast;
+
 struct netbe_lcore {
 	uint32_t id;
 	uint32_t proto; /**< L4 proto to handle. */
@@ -117,6 +139,7 @@ struct netbe_lcore {
 	struct rte_lpm6 *lpm6;
 	struct rte_ip_frag_tbl *ftbl;
 	struct tle_ctx *ctx;
+	struct tle_ctx *tcp_ctx; /**< TCP next to a UDP ctx, NULL if unused. */
 	uint32_t prtq_num;
 	uint32_t dst4_num;
 	uint32_t dst6_num;
@@ -127,6 +150,7 @@ struct netbe_lcore {
 	struct {
 		uint64_t flags[UINT8_MAX + 1];
 	} tcp_stat;
+	struct netbe_mcast *mcast; /**< Groups joined, NULL if none yet. */
 };
 
 struct netbe_cfg {
@@ -137,6 +161,8 @@ struct netbe_cfg {
 	uint32_t prt_num;
 	uint32_t cpu_num;
 	uint32_t mpool_buf_num;
+	/* Streams of the TCP context next to the UDP one, 0 for none. */
+	uint32_t tcp_max_streams;
 	struct netbe_port *prt;
 	struct netbe_lcore *cpu;
 };
@@ -201,6 +227,21 @@ struct netfe_stream {
 		uint64_t erev[TLE_SEV_NUM];
 	} stat;
 	struct pkt_buf pbuf;
+	uint64_t tx_deadline; /* TSC by which pbuf must be flushed. */
+	struct pkt_mag mag; /* TX mbufs, set up by the stream owner. */
+	/* Run by nspk_tldk_lcore_rx() when rxev fires, udata is its owner. */
+	uint32_t (*rx_cb)(struct netfe_stream *fes);
+	/* Run on the packets about to be handed to TLDK, same owner. */
+	void (*tx_cb)(struct netfe_stream *fes, struct rte_mbuf *pkt[],
+		uint32_t num);
+	/* TCP only, run by nspk_tldk_lcore_rx() when erev fires. */
+	void (*err_cb)(struct netfe_stream *fes);
+	/*
+	 * Accepted TCP streams only, run by nspk_tldk_lcore_rx() when txev
+	 * fires, i.e. the send buffer has room again, after pbuf was pushed.
+	 */
+	void (*send_cb)(struct netfe_stream *fes);
+	void *udata;
 	struct sockaddr_storage laddr;
 	struct sockaddr_storage raddr;
 	struct netfe_sprm fwdprm;
@@ -219,6 +260,8 @@ struct netfe_lcore {
 	struct tle_evq *ereq;
 	struct tle_evq *rxeq;
 	struct tle_evq *txeq;
+	/* TCP streams only, the UDP ones keep their txev on txeq. */
+	struct tle_evq *tcp_txeq;
 	struct rte_hash *fw4h;
 	struct rte_hash *fw6h;
 	struct {
@@ -310,6 +353,12 @@ extern struct tx_content tx_content;
 int setup_rx_cb(const struct netbe_port *uprt, struct netbe_lcore *lc,
 	uint16_t qid, uint32_t arp);
 
+/*
+ * Parse the headers of packets as TCP ones, for the TCP context of
+ * a UDP lcore, whose RX callbacks leave TCP packets untyped.
+ */
+void netbe_pkt_tcp_hdr_len(struct rte_mbuf *pkt[], uint32_t num);
+
 /*
  * application function pointers
  */
@@ -34,10 +34,48 @@ int netbe_parse_dest(const char *fname, struct netbe_dest_prm *prm);
 
 int netfe_parse_cfg(const char *fname, struct netfe_lcore_prm *lp);
 
+/*
+ * One RTP session per line of the --rtpcfg file:
+ * lcore=<id>[,egress=url|mbuf|native][,vcodec=<name>][,acodec=<name>]
+ * [,readrate=0|1][,pipeline=0|1][,ccpu=<cpu>][,passthrough=0|1][,pace=0|1]
+ * [,rtcp=0|1][,cc=0|1][,vbitrate=<kbps>][,rtx=<ms>][,rtxpt=<pt>]
+ * [,cthreads=<n>][,ctype=slice|frame|auto]
+ * <src_url> <dst_url>
+ */
+struct nspk_rtp_sess_prm {
+	uint32_t line;
+	uint32_t lcore;
+	struct nspk_rtp_session_ctx_t sess;
+};
+
+struct nspk_rtp_cfg {
+	uint32_t nb_sess;
+	struct nspk_rtp_sess_prm *sess;
+};
+
+int nspk_parse_rtp_cfg(const char *fname, struct nspk_rtp_cfg *cfg);
+
+/*
+ * --txflush [hwm=<pkts>][,delay=<us>][,marker=0|1]
+ */
+int nspk_parse_txflush(const char *arg, struct nspk_tldk_flush_prm *prm);
+
+/*
+ * --rtsp "[port=<port>][,ports=<n>][,conn=<n>][,rtpport=<port>]
+ * [,vcodec=<name>][,acodec=<name>][,passthrough=0|1][,vbitrate=<kbps>]
+ * [,cc=0|1][,rtx=<ms>][,rtxpt=<pt>] <root>"
+ */
+int nspk_parse_rtsp(const char *arg, struct nspk_rtsp_prm *prm);
+
+/*
+ * --http "[port=<port>][,ports=<n>][,conn=<n>][,cache=<MiB>] <root>"
+ */
+int nspk_parse_http(const char *arg, struct nspk_http_prm *prm);
+
 int
 parse_app_options(int argc, char **argv, struct netbe_cfg *cfg,
 	struct tle_ctx_param *ctx_prm,
-	char *fecfg_fname, char *becfg_fname);
+	char *fecfg_fname, char *becfg_fname, char *rtpcfg_fname);
 
 #endif /* __PARSE_H__ */
 
@@ -12,6 +12,8 @@ volatile int force_quit;
 
 RTE_DEFINE_PER_LCORE(struct netbe_lcore *, _be) = NULL;
 RTE_DEFINE_PER_LCORE(struct netfe_lcore *, _fe) = NULL;
+RTE_DEFINE_PER_LCORE(struct nspk_rtp_session_ctx_t *, _rtp_sess) = NULL;
+RTE_DEFINE_PER_LCORE(struct nspk_sched_t *, _sched) = NULL;
 
 struct netbe_cfg becfg = {.mpool_buf_num=MPOOL_NB_BUF};
 struct rte_mempool *mpool[RTE_MAX_NUMA_NODES + 1];
@@ -42,6 +44,8 @@ netbe_lcore_fini(struct netbe_cfg *cfg)
 
 	for (i = 0; i != cfg->cpu_num; i++) {
 		tle_ctx_destroy(cfg->cpu[i].ctx);
+		if (cfg->cpu[i].tcp_ctx != NULL)
+			tle_ctx_destroy(cfg->cpu[i].tcp_ctx);
 		rte_ip_frag_table_destroy(cfg->cpu[i].ftbl);
 		rte_lpm_free(cfg->cpu[i].lpm4);
 		rte_lpm6_free(cfg->cpu[i].lpm6);
@@ -110,6 +114,109 @@ netbe_dest_init(const char *fname, struct netbe_cfg *cfg)
 	return rc;
 }
 
+static struct nspk_sched_t *
+nspk_sched_get(struct nspk_sched_t *sched[RTE_MAX_LCORE],
+	struct lcore_prm prm[RTE_MAX_LCORE], uint32_t lcore)
+{
+	if (lcore >= RTE_MAX_LCORE || !rte_lcore_is_enabled(lcore) ||
+			lcore == rte_get_main_lcore() ||
+			(prm[lcore].be.lc == NULL && prm[lcore].fe.max_streams == 0))
+		return NULL;
+
+	if (sched[lcore] == NULL) {
+		sched[lcore] = calloc(1, sizeof(*sched[lcore]));
+		if (sched[lcore] == NULL)
+			return NULL;
+		sched[lcore]->lcore = lcore;
+		sched[lcore]->lcore_prm = prm + lcore;
+	}
+	return sched[lcore];
+}
+
+/*
+ * Hand the sessions of the --rtpcfg file over to the schedulers of their
+ * lcores. Without the file, a single default session goes to the first
+ * worker lcore able to run it, unless the RTSP server or the HTTP origin
+ * is on: they then have a persistent scheduler on every worker BE lcore,
+ * to spawn sessions on and to serve connections from.
+ */
+static int
+nspk_sched_init(const char *fname, struct nspk_sched_t *sched[RTE_MAX_LCORE],
+	struct lcore_prm prm[RTE_MAX_LCORE])
+{
+	int32_t rc;
+	uint32_t i;
+	struct nspk_sched_t *sc;
+	struct nspk_rtp_session_ctx_t *sess;
+	struct nspk_rtp_cfg cfg;
+
+	if (nspk_rtsp_prm.enable || nspk_http_prm.enable) {
+		for (i = 0; i != becfg.cpu_num; i++) {
+			if (becfg.cpu[i].id == rte_get_main_lcore())
+				continue;
+			sc = nspk_sched_get(sched, prm, becfg.cpu[i].id);
+			if (sc == NULL)
+				return -ENOMEM;
+			sc->persist = 1;
+		}
+		if (fname[0] == 0)
+			return 0;
+	}
+
+	if (fname[0] == 0) {
+		sc = NULL;
+		RTE_LCORE_FOREACH_WORKER(i) {
+			sc = nspk_sched_get(sched, prm, i);
+			if (sc != NULL)
+				break;
+		}
+		sess = calloc(1, sizeof(*sess));
+		if (sc == NULL || sess == NULL) {
+			free(sess);
+			return -ENODEV;
+		}
+		strncpy(sess->src_url, RTP_VIDEO_SRC_PATH,
+			sizeof(sess->src_url));
+		strncpy(sess->dst_url, RTP_VIDEO_SRC_URL, sizeof(sess->dst_url));
+		sess->egress = NSPK_RTP_EGRESS_NATIVE;
+		sess->video_codec = AV_CODEC_ID_H264;
+		sess->audio_codec = AV_CODEC_ID_AAC;
+		sess->readrate = 1;
+		sess->codec_cpu = -1;
+		sess->pace = 1;
+		sess->rtcp = 1;
+		return nspk_sched_add(sc, sess);
+	}
+
+	rc = nspk_parse_rtp_cfg(fname, &cfg);
+	if (rc != 0)
+		return rc;
+
+	for (i = 0; i != cfg.nb_sess && rc == 0; i++) {
+		sc = nspk_sched_get(sched, prm, cfg.sess[i].lcore);
+		if (sc == NULL) {
+			RTE_LOG(ERR, USER1, "%s(%s) error at line %u: "
+				"lcore %u cannot run RTP sessions;\n",
+				__func__, fname, cfg.sess[i].line,
+				cfg.sess[i].lcore);
+			rc = -EINVAL;
+			break;
+		}
+		sess = malloc(sizeof(*sess));
+		if (sess == NULL) {
+			rc = -ENOMEM;
+			break;
+		}
+		*sess = cfg.sess[i].sess;
+		rc = nspk_sched_add(sc, sess);
+		if (rc != 0)
+			free(sess);
+	}
+
+	free(cfg.sess);
+	return rc;
+}
+
 static void
 func_ptrs_init(uint32_t proto) {
 	if (proto == TLE_PROTO_TCP) {
@@ -140,18 +247,25 @@ main(int argc, char *argv[])
 	struct rte_eth_stats stats;
 	char fecfg_fname[PATH_MAX + 1];
 	char becfg_fname[PATH_MAX + 1];
+	char rtpcfg_fname[PATH_MAX + 1];
 	struct lcore_prm prm[RTE_MAX_LCORE];
+	struct nspk_sched_t *sched[RTE_MAX_LCORE];
 	struct rte_eth_dev_info dev_info;
 
 	fecfg_fname[0] = 0;
 	becfg_fname[0] = 0;
+	rtpcfg_fname[0] = 0;
 	memset(prm, 0, sizeof(prm));
+	memset(sched, 0, sizeof(sched));
 
 	rc = rte_eal_init(argc, argv);
 	if (rc < 0)
 		rte_exit(EXIT_FAILURE,
 			"%s: rte_eal_init failed with error code: %d\n",
 			__func__, rc);
+	rte_timer_subsystem_init();
+	/* codec threads go to the CPUs the lcores do not poll on. */
+	nspk_cpu_plan_init();
 
 	memset(&ctx_prm, 0, sizeof(ctx_prm));
 	ctx_prm.timewait = TLE_TCP_TIMEWAIT_DEFAULT;
@@ -162,7 +276,7 @@ main(int argc, char *argv[])
 	argv += rc;
 
 	rc = parse_app_options(argc, argv, &becfg, &ctx_prm,
-		fecfg_fname, becfg_fname);
+		fecfg_fname, becfg_fname, rtpcfg_fname);
 	if (rc != 0)
 		rte_exit(EXIT_FAILURE,
 			"%s: parse_app_options failed with error code: %d\n",
@@ -202,7 +316,8 @@ main(int argc, char *argv[])
 			sig_handle(SIGQUIT);
 	}
 
-	feprm.max_streams = ctx_prm.max_streams * becfg.cpu_num;
+	feprm.max_streams = ctx_prm.max_streams * becfg.cpu_num +
+		becfg.tcp_max_streams;
 
 	rc = (rc != 0) ? rc : netfe_parse_cfg(fecfg_fname, &feprm);
 	if (rc != 0)
@@ -215,23 +330,29 @@ main(int argc, char *argv[])
 	if (rc != 0)
 		sig_handle(SIGQUIT);
 
-	int rc1;
-	/* launch all slave lcores. */
+	/* the RTSP server and HTTP origin open their streams on every BE lcore. */
+	for (i = 0; (nspk_rtsp_prm.enable || nspk_http_prm.enable) &&
+			i != becfg.cpu_num; i++) {
+		if (prm[becfg.cpu[i].id].fe.max_streams == 0)
+			prm[becfg.cpu[i].id].fe.max_streams =
+				feprm.max_streams;
+	}
+
+	rc = (rc != 0) ? rc : nspk_sched_init(rtpcfg_fname, sched, prm);
+	if (rc != 0)
+		sig_handle(SIGQUIT);
+
+	int rc1 = 0;
+	/* launch all slave lcores which have RTP sessions. */
 	RTE_LCORE_FOREACH_WORKER(i) {
-		if (prm[i].be.lc != NULL || prm[i].fe.max_streams != 0) {
-			struct nspk_rtp_session_ctx_t *my_sess = calloc(1, sizeof(*my_sess));
-			my_sess->session_id = 0;
-			strncpy(my_sess->src_url, RTP_VIDEO_SRC_PATH,
-					sizeof(my_sess->src_url));
-			strncpy(my_sess->dst_url, RTP_VIDEO_SRC_URL, sizeof(my_sess->dst_url));
-			my_sess->lcore_prm = prm + i;
-			rc1 = rte_eal_remote_launch(nspk_lcore_main_rtp, my_sess, i);
-			if (rc1 == 0) {
-				printf("RTP thread started at slave LCore %u\n", i);
-				break;
-			}
-			printf("Failed to launch RTP thread at core %u. Trying next...", i);
-		}
+		if (sched[i] == NULL)
+			continue;
+		rc1 = rte_eal_remote_launch(nspk_lcore_main_rtp, sched[i], i);
+		if (rc1 == 0)
+			printf("RTP thread started at slave LCore %u with %u sessions\n",
+				i, sched[i]->nb_sess);
+		else
+			printf("Failed to launch RTP thread at core %u.\n", i);
 	}
 
 	/* launch master lcore. */
@@ -268,6 +389,9 @@ main(int argc, char *argv[])
 		rte_eth_dev_stop(becfg.prt[i].id);
 	}
 
+	RTE_LCORE_FOREACH_WORKER(i)
+		free(sched[i]);
+
 	netbe_lcore_fini(&becfg);
 
 	return 0;
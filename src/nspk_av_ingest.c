@@ -0,0 +1,312 @@
+/**
+ * NSPK TLDK ingest demuxer.
+ * MPEG-TS over UDP or RTP (RFC 2250) received on the lcore by TLDK. The TS
+ * packets of each datagram are fed to the mpegts parser straight from the
+ * mbuf, which is released once the parser is done with it. RTP packets are
+ * put back in order by a jitter buffer per SSRC first.
+ */
+
+#include <libavutil/avstring.h>
+#include <libavutil/intreadwrite.h>
+#include <libavformat/internal.h>
+#include <libavformat/mpegts.h>
+#include <libavformat/rtp.h>
+
+#include <nspk.h>
+#include <nspk_av_ingest.h>
+#include <nspk_jitter.h>
+
+/* RTP sources taken from one input, further ones are dropped. */
+#define INGEST_MAX_SSRC 4
+
+typedef struct IngestContext {
+    URLContext *hd;
+    int is_rtp;
+    MpegTSContext *ts;
+
+    /* RTP inputs only. */
+    struct nspk_jitter_t jb[INGEST_MAX_SSRC];
+    int nb_jb;
+    int next_jb;
+    uint32_t jb_size;
+    uint32_t playout_delay;
+
+    /* Datagram being demuxed, and the bounds of the TS packets left in it. */
+    AVBufferRef *buf;
+    int pos;
+    int end;
+
+    uint64_t datagrams;
+    uint64_t octets;
+    /* RTCP datagrams of RTP inputs, served from the same ring. */
+    uint64_t rtcp;
+    uint64_t invalid;
+    /* Sequence numbers found missing on arrival, before reordering. */
+    uint64_t missing;
+    uint64_t ssrc_drops;
+} IngestContext;
+
+int nspk_ingest_supported(const char *url)
+{
+    return av_strstart(url, "tldk_udp:", NULL) || av_strstart(url, "tldk_rtp:", NULL);
+}
+
+/**
+ * Find the payload of an RTP packet.
+ * \return 0 if there is one, negative AVERROR otherwise.
+ */
+static int ingest_rtp_payload(IngestContext *c, const uint8_t *p, int len, int *pos, int *end)
+{
+    int off;
+
+    if (len < NSPK_RTP_HDR_SIZE || (p[0] & 0xc0) != (RTP_VERSION << 6))
+        goto invalid;
+    if (RTP_PT_IS_RTCP(p[1])) {
+        c->rtcp++;
+        return AVERROR(EAGAIN);
+    }
+
+    off = NSPK_RTP_HDR_SIZE + 4 * (p[0] & 0x0f);
+    if (p[0] & 0x10) {
+        if (len < off + 4)
+            goto invalid;
+        off += 4 + 4 * AV_RB16(p + off + 2);
+    }
+    if (p[0] & 0x20)
+        len -= p[len - 1];
+    if (off > len)
+        goto invalid;
+
+    *pos = off;
+    *end = len;
+    return 0;
+
+invalid:
+    c->invalid++;
+    return AVERROR_INVALIDDATA;
+}
+
+static int ingest_read_header(AVFormatContext *s)
+{
+    IngestContext *c = s->priv_data;
+    const char *p;
+    char buf[32];
+    int ret;
+
+    c->is_rtp = av_strstart(s->url, "tldk_rtp:", NULL);
+    c->jb_size = NSPK_JITTER_DEFAULT_SIZE;
+    c->playout_delay = NSPK_JITTER_DEFAULT_DELAY_US;
+    p = strchr(s->url, '?');
+    if (p) {
+        if (av_find_info_tag(buf, sizeof(buf), "jb_size", p))
+            c->jb_size = strtoul(buf, NULL, 10);
+        if (av_find_info_tag(buf, sizeof(buf), "playout_delay", p))
+            c->playout_delay = strtoul(buf, NULL, 10);
+    }
+    if (!rte_is_power_of_2(c->jb_size) || c->jb_size > NSPK_JITTER_MAX_SIZE) {
+        av_log(s, AV_LOG_ERROR, "jb_size must be a power of 2 up to %u\n", NSPK_JITTER_MAX_SIZE);
+        return AVERROR(EINVAL);
+    }
+
+    ret = nspk_ffurl_open_whitelist(&c->hd, s->url, AVIO_FLAG_READ, &s->interrupt_callback,
+                                    NULL, s->protocol_whitelist, s->protocol_blacklist, NULL,
+                                    c->is_rtp ? &tldk_rtp_protocol : &tldk_udp_protocol);
+    if (ret < 0) {
+        av_log(s, AV_LOG_ERROR, "%s: Cannot open %s\n", __func__, s->url);
+        return ret;
+    }
+
+    c->ts = avpriv_mpegts_parse_open(s);
+    if (!c->ts) {
+        ffurl_closep(&c->hd);
+        return AVERROR(ENOMEM);
+    }
+
+    // Streams show up as the PAT and PMT arrive.
+    s->ctx_flags |= AVFMTCTX_NOHEADER;
+    return 0;
+}
+
+/**
+ * Hold a received RTP packet in the jitter buffer of its source.
+ * RTCP packets are only counted.
+ */
+static void ingest_rtp_insert(AVFormatContext *s, IngestContext *c, struct rte_mbuf *m, uint64_t now)
+{
+    const uint8_t *p;
+    uint16_t gap_first;
+    uint32_t ssrc, gap;
+    int pos, end, i;
+
+    c->datagrams++;
+    c->octets += m->pkt_len;
+
+    // The padding length is in the last byte, the whole packet must be at hand.
+    if (!rte_pktmbuf_is_contiguous(m) && rte_pktmbuf_linearize(m) < 0) {
+        c->invalid++;
+        rte_pktmbuf_free(m);
+        return;
+    }
+    p = rte_pktmbuf_mtod(m, const uint8_t *);
+    if (ingest_rtp_payload(c, p, m->pkt_len, &pos, &end) < 0) {
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    ssrc = AV_RB32(p + 8);
+    for (i = 0; i < c->nb_jb && c->jb[i].ssrc != ssrc; i++)
+        ;
+    if (i == c->nb_jb) {
+        if (i == INGEST_MAX_SSRC || nspk_jitter_init(&c->jb[i], ssrc, c->jb_size, c->playout_delay) < 0) {
+            c->ssrc_drops++;
+            rte_pktmbuf_free(m);
+            return;
+        }
+        c->nb_jb++;
+        av_log(s, AV_LOG_VERBOSE, "New RTP source %08"PRIx32"\n", ssrc);
+    }
+
+    gap = nspk_jitter_insert(&c->jb[i], m, AV_RB16(p + 2), now, &gap_first);
+    if (gap != 0) {
+        c->missing += gap;
+        av_log(s, AV_LOG_DEBUG, "SSRC %08"PRIx32": %"PRIu32" packets missing from %u\n",
+               ssrc, gap, gap_first);
+    }
+}
+
+/**
+ * Play out the next due packet of any source, taking turns.
+ */
+static struct rte_mbuf *ingest_rtp_pop(IngestContext *c, uint64_t now)
+{
+    struct rte_mbuf *m;
+    int i, k;
+
+    for (k = 0; k < c->nb_jb; k++) {
+        i = (c->next_jb + k) % c->nb_jb;
+        if ((m = nspk_jitter_pop(&c->jb[i], now)) != NULL) {
+            c->next_jb = i + 1;
+            return m;
+        }
+    }
+    return NULL;
+}
+
+static int ingest_rtp_next(AVFormatContext *s, IngestContext *c)
+{
+    struct rte_mbuf *m;
+    uint64_t now;
+    uint32_t held;
+    int i, ret;
+
+    for (;;) {
+        // Take in all that was received, then play out what is due.
+        c->hd->flags |= AVIO_FLAG_NONBLOCK;
+        now = rte_rdtsc();
+        while ((ret = nspk_rtp_read_mbuf(c->hd, &m)) >= 0)
+            ingest_rtp_insert(s, c, m, now);
+        if (ret != AVERROR(EAGAIN))
+            return ret;
+
+        if ((m = ingest_rtp_pop(c, now)) != NULL) {
+            if (!(c->buf = nspk_udp_mbuf_to_buffer(m)))
+                return AVERROR(ENOMEM);
+            ingest_rtp_payload(c, c->buf->data, c->buf->size, &c->pos, &c->end);
+            return 0;
+        }
+
+        if (s->flags & AVFMT_FLAG_NONBLOCK)
+            return AVERROR(EAGAIN);
+        for (held = 0, i = 0; i < c->nb_jb; i++)
+            held += c->jb[i].count;
+        if (held == 0) {
+            // Nothing to play out, wait for the input.
+            c->hd->flags &= ~AVIO_FLAG_NONBLOCK;
+            if ((ret = nspk_rtp_read_mbuf(c->hd, &m)) < 0)
+                return ret;
+            ingest_rtp_insert(s, c, m, rte_rdtsc());
+            continue;
+        }
+        if (ff_check_interrupt(&s->interrupt_callback))
+            return AVERROR_EXIT;
+        rte_pause();
+    }
+}
+
+static int ingest_udp_next(AVFormatContext *s, IngestContext *c)
+{
+    int ret;
+
+    if (s->flags & AVFMT_FLAG_NONBLOCK)
+        c->hd->flags |= AVIO_FLAG_NONBLOCK;
+    else
+        c->hd->flags &= ~AVIO_FLAG_NONBLOCK;
+
+    ret = nspk_udp_read_buffer(c->hd, &c->buf);
+    if (ret < 0)
+        return ret;
+    c->datagrams++;
+    c->octets += ret;
+    c->pos = 0;
+    c->end = ret;
+    return 0;
+}
+
+static int ingest_read_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    IngestContext *c = s->priv_data;
+    int ret;
+
+    for (;;) {
+        if (c->buf) {
+            // Returns once a PES packet is complete, or fails when the datagram is used up.
+            ret = avpriv_mpegts_parse_packet(c->ts, pkt, c->buf->data + c->pos, c->end - c->pos);
+            if (ret >= 0) {
+                c->pos += ret;
+                if (c->end - c->pos < TS_PACKET_SIZE)
+                    av_buffer_unref(&c->buf);
+                return 0;
+            }
+            av_buffer_unref(&c->buf);
+        }
+
+        ret = c->is_rtp ? ingest_rtp_next(s, c) : ingest_udp_next(s, c);
+        if (ret < 0)
+            return ret;
+    }
+}
+
+static int ingest_read_close(AVFormatContext *s)
+{
+    IngestContext *c = s->priv_data;
+    struct nspk_jitter_t *jb;
+    int i;
+
+    av_log(s, AV_LOG_INFO, "%s: %"PRIu64" datagrams, %"PRIu64" bytes, %"PRIu64" RTCP, "
+           "%"PRIu64" invalid, %"PRIu64" missing, %"PRIu64" from extra sources\n",
+           s->url, c->datagrams, c->octets, c->rtcp, c->invalid, c->missing, c->ssrc_drops);
+
+    for (i = 0; i < c->nb_jb; i++) {
+        jb = &c->jb[i];
+        av_log(s, AV_LOG_INFO, "SSRC %08"PRIx32": %"PRIu64" received, %"PRIu64" played, %"PRIu64" lost, "
+               "%"PRIu64" late, %"PRIu64" duplicate, %"PRIu64" resyncs\n", jb->ssrc,
+               jb->received, jb->played, jb->lost, jb->late, jb->dups, jb->resyncs);
+        nspk_jitter_fini(jb);
+    }
+
+    av_buffer_unref(&c->buf);
+    if (c->ts)
+        avpriv_mpegts_parse_close(c->ts);
+    ffurl_closep(&c->hd);
+    return 0;
+}
+
+AVInputFormat nspk_ingest_demuxer = {
+    .name           = "tldk_ingest",
+    .long_name      = "MPEG-TS over TLDK UDP or RTP",
+    .priv_data_size = sizeof(IngestContext),
+    .read_header    = ingest_read_header,
+    .read_packet    = ingest_read_packet,
+    .read_close     = ingest_read_close,
+    .flags          = AVFMT_NOFILE,
+};
@@ -21,15 +21,15 @@
 #include <libavformat/network.h>
 #include <libavformat/os_support.h>
 #include <fcntl.h>
-#if HAVE_POLL_H
-#include <poll.h>
-#endif
+#include <libavutil/time.h>
 
 #include <nspk.h>
 
 typedef struct RTPContext {
     const AVClass *class;
-    URLContext *rtp_hd, *rtcp_hd, *fec_hd;
+    URLContext *rtp_hd, *rtcp_hd;
+    /* Built-in SMPTE 2022-1 generator, replaces the prompeg protocol. */
+    struct nspk_fec_t *fec;
     int rtp_fd, rtcp_fd;
     IPSourceFilters filters;
     int write_to_source;
@@ -211,11 +211,12 @@ static int rtp_open(URLContext *h, const char *uri, int flags)
 {
 
     RTPContext *s = h->priv_data;
-    AVDictionary *fec_opts = NULL;
+    struct nspk_rtp_session_ctx_t *rtp_sess = RTE_PER_LCORE(_rtp_sess);
+    struct netfe_sprm sprm;
+    int fec_l = 0, fec_d = 0;
     int rtp_port;
     char hostname[256], include_sources[1024] = "", exclude_sources[1024] = "";
     char *sources = include_sources, *block = exclude_sources;
-    char *fec_protocol = NULL;
     char buf[1024];
     char path[1024];
     const char *p;
@@ -278,28 +279,11 @@ static int rtp_open(URLContext *h, const char *uri, int flags)
     if (s->rw_timeout >= 0)
         h->rw_timeout = s->rw_timeout;
 
-    if (s->fec_options_str) {
-        p = s->fec_options_str;
-
-        if (!(fec_protocol = av_get_token(&p, "="))) {
-            av_log(h, AV_LOG_ERROR, "Failed to parse the FEC protocol value\n");
-            goto fail;
-        }
-        if (strcmp(fec_protocol, "prompeg")) {
-            av_log(h, AV_LOG_ERROR, "Unsupported FEC protocol %s\n", fec_protocol);
-            goto fail;
-        }
-
-        p = s->fec_options_str + strlen(fec_protocol);
-        while (*p && *p == '=') p++;
-
-        if (av_dict_parse_string(&fec_opts, p, "=", ":", 0) < 0) {
-            av_log(h, AV_LOG_ERROR, "Failed to parse the FEC options\n");
+    if (s->fec_options_str && (flags & AVIO_FLAG_WRITE)) {
+        if (nspk_fec_parse(s->fec_options_str, &fec_l, &fec_d) < 0) {
+            av_log(h, AV_LOG_ERROR, "Unsupported FEC options %s\n", s->fec_options_str);
             goto fail;
         }
-        if (s->ttl > 0) {
-            av_dict_set_int(&fec_opts, "ttl", s->ttl, 0);
-        }
     }
 
     for (i = 0; i < max_retry_count; i++) {
@@ -343,13 +327,17 @@ static int rtp_open(URLContext *h, const char *uri, int flags)
         break;
     }
 
-    s->fec_hd = NULL;
-    fec_protocol = NULL;
-    if (fec_protocol) {
-        ff_url_join(buf, sizeof(buf), fec_protocol, NULL, hostname, rtp_port, NULL);
-        if (nspk_ffurl_open_whitelist(&s->fec_hd, buf, flags, &h->interrupt_callback, &fec_opts,
-                h->protocol_whitelist, h->protocol_blacklist, h, &tldk_udp_protocol) < 0)
+    // The FEC streams live on the lcore of the session, next to the RTP one.
+    if (fec_l) {
+        if (!rtp_sess || nspk_rtp_url_parse(uri, &sprm, NULL, NULL) < 0)
+            goto fail;
+        s->fec = av_malloc(sizeof(*s->fec));
+        if (!s->fec)
             goto fail;
+        if (nspk_fec_init(s->fec, rtp_sess->lcore_prm, &sprm, fec_l, fec_d) < 0) {
+            av_freep(&s->fec);
+            goto fail;
+        }
     }
 
     /* just to ease handle access. XXX: need to suppress direct handle
@@ -357,74 +345,96 @@ static int rtp_open(URLContext *h, const char *uri, int flags)
     s->rtp_fd = ffurl_get_file_handle(s->rtp_hd);
     s->rtcp_fd = ffurl_get_file_handle(s->rtcp_hd);
 
+    // rtp_read() polls both streams, it does the waiting.
+    if (flags & AVIO_FLAG_READ) {
+        s->rtp_hd->flags |= AVIO_FLAG_NONBLOCK;
+        s->rtcp_hd->flags |= AVIO_FLAG_NONBLOCK;
+    }
+
     h->max_packet_size = s->rtp_hd->max_packet_size;
     h->is_streamed = 1;
 
-    av_free(fec_protocol);
-    av_dict_free(&fec_opts);
-
     return 0;
 
  fail:
     ffurl_closep(&s->rtp_hd);
     ffurl_closep(&s->rtcp_hd);
-    ffurl_closep(&s->fec_hd);
-    av_free(fec_protocol);
-    av_dict_free(&fec_opts);
     return AVERROR(EIO);
 }
 
-// TODO: Do TLDK UDP
-static int rtp_read(URLContext *h, uint8_t *buf, int size)
+int nspk_rtp_read_mbuf(URLContext *h, struct rte_mbuf **pm)
 {
-
     RTPContext *s = h->priv_data;
-    int len, n, i;
-    struct pollfd p[2] = {{s->rtp_fd, POLLIN, 0}, {s->rtcp_fd, POLLIN, 0}};
-    int poll_delay = h->flags & AVIO_FLAG_NONBLOCK ? 0 : POLLING_TIME;
-    struct sockaddr_storage *addrs[2] = { &s->last_rtp_source, &s->last_rtcp_source };
-    socklen_t *addr_lens[2] = { &s->last_rtp_source_len, &s->last_rtcp_source_len };
-    int runs = h->rw_timeout / 1000 / POLLING_TIME;
+    URLContext *hd[2] = { s->rtcp_hd, s->rtp_hd };
+    struct sockaddr_storage *addrs[2] = { &s->last_rtcp_source, &s->last_rtp_source };
+    socklen_t *addr_lens[2] = { &s->last_rtcp_source_len, &s->last_rtp_source_len };
+    int64_t deadline = 0;
+    int ret, i;
 
     for(;;) {
-        if (ff_check_interrupt(&h->interrupt_callback))
-            return AVERROR_EXIT;
-        n = poll(p, 2, poll_delay);
-        if (n > 0) {
-            /* first try RTCP, then RTP */
-            for (i = 1; i >= 0; i--) {
-                if (!(p[i].revents & POLLIN))
-                    continue;
-                *addr_lens[i] = sizeof(*addrs[i]);
-                len = recvfrom(p[i].fd, buf, size, 0,
-                                (struct sockaddr *)addrs[i], addr_lens[i]);
-                if (len < 0) {
-                    if (ff_neterrno() == AVERROR(EAGAIN) ||
-                        ff_neterrno() == AVERROR(EINTR))
-                        continue;
-                    return AVERROR(EIO);
-                }
-                if (ff_ip_check_source_lists(addrs[i], &s->filters))
-                    continue;
-                return len;
-            }
-        } else if (n == 0 && h->rw_timeout > 0 && --runs <= 0) {
-            return AVERROR(ETIMEDOUT);
-        } else if (n < 0) {
-            if (ff_neterrno() == AVERROR(EINTR))
+        /* first try RTCP, then RTP */
+        for (i = 0; i < 2; i++) {
+            ret = nspk_udp_read_mbuf(hd[i], pm);
+            if (ret == AVERROR(EAGAIN))
                 continue;
-            return AVERROR(EIO);
+            if (ret >= 0) {
+                *addrs[i] = ((UDPTldkContext *)hd[i]->priv_data)->last_source;
+                *addr_lens[i] = addrs[i]->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) :
+                                                                  sizeof(struct sockaddr_in);
+            }
+            return ret;
         }
         if (h->flags & AVIO_FLAG_NONBLOCK)
             return AVERROR(EAGAIN);
+        if (ff_check_interrupt(&h->interrupt_callback))
+            return AVERROR_EXIT;
+        if (h->rw_timeout > 0) {
+            if (!deadline)
+                deadline = av_gettime_relative() + h->rw_timeout;
+            else if (av_gettime_relative() > deadline)
+                return AVERROR(ETIMEDOUT);
+        }
+        rte_pause();
     }
 }
 
+int nspk_rtp_read_buffer(URLContext *h, AVBufferRef **pbuf)
+{
+    struct rte_mbuf *m;
+    int ret;
+
+    if ((ret = nspk_rtp_read_mbuf(h, &m)) < 0)
+        return ret;
+
+    *pbuf = nspk_udp_mbuf_to_buffer(m);
+    return *pbuf ? ret : AVERROR(ENOMEM);
+}
+
+static int rtp_read(URLContext *h, uint8_t *buf, int size)
+{
+    struct rte_mbuf *m;
+    const void *data;
+    int len;
+
+    len = nspk_rtp_read_mbuf(h, &m);
+    if (len < 0)
+        return len;
+    if (len > size) {
+        av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
+        len = size;
+    }
+    data = rte_pktmbuf_read(m, 0, len, buf);
+    if (data != buf)
+        memcpy(buf, data, len);
+    rte_pktmbuf_free(m);
+    return len;
+}
+
 static int rtp_write(URLContext *h, const uint8_t *buf, int size)
 {
 
     RTPContext *s = h->priv_data;
-    int ret, ret_fec;
+    int ret;
     URLContext *hd;
 
     if (size < 2)
@@ -497,12 +507,8 @@ static int rtp_write(URLContext *h, const uint8_t *buf, int size)
         return ret;
     }
 
-    if (s->fec_hd && !RTP_PT_IS_RTCP(buf[1])) {
-        if ((ret_fec = ffurl_write(s->fec_hd, buf, size)) < 0) {
-            av_log(h, AV_LOG_ERROR, "Failed to send FEC\n");
-            return ret_fec;
-        }
-    }
+    if (s->fec && !RTP_PT_IS_RTCP(buf[1]))
+        nspk_fec_add(s->fec, buf, size);
 
     return ret;
 }
@@ -516,7 +522,10 @@ static int rtp_close(URLContext *h)
 
     ffurl_closep(&s->rtp_hd);
     ffurl_closep(&s->rtcp_hd);
-    ffurl_closep(&s->fec_hd);
+    if (s->fec) {
+        nspk_fec_fini(s->fec);
+        av_freep(&s->fec);
+    }
     return 0;
 }
 
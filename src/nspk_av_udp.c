@@ -1,5 +1,4 @@
 #define _DEFAULT_SOURCE
-#define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
 
 #include <libavformat/avformat.h>
 #include <libavformat/avio_internal.h>
@@ -14,18 +13,9 @@
 #include <libavformat/network.h>
 #include <arpa/inet.h>
 
-#if HAVE_PTHREAD_CANCEL
-#include <libavutil/thread.h>
-#endif
-
 #include <nspk.h>
 #include <tldk_utils/udp.h>
 
-#ifndef IPV6_ADD_MEMBERSHIP
-#define IPV6_ADD_MEMBERSHIP IPV6_JOIN_GROUP
-#define IPV6_DROP_MEMBERSHIP IPV6_LEAVE_GROUP
-#endif
-
 #define OFFSET(x) offsetof(UDPTldkContext, x)
 #define D AV_OPT_FLAG_DECODING_PARAM
 #define E AV_OPT_FLAG_ENCODING_PARAM
@@ -42,8 +32,8 @@ static const AVOption options[] = {
     { "broadcast", "explicitly allow or disallow broadcast destination",   OFFSET(is_broadcast),   AV_OPT_TYPE_BOOL,   { .i64 = 0  },     0, 1,       E },
     { "ttl",            "Time to live (multicast only)",                   OFFSET(ttl),            AV_OPT_TYPE_INT,    { .i64 = 16 },     0, INT_MAX, E },
     { "connect",        "set if connect() should be called on socket",     OFFSET(is_connected),   AV_OPT_TYPE_BOOL,   { .i64 =  0 },     0, 1,       .flags = D|E },
-    { "fifo_size",      "set the UDP receiving circular buffer size, expressed as a number of packets with size of 188 bytes", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = 7*4096}, 0, INT_MAX, D },
-    { "overrun_nonfatal", "survive in case of UDP receiving circular buffer overrun", OFFSET(overrun_nonfatal), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1,    D },
+    { "fifo_size",      "set the size of the mbuf ring to the lcore, expressed as a number of datagrams (0: default on input, none on output)", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, D|E },
+    { "overrun_nonfatal", "survive in case of UDP receiving ring overrun", OFFSET(overrun_nonfatal), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1,    D },
     { "timeout",        "set raise error timeout, in microseconds (only in read mode)",OFFSET(timeout),         AV_OPT_TYPE_INT,  {.i64 = 0}, 0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -57,163 +47,6 @@ static const AVClass udp_class = {
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
-static int udp_set_multicast_ttl(int sockfd, int mcastTTL,
-                                 struct sockaddr *addr)
-{
-#ifdef IP_MULTICAST_TTL
-    if (addr->sa_family == AF_INET) {
-        if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &mcastTTL, sizeof(mcastTTL)) < 0) {
-            ff_log_net_error(NULL, AV_LOG_ERROR, "setsockopt(IP_MULTICAST_TTL)");
-            return ff_neterrno();
-        }
-    }
-#endif
-#if defined(IPPROTO_IPV6) && defined(IPV6_MULTICAST_HOPS)
-    if (addr->sa_family == AF_INET6) {
-        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &mcastTTL, sizeof(mcastTTL)) < 0) {
-            ff_log_net_error(NULL, AV_LOG_ERROR, "setsockopt(IPV6_MULTICAST_HOPS)");
-            return ff_neterrno();
-        }
-    }
-#endif
-    return 0;
-}
-
-static int udp_join_multicast_group(int sockfd, struct sockaddr *addr,struct sockaddr *local_addr)
-{
-#ifdef IP_ADD_MEMBERSHIP
-    if (addr->sa_family == AF_INET) {
-        struct ip_mreq mreq;
-
-        mreq.imr_multiaddr.s_addr = ((struct sockaddr_in *)addr)->sin_addr.s_addr;
-        if (local_addr)
-            mreq.imr_interface= ((struct sockaddr_in *)local_addr)->sin_addr;
-        else
-            mreq.imr_interface.s_addr = INADDR_ANY;
-        if (setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const void *)&mreq, sizeof(mreq)) < 0) {
-            ff_log_net_error(NULL, AV_LOG_ERROR, "setsockopt(IP_ADD_MEMBERSHIP)");
-            return ff_neterrno();
-        }
-    }
-#endif
-#if HAVE_STRUCT_IPV6_MREQ && defined(IPPROTO_IPV6)
-    if (addr->sa_family == AF_INET6) {
-        struct ipv6_mreq mreq6;
-
-        memcpy(&mreq6.ipv6mr_multiaddr, &(((struct sockaddr_in6 *)addr)->sin6_addr), sizeof(struct in6_addr));
-        //TODO: Interface index should be looked up from local_addr
-        mreq6.ipv6mr_interface = 0;
-        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &mreq6, sizeof(mreq6)) < 0) {
-            ff_log_net_error(NULL, AV_LOG_ERROR, "setsockopt(IPV6_ADD_MEMBERSHIP)");
-            return ff_neterrno();
-        }
-    }
-#endif
-    return 0;
-}
-
-static int udp_leave_multicast_group(int sockfd, struct sockaddr *addr,struct sockaddr *local_addr)
-{
-#ifdef IP_DROP_MEMBERSHIP
-    if (addr->sa_family == AF_INET) {
-        struct ip_mreq mreq;
-
-        mreq.imr_multiaddr.s_addr = ((struct sockaddr_in *)addr)->sin_addr.s_addr;
-        if (local_addr)
-            mreq.imr_interface = ((struct sockaddr_in *)local_addr)->sin_addr;
-        else
-            mreq.imr_interface.s_addr = INADDR_ANY;
-        if (setsockopt(sockfd, IPPROTO_IP, IP_DROP_MEMBERSHIP, (const void *)&mreq, sizeof(mreq)) < 0) {
-            ff_log_net_error(NULL, AV_LOG_ERROR, "setsockopt(IP_DROP_MEMBERSHIP)");
-            return -1;
-        }
-    }
-#endif
-#if HAVE_STRUCT_IPV6_MREQ && defined(IPPROTO_IPV6)
-    if (addr->sa_family == AF_INET6) {
-        struct ipv6_mreq mreq6;
-
-        memcpy(&mreq6.ipv6mr_multiaddr, &(((struct sockaddr_in6 *)addr)->sin6_addr), sizeof(struct in6_addr));
-        //TODO: Interface index should be looked up from local_addr
-        mreq6.ipv6mr_interface = 0;
-        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_DROP_MEMBERSHIP, &mreq6, sizeof(mreq6)) < 0) {
-            ff_log_net_error(NULL, AV_LOG_ERROR, "setsockopt(IPV6_DROP_MEMBERSHIP)");
-            return -1;
-        }
-    }
-#endif
-    return 0;
-}
-
-static int udp_set_multicast_sources(URLContext *h,
-                                     int sockfd, struct sockaddr *addr,
-                                     int addr_len, struct sockaddr_storage *local_addr,
-                                     struct sockaddr_storage *sources,
-                                     int nb_sources, int include)
-{
-    int i;
-    if (addr->sa_family != AF_INET) {
-#if HAVE_STRUCT_GROUP_SOURCE_REQ && defined(MCAST_BLOCK_SOURCE)
-        /* For IPv4 prefer the old approach, as that alone works reliably on
-         * Windows and it also supports supplying the interface based on its
-         * address. */
-        int i;
-        for (i = 0; i < nb_sources; i++) {
-            struct group_source_req mreqs;
-            int level = addr->sa_family == AF_INET ? IPPROTO_IP : IPPROTO_IPV6;
-
-            //TODO: Interface index should be looked up from local_addr
-            mreqs.gsr_interface = 0;
-            memcpy(&mreqs.gsr_group, addr, addr_len);
-            memcpy(&mreqs.gsr_source, &sources[i], sizeof(*sources));
-
-            if (setsockopt(sockfd, level,
-                           include ? MCAST_JOIN_SOURCE_GROUP : MCAST_BLOCK_SOURCE,
-                           (const void *)&mreqs, sizeof(mreqs)) < 0) {
-                if (include)
-                    ff_log_net_error(NULL, AV_LOG_ERROR, "setsockopt(MCAST_JOIN_SOURCE_GROUP)");
-                else
-                    ff_log_net_error(NULL, AV_LOG_ERROR, "setsockopt(MCAST_BLOCK_SOURCE)");
-                return ff_neterrno();
-            }
-        }
-        return 0;
-#else
-        av_log(h, AV_LOG_ERROR,
-               "Setting multicast sources only supported for IPv4\n");
-        return AVERROR(EINVAL);
-#endif
-    }
-#if HAVE_STRUCT_IP_MREQ_SOURCE && defined(IP_BLOCK_SOURCE)
-    for (i = 0; i < nb_sources; i++) {
-        struct ip_mreq_source mreqs;
-        if (sources[i].ss_family != AF_INET) {
-            av_log(h, AV_LOG_ERROR, "Source/block address %d is of incorrect protocol family\n", i + 1);
-            return AVERROR(EINVAL);
-        }
-
-        mreqs.imr_multiaddr.s_addr = ((struct sockaddr_in *)addr)->sin_addr.s_addr;
-        if (local_addr)
-            mreqs.imr_interface = ((struct sockaddr_in *)local_addr)->sin_addr;
-        else
-            mreqs.imr_interface.s_addr = INADDR_ANY;
-        mreqs.imr_sourceaddr.s_addr = ((struct sockaddr_in *)&sources[i])->sin_addr.s_addr;
-
-        if (setsockopt(sockfd, IPPROTO_IP,
-                       include ? IP_ADD_SOURCE_MEMBERSHIP : IP_BLOCK_SOURCE,
-                       (const void *)&mreqs, sizeof(mreqs)) < 0) {
-            if (include)
-                ff_log_net_error(h, AV_LOG_ERROR, "setsockopt(IP_ADD_SOURCE_MEMBERSHIP)");
-            else
-                ff_log_net_error(h, AV_LOG_ERROR, "setsockopt(IP_BLOCK_SOURCE)");
-            return ff_neterrno();
-        }
-    }
-#else
-    return AVERROR(ENOSYS);
-#endif
-    return 0;
-}
 static int udp_set_url(URLContext *h,
                        struct sockaddr_storage *addr,
                        const char *hostname, int port)
@@ -293,7 +126,7 @@ static int udp_port(struct sockaddr_storage *addr, int addr_len)
  *         'localport=n' : set the local port
  *         'pkt_size=n'  : set max packet size
  *         'reuse=1'     : enable reusing the socket
- *         'overrun_nonfatal=1': survive in case of circular buffer overrun
+ *         'overrun_nonfatal=1': survive in case of ring overrun
  *
  * @param h media file context
  * @param uri of the remote server
@@ -358,168 +191,144 @@ static int udp_get_file_handle(URLContext *h)
     return s->udp_fd;
 }
 
-#if HAVE_PTHREAD_CANCEL
-static void *circular_buffer_task_rx( void *_URLContext)
+/* Output contexts with a ring, opened on this lcore. */
+LIST_HEAD(udp_ring_list, UDPTldkContext);
+static RTE_DEFINE_PER_LCORE(struct udp_ring_list, _udp_rings);
+
+/**
+ * Move one burst across the ring of a context. Runs on the lcore owning
+ * the stream: received datagrams go to the reader, written ones to TLDK.
+ */
+static uint32_t udp_ring_service(UDPTldkContext *s)
 {
-    URLContext *h = _URLContext;
-    UDPTldkContext *s = h->priv_data;
-    int old_cancelstate;
-
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
-    pthread_mutex_lock(&s->mutex);
-    if (ff_socket_nonblock(s->udp_fd, 0) < 0) {
-        av_log(h, AV_LOG_ERROR, "Failed to set blocking mode");
-        s->circular_buffer_error = AVERROR(EIO);
-        goto end;
-    }
-    while(1) {
-        int len;
-        struct sockaddr_storage addr;
-        socklen_t addr_len = sizeof(addr);
-
-        pthread_mutex_unlock(&s->mutex);
-        /* Blocking operations are always cancellation points;
-           see "General Information" / "Thread Cancelation Overview"
-           in Single Unix. */
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
-        len = recvfrom(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0, (struct sockaddr *)&addr, &addr_len);
-        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
-        pthread_mutex_lock(&s->mutex);
-        if (len < 0) {
-            if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR)) {
-                s->circular_buffer_error = ff_neterrno();
-                goto end;
+    struct rte_mbuf *pkts[MAX_PKT_BURST];
+    uint32_t i, n, k;
+
+    if (s->is_output) {
+        n = rte_ring_sc_dequeue_burst(s->ring, (void **)pkts, RTE_DIM(pkts), NULL);
+        for (i = 0; i != n; i++) {
+            if (s->pacer) {
+                nspk_pacer_enqueue(s->pacer, pkts[i]);
+            } else if (nspk_tldk_udp_stream_send_mbuf(s->tldk_udp_stream, pkts[i]) < 0) {
+                rte_pktmbuf_free(pkts[i]);
+                s->ring_drops++;
             }
-            continue;
         }
-        if (ff_ip_check_source_lists(&addr, &s->filters))
-            continue;
-        AV_WL32(s->tmp, len);
+        return n;
+    }
 
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
-                continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
-                goto end;
-            }
-        }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
-        pthread_cond_signal(&s->cond);
+    // Datagrams the ring has no room for wait in TLDK.
+    k = RTE_MIN(rte_ring_free_count(s->ring), RTE_DIM(pkts));
+    if (k == 0) {
+        if (!s->overrun_nonfatal && !s->circular_buffer_error) {
+            av_log(NULL, AV_LOG_ERROR, "Ring overrun. "
+                   "To avoid, increase fifo_size URL option. "
+                   "To survive in such case, use overrun_nonfatal option\n");
+            __atomic_store_n(&s->circular_buffer_error, AVERROR(EIO), __ATOMIC_RELEASE);
+        }
+        // TLDK only raises the event again on the next arrival, look again next round.
+        tle_event_raise(s->tldk_udp_stream->rxev);
+        return 0;
     }
 
-end:
-    pthread_cond_signal(&s->cond);
-    pthread_mutex_unlock(&s->mutex);
-    return NULL;
+    n = tle_udp_stream_recv(s->tldk_udp_stream->s, pkts, k);
+    if (n == 0)
+        return 0;
+    s->tldk_udp_stream->stat.rxp += n;
+    rte_ring_sp_enqueue_burst(s->ring, (void **)pkts, n, NULL);
+    return n;
 }
 
-static void *circular_buffer_task_tx( void *_URLContext)
+uint32_t nspk_udp_lcore_run(void)
 {
-    URLContext *h = _URLContext;
-    UDPTldkContext *s = h->priv_data;
-    int64_t target_timestamp = av_gettime_relative();
-    int64_t start_timestamp = av_gettime_relative();
-    int64_t sent_bits = 0;
-    int64_t burst_interval = s->bitrate ? (s->burst_bits * 1000000 / s->bitrate) : 0;
-    int64_t max_delay = s->bitrate ?  ((int64_t)h->max_packet_size * 8 * 1000000 / s->bitrate + 1) : 0;
-
-    pthread_mutex_lock(&s->mutex);
-
-    if (ff_socket_nonblock(s->udp_fd, 0) < 0) {
-        av_log(h, AV_LOG_ERROR, "Failed to set blocking mode");
-        s->circular_buffer_error = AVERROR(EIO);
-        goto end;
-    }
-
-    for(;;) {
-        int len;
-        const uint8_t *p;
-        uint8_t tmp[4];
-        int64_t timestamp;
-
-        len = av_fifo_size(s->fifo);
+    UDPTldkContext *s;
+    uint32_t n = 0;
 
-        while (len<4) {
-            if (s->close_req)
-                goto end;
-            if (pthread_cond_wait(&s->cond, &s->mutex) < 0) {
-                goto end;
-            }
-            len = av_fifo_size(s->fifo);
-        }
+    LIST_FOREACH(s, &RTE_PER_LCORE(_udp_rings), link)
+        n += udp_ring_service(s);
+    return n;
+}
 
-        av_fifo_generic_read(s->fifo, tmp, 4, NULL);
-        len = AV_RL32(tmp);
+/**
+ * RX event of an input stream, see nspk_tldk_lcore_rx(). The RTP and RTCP
+ * streams of a session come through the same event queue.
+ */
+static uint32_t udp_rx_event(struct netfe_stream *fs)
+{
+    return udp_ring_service(fs->udata);
+}
 
-        av_assert0(len >= 0);
-        av_assert0(len <= sizeof(s->tmp));
+/**
+ * Source address of a received datagram, from the headers TLDK leaves in
+ * front of the payload.
+ */
+static void udp_src_addr(const struct rte_mbuf *m, struct sockaddr_storage *ss)
+{
+    const struct rte_udp_hdr *udph = rte_pktmbuf_mtod_offset(m, const struct rte_udp_hdr *,
+                                                             -(int)m->l4_len);
+    const void *iph = rte_pktmbuf_mtod_offset(m, const void *, -(int)(m->l4_len + m->l3_len));
+
+    memset(ss, 0, sizeof(*ss));
+    if (m->l3_len == sizeof(struct rte_ipv4_hdr)) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = ((const struct rte_ipv4_hdr *)iph)->src_addr;
+        sin->sin_port = udph->src_port;
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+        sin6->sin6_family = AF_INET6;
+        memcpy(&sin6->sin6_addr, ((const struct rte_ipv6_hdr *)iph)->src_addr, sizeof(sin6->sin6_addr));
+        sin6->sin6_port = udph->src_port;
+    }
+}
 
-        av_fifo_generic_read(s->fifo, s->tmp, len, NULL);
+static int udp_ring_open(URLContext *h, UDPTldkContext *s)
+{
+    char name[RTE_RING_NAMESIZE];
+    uint32_t size = s->circular_buffer_size ? s->circular_buffer_size : UDP_RING_DEFAULT_SIZE;
+
+    snprintf(name, sizeof(name), "nspk_udp_%p", (void *)s);
+    s->ring = rte_ring_create(name, rte_align32pow2(size + 1), rte_socket_id(),
+                              RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (!s->ring) {
+        av_log(h, AV_LOG_ERROR, "rte_ring_create failed: %s\n", rte_strerror(rte_errno));
+        return AVERROR(rte_errno);
+    }
 
-        pthread_mutex_unlock(&s->mutex);
+    s->lcore = rte_lcore_id();
+    if (s->is_output)
+        LIST_INSERT_HEAD(&RTE_PER_LCORE(_udp_rings), s, link);
+    else {
+        s->tldk_udp_stream->udata = s;
+        s->tldk_udp_stream->rx_cb = udp_rx_event;
+    }
+    return 0;
+}
 
-        if (s->bitrate) {
-            timestamp = av_gettime_relative();
-            if (timestamp < target_timestamp) {
-                int64_t delay = target_timestamp - timestamp;
-                if (delay > max_delay) {
-                    delay = max_delay;
-                    start_timestamp = timestamp + delay;
-                    sent_bits = 0;
-                }
-                av_usleep(delay);
-            } else {
-                if (timestamp - burst_interval > target_timestamp) {
-                    start_timestamp = timestamp - burst_interval;
-                    sent_bits = 0;
-                }
-            }
-            sent_bits += len * 8;
-            target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
-        }
+static void udp_ring_close(UDPTldkContext *s)
+{
+    struct rte_mbuf *m;
 
-        p = s->tmp;
-        while (len) {
-            int ret;
-            av_assert0(len > 0);
-            if (!s->is_connected) {
-                ret = sendto (s->udp_fd, p, len, 0,
-                            (struct sockaddr *) &s->dest_addr,
-                            s->dest_addr_len);
-            } else
-                ret = send(s->udp_fd, p, len, 0);
-            if (ret >= 0) {
-                len -= ret;
-                p   += ret;
-            } else {
-                ret = ff_neterrno();
-                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR)) {
-                    pthread_mutex_lock(&s->mutex);
-                    s->circular_buffer_error = ret;
-                    pthread_mutex_unlock(&s->mutex);
-                    return NULL;
-                }
-            }
-        }
+    if (!s->ring)
+        return;
 
-        pthread_mutex_lock(&s->mutex);
+    if (s->is_output) {
+        LIST_REMOVE(s, link);
+        while (udp_ring_service(s) != 0)
+            ;
+    } else {
+        s->tldk_udp_stream->rx_cb = NULL;
+        s->tldk_udp_stream->udata = NULL;
     }
-
-end:
-    pthread_mutex_unlock(&s->mutex);
-    return NULL;
+    while (rte_ring_sc_dequeue(s->ring, (void **)&m) == 0)
+        rte_pktmbuf_free(m);
+    if (s->ring_drops)
+        av_log(NULL, AV_LOG_WARNING, "%s: dropped %"PRIu64" datagrams\n", __func__, s->ring_drops);
+    rte_ring_free(s->ring);
+    s->ring = NULL;
 }
 
 
-#endif
-
 /* put it in UDP context */
 /* return non zero if error */
 static int udp_open(URLContext *h, const char *uri, int flags)
@@ -530,7 +339,7 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     int is_output;
     const char *p;
     char buf[256];
-    struct sockaddr_storage my_addr;
+    struct sockaddr_storage my_addr, group;
     socklen_t len;
     int ret;
 
@@ -538,6 +347,7 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     h->is_streamed = 1;
 
     is_output = !(flags & AVIO_FLAG_READ);
+    s->is_output = is_output;
     if (s->buffer_size < 0)
         s->buffer_size = is_output ? UDP_TX_BUF_SIZE : UDP_RX_BUF_SIZE;
 
@@ -566,10 +376,6 @@ static int udp_open(URLContext *h, const char *uri, int flags)
             /* assume if no digits were found it is a request to enable it */
             if (buf == endptr)
                 s->overrun_nonfatal = 1;
-            if (!HAVE_PTHREAD_CANCEL)
-                av_log(h, AV_LOG_WARNING,
-                       "'overrun_nonfatal' option was set but it is not supported "
-                       "on this build (pthread support is required)\n");
         }
         if (av_find_info_tag(buf, sizeof(buf), "ttl", p)) {
             s->ttl = strtol(buf, NULL, 10);
@@ -591,17 +397,9 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         }
         if (av_find_info_tag(buf, sizeof(buf), "fifo_size", p)) {
             s->circular_buffer_size = strtol(buf, NULL, 10);
-            if (!HAVE_PTHREAD_CANCEL)
-                av_log(h, AV_LOG_WARNING,
-                       "'circular_buffer_size' option was set but it is not supported "
-                       "on this build (pthread support is required)\n");
         }
         if (av_find_info_tag(buf, sizeof(buf), "bitrate", p)) {
             s->bitrate = strtoll(buf, NULL, 10);
-            if (!HAVE_PTHREAD_CANCEL)
-                av_log(h, AV_LOG_WARNING,
-                       "'bitrate' option was set but it is not supported "
-                       "on this build (pthread support is required)\n");
         }
         if (av_find_info_tag(buf, sizeof(buf), "burst_bits", p)) {
             s->burst_bits = strtoll(buf, NULL, 10);
@@ -622,8 +420,6 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         if (is_output && av_find_info_tag(buf, sizeof(buf), "broadcast", p))
             s->is_broadcast = strtol(buf, NULL, 10);
     }
-    /* handling needed to support options picking from both AVOption and URL */
-    s->circular_buffer_size *= 188;
     if (flags & AVIO_FLAG_WRITE) {
         h->max_packet_size = s->pkt_size;
     } else {
@@ -655,7 +451,13 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     struct sockaddr_in *_addr = (struct sockaddr_in*)&s->local_addr_storage;
     _addr->sin_family = AF_INET;
     _addr->sin_addr.s_addr = INADDR_ANY;
-    _addr->sin_port = 0;
+    _addr->sin_port = is_output ? 0 : htons(s->local_port);
+    // The group is joined on the BE once the stream is bound to its port.
+    if (!is_output && s->is_multicast)
+        group = s->dest_addr;
+    // Input takes datagrams from any source unless asked to connect.
+    if (!is_output && (!s->is_connected || !s->dest_addr_len))
+        nspk_tldk_sockaddr_fill(&s->dest_addr, NULL, 0);
 
     // TODO:
     ret = nspk_tldk_udp_stream_new(s);
@@ -664,11 +466,34 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         goto fail;
     }
 
-    s->local_port = 0; // TODO: Try to get it from TLDK APIs
-    print_stream_addresses(s->tldk_stream_prm);
+    if (!is_output && s->is_multicast) {
+        ret = nspk_tldk_mcast_join(&group, &s->filters);
+        if (ret < 0) {
+            av_log(h, AV_LOG_ERROR, "%s: Could not join the multicast group: %s\n",
+                   __func__, av_err2str(AVERROR(-ret)));
+            ret = AVERROR(-ret);
+            goto fail;
+        }
+        s->mcast_group = group;
+    }
+
+    // Input is bound to local_port, output to an ephemeral port.
+    if (is_output)
+        s->local_port = 0; // TODO: Try to get it from TLDK APIs
+    print_stream_addresses(&s->tldk_stream_prm);
 
     av_log(h, AV_LOG_DEBUG, "%s: TLDK UDP stream opened.\n", __func__);
 
+    // The lcore paces the stream, see nspk_pacer_lcore_run().
+    if (is_output && s->bitrate) {
+        s->pacer = av_malloc(sizeof(*s->pacer));
+        if (!s->pacer) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        nspk_pacer_init(s->pacer, s->tldk_udp_stream, s->bitrate / 8, s->burst_bits / 8);
+    }
+
     /* Follow the requested reuse option, unless it's multicast in which
      * case enable reuse unless explicitly disabled.
      */
@@ -700,136 +525,140 @@ static int udp_open(URLContext *h, const char *uri, int flags)
 
     s->udp_fd = -2;
 
-#if HAVE_PTHREAD_CANCEL
-    /*
-      Create thread in case of:
-      1. Input and circular_buffer_size is set
-      2. Output and bitrate and circular_buffer_size is set
-    */
-
-    // if (is_output && s->bitrate && !s->circular_buffer_size) {
-    //     /* Warn user in case of 'circular_buffer_size' is not set */
-    //     av_log(h, AV_LOG_WARNING,"'bitrate' option was set but 'circular_buffer_size' is not, but required\n");
-    // }
-
-    if ((!is_output && s->circular_buffer_size) || (is_output && s->bitrate && s->circular_buffer_size)) {
-        /* start the task going */
-        s->fifo = av_fifo_alloc(s->circular_buffer_size);
-        if (!s->fifo) {
-            ret = AVERROR(ENOMEM);
-            goto fail;
-        }
-        ret = pthread_mutex_init(&s->mutex, NULL);
-        if (ret != 0) {
-            av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
-            ret = AVERROR(ret);
+    // Input always goes through the ring, output only if fifo_size is set.
+    if (!is_output || s->circular_buffer_size) {
+        if ((ret = udp_ring_open(h, s)) < 0)
             goto fail;
-        }
-        ret = pthread_cond_init(&s->cond, NULL);
-        if (ret != 0) {
-            av_log(h, AV_LOG_ERROR, "pthread_cond_init failed : %s\n", strerror(ret));
-            ret = AVERROR(ret);
-            goto cond_fail;
-        }
-        ret = pthread_create(&s->circular_buffer_thread, NULL, is_output?circular_buffer_task_tx:circular_buffer_task_rx, h);
-        if (ret != 0) {
-            av_log(h, AV_LOG_ERROR, "pthread_create failed : %s\n", strerror(ret));
-            ret = AVERROR(ret);
-            goto thread_fail;
-        }
-        s->thread_started = 1;
     }
-#endif
 
     return 0;
-#if HAVE_PTHREAD_CANCEL
- thread_fail:
-    pthread_cond_destroy(&s->cond);
- cond_fail:
-    pthread_mutex_destroy(&s->mutex);
-#endif
  fail:
-    av_fifo_freep(&s->fifo);
+    if (s->mcast_group.ss_family) {
+        nspk_tldk_mcast_leave(&s->mcast_group);
+        s->mcast_group.ss_family = 0;
+    }
+    if (s->pacer) {
+        nspk_pacer_fini(s->pacer);
+        av_freep(&s->pacer);
+    }
+    nspk_tldk_udp_stream_delete(s);
     ff_ip_reset_filters(&s->filters);
     return ret;
 }
 
-static int udp_read(URLContext *h, uint8_t *buf, int size)
+/**
+ * Dequeue the next datagram which passes the source filters.
+ */
+static int udp_dequeue(URLContext *h, UDPTldkContext *s, struct rte_mbuf **pm)
 {
-    return 0;
-    UDPTldkContext *s = h->priv_data;
+    int nonblock = h->flags & AVIO_FLAG_NONBLOCK;
+    int64_t deadline = 0;
+    struct rte_mbuf *m;
     int ret;
-    struct sockaddr_storage addr;
-    socklen_t addr_len = sizeof(addr);
-#if HAVE_PTHREAD_CANCEL
-    int avail, nonblock = h->flags & AVIO_FLAG_NONBLOCK;
-
-    if (s->fifo) {
-        pthread_mutex_lock(&s->mutex);
-        do {
-            avail = av_fifo_size(s->fifo);
-            if (avail) { // >=size) {
-                uint8_t tmp[4];
-
-                av_fifo_generic_read(s->fifo, tmp, 4, NULL);
-                avail = AV_RL32(tmp);
-                if(avail > size){
-                    av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
-                    avail = size;
-                }
 
-                av_fifo_generic_read(s->fifo, buf, avail, NULL);
-                av_fifo_drain(s->fifo, AV_RL32(tmp) - avail);
-                pthread_mutex_unlock(&s->mutex);
-                return avail;
-            } else if(s->circular_buffer_error){
-                int err = s->circular_buffer_error;
-                pthread_mutex_unlock(&s->mutex);
-                return err;
-            } else if(nonblock) {
-                pthread_mutex_unlock(&s->mutex);
-                return AVERROR(EAGAIN);
-            } else {
-                /* FIXME: using the monotonic clock would be better,
-                   but it does not exist on all supported platforms. */
-                int64_t t = av_gettime() + 100000;
-                struct timespec tv = { .tv_sec  =  t / 1000000,
-                                       .tv_nsec = (t % 1000000) * 1000 };
-                int err = pthread_cond_timedwait(&s->cond, &s->mutex, &tv);
-                if (err) {
-                    pthread_mutex_unlock(&s->mutex);
-                    return AVERROR(err == ETIMEDOUT ? EAGAIN : err);
-                }
-                nonblock = 1;
+    if (!s->ring)
+        return AVERROR(ENOSYS);
+
+    for (;;) {
+        if (rte_ring_sc_dequeue(s->ring, (void **)&m) == 0) {
+            udp_src_addr(m, &s->last_source);
+            if (!ff_ip_check_source_lists(&s->last_source, &s->filters)) {
+                *pm = m;
+                return 0;
             }
-        } while(1);
+            rte_pktmbuf_free(m);
+            continue;
+        }
+        // The lcore owning the stream can not wait for itself.
+        if (rte_lcore_id() == s->lcore) {
+            netbe_lcore();
+            if (udp_ring_service(s) != 0)
+                continue;
+        }
+
+        ret = __atomic_load_n(&s->circular_buffer_error, __ATOMIC_ACQUIRE);
+        if (ret < 0)
+            return ret;
+        if (nonblock)
+            return AVERROR(EAGAIN);
+        if (ff_check_interrupt(&h->interrupt_callback))
+            return AVERROR_EXIT;
+        if (s->timeout > 0) {
+            if (!deadline)
+                deadline = av_gettime_relative() + s->timeout;
+            else if (av_gettime_relative() > deadline)
+                return AVERROR(ETIMEDOUT);
+        }
+        rte_pause();
     }
-#endif
+}
 
-    // if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
-    //     ret = ff_network_wait_fd(s->udp_fd, 0);
-    //     if (ret < 0)
-    //         return ret;
-    // }
-    // ret = recvfrom(s->udp_fd, buf, size, 0, (struct sockaddr *)&addr, &addr_len);
-    // if (ret < 0)
-    //     return ff_neterrno();
-
-    // TLDK receive
-    netbe_lcore();
-    int n = s->tldk_udp_stream->pbuf.num;
-    int k = RTE_DIM(s->tldk_udp_stream->pbuf.pkt) - n;
-    // n = netfe_rx_process(rte_lcore_id(), s->tldk_udp_stream);
-	n = tle_stream_recv(s->tldk_udp_stream->s, s->tldk_udp_stream->pbuf.pkt + n, k);
-    av_log(NULL, AV_LOG_DEBUG, "%s: Received %u bytes\n", __func__, n);
-	if (n == 0)
-        return AVERROR(ENODATA);
-    for (int i = 0; i < n; i++) {
-        struct rte_mbuf *pkt_data = s->tldk_udp_stream->pbuf.pkt[i];
-        memcpy(buf, rte_pktmbuf_mtod(pkt_data, void*), rte_pktmbuf_data_len(pkt_data));
+static void udp_buffer_free(void *opaque, uint8_t *data)
+{
+    rte_pktmbuf_free(opaque);
+}
+
+int nspk_udp_read_mbuf(URLContext *h, struct rte_mbuf **pm)
+{
+    int ret;
+
+    if ((ret = udp_dequeue(h, h->priv_data, pm)) < 0)
+        return ret;
+    return (*pm)->pkt_len;
+}
+
+AVBufferRef *nspk_udp_mbuf_to_buffer(struct rte_mbuf *m)
+{
+    AVBufferRef *buf;
+    int len = m->pkt_len;
+
+    // Only datagrams reassembled from IP fragments are chained.
+    if (!rte_pktmbuf_is_contiguous(m)) {
+        buf = av_buffer_alloc(len);
+        if (buf)
+            rte_pktmbuf_read(m, 0, len, buf->data);
+        rte_pktmbuf_free(m);
+        return buf;
     }
-    if (ff_ip_check_source_lists(&addr, &s->filters))
-        return AVERROR(EINTR);
+
+    buf = av_buffer_create(rte_pktmbuf_mtod(m, uint8_t *), len,
+                           udp_buffer_free, m, AV_BUFFER_FLAG_READONLY);
+    if (!buf)
+        rte_pktmbuf_free(m);
+    return buf;
+}
+
+int nspk_udp_read_buffer(URLContext *h, AVBufferRef **pbuf)
+{
+    struct rte_mbuf *m;
+    int ret;
+
+    if ((ret = nspk_udp_read_mbuf(h, &m)) < 0)
+        return ret;
+
+    *pbuf = nspk_udp_mbuf_to_buffer(m);
+    return *pbuf ? ret : AVERROR(ENOMEM);
+}
+
+static int udp_read(URLContext *h, uint8_t *buf, int size)
+{
+    UDPTldkContext *s = h->priv_data;
+    struct rte_mbuf *m;
+    const void *data;
+    int ret;
+
+    if ((ret = udp_dequeue(h, s, &m)) < 0)
+        return ret;
+
+    ret = m->pkt_len;
+    if (ret > size) {
+        av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
+        ret = size;
+    }
+    data = rte_pktmbuf_read(m, 0, ret, buf);
+    if (data != buf)
+        memcpy(buf, data, ret);
+    rte_pktmbuf_free(m);
     return ret;
 }
 
@@ -838,35 +667,47 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
     UDPTldkContext *s = h->priv_data;
     int ret;
 
-#if HAVE_PTHREAD_CANCEL
-    if (s->fifo) {
-        uint8_t tmp[4];
+    if (s->ring) {
+        struct rte_mbuf *m;
 
-        pthread_mutex_lock(&s->mutex);
+        ret = __atomic_load_n(&s->circular_buffer_error, __ATOMIC_ACQUIRE);
+        if (ret < 0)
+            return ret;
 
-        /*
-          Return error if last tx failed.
-          Here we can't know on which packet error was, but it needs to know that error exists.
-        */
-        if (s->circular_buffer_error<0) {
-            int err = s->circular_buffer_error;
-            pthread_mutex_unlock(&s->mutex);
-            return err;
+        // Any thread may write, the lcore magazines are not used here.
+        m = rte_pktmbuf_alloc(s->tldk_udp_stream->mag.mp);
+        if (!m)
+            return AVERROR(ENOMEM);
+        m->data_off = NSPK_MBUF_TX_HEADROOM;
+        if (size > rte_pktmbuf_tailroom(m)) {
+            rte_pktmbuf_free(m);
+            return AVERROR(EINVAL);
         }
-
-        if(av_fifo_space(s->fifo) < size + 4) {
-            /* What about a partial packet tx ? */
-            pthread_mutex_unlock(&s->mutex);
+        memcpy(rte_pktmbuf_mtod(m, uint8_t *), buf, size);
+        m->data_len = size;
+        m->pkt_len = size;
+        if (rte_ring_sp_enqueue(s->ring, m) != 0) {
+            rte_pktmbuf_free(m);
             return AVERROR(ENOMEM);
         }
-        AV_WL32(tmp, size);
-        av_fifo_generic_write(s->fifo, tmp, 4, NULL); /* size of packet */
-        av_fifo_generic_write(s->fifo, (uint8_t *)buf, size, NULL); /* the data */
-        pthread_cond_signal(&s->cond);
-        pthread_mutex_unlock(&s->mutex);
         return size;
     }
-#endif
+    if (s->pacer) {
+        struct pkt_mag *mg = &s->tldk_udp_stream->mag;
+        struct rte_mbuf *m = pkt_mag_get(mg);
+
+        if (!m)
+            return AVERROR(ENOMEM);
+        if (size > rte_pktmbuf_tailroom(m)) {
+            pkt_mag_put(mg, m);
+            return AVERROR(EINVAL);
+        }
+        memcpy(rte_pktmbuf_mtod(m, uint8_t *), buf, size);
+        m->data_len = size;
+        m->pkt_len = size;
+        return nspk_pacer_enqueue(s->pacer, m);
+    }
+
     // if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
     //     av_log(h, AV_LOG_WARNING, "%s: Non-blocking socket not implemented for TLDK.\n", __func__);
     // }
@@ -891,47 +732,19 @@ static int udp_close(URLContext *h)
 
     UDPTldkContext *s = h->priv_data;
 
-#if HAVE_PTHREAD_CANCEL
-    // Request close once writing is finished
-    if (s->thread_started && !(h->flags & AVIO_FLAG_READ)) {
-        pthread_mutex_lock(&s->mutex);
-        s->close_req = 1;
-        pthread_cond_signal(&s->cond);
-        pthread_mutex_unlock(&s->mutex);
-    }
-#endif
-
-    if (s->is_multicast && (h->flags & AVIO_FLAG_READ))
-        udp_leave_multicast_group(s->udp_fd, (struct sockaddr *)&s->dest_addr,(struct sockaddr *)&s->local_addr_storage);
-#if HAVE_PTHREAD_CANCEL
-    if (s->thread_started) {
-        int ret;
-        // Cancel only read, as write has been signaled as success to the user
-        if (h->flags & AVIO_FLAG_READ) {
-#ifdef _WIN32
-            /* recvfrom() is not a cancellation point for win32, so we shutdown
-             * the socket and abort pending IO, subsequent recvfrom() calls
-             * will fail with WSAESHUTDOWN causing the thread to exit. */
-            shutdown(s->udp_fd, SD_RECEIVE);
-            CancelIoEx((HANDLE)(SOCKET)s->udp_fd, NULL);
-#else
-            pthread_cancel(s->circular_buffer_thread);
-#endif
-        }
-        ret = pthread_join(s->circular_buffer_thread, NULL);
-        if (ret != 0)
-            av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", strerror(ret));
-        pthread_mutex_destroy(&s->mutex);
-        pthread_cond_destroy(&s->cond);
-    }
-#endif
+    if (s->mcast_group.ss_family)
+        nspk_tldk_mcast_leave(&s->mcast_group);
+    // Written datagrams still in the ring go to the pacer or TLDK first.
+    udp_ring_close(s);
 
-    // Flush pkts.
-    netfe_tx_process_udp(rte_lcore_id(), s->tldk_udp_stream);
-    netbe_lcore();
+    if (s->pacer) {
+        nspk_pacer_flush(s->pacer);
+        nspk_pacer_fini(s->pacer);
+        av_freep(&s->pacer);
+    }
 
     // closesocket(s->udp_fd);
-    av_fifo_freep(&s->fifo);
+    nspk_tldk_udp_stream_delete(s);
     ff_ip_reset_filters(&s->filters);
     return 0;
 }
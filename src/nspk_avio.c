@@ -2,8 +2,11 @@
 #include <libavutil/avstring.h>
 #include <libavdevice/avdevice.h>
 #include <libavutil/avassert.h>
+#include <nspk.h>
 #include <nspk_avio.h>
 #include <nspk_av_rtp.h>
+#include <libavutil/parseutils.h>
+#include <libavformat/rtp.h>
 
 static int nspk_url_alloc_for_protocol(URLContext **puc, const URLProtocol *up,
                                 const char *filename, int flags,
@@ -173,3 +176,218 @@ fail:
     ffurl_close(tldk_url_ctx);
     return ret;
 }
+
+/**
+ * Opaque of an mbuf backed AVIOContext.
+ * The AVIOContext buffer always points into the data room of `m`, so the
+ * muxer serializes each RTP packet straight into the mbuf which is then
+ * handed to TLDK as is.
+ */
+struct nspk_mbuf_avio_ctx_t
+{
+    AVIOContext *pb;
+    struct rte_mempool *mp;
+    struct rte_mbuf *m;
+    struct netfe_stream *rtp_fs;
+    struct netfe_stream *rtcp_fs;
+    struct netfe_sprm rtp_sprm;
+    struct netfe_sprm rtcp_sprm;
+    int pkt_size;
+    uint64_t nomem_drops;
+    uint64_t nobufs_drops;
+};
+
+/**
+ * RTP and RTCP packets are both written before the stream is known, they
+ * take their mbufs from the magazine of the RTP stream.
+ */
+static struct rte_mbuf *nspk_mbuf_avio_alloc(struct nspk_mbuf_avio_ctx_t *mctx)
+{
+    return pkt_mag_get(&mctx->rtp_fs->mag);
+}
+
+static void nspk_mbuf_avio_set_buffer(struct nspk_mbuf_avio_ctx_t *mctx, struct rte_mbuf *m)
+{
+    AVIOContext *pb = mctx->pb;
+
+    mctx->m = m;
+    pb->buffer = rte_pktmbuf_mtod(m, uint8_t *);
+    pb->buffer_size = mctx->pkt_size;
+    pb->buf_ptr = pb->buf_ptr_max = pb->buffer;
+    pb->buf_end = pb->buffer + pb->buffer_size;
+}
+
+/**
+ * AVIOContext write callback. @buf is the data room of mctx->m and holds
+ * exactly one RTP or RTCP packet since the muxer flushes per packet.
+ * A fresh mbuf is swapped in before the filled one is handed to TLDK.
+ * Packets that can not be sent are dropped and accounted, never reported
+ * to the muxer, so one short burst does not tear down the session.
+ */
+static int nspk_mbuf_avio_write(void *opaque, uint8_t *buf, int buf_size)
+{
+    struct nspk_mbuf_avio_ctx_t *mctx = opaque;
+    struct rte_mbuf *m = mctx->m;
+    struct rte_mbuf *next;
+    struct netfe_stream *fs;
+
+    av_assert1(buf == rte_pktmbuf_mtod(m, uint8_t *));
+    if (buf_size < 2 || buf_size > mctx->pkt_size)
+        return AVERROR(EINVAL);
+
+    next = nspk_mbuf_avio_alloc(mctx);
+    if (!next) {
+        mctx->nomem_drops++;
+        return buf_size;
+    }
+
+    m->data_len = buf_size;
+    m->pkt_len = buf_size;
+    fs = RTP_PT_IS_RTCP(buf[1]) ? mctx->rtcp_fs : mctx->rtp_fs;
+    if (nspk_tldk_udp_stream_send_mbuf(fs, m) < 0) {
+        // Keep writing into the current mbuf.
+        pkt_mag_put(&mctx->rtp_fs->mag, next);
+        mctx->nobufs_drops++;
+        return buf_size;
+    }
+
+    nspk_mbuf_avio_set_buffer(mctx, next);
+    return buf_size;
+}
+
+int nspk_rtp_url_parse(const char *url, struct netfe_sprm *rtp_sprm,
+                       struct netfe_sprm *rtcp_sprm, int *pkt_size)
+{
+    char hostname[256], path[1024], buf[1024];
+    const char *p;
+    int port, rtcp_port, local_port = 0, local_rtcp_port = 0;
+    int ret;
+
+    av_url_split(NULL, 0, NULL, 0, hostname, sizeof(hostname), &port,
+                 path, sizeof(path), url);
+    if (port <= 0)
+        return AVERROR(EINVAL);
+    rtcp_port = port + 1;
+
+    p = strchr(url, '?');
+    if (p) {
+        if (av_find_info_tag(buf, sizeof(buf), "rtcpport", p))
+            rtcp_port = strtol(buf, NULL, 10);
+        if (pkt_size && av_find_info_tag(buf, sizeof(buf), "pkt_size", p))
+            *pkt_size = strtol(buf, NULL, 10);
+        if (av_find_info_tag(buf, sizeof(buf), "localport", p))
+            local_port = strtol(buf, NULL, 10);
+        if (av_find_info_tag(buf, sizeof(buf), "localrtcpport", p))
+            local_rtcp_port = strtol(buf, NULL, 10);
+    }
+
+    memset(rtp_sprm, 0, sizeof(*rtp_sprm));
+    if ((ret = nspk_tldk_sockaddr_fill(&rtp_sprm->remote_addr, hostname, port)) < 0)
+        return AVERROR(-ret);
+    // Wildcard local address with an ephemeral port, as udp_open() does.
+    rtp_sprm->local_addr.ss_family = rtp_sprm->remote_addr.ss_family;
+    nspk_tldk_sockaddr_set_port(&rtp_sprm->local_addr, local_port);
+
+    if (rtcp_sprm) {
+        memset(rtcp_sprm, 0, sizeof(*rtcp_sprm));
+        if ((ret = nspk_tldk_sockaddr_fill(&rtcp_sprm->remote_addr, hostname, rtcp_port)) < 0)
+            return AVERROR(-ret);
+        rtcp_sprm->local_addr.ss_family = rtcp_sprm->remote_addr.ss_family;
+        nspk_tldk_sockaddr_set_port(&rtcp_sprm->local_addr, local_rtcp_port);
+    }
+
+    return 0;
+}
+
+int nspk_avio_open_mbuf(struct nspk_rtp_session_ctx_t *rtp_sess, AVIOContext **s, const char *filename)
+{
+    struct nspk_mbuf_avio_ctx_t *mctx;
+    struct rte_mbuf *m;
+    int max_size;
+    int ret;
+
+    if (!rtp_sess || !s || !filename)
+        return AVERROR(EINVAL);
+
+    mctx = av_mallocz(sizeof(*mctx));
+    if (!mctx)
+        return AVERROR(ENOMEM);
+
+    mctx->mp = mpool[rte_lcore_to_socket_id(rte_lcore_id()) + 1];
+    mctx->pkt_size = NSPK_RTP_DEFAULT_PKT_SIZE;
+
+    ret = nspk_rtp_url_parse(filename, &mctx->rtp_sprm, &mctx->rtcp_sprm, &mctx->pkt_size);
+    if (ret < 0)
+        goto fail;
+
+    max_size = rte_pktmbuf_data_room_size(mctx->mp) - NSPK_MBUF_TX_HEADROOM;
+    if (mctx->pkt_size > max_size) {
+        av_log(NULL, AV_LOG_WARNING, "%s: pkt_size %d exceeds mbuf data room, using %d\n",
+               __func__, mctx->pkt_size, max_size);
+        mctx->pkt_size = max_size;
+    }
+
+    mctx->rtp_fs = nspk_tldk_udp_stream_open(rtp_sess->lcore_prm, &mctx->rtp_sprm, TXONLY);
+    if (!mctx->rtp_fs) {
+        ret = AVERROR(rte_errno);
+        goto fail;
+    }
+    mctx->rtcp_fs = nspk_tldk_udp_stream_open(rtp_sess->lcore_prm, &mctx->rtcp_sprm, TXONLY);
+    if (!mctx->rtcp_fs) {
+        ret = AVERROR(rte_errno);
+        goto fail;
+    }
+
+    m = nspk_mbuf_avio_alloc(mctx);
+    if (!m) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    mctx->pb = avio_alloc_context(rte_pktmbuf_mtod(m, uint8_t *), mctx->pkt_size, 1,
+                                  mctx, NULL, nspk_mbuf_avio_write, NULL);
+    if (!mctx->pb) {
+        pkt_mag_put(&mctx->rtp_fs->mag, m);
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    nspk_mbuf_avio_set_buffer(mctx, m);
+    mctx->pb->max_packet_size = mctx->pkt_size;
+    mctx->pb->seekable = 0;
+
+    av_log(NULL, AV_LOG_DEBUG, "%s: %s opened, pkt_size=%d, headroom=%u\n",
+           __func__, filename, mctx->pkt_size, (unsigned)NSPK_MBUF_TX_HEADROOM);
+    *s = mctx->pb;
+    return 0;
+fail:
+    // Streams opened so far go back to the lcore, each failure path leaks nothing.
+    av_log(NULL, AV_LOG_ERROR, "%s: Could not open '%s', ret=%d\n", __func__, filename, ret);
+    nspk_tldk_udp_stream_close(mctx->rtcp_fs);
+    nspk_tldk_udp_stream_close(mctx->rtp_fs);
+    av_free(mctx);
+    *s = NULL;
+    return ret;
+}
+
+void nspk_avio_close_mbuf(AVIOContext **s)
+{
+    struct nspk_mbuf_avio_ctx_t *mctx;
+
+    if (!s || !*s)
+        return;
+
+    mctx = (*s)->opaque;
+    avio_flush(*s);
+    nspk_tldk_udp_stream_close(mctx->rtp_fs);
+    nspk_tldk_udp_stream_close(mctx->rtcp_fs);
+
+    if (mctx->nomem_drops || mctx->nobufs_drops)
+        av_log(NULL, AV_LOG_WARNING, "%s: dropped %"PRIu64" packets on mbuf alloc, "
+               "%"PRIu64" on full TX queue\n", __func__, mctx->nomem_drops, mctx->nobufs_drops);
+
+    // The buffer belongs to the mbuf, avio must not free it.
+    rte_pktmbuf_free(mctx->m);
+    (*s)->buffer = NULL;
+    av_free(mctx);
+    avio_context_free(s);
+}
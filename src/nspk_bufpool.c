@@ -0,0 +1,341 @@
+/**
+ * NSPK codec buffer pools.
+ * Frame and packet data of the codecs in rte_malloc() memory on the NUMA
+ * node of the session's lcore, recycled through AVBufferPools instead of
+ * going through malloc() and page faults for every frame. Packet buffers
+ * are also mbuf external buffer memory, see struct nspk_bufpool_ext_t.
+ */
+
+#include <rte_malloc.h>
+#include <rte_memory.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/internal.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+
+#include <nspk.h>
+#include <nspk_bufpool.h>
+
+/* Alignment of the planes, for the widest SIMD the codecs use. */
+#define BUFPOOL_ALIGN   64
+
+/* Tells the packet buffers with an extbuf header from any other DPDK memory. */
+#define BUFPOOL_EXT_MAGIC   UINT64_C(0x6e73706b65787462)
+
+static void bufpool_rte_free(void *opaque, uint8_t *data)
+{
+    rte_free(data);
+}
+
+/**
+ * Allocator of the AVBufferPools, the node travels in opaque so the pools
+ * do not depend on struct nspk_bufpool_t outliving them.
+ */
+static AVBufferRef *bufpool_alloc(void *opaque, int size)
+{
+    AVBufferRef *buf;
+    uint8_t *data;
+
+    data = rte_malloc_socket("nspk_bufpool", size, BUFPOOL_ALIGN, (int)(intptr_t)opaque);
+    if (!data)
+        return NULL;
+    buf = av_buffer_create(data, size, bufpool_rte_free, NULL, 0);
+    if (!buf)
+        rte_free(data);
+    return buf;
+}
+
+static AVBufferPool *bufpool_init(struct nspk_bufpool_t *pool, int size)
+{
+    return av_buffer_pool_init2(size, (void *)(intptr_t)pool->socket, bufpool_alloc, NULL);
+}
+
+/**
+ * The last mbuf attached to a packet buffer was freed, wherever the NIC or
+ * TLDK let go of it.
+ */
+static void bufpool_ext_free_cb(void *addr, void *opaque)
+{
+    struct nspk_bufpool_ext_t *ext = opaque;
+    AVBufferRef *ref = ext->ref;
+
+    RTE_SET_USED(addr);
+    // The buffer may be handed out again as soon as it is unreferenced.
+    ext->ref = NULL;
+    av_buffer_unref(&ref);
+}
+
+static void bufpool_ext_rte_free(void *opaque, uint8_t *data)
+{
+    RTE_SET_USED(data);
+    rte_free(opaque);
+}
+
+/**
+ * Allocator of the packet pools: the data follows a struct nspk_bufpool_ext_t.
+ */
+static AVBufferRef *bufpool_ext_alloc(void *opaque, int size)
+{
+    struct nspk_bufpool_ext_t *ext;
+    AVBufferRef *buf;
+
+    ext = rte_malloc_socket("nspk_bufpool_pkt", sizeof(*ext) + size, BUFPOOL_ALIGN,
+                            (int)(intptr_t)opaque);
+    if (!ext)
+        return NULL;
+    ext->shinfo.free_cb = bufpool_ext_free_cb;
+    ext->shinfo.fcb_opaque = ext;
+    rte_mbuf_ext_refcnt_set(&ext->shinfo, 0);
+    ext->ref = NULL;
+    ext->magic = BUFPOOL_EXT_MAGIC;
+    buf = av_buffer_create((uint8_t *)(ext + 1), size, bufpool_ext_rte_free, ext, 0);
+    if (!buf)
+        rte_free(ext);
+    return buf;
+}
+
+struct nspk_bufpool_ext_t *nspk_bufpool_ext(const AVPacket *pkt)
+{
+    struct nspk_bufpool_ext_t *ext;
+
+    // Heap memory has nothing readable to rely on in front of it.
+    if (!pkt->buf || !rte_mem_virt2memseg(pkt->buf->data, NULL))
+        return NULL;
+    ext = (struct nspk_bufpool_ext_t *)pkt->buf->data - 1;
+    return ext->magic == BUFPOOL_EXT_MAGIC ? ext : NULL;
+}
+
+int nspk_bufpool_ext_hold(struct nspk_bufpool_ext_t *ext, const AVPacket *pkt)
+{
+    // Mbufs of the previous packet in this buffer are all gone, or it would not have been reused.
+    if (!ext->ref && !(ext->ref = av_buffer_ref(pkt->buf)))
+        return AVERROR(ENOMEM);
+    rte_mbuf_ext_refcnt_update(&ext->shinfo, 1);
+    return 0;
+}
+
+void nspk_bufpool_ext_release(struct nspk_bufpool_ext_t *ext)
+{
+    if (rte_mbuf_ext_refcnt_update(&ext->shinfo, -1) == 0)
+        bufpool_ext_free_cb(NULL, ext);
+}
+
+static void frame_pools_uninit(struct nspk_bufpool_t *pool)
+{
+    int i;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(pool->pools); i++)
+        av_buffer_pool_uninit(&pool->pools[i]);
+    pool->format = -1;
+}
+
+/**
+ * Pools for the planes of frame, the layout avcodec_default_get_buffer2()
+ * would give it.
+ */
+static int frame_pools_update(struct nspk_bufpool_t *pool, AVCodecContext *avctx, const AVFrame *frame)
+{
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    uint8_t *data[4];
+    int size[4] = { 0 };
+    int i, w, h, tmpsize, unaligned, ret;
+
+    if (avctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        if (pool->format == frame->format && pool->width == frame->width &&
+            pool->height == frame->height)
+            return 0;
+        frame_pools_uninit(pool);
+
+        w = frame->width;
+        h = frame->height;
+        avcodec_align_dimensions2(avctx, &w, &h, linesize_align);
+        do {
+            // Widen the picture rather than align the linesizes one by one, the chroma
+            // linesizes must stay a fraction of the luma one.
+            if ((ret = av_image_fill_linesizes(pool->linesize, frame->format, w)) < 0)
+                return ret;
+            w += w & ~(w - 1);
+            unaligned = 0;
+            for (i = 0; i < 4; i++)
+                unaligned |= pool->linesize[i] % linesize_align[i];
+        } while (unaligned);
+
+        tmpsize = av_image_fill_pointers(data, frame->format, h, NULL, pool->linesize);
+        if (tmpsize < 0)
+            return tmpsize;
+        for (i = 0; i < 3 && data[i + 1]; i++)
+            size[i] = data[i + 1] - data[i];
+        size[i] = tmpsize - (data[i] - data[0]);
+
+        for (i = 0; i < 4; i++) {
+            if (!size[i])
+                continue;
+            pool->pools[i] = bufpool_init(pool, size[i] + 16 + BUFPOOL_ALIGN - 1);
+            if (!pool->pools[i])
+                goto fail;
+        }
+        pool->width = frame->width;
+        pool->height = frame->height;
+    } else {
+        if (pool->format == frame->format && pool->channels == frame->channels &&
+            pool->nb_samples == frame->nb_samples)
+            return 0;
+        frame_pools_uninit(pool);
+
+        pool->planes = av_sample_fmt_is_planar(frame->format) ? frame->channels : 1;
+        ret = av_samples_get_buffer_size(&pool->linesize[0], frame->channels, frame->nb_samples,
+                                         frame->format, 0);
+        if (ret < 0)
+            return ret;
+        pool->pools[0] = bufpool_init(pool, pool->linesize[0]);
+        if (!pool->pools[0])
+            goto fail;
+        pool->channels = frame->channels;
+        pool->nb_samples = frame->nb_samples;
+    }
+    pool->format = frame->format;
+    return 0;
+
+fail:
+    frame_pools_uninit(pool);
+    return AVERROR(ENOMEM);
+}
+
+static int frame_get(struct nspk_bufpool_t *pool, AVCodecContext *avctx, AVFrame *frame)
+{
+    int i, ret;
+
+    if ((ret = frame_pools_update(pool, avctx, frame)) < 0)
+        return ret;
+
+    if (avctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        for (i = 0; i < 4 && pool->pools[i]; i++) {
+            frame->linesize[i] = pool->linesize[i];
+            if (!(frame->buf[i] = av_buffer_pool_get(pool->pools[i])))
+                goto fail;
+            frame->data[i] = frame->buf[i]->data;
+        }
+        for (; i < AV_NUM_DATA_POINTERS; i++) {
+            frame->data[i] = NULL;
+            frame->linesize[i] = 0;
+        }
+    } else {
+        for (i = 0; i < pool->planes; i++) {
+            if (!(frame->buf[i] = av_buffer_pool_get(pool->pools[0])))
+                goto fail;
+            frame->data[i] = frame->buf[i]->data;
+        }
+        frame->extended_data = frame->data;
+        frame->linesize[0] = pool->linesize[0];
+    }
+    return 0;
+
+fail:
+    for (i = 0; i < AV_NUM_DATA_POINTERS; i++)
+        av_buffer_unref(&frame->buf[i]);
+    return AVERROR(ENOMEM);
+}
+
+static int bufpool_get_buffer2(AVCodecContext *avctx, AVFrame *frame, int flags)
+{
+    struct nspk_bufpool_t *pool = avctx->opaque;
+    const AVPixFmtDescriptor *desc;
+    int ret;
+
+    // Hardware frames, palettes and more channels than data pointers keep the default layout.
+    if (avctx->hw_frames_ctx)
+        return avcodec_default_get_buffer2(avctx, frame, flags);
+    if (avctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        desc = av_pix_fmt_desc_get(frame->format);
+        if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL)))
+            return avcodec_default_get_buffer2(avctx, frame, flags);
+    } else if (frame->channels > AV_NUM_DATA_POINTERS) {
+        return avcodec_default_get_buffer2(avctx, frame, flags);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    ret = frame_get(pool, avctx, frame);
+    if (ret < 0)
+        pool->fallbacks++;
+    else
+        pool->gets++;
+    pthread_mutex_unlock(&pool->lock);
+
+    // Out of hugepages: the frame is still decoded, from the heap.
+    if (ret < 0)
+        return avcodec_default_get_buffer2(avctx, frame, flags);
+    return 0;
+}
+
+static int bufpool_get_encode_buffer(AVCodecContext *avctx, AVPacket *pkt, int flags)
+{
+    struct nspk_bufpool_t *pool = avctx->opaque;
+    int64_t size = (int64_t)pkt->size + AV_INPUT_BUFFER_PADDING_SIZE;
+    AVBufferPool **p;
+    int k = 0;
+
+    while (k < NSPK_BUFPOOL_PKT_CLASSES && size > (1 << (NSPK_BUFPOOL_PKT_MIN_SHIFT + k)))
+        k++;
+    if (k == NSPK_BUFPOOL_PKT_CLASSES)
+        return avcodec_default_get_encode_buffer(avctx, pkt, flags);
+
+    p = &pool->pkt_pools[k];
+    pthread_mutex_lock(&pool->lock);
+    if (!*p)
+        *p = av_buffer_pool_init2(1 << (NSPK_BUFPOOL_PKT_MIN_SHIFT + k), (void *)(intptr_t)pool->socket,
+                                  bufpool_ext_alloc, NULL);
+    pkt->buf = *p ? av_buffer_pool_get(*p) : NULL;
+    if (pkt->buf)
+        pool->gets++;
+    else
+        pool->fallbacks++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!pkt->buf)
+        return avcodec_default_get_encode_buffer(avctx, pkt, flags);
+    pkt->data = pkt->buf->data;
+    memset(pkt->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    return 0;
+}
+
+struct nspk_bufpool_t *nspk_bufpool_attach(AVCodecContext *ctx, int socket)
+{
+    struct nspk_bufpool_t *pool;
+
+    pool = av_mallocz(sizeof(*pool));
+    if (!pool)
+        return NULL;
+    pool->socket = socket;
+    pool->format = -1;
+    pthread_mutex_init(&pool->lock, NULL);
+
+    if (!(ctx->codec->capabilities & AV_CODEC_CAP_DR1))
+        return pool;
+    ctx->opaque = pool;
+    if (av_codec_is_decoder(ctx->codec)) {
+        ctx->get_buffer2 = bufpool_get_buffer2;
+#if FF_API_THREAD_SAFE_CALLBACKS
+FF_DISABLE_DEPRECATION_WARNINGS
+        // Frame threads call it directly instead of queuing to the decoding thread.
+        ctx->thread_safe_callbacks = 1;
+FF_ENABLE_DEPRECATION_WARNINGS
+#endif
+    } else {
+        ctx->get_encode_buffer = bufpool_get_encode_buffer;
+    }
+    return pool;
+}
+
+void nspk_bufpool_free(struct nspk_bufpool_t **pool)
+{
+    struct nspk_bufpool_t *p = *pool;
+    int k;
+
+    if (!p)
+        return;
+    frame_pools_uninit(p);
+    for (k = 0; k < NSPK_BUFPOOL_PKT_CLASSES; k++)
+        av_buffer_pool_uninit(&p->pkt_pools[k]);
+    pthread_mutex_destroy(&p->lock);
+    av_freep(pool);
+}
@@ -0,0 +1,102 @@
+/**
+ * NSPK receiver driven rate control.
+ * Cuts the encoder bitrate in proportion to the loss the receivers report,
+ * or by a fixed step when their jitter grows, and probes upwards while the
+ * path is clean. Frames are skipped while the pacer queue keeps growing.
+ */
+
+#include <rte_cycles.h>
+#include <nspk.h>
+#include <nspk_cc.h>
+
+void nspk_cc_init(struct nspk_cc_t *cc, const struct nspk_rtcp_t *rtcp,
+                  const struct nspk_pacer_t *pacer, int64_t max_bps)
+{
+    memset(cc, 0, sizeof(*cc));
+    cc->rtcp = rtcp;
+    cc->pacer = pacer;
+    cc->interval = rte_get_tsc_hz() * NSPK_CC_INTERVAL_MS / MS_PER_S;
+
+    cc->max_bps = FFMAX(max_bps, NSPK_CC_MIN_BPS);
+    cc->min_bps = FFMAX(cc->max_bps / 8, NSPK_CC_MIN_BPS);
+    cc->bps = cc->max_bps;
+    cc->applied_bps = cc->max_bps;
+    __atomic_store_n(&cc->target_bps, cc->max_bps, __ATOMIC_RELAXED);
+    __atomic_store_n(&cc->hold, 0, __ATOMIC_RELAXED);
+}
+
+int nspk_cc_run(struct nspk_cc_t *cc, uint64_t now)
+{
+    const struct nspk_rtcp_report_t *rr = &cc->rtcp->rr;
+    int64_t bps = cc->bps;
+    int hold = cc->lcore_hold;
+
+    if (now < cc->next_tsc)
+        return 0;
+    cc->next_tsc = now + cc->interval;
+
+    // Each report is acted upon once.
+    if (rr->tsc != cc->rr_tsc) {
+        cc->rr_tsc = rr->tsc;
+        if (rr->fraction_lost > NSPK_CC_LOSS_HIGH)
+            bps = bps * (512 - rr->fraction_lost) / 512;
+        else if (rr->jitter_us > cc->jitter_us + NSPK_CC_JITTER_RISE_US)
+            bps = bps * 85 / 100;
+        else if (rr->fraction_lost < NSPK_CC_LOSS_LOW)
+            bps = bps * 108 / 100 + 1000;
+        cc->jitter_us = rr->jitter_us;
+    }
+
+    if (cc->pacer) {
+        if (cc->pacer->q_bytes > cc->q_bytes)
+            cc->q_growth++;
+        else
+            cc->q_growth = 0;
+        cc->q_bytes = cc->pacer->q_bytes;
+
+        hold = cc->q_growth >= NSPK_CC_QUEUE_SAMPLES;
+        // The queue outgrows the path: take the rate down with the frames.
+        if (hold && !cc->lcore_hold) {
+            bps = bps * 85 / 100;
+            cc->holds++;
+        }
+    }
+
+    bps = av_clip64(bps, cc->min_bps, cc->max_bps);
+    if (bps == cc->bps && hold == cc->lcore_hold)
+        return 0;
+
+    if (bps < cc->bps)
+        cc->decreases++;
+    else if (bps > cc->bps)
+        cc->increases++;
+    cc->bps = bps;
+    cc->lcore_hold = hold;
+    __atomic_store_n(&cc->target_bps, bps, __ATOMIC_RELAXED);
+    __atomic_store_n(&cc->hold, hold, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int nspk_cc_apply(struct nspk_cc_t *cc, AVCodecContext *enc_ctx)
+{
+    int64_t bps;
+
+    if (__atomic_load_n(&cc->hold, __ATOMIC_RELAXED)) {
+        cc->skipped++;
+        return 1;
+    }
+
+    bps = __atomic_load_n(&cc->target_bps, __ATOMIC_RELAXED);
+    if (bps == cc->applied_bps)
+        return 0;
+
+    // Encoders which support it (e.g. libx264) reconfigure on the next frame.
+    enc_ctx->bit_rate = bps;
+    if (enc_ctx->rc_max_rate) {
+        enc_ctx->rc_max_rate = bps;
+        enc_ctx->rc_buffer_size = bps * NSPK_CC_VBV_MS / 1000;
+    }
+    cc->applied_bps = bps;
+    cc->retunes++;
+    return 0;
+}
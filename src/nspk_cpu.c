@@ -0,0 +1,245 @@
+/**
+ * NSPK codec CPU planner.
+ * Keeps the threads libavcodec and the codec libraries start off the CPUs
+ * the EAL lcores busy-poll: a thread inherits the affinity of the one which
+ * creates it, so codecs opened on an lcore would otherwise share its CPU.
+ * The threads a codec starts are pinned by a pthread_create() wrapper.
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <libavutil/avstring.h>
+#include <libavutil/mem.h>
+
+#include <nspk.h>
+#include <nspk_cpu.h>
+
+#define CPU_SYSFS   "/sys/devices/system/cpu"
+#define NODE_SYSFS  "/sys/devices/system/node"
+
+static struct {
+    /* Codec CPUs of each NUMA node, and of all of them. */
+    rte_cpuset_t node[RTE_MAX_NUMA_NODES];
+    rte_cpuset_t all;
+    /* Next CPU a codec thread is pinned to, round robin over the threads of all lcores. */
+    uint32_t next;
+} plan;
+
+/* CPUs of the codec the calling thread opens, NULL outside nspk_cpu_codec_open(). */
+static RTE_DEFINE_PER_LCORE(const rte_cpuset_t *, _codec_cpus);
+
+/**
+ * Read a sysfs CPU list, e.g. "0-3,8-11".
+ */
+static int cpu_list_read(const char *path, rte_cpuset_t *cpuset)
+{
+    char buf[4096], *p, *e;
+    long first, last, cpu;
+    FILE *f;
+
+    CPU_ZERO(cpuset);
+    if (!(f = fopen(path, "r")))
+        return AVERROR(errno);
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    if (!p)
+        return AVERROR(EIO);
+
+    while (*p && *p != '\n') {
+        first = strtol(p, &e, 10);
+        if (e == p || first < 0)
+            return AVERROR_INVALIDDATA;
+        last = first;
+        if (*e == '-') {
+            p = e + 1;
+            last = strtol(p, &e, 10);
+            if (e == p || last < first)
+                return AVERROR_INVALIDDATA;
+        }
+        for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, cpuset);
+        p = e + (*e == ',');
+    }
+    return 0;
+}
+
+static const char *cpu_list_str(const rte_cpuset_t *cpuset, char *buf, size_t size)
+{
+    int cpu, first;
+
+    buf[0] = 0;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, cpuset))
+            continue;
+        for (first = cpu; cpu + 1 < CPU_SETSIZE && CPU_ISSET(cpu + 1, cpuset); cpu++)
+            ;
+        if (first == cpu)
+            av_strlcatf(buf, size, "%s%d", buf[0] ? "," : "", cpu);
+        else
+            av_strlcatf(buf, size, "%s%d-%d", buf[0] ? "," : "", first, cpu);
+    }
+    return buf[0] ? buf : "none";
+}
+
+static void cpu_set_sub(rte_cpuset_t *dst, const rte_cpuset_t *a, const rte_cpuset_t *b)
+{
+    int cpu;
+
+    CPU_ZERO(dst);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, a) && !CPU_ISSET(cpu, b))
+            CPU_SET(cpu, dst);
+}
+
+void nspk_cpu_plan_init(void)
+{
+    rte_cpuset_t online, eal, busy, cpuset;
+    char path[PATH_MAX], buf[256];
+    unsigned int lcore;
+    long cpu, nb_cpu;
+    int node;
+
+    memset(&plan, 0, sizeof(plan));
+
+    if (cpu_list_read(CPU_SYSFS "/online", &online) < 0) {
+        // No sysfs, e.g. in some containers: all the CPUs there are.
+        nb_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+        for (cpu = 0; cpu < nb_cpu && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &online);
+    }
+
+    CPU_ZERO(&eal);
+    RTE_LCORE_FOREACH(lcore) {
+        cpuset = rte_lcore_cpuset(lcore);
+        CPU_OR(&eal, &eal, &cpuset);
+    }
+    // A hyperthread sibling shares the core's execution units with the lcore polling on it.
+    busy = eal;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &eal))
+            continue;
+        snprintf(path, sizeof(path), CPU_SYSFS "/cpu%ld/topology/thread_siblings_list", cpu);
+        if (cpu_list_read(path, &cpuset) == 0)
+            CPU_OR(&busy, &busy, &cpuset);
+    }
+
+    cpu_set_sub(&plan.all, &online, &busy);
+    if (!CPU_COUNT(&plan.all)) {
+        cpu_set_sub(&plan.all, &online, &eal);
+        if (CPU_COUNT(&plan.all))
+            av_log(NULL, AV_LOG_WARNING, "Codec threads share cores with EAL lcores, "
+                   "only their hyperthread siblings are left\n");
+        else
+            av_log(NULL, AV_LOG_WARNING, "No CPU left for codec threads, "
+                   "codecs run single threaded\n");
+    }
+
+    for (node = 0; node < RTE_MAX_NUMA_NODES; node++) {
+        snprintf(path, sizeof(path), NODE_SYSFS "/node%d/cpulist", node);
+        if (cpu_list_read(path, &cpuset) < 0)
+            continue;
+        CPU_AND(&plan.node[node], &plan.all, &cpuset);
+        av_log(NULL, AV_LOG_INFO, "Codec CPUs of NUMA node %d: %s\n", node,
+               cpu_list_str(&plan.node[node], buf, sizeof(buf)));
+    }
+    av_log(NULL, AV_LOG_INFO, "EAL lcore CPUs: %s\n", cpu_list_str(&eal, buf, sizeof(buf)));
+    av_log(NULL, AV_LOG_INFO, "Codec CPUs: %s\n", cpu_list_str(&plan.all, buf, sizeof(buf)));
+}
+
+void nspk_cpu_worker_set(rte_cpuset_t *cpuset)
+{
+    unsigned int node = rte_socket_id();
+
+    if (node < RTE_MAX_NUMA_NODES && CPU_COUNT(&plan.node[node]))
+        *cpuset = plan.node[node];
+    else
+        // A remote node still beats the lcore's own CPU.
+        *cpuset = plan.all;
+}
+
+void nspk_cpu_codec_set(const struct nspk_rtp_session_ctx_t *rtp_sess, rte_cpuset_t *cpuset)
+{
+    CPU_ZERO(cpuset);
+    if (rtp_sess->codec_cpu >= 0)
+        CPU_SET(rtp_sess->codec_cpu, cpuset);
+    else
+        nspk_cpu_worker_set(cpuset);
+}
+
+typedef int (*pthread_create_fn)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *);
+
+/**
+ * Wraps the libc one for the whole process, libavcodec and the codec
+ * libraries included. Threads created while the calling thread opens a
+ * codec are pinned to a CPU of the codec's each as soon as they exist:
+ * they are told apart by whom creates them, not by a scan of the threads
+ * of the process, so codecs open on all lcores at once.
+ */
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start)(void *), void *arg)
+{
+    static pthread_create_fn next_create;
+    const rte_cpuset_t *cpuset = RTE_PER_LCORE(_codec_cpus);
+    pthread_create_fn create = __atomic_load_n(&next_create, __ATOMIC_ACQUIRE);
+    rte_cpuset_t one;
+    int ret, n, cpu;
+
+    if (!create) {
+        create = (pthread_create_fn)dlsym(RTLD_NEXT, "pthread_create");
+        if (!create)
+            return EAGAIN;
+        __atomic_store_n(&next_create, create, __ATOMIC_RELEASE);
+    }
+    ret = create(thread, attr, start, arg);
+    if (ret != 0 || !cpuset)
+        return ret;
+
+    // It starts on all the codec's CPUs, inherited from the caller, until it is pinned.
+    n = __atomic_fetch_add(&plan.next, 1, __ATOMIC_RELAXED) % CPU_COUNT(cpuset);
+    for (cpu = 0; n || !CPU_ISSET(cpu, cpuset); cpu++)
+        n -= CPU_ISSET(cpu, cpuset) ? 1 : 0;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    if ((ret = pthread_setaffinity_np(*thread, sizeof(one), &one)) != 0)
+        av_log(NULL, AV_LOG_WARNING, "Cannot pin codec thread to CPU %d: %s\n", cpu, strerror(ret));
+    return 0;
+}
+
+int nspk_cpu_codec_open(const struct nspk_rtp_session_ctx_t *rtp_sess, AVCodecContext *ctx,
+                        const AVCodec *codec, AVDictionary **options)
+{
+    pthread_t self = pthread_self();
+    rte_cpuset_t cpuset, saved;
+    char buf[256];
+    int ret, nb_cpu;
+
+    nspk_cpu_codec_set(rtp_sess, &cpuset);
+    nb_cpu = CPU_COUNT(&cpuset);
+    // Audio codecs gain nothing from threads, and without a CPU of their own they would share the caller's.
+    if (ctx->codec_type != AVMEDIA_TYPE_VIDEO || !nb_cpu) {
+        ctx->thread_count = 1;
+        return avcodec_open2(ctx, codec, options);
+    }
+    ctx->thread_count = rtp_sess->codec_threads > 0 ? rtp_sess->codec_threads :
+                        RTE_MIN(nb_cpu, NSPK_CPU_CODEC_THREADS);
+    // Slices add no delay, frame threads hold thread_count frames back.
+    ctx->thread_type = rtp_sess->codec_thread_type ? rtp_sess->codec_thread_type : FF_THREAD_SLICE;
+    if (ctx->thread_count == 1)
+        return avcodec_open2(ctx, codec, options);
+
+    // Threads the codec starts from threads of its own inherit their affinity instead.
+    RTE_PER_LCORE(_codec_cpus) = &cpuset;
+    pthread_getaffinity_np(self, sizeof(saved), &saved);
+    pthread_setaffinity_np(self, sizeof(cpuset), &cpuset);
+    ret = avcodec_open2(ctx, codec, options);
+    pthread_setaffinity_np(self, sizeof(saved), &saved);
+    RTE_PER_LCORE(_codec_cpus) = NULL;
+
+    if (ret >= 0)
+        av_log(NULL, AV_LOG_INFO, "RTP session %d: %s with %d %s threads on CPUs %s\n",
+               rtp_sess->session_id, codec->name, ctx->thread_count,
+               ctx->active_thread_type == FF_THREAD_FRAME ? "frame" :
+               ctx->active_thread_type == FF_THREAD_SLICE ? "slice" : "codec",
+               cpu_list_str(&cpuset, buf, sizeof(buf)));
+    return ret;
+}
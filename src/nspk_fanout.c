@@ -0,0 +1,186 @@
+/**
+ * NSPK unicast fan-out.
+ * One packetized RTP stream is sent to many receivers: the payload is
+ * shared through a single indirect mbuf, each receiver only gets a header.
+ */
+
+#include <stdio.h>
+#include <libavutil/avstring.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+#include <libavutil/random_seed.h>
+
+#include <nspk.h>
+#include <nspk_fanout.h>
+
+#define FANOUT_INIT_SIZE    16
+
+void nspk_fanout_init(struct nspk_fanout_t *f, uint32_t ssrc)
+{
+    memset(f, 0, sizeof(*f));
+    f->ssrc = ssrc;
+}
+
+void nspk_fanout_fini(struct nspk_fanout_t *f)
+{
+    uint32_t i;
+
+    for (i = 0; i != f->num; i++)
+        nspk_tldk_udp_stream_close(f->dst[i].fs);
+    av_freep(&f->dst);
+    f->num = 0;
+    f->size = 0;
+}
+
+int nspk_fanout_add(struct nspk_fanout_t *f, struct lcore_prm *lcore_prm,
+                    const struct netfe_sprm *sprm)
+{
+    struct nspk_fanout_dst_t *d;
+    struct netfe_sprm prm = *sprm;
+
+    if (f->num == f->size) {
+        uint32_t size = f->size ? f->size * 2 : FANOUT_INIT_SIZE;
+        d = av_realloc_array(f->dst, size, sizeof(*d));
+        if (!d)
+            return AVERROR(ENOMEM);
+        f->dst = d;
+        f->size = size;
+    }
+
+    d = &f->dst[f->num];
+    memset(d, 0, sizeof(*d));
+    d->fs = nspk_tldk_udp_stream_open(lcore_prm, &prm, TXONLY);
+    if (!d->fs)
+        return AVERROR(rte_errno);
+    d->ssrc = av_get_random_seed();
+    d->seq_off = av_get_random_seed() & 0xffff;
+    f->num++;
+    return 0;
+}
+
+int nspk_fanout_load(struct nspk_fanout_t *f, struct lcore_prm *lcore_prm,
+                     const char *path, int port_off)
+{
+    struct netfe_sprm sprm;
+    char line[256], url[272];
+    char *s, *e;
+    FILE *fp;
+    int n = 0, ln = 0;
+    int ret = 0;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not open fan-out list '%s'\n", path);
+        return ret;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        ln++;
+        if ((e = strchr(line, '#')))
+            *e = '\0';
+        for (s = line; av_isspace(*s); s++)
+            ;
+        for (e = s + strlen(s); e > s && av_isspace(e[-1]); e--)
+            ;
+        *e = '\0';
+        if (*s == '\0')
+            continue;
+
+        snprintf(url, sizeof(url), "rtp://%s", s);
+        if ((ret = nspk_rtp_url_parse(url, &sprm, NULL, NULL)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "%s:%d: invalid receiver '%s'\n", path, ln, s);
+            break;
+        }
+        nspk_tldk_sockaddr_set_port(&sprm.remote_addr,
+                                    nspk_tldk_sockaddr_get_port(&sprm.remote_addr) + port_off);
+        if ((ret = nspk_fanout_add(f, lcore_prm, &sprm)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "%s:%d: could not open a TLDK stream for '%s'\n", path, ln, s);
+            break;
+        }
+        n++;
+    }
+
+    fclose(fp);
+    return ret < 0 ? ret : n;
+}
+
+/**
+ * Send one packet to every receiver, behind a header of their own chained
+ * to the shared indirect mbuf mi.
+ */
+static void fanout_packet(struct nspk_fanout_t *f, const uint8_t *p, uint16_t seq,
+                          struct rte_mbuf *mi)
+{
+    struct nspk_fanout_dst_t *d;
+    struct rte_mbuf *h;
+    uint8_t *hp;
+    uint32_t i;
+
+    for (i = 0; i != f->num; i++) {
+        d = &f->dst[i];
+        h = pkt_mag_get(&d->fs->mag);
+        if (h == NULL) {
+            d->drops++;
+            continue;
+        }
+
+        hp = rte_pktmbuf_mtod(h, uint8_t *);
+        memcpy(hp, p, NSPK_RTP_HDR_SIZE);
+        AV_WB16(hp + 2, seq + d->seq_off);
+        AV_WB32(hp + 8, d->ssrc);
+        h->data_len = NSPK_RTP_HDR_SIZE;
+        h->pkt_len = NSPK_RTP_HDR_SIZE;
+        if (rte_pktmbuf_chain(h, mi) != 0) {
+            pkt_mag_put(&d->fs->mag, h);
+            d->drops++;
+            continue;
+        }
+        rte_mbuf_refcnt_update(mi, 1);
+
+        // Freeing the header also drops its reference on the payload.
+        if (nspk_tldk_udp_stream_queue_mbuf(d->fs, h) < 0) {
+            rte_pktmbuf_free(h);
+            d->drops++;
+            continue;
+        }
+        d->packets++;
+        f->copies++;
+    }
+}
+
+void nspk_fanout_sent(struct nspk_fanout_t *f, struct rte_mbuf *pkt[], uint32_t num)
+{
+    struct rte_mbuf *mi;
+    const uint8_t *p;
+    uint16_t seq;
+    uint32_t i;
+
+    for (i = 0; i != num; i++) {
+        p = rte_pktmbuf_mtod(pkt[i], const uint8_t *);
+        if (pkt[i]->data_len < NSPK_RTP_HDR_SIZE || AV_RB32(p + 8) != f->ssrc ||
+            !rte_pktmbuf_is_contiguous(pkt[i]))
+            continue;
+
+        seq = AV_RB16(p + 2);
+        if (f->started && (int16_t)(seq - f->next) < 0)
+            continue;
+        f->started = 1;
+        f->next = seq + 1;
+        if (f->num == 0)
+            continue;
+        f->packets++;
+
+        mi = pkt_mag_get(&f->dst[0].fs->mag);
+        if (mi == NULL) {
+            f->drops++;
+            continue;
+        }
+        rte_pktmbuf_attach(mi, pkt[i]);
+        rte_pktmbuf_adj(mi, NSPK_RTP_HDR_SIZE);
+
+        fanout_packet(f, p, seq, mi);
+        // Our own reference, the receivers' headers hold the others.
+        rte_pktmbuf_free(mi);
+    }
+}
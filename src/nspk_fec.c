@@ -0,0 +1,307 @@
+/**
+ * NSPK SMPTE 2022-1 FEC generator.
+ * Row and column XOR parity of the outgoing RTP packets, built in place in
+ * the FEC mbufs with SIMD kernels, sent on their own TLDK streams.
+ */
+
+#include <rte_cpuflags.h>
+#include <rte_memcpy.h>
+#include <libavutil/avstring.h>
+#include <libavutil/dict.h>
+#include <libavutil/intreadwrite.h>
+#include <libavformat/rtp.h>
+
+#include <nspk.h>
+#include <nspk_fec.h>
+
+#ifdef RTE_ARCH_X86
+#include <immintrin.h>
+#endif
+
+#define FEC_HDR_SIZE    16
+#define FEC_PT          96
+/* D bit of the FEC header: the packet protects a row. */
+#define FEC_D_ROW       0x40
+
+typedef void (*fec_xor_fn)(uint8_t *dst, const uint8_t *src, size_t len);
+
+static void fec_xor_scalar(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    for (; len >= 8; dst += 8, src += 8, len -= 8)
+        AV_WN64(dst, AV_RN64(dst) ^ AV_RN64(src));
+    for (; len != 0; len--)
+        *dst++ ^= *src++;
+}
+
+#ifdef RTE_ARCH_X86
+__attribute__((target("avx2")))
+static void fec_xor_avx2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    __m256i a0, a1, a2, a3;
+    size_t i = 0;
+
+    for (; i + 128 <= len; i += 128) {
+        a0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i)),
+                              _mm256_loadu_si256((const __m256i *)(src + i)));
+        a1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i + 32)),
+                              _mm256_loadu_si256((const __m256i *)(src + i + 32)));
+        a2 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i + 64)),
+                              _mm256_loadu_si256((const __m256i *)(src + i + 64)));
+        a3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i + 96)),
+                              _mm256_loadu_si256((const __m256i *)(src + i + 96)));
+        _mm256_storeu_si256((__m256i *)(dst + i), a0);
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), a1);
+        _mm256_storeu_si256((__m256i *)(dst + i + 64), a2);
+        _mm256_storeu_si256((__m256i *)(dst + i + 96), a3);
+    }
+    for (; i + 32 <= len; i += 32) {
+        a0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i)),
+                              _mm256_loadu_si256((const __m256i *)(src + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), a0);
+    }
+    fec_xor_scalar(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+static void fec_xor_avx512(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    __m512i a0, a1;
+    size_t i = 0;
+
+    for (; i + 128 <= len; i += 128) {
+        a0 = _mm512_xor_si512(_mm512_loadu_si512(dst + i), _mm512_loadu_si512(src + i));
+        a1 = _mm512_xor_si512(_mm512_loadu_si512(dst + i + 64), _mm512_loadu_si512(src + i + 64));
+        _mm512_storeu_si512(dst + i, a0);
+        _mm512_storeu_si512(dst + i + 64, a1);
+    }
+    for (; i + 64 <= len; i += 64) {
+        a0 = _mm512_xor_si512(_mm512_loadu_si512(dst + i), _mm512_loadu_si512(src + i));
+        _mm512_storeu_si512(dst + i, a0);
+    }
+    fec_xor_scalar(dst + i, src + i, len - i);
+}
+#endif
+
+static fec_xor_fn fec_xor = fec_xor_scalar;
+
+static void fec_xor_select(void)
+{
+#ifdef RTE_ARCH_X86
+    if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX512F) > 0)
+        fec_xor = fec_xor_avx512;
+    else if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0)
+        fec_xor = fec_xor_avx2;
+#endif
+}
+
+int nspk_fec_parse(const char *str, int *l, int *d)
+{
+    AVDictionary *opts = NULL;
+    AVDictionaryEntry *e;
+    const char *p;
+    int ret = 0;
+
+    if (!av_strstart(str, "prompeg", &p) || (*p != '=' && *p != '\0'))
+        return AVERROR(EINVAL);
+    while (*p == '=')
+        p++;
+    if (av_dict_parse_string(&opts, p, "=", ":", 0) < 0) {
+        av_dict_free(&opts);
+        return AVERROR(EINVAL);
+    }
+
+    *l = (e = av_dict_get(opts, "l", NULL, 0)) ? strtol(e->value, NULL, 10) : 0;
+    *d = (e = av_dict_get(opts, "d", NULL, 0)) ? strtol(e->value, NULL, 10) : 0;
+    if (*l < NSPK_FEC_MIN_L || *l > NSPK_FEC_MAX_L || *d < NSPK_FEC_MIN_D || *d > NSPK_FEC_MAX_D ||
+        *l * *d > NSPK_FEC_MAX_LD) {
+        av_log(NULL, AV_LOG_ERROR, "FEC needs l=%d-%d and d=%d-%d with l*d <= %d\n",
+               NSPK_FEC_MIN_L, NSPK_FEC_MAX_L, NSPK_FEC_MIN_D, NSPK_FEC_MAX_D, NSPK_FEC_MAX_LD);
+        ret = AVERROR(EINVAL);
+    }
+    av_dict_free(&opts);
+    return ret;
+}
+
+static struct netfe_stream *fec_stream_open(struct lcore_prm *lcore_prm,
+                                            const struct netfe_sprm *rtp_sprm, int off)
+{
+    struct netfe_sprm sprm = *rtp_sprm;
+
+    // Local ports are ephemeral like the media stream's.
+    nspk_tldk_sockaddr_set_port(&sprm.local_addr, 0);
+    nspk_tldk_sockaddr_set_port(&sprm.remote_addr,
+                                nspk_tldk_sockaddr_get_port(&rtp_sprm->remote_addr) + off);
+    return nspk_tldk_udp_stream_open(lcore_prm, &sprm, TXONLY);
+}
+
+int nspk_fec_init(struct nspk_fec_t *f, struct lcore_prm *lcore_prm,
+                  const struct netfe_sprm *rtp_sprm, int l, int d)
+{
+    memset(f, 0, sizeof(*f));
+    f->l = l;
+    f->d = d;
+
+    f->col_fs = fec_stream_open(lcore_prm, rtp_sprm, NSPK_FEC_COL_PORT_OFF);
+    f->row_fs = fec_stream_open(lcore_prm, rtp_sprm, NSPK_FEC_ROW_PORT_OFF);
+    if (!f->col_fs || !f->row_fs) {
+        av_log(NULL, AV_LOG_ERROR, "%s: Could not open the FEC streams\n", __func__);
+        nspk_fec_fini(f);
+        return AVERROR(rte_errno);
+    }
+
+    fec_xor_select();
+    return 0;
+}
+
+static void fec_acc_drop(struct netfe_stream *fs, struct nspk_fec_acc_t *acc)
+{
+    if (acc->m != NULL)
+        pkt_mag_put(&fs->mag, acc->m);
+    acc->m = NULL;
+}
+
+void nspk_fec_fini(struct nspk_fec_t *f)
+{
+    int i;
+
+    if (f->col_fs) {
+        for (i = 0; i < f->l; i++)
+            fec_acc_drop(f->col_fs, &f->col[i]);
+    }
+    if (f->row_fs)
+        fec_acc_drop(f->row_fs, &f->row);
+    nspk_tldk_udp_stream_close(f->col_fs);
+    nspk_tldk_udp_stream_close(f->row_fs);
+    f->col_fs = NULL;
+    f->row_fs = NULL;
+}
+
+/**
+ * XOR a media packet into an accumulator, the first one of a group is copied.
+ */
+static int fec_acc_add(struct netfe_stream *fs, struct nspk_fec_acc_t *acc, uint16_t seq,
+                       const uint8_t *pkt, int len)
+{
+    const uint8_t *payload = pkt + NSPK_RTP_HDR_SIZE;
+    uint8_t *dst;
+    int plen = len - NSPK_RTP_HDR_SIZE;
+
+    if (acc->m == NULL) {
+        acc->m = pkt_mag_get(&fs->mag);
+        if (acc->m == NULL)
+            return -ENOBUFS;
+        acc->len = 0;
+        acc->snbase = seq;
+        acc->len_rec = 0;
+        acc->pt_rec = 0;
+        acc->ts_rec = 0;
+    }
+    if (NSPK_RTP_HDR_SIZE + FEC_HDR_SIZE + plen > rte_pktmbuf_tailroom(acc->m))
+        return -EMSGSIZE;
+
+    dst = rte_pktmbuf_mtod_offset(acc->m, uint8_t *, NSPK_RTP_HDR_SIZE + FEC_HDR_SIZE);
+    fec_xor(dst, payload, FFMIN(plen, acc->len));
+    if (plen > acc->len) {
+        rte_memcpy(dst + acc->len, payload + acc->len, plen - acc->len);
+        acc->len = plen;
+    }
+    acc->len_rec ^= plen;
+    acc->pt_rec ^= pkt[1] & 0x7f;
+    acc->ts_rec ^= AV_RB32(pkt + 4);
+    acc->ts = AV_RB32(pkt + 4);
+    return 0;
+}
+
+/**
+ * Write the headers of an accumulator and queue its FEC packet.
+ */
+static void fec_acc_send(struct nspk_fec_t *f, struct netfe_stream *fs, struct nspk_fec_acc_t *acc,
+                         uint16_t *seq, int row)
+{
+    struct rte_mbuf *m = acc->m;
+    uint8_t *p = rte_pktmbuf_mtod(m, uint8_t *);
+
+    acc->m = NULL;
+
+    p[0] = NSPK_RTP_VERSION << 6;
+    p[1] = FEC_PT;
+    AV_WB16(p + 2, *seq);
+    AV_WB32(p + 4, acc->ts);
+    AV_WB32(p + 8, 0);
+
+    p += NSPK_RTP_HDR_SIZE;
+    AV_WB16(p, acc->snbase);
+    AV_WB16(p + 2, acc->len_rec);
+    p[4] = 0x80 | acc->pt_rec;
+    AV_WB24(p + 5, 0);
+    AV_WB32(p + 8, acc->ts_rec);
+    p[12] = row ? FEC_D_ROW : 0;
+    p[13] = row ? 1 : f->l;
+    p[14] = row ? f->l : f->d;
+    p[15] = 0;
+
+    m->data_len = NSPK_RTP_HDR_SIZE + FEC_HDR_SIZE + acc->len;
+    m->pkt_len = m->data_len;
+    if (nspk_tldk_udp_stream_queue_mbuf(fs, m) < 0) {
+        pkt_mag_put(&fs->mag, m);
+        f->drops++;
+        return;
+    }
+    (*seq)++;
+    if (row)
+        f->row_sent++;
+    else
+        f->col_sent++;
+}
+
+static void fec_reset(struct nspk_fec_t *f, uint16_t seq)
+{
+    int i;
+
+    for (i = 0; i < f->l; i++)
+        fec_acc_drop(f->col_fs, &f->col[i]);
+    fec_acc_drop(f->row_fs, &f->row);
+    f->base = seq;
+    f->next = seq;
+}
+
+void nspk_fec_add(struct nspk_fec_t *f, const uint8_t *pkt, int len)
+{
+    uint16_t seq;
+    int k, c;
+
+    if (len <= NSPK_RTP_HDR_SIZE || RTP_PT_IS_RTCP(pkt[1]))
+        return;
+    seq = AV_RB16(pkt + 2);
+
+    if (!f->started) {
+        f->started = 1;
+        fec_reset(f, seq);
+    } else if ((int16_t)(seq - f->next) < 0) {
+        return;
+    } else if (seq != f->next) {
+        // Packets went missing before the FEC stage, the matrix cannot cover them.
+        fec_reset(f, seq);
+        f->resets++;
+    }
+    f->next = seq + 1;
+    f->packets++;
+
+    k = (uint16_t)(seq - f->base);
+    c = k % f->l;
+    if (fec_acc_add(f->col_fs, &f->col[c], seq, pkt, len) < 0 ||
+        fec_acc_add(f->row_fs, &f->row, seq, pkt, len) < 0) {
+        // The matrix has a hole, start over with the next packet.
+        fec_reset(f, seq + 1);
+        f->drops++;
+        return;
+    }
+
+    if (c == f->l - 1)
+        fec_acc_send(f, f->row_fs, &f->row, &f->row_seq, 1);
+    if (k / f->l == f->d - 1) {
+        fec_acc_send(f, f->col_fs, &f->col[c], &f->col_seq, 0);
+        if (c == f->l - 1)
+            f->base = seq + 1;
+    }
+}
@@ -0,0 +1,1069 @@
+/**
+ * NSPK HTTP origin.
+ * HTTP/1.1 (RFC 7230) GET and HEAD of the files of a directory, over the
+ * TLDK TCP context of each worker BE lcore. File bodies are cached in
+ * hugepage memory and every TCP segment of a reply is a header mbuf
+ * chained to an mbuf attached to the body as an external buffer, so the
+ * payload is never copied, however many clients fetch it. Files missing
+ * from the cache are read by a thread of the lcore's own, the requests for
+ * them wait meanwhile.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_malloc.h>
+#include <rte_memory.h>
+#include <rte_ring.h>
+#include <rte_timer.h>
+#include <libavutil/avstring.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include <nspk.h>
+#include <nspk_http.h>
+
+#define HTTP_SERVER         "NSPKCore"
+#define HTTP_NAME_SIZE      256
+/* Period at which the lcore takes back the bodies read. */
+#define HTTP_LOAD_POLL_MS   1
+/* Sleep of the loader when it has no file to read. */
+#define HTTP_LOAD_WAIT_US   200
+/* http_request(): the request waits for the body of its file. */
+#define HTTP_DEFERRED       1
+
+struct nspk_http_prm nspk_http_prm = {
+    .port = NSPK_HTTP_DEFAULT_PORT,
+    .nb_port = 1,
+    .max_conn = NSPK_HTTP_DEFAULT_MAX_CONN,
+    .cache_size = (uint64_t)NSPK_HTTP_DEFAULT_CACHE_MB << 20,
+};
+
+/**
+ * Segments of one reply in flight at most. Clones the stack may take of a
+ * segment hold a reference too, so this leaves room below the 16-bit count.
+ */
+#define HTTP_TX_MAX_SEGS    (UINT16_MAX / 2)
+
+/**
+ * A file body in hugepage memory. The cache holds a reference on shinfo
+ * while the body is in it and each reply one while mbufs of it are in
+ * flight: the last one to go frees the body.
+ */
+struct http_body
+{
+    struct rte_mbuf_ext_shared_info shinfo;
+    char name[HTTP_NAME_SIZE];
+    uint64_t size;
+    struct timespec mtime;
+    /* TSC of the last request, the least recently used body is evicted first. */
+    uint64_t last_use;
+    /*
+     * Hugepage size of data in IOVA as PA mode, where it is only
+     * IOVA-contiguous within a page; 0 in IOVA as VA mode.
+     */
+    uint64_t page_sz;
+    uint8_t data[] __rte_cache_aligned;
+};
+
+/**
+ * The mbufs of one reply attached to its body. The connection holds a
+ * reference on shinfo while it sends the reply and each attached mbuf one;
+ * the last one to go drops the single reference of the reply on the body,
+ * so the count of the body only grows with the replies, not their segments.
+ */
+struct http_tx
+{
+    struct rte_mbuf_ext_shared_info shinfo;
+    struct http_body *body;
+};
+
+/**
+ * A file the loader reads. Once it is handed back, the requests which
+ * waited for it take their body from it, the last one frees it.
+ */
+struct http_load
+{
+    LIST_ENTRY(http_load) link;
+    char name[HTTP_NAME_SIZE];
+    char path[PATH_MAX];
+    struct stat st;
+    int socket;
+    /* Set by the loader, with a reference on body if ret is 0. */
+    struct http_body *body;
+    int ret;
+    int done;
+    /* Requests waiting for it or not served again yet. */
+    uint32_t nb_wait;
+};
+
+struct http_conn
+{
+    LIST_ENTRY(http_conn) link;
+    struct nspk_http_lcore *hl;
+    struct netfe_stream *fs;
+    /* Header of the reply being sent, until it leaves with the first body segment. */
+    struct rte_mbuf *hdr;
+    /* Body of the reply being sent and the part of it left, NULL between replies. */
+    struct http_tx *tx;
+    uint64_t off, end;
+    /* Close once the reply is out: HTTP/1.0, "Connection: close" or a bad request. */
+    int close;
+    /* Data arrived during a reply, or a load, and was left in the stream. */
+    int rx_held;
+    /* Load of the body of the request at the head of buf. */
+    struct http_load *load;
+    uint32_t len;
+    char buf[NSPK_HTTP_REQ_SIZE + 1];
+};
+
+struct nspk_http_lcore
+{
+    struct lcore_prm *lcore_prm;
+    /* The mbufs attached to the bodies. */
+    struct rte_mempool *mp;
+    uint32_t nb_listen;
+    struct netfe_stream *listen[NSPK_HTTP_MAX_LISTEN];
+    uint32_t nb_conn;
+    LIST_HEAD(, http_conn) conn;
+    uint32_t nb_body;
+    uint64_t cache_bytes;
+    struct http_body *body[NSPK_HTTP_MAX_BODY];
+    /* Loads in flight, to the loader and back, single producer and consumer each. */
+    uint32_t nb_loading;
+    LIST_HEAD(, http_load) loading;
+    struct rte_ring *load;
+    struct rte_ring *loaded;
+    pthread_t loader;
+    int loader_started;
+    int loader_stop;
+    struct rte_timer load_timer;
+    struct {
+        uint64_t acc;
+        uint64_t rej;
+        uint64_t req;
+        uint64_t err;
+        uint64_t hit;
+        uint64_t miss;
+        uint64_t segs;
+        uint64_t bytes;
+    } stat;
+};
+
+static RTE_DEFINE_PER_LCORE(struct nspk_http_lcore *, _http);
+
+static const char *http_reason(int code)
+{
+    switch (code) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 416: return "Range Not Satisfiable";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    default:  return "Internal Server Error";
+    }
+}
+
+/**
+ * Content type of a file and how long clients may keep it: playlists and
+ * manifests change with every segment, segments do not.
+ */
+static const char *http_content_type(const char *name, int *playlist)
+{
+    static const struct {
+        const char *ext;
+        const char *type;
+        int playlist;
+    } types[] = {
+        { ".m3u8", "application/vnd.apple.mpegurl", 1 },
+        { ".mpd",  "application/dash+xml",          1 },
+        { ".ts",   "video/mp2t",                    0 },
+        { ".m4s",  "video/iso.segment",             0 },
+        { ".mp4",  "video/mp4",                     0 },
+        { ".m4v",  "video/mp4",                     0 },
+        { ".m4a",  "audio/mp4",                     0 },
+        { ".aac",  "audio/aac",                     0 },
+        { ".vtt",  "text/vtt",                      0 },
+    };
+    const char *ext = strrchr(name, '.');
+    unsigned int i;
+
+    *playlist = 0;
+    for (i = 0; ext && i != RTE_DIM(types); i++) {
+        if (!av_strcasecmp(ext, types[i].ext)) {
+            *playlist = types[i].playlist;
+            return types[i].type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+static void http_body_free(void *addr, void *opaque)
+{
+    RTE_SET_USED(addr);
+    rte_free(opaque);
+}
+
+static void http_body_put(struct http_body *b)
+{
+    if (rte_mbuf_ext_refcnt_update(&b->shinfo, -1) == 0)
+        rte_free(b);
+}
+
+static void http_tx_free(void *addr, void *opaque)
+{
+    struct http_tx *tx = opaque;
+
+    RTE_SET_USED(addr);
+    http_body_put(tx->body);
+    rte_free(tx);
+}
+
+static void http_tx_put(struct http_tx *tx)
+{
+    if (rte_mbuf_ext_refcnt_update(&tx->shinfo, -1) == 0)
+        http_tx_free(NULL, tx);
+}
+
+static void http_cache_remove(struct nspk_http_lcore *hl, uint32_t i)
+{
+    struct http_body *b = hl->body[i];
+
+    hl->cache_bytes -= b->size;
+    hl->body[i] = hl->body[--hl->nb_body];
+    http_body_put(b);
+}
+
+/**
+ * Read a file into a new body on socket, with one reference.
+ */
+static int http_body_load(const char *path, const struct stat *st, int socket, struct http_body **bp)
+{
+    struct http_body *b;
+    uint64_t off, size = st->st_size;
+    ssize_t n;
+    int fd, ret;
+
+    b = rte_malloc_socket("nspk_http_body", sizeof(*b) + size, RTE_CACHE_LINE_SIZE, socket);
+    if (!b)
+        return AVERROR(ENOMEM);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ret = AVERROR(errno);
+        rte_free(b);
+        return ret;
+    }
+    for (off = 0; off < size; off += n) {
+        n = read(fd, b->data + off, size - off);
+        if (n <= 0)
+            break;
+    }
+    close(fd);
+    // A file cut short while it was read, e.g. rewritten in place, is not served half.
+    if (off != size) {
+        rte_free(b);
+        return AVERROR(EAGAIN);
+    }
+
+    b->size = size;
+    b->mtime = st->st_mtim;
+    b->page_sz = 0;
+    if (rte_eal_iova_mode() != RTE_IOVA_VA) {
+        const struct rte_memseg_list *msl = rte_mem_virt2memseg_list(b->data);
+
+        b->page_sz = msl ? msl->page_sz : RTE_PGSIZE_4K;
+    }
+    b->shinfo.free_cb = http_body_free;
+    b->shinfo.fcb_opaque = b;
+    rte_mbuf_ext_refcnt_set(&b->shinfo, 1);
+    *bp = b;
+    return 0;
+}
+
+static void http_load_free(struct http_load *ld)
+{
+    if (ld->body)
+        http_body_put(ld->body);
+    av_free(ld);
+}
+
+static void http_load_put(struct http_load *ld)
+{
+    if (--ld->nb_wait == 0 && ld->done)
+        http_load_free(ld);
+}
+
+/**
+ * Read the files the lcore queues, until nspk_http_lcore_fini() stops it.
+ */
+static void *http_loader(void *arg)
+{
+    struct nspk_http_lcore *hl = arg;
+    struct http_load *ld;
+
+    while (!__atomic_load_n(&hl->loader_stop, __ATOMIC_ACQUIRE)) {
+        if (rte_ring_sc_dequeue(hl->load, (void **)&ld) != 0) {
+            av_usleep(HTTP_LOAD_WAIT_US);
+            continue;
+        }
+        ld->ret = http_body_load(ld->path, &ld->st, ld->socket, &ld->body);
+        if (ld->ret >= 0)
+            av_strlcpy(ld->body->name, ld->name, sizeof(ld->body->name));
+        // Both rings have room for all the loads.
+        rte_ring_sp_enqueue(hl->loaded, ld);
+    }
+    return NULL;
+}
+
+/**
+ * Keep a body the loader read, in place of an earlier one of the file,
+ * evicting the least recently used ones to make room. Bodies larger than
+ * the whole cache are not kept.
+ */
+static void http_cache_add(struct nspk_http_lcore *hl, struct http_body *b)
+{
+    uint32_t i, lru;
+
+    b->last_use = rte_rdtsc();
+    if (b->size > nspk_http_prm.cache_size)
+        return;
+    for (i = 0; i != hl->nb_body; i++) {
+        if (!strcmp(hl->body[i]->name, b->name)) {
+            http_cache_remove(hl, i);
+            break;
+        }
+    }
+
+    while (hl->nb_body == NSPK_HTTP_MAX_BODY ||
+           (hl->nb_body && hl->cache_bytes + b->size > nspk_http_prm.cache_size)) {
+        for (i = 1, lru = 0; i != hl->nb_body; i++) {
+            if (hl->body[i]->last_use < hl->body[lru]->last_use)
+                lru = i;
+        }
+        http_cache_remove(hl, lru);
+    }
+    rte_mbuf_ext_refcnt_update(&b->shinfo, 1);
+    hl->body[hl->nb_body++] = b;
+    hl->cache_bytes += b->size;
+}
+
+/**
+ * Body of a file, from the cache while the file keeps its size and mtime.
+ * Otherwise the file is queued to the loader, or the load of it in flight
+ * joined, and the request waits in conn->load; served again, it takes the
+ * body from there. Files larger than the whole cache are read for each
+ * request and not kept.
+ * \return 0 with a reference on *bp for the caller, AVERROR(EINPROGRESS)
+ *         while the file is read, negative AVERROR on failure.
+ */
+static int http_body_get(struct http_conn *conn, const char *name, struct http_body **bp)
+{
+    struct nspk_http_lcore *hl = conn->hl;
+    uint64_t now = rte_rdtsc();
+    struct http_load *ld = conn->load;
+    struct http_body *b;
+    char path[PATH_MAX];
+    struct stat st;
+    uint32_t i;
+    int ret;
+
+    if (ld) {
+        conn->load = NULL;
+        ret = ld->ret;
+        if (ret >= 0) {
+            rte_mbuf_ext_refcnt_update(&ld->body->shinfo, 1);
+            *bp = ld->body;
+        }
+        http_load_put(ld);
+        return ret;
+    }
+
+    if (snprintf(path, sizeof(path), "%s/%s", nspk_http_prm.root, name) >= (int)sizeof(path))
+        return AVERROR(ENAMETOOLONG);
+    if (stat(path, &st) != 0)
+        return AVERROR(errno);
+    if (!S_ISREG(st.st_mode))
+        return AVERROR(ENOENT);
+
+    for (i = 0; i != hl->nb_body; i++) {
+        b = hl->body[i];
+        if (strcmp(b->name, name))
+            continue;
+        if (b->size == (uint64_t)st.st_size && b->mtime.tv_sec == st.st_mtim.tv_sec &&
+            b->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            // As many replies in flight as the count holds, the next ones are turned away.
+            if (rte_mbuf_ext_refcnt_read(&b->shinfo) == UINT16_MAX)
+                return AVERROR(EAGAIN);
+            b->last_use = now;
+            rte_mbuf_ext_refcnt_update(&b->shinfo, 1);
+            hl->stat.hit++;
+            *bp = b;
+            return 0;
+        }
+        // Rewritten since, e.g. a live playlist. Replies in flight keep the previous body.
+        http_cache_remove(hl, i);
+        break;
+    }
+
+    hl->stat.miss++;
+    LIST_FOREACH(ld, &hl->loading, link) {
+        if (!strcmp(ld->name, name) && ld->st.st_size == st.st_size &&
+            ld->st.st_mtim.tv_sec == st.st_mtim.tv_sec && ld->st.st_mtim.tv_nsec == st.st_mtim.tv_nsec)
+            break;
+    }
+    if (!ld) {
+        if (hl->nb_loading == NSPK_HTTP_MAX_LOAD)
+            return AVERROR(EAGAIN);
+        ld = av_mallocz(sizeof(*ld));
+        if (!ld)
+            return AVERROR(ENOMEM);
+        av_strlcpy(ld->name, name, sizeof(ld->name));
+        av_strlcpy(ld->path, path, sizeof(ld->path));
+        ld->st = st;
+        ld->socket = rte_socket_id();
+        LIST_INSERT_HEAD(&hl->loading, ld, link);
+        hl->nb_loading++;
+        rte_ring_sp_enqueue(hl->load, ld);
+    }
+    ld->nb_wait++;
+    conn->load = ld;
+    return AVERROR(EINPROGRESS);
+}
+
+/**
+ * Write the status line and headers of a reply into an mbuf of the
+ * connection's magazine, hdrs holding the extra header lines.
+ */
+static struct rte_mbuf *http_header(struct http_conn *conn, int code, const char *hdrs, uint64_t len)
+{
+    struct netfe_stream *fs = conn->fs;
+    struct rte_mbuf *m;
+    int n;
+
+    m = pkt_mag_get(&fs->mag);
+    if (!m)
+        return NULL;
+    n = snprintf(rte_pktmbuf_mtod(m, char *), rte_pktmbuf_tailroom(m),
+                 "HTTP/1.1 %d %s\r\nServer: " HTTP_SERVER "\r\nContent-Length: %"PRIu64"\r\n%s%s\r\n",
+                 code, http_reason(code), len, hdrs ? hdrs : "", conn->close ? "Connection: close\r\n" : "");
+    if (n < 0 || n >= rte_pktmbuf_tailroom(m)) {
+        pkt_mag_put(&fs->mag, m);
+        return NULL;
+    }
+    m->data_len = n;
+    m->pkt_len = n;
+    return m;
+}
+
+/**
+ * Start a reply: its header, then length bytes of body from off, if any.
+ * Takes over the caller's reference on body.
+ * \return 0, or AVERROR(ENOMEM) if the header could not be written.
+ */
+static int http_reply(struct http_conn *conn, int code, const char *hdrs, struct http_body *body,
+                      uint64_t off, uint64_t length, int head)
+{
+    struct http_tx *tx = NULL;
+
+    if (code >= 400)
+        conn->hl->stat.err++;
+    // HEAD announces the body it does not send.
+    if (body && head) {
+        http_body_put(body);
+        body = NULL;
+    }
+    if (body) {
+        tx = rte_malloc_socket("nspk_http_tx", sizeof(*tx), RTE_CACHE_LINE_SIZE, rte_socket_id());
+        if (!tx) {
+            http_body_put(body);
+            return AVERROR(ENOMEM);
+        }
+        tx->body = body;
+        tx->shinfo.free_cb = http_tx_free;
+        tx->shinfo.fcb_opaque = tx;
+        rte_mbuf_ext_refcnt_set(&tx->shinfo, 1);
+    }
+    conn->hdr = http_header(conn, code, hdrs, length);
+    if (!conn->hdr) {
+        if (tx)
+            http_tx_put(tx);
+        return AVERROR(ENOMEM);
+    }
+    conn->tx = tx;
+    conn->off = tx ? off : 0;
+    conn->end = tx ? off + length : 0;
+    return 0;
+}
+
+/**
+ * Chain n bytes of the body from off to h, as mbufs attached to it. In
+ * IOVA as PA mode a page boundary splits them over two mbufs, the IOVA of
+ * each being contiguous.
+ * \return 0, or -1 with h left as it was.
+ */
+static int http_attach(struct http_conn *conn, struct rte_mbuf *h, uint64_t off, uint64_t n)
+{
+    struct http_tx *tx = conn->tx;
+    const struct http_body *b = tx->body;
+    struct rte_mbuf *m;
+    uint64_t len, k;
+    uint8_t *p;
+
+    for (len = 0; len != n; len += k) {
+        p = (uint8_t *)b->data + off + len;
+        k = n - len;
+        if (b->page_sz)
+            k = RTE_MIN(k, b->page_sz - ((uintptr_t)p & (b->page_sz - 1)));
+        m = rte_pktmbuf_alloc(conn->hl->mp);
+        if (!m)
+            goto fail;
+        rte_mbuf_ext_refcnt_update(&tx->shinfo, 1);
+        rte_pktmbuf_attach_extbuf(m, p, rte_malloc_virt2iova(p), k, &tx->shinfo);
+        m->data_len = k;
+        m->pkt_len = k;
+        if (rte_pktmbuf_chain(h, m) != 0) {
+            rte_pktmbuf_free(m);
+            goto fail;
+        }
+    }
+    return 0;
+
+fail:
+    rte_pktmbuf_free(h->next);
+    h->next = NULL;
+    h->nb_segs = 1;
+    h->pkt_len = h->data_len;
+    return -1;
+}
+
+/**
+ * Hand the reply in progress to the connection, one segment per mbuf
+ * chain: the header, or an empty mbuf holding the headroom of the TCP/IP
+ * headers, then up to an MSS of body attached to the shared body. Stops
+ * when the stream's queue is full or HTTP_TX_MAX_SEGS segments are in
+ * flight, send_cb resumes once there is room.
+ * \return 1 while the reply is not out, 0 once it is.
+ */
+static int http_conn_tx(struct http_conn *conn)
+{
+    struct nspk_http_lcore *hl = conn->hl;
+    struct netfe_stream *fs = conn->fs;
+    struct rte_mbuf *h;
+    int mss = tle_tcp_stream_get_mss(fs->s);
+    uint64_t n;
+
+    if (mss <= 0)
+        return 1;
+    while (conn->hdr || conn->off != conn->end) {
+        if (fs->pbuf.num == RTE_DIM(fs->pbuf.pkt))
+            return 1;
+        if (conn->off != conn->end && rte_mbuf_ext_refcnt_read(&conn->tx->shinfo) > HTTP_TX_MAX_SEGS)
+            return 1;
+        h = conn->hdr;
+        if (!h) {
+            h = pkt_mag_get(&fs->mag);
+            if (!h)
+                return 1;
+            h->data_len = 0;
+            h->pkt_len = 0;
+        }
+        conn->hdr = NULL;
+
+        n = RTE_MIN(conn->end - conn->off, (uint64_t)(mss - RTE_MIN(mss, (int)h->data_len)));
+        if (n && http_attach(conn, h, conn->off, n) != 0) {
+            if (h->data_len)
+                conn->hdr = h;
+            else
+                pkt_mag_put(&fs->mag, h);
+            return 1;
+        }
+        // Cannot fail, the queue has room.
+        nspk_tldk_tcp_stream_send_mbuf(fs, h);
+        conn->off += n;
+        hl->stat.segs++;
+        hl->stat.bytes += n;
+    }
+
+    if (conn->tx) {
+        http_tx_put(conn->tx);
+        conn->tx = NULL;
+    }
+    return 0;
+}
+
+/**
+ * Name of the file a request target points to, under root.
+ * \return 0, or the status code to reply with.
+ */
+static int http_target(const char *uri, char *name, size_t size)
+{
+    const char *p = uri;
+    size_t len;
+
+    if (av_strstart(p, "http://", &p)) {
+        p = strchr(p, '/');
+        if (!p)
+            p = "";
+    } else if (*p != '/') {
+        return 400;
+    }
+    p += strspn(p, "/");
+    len = strcspn(p, "?#");
+    if (len >= size)
+        return 414;
+    memcpy(name, p, len);
+    name[len] = 0;
+    if (!len || strstr(name, "..") || strchr(name, '%'))
+        return 404;
+    return 0;
+}
+
+/**
+ * Parse a single "bytes=" range of a body of size bytes. Anything else,
+ * e.g. several ranges, leaves the whole body to be sent.
+ * \return 1 with the range set, 0 to send the whole body, -1 if unsatisfiable.
+ */
+static int http_range(const char *range, uint64_t size, uint64_t *first, uint64_t *last)
+{
+    const char *p;
+    char *e;
+
+    if (!av_strstart(range, "bytes=", &p) || strchr(p, ','))
+        return 0;
+    if (*p == '-') {
+        // The last n bytes.
+        *last = strtoull(p + 1, &e, 10);
+        if (e == p + 1 || *last == 0 || size == 0)
+            return -1;
+        *first = size - RTE_MIN(*last, size);
+        *last = size - 1;
+        return 1;
+    }
+    *first = strtoull(p, &e, 10);
+    if (e == p || *e != '-')
+        return 0;
+    p = e + 1;
+    *last = *p ? strtoull(p, &e, 10) : UINT64_MAX;
+    if (*p && e == p)
+        return 0;
+    if (*first >= size || *last < *first)
+        return -1;
+    *last = RTE_MIN(*last, size - 1);
+    return 1;
+}
+
+/**
+ * Value of a header of a request, NUL terminated at CRLF.
+ */
+static int http_header_value(const char *req, const char *name, char *val, size_t size)
+{
+    size_t nlen = strlen(name);
+    const char *p, *e;
+
+    for (p = strstr(req, "\r\n"); p; p = strstr(p, "\r\n")) {
+        p += 2;
+        if (av_strncasecmp(p, name, nlen) || p[nlen] != ':')
+            continue;
+        p += nlen + 1;
+        p += strspn(p, " \t");
+        e = strstr(p, "\r\n");
+        if (!e)
+            e = p + strlen(p);
+        av_strlcpy(val, p, FFMIN(size, (size_t)(e - p) + 1));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Start the reply to one request, NUL terminated after its headers.
+ * \return 0, HTTP_DEFERRED if it is to be handled again once conn->load
+ *         is done, or negative AVERROR if the connection has to be dropped.
+ */
+static int http_request(struct http_conn *conn, const char *req)
+{
+    char method[16], uri[1024], version[16], name[HTTP_NAME_SIZE], val[64], hdrs[256];
+    struct http_body *body;
+    uint64_t first = 0, last = 0;
+    const char *type;
+    int code, playlist, head, ret;
+
+    if (sscanf(req, "%15s %1023s %15s", method, uri, version) != 3) {
+        conn->close = 1;
+        return http_reply(conn, 400, NULL, NULL, 0, 0, 0);
+    }
+    if (strcmp(version, "HTTP/1.1") && strcmp(version, "HTTP/1.0")) {
+        conn->close = 1;
+        return http_reply(conn, 505, NULL, NULL, 0, 0, 0);
+    }
+    if (http_header_value(req, "Connection", val, sizeof(val)))
+        conn->close = !av_strcasecmp(val, "close") ||
+                      (!strcmp(version, "HTTP/1.0") && av_strcasecmp(val, "keep-alive"));
+    else
+        conn->close = !strcmp(version, "HTTP/1.0");
+
+    head = !strcmp(method, "HEAD");
+    if (!head && strcmp(method, "GET"))
+        return http_reply(conn, 501, "Allow: GET, HEAD\r\n", NULL, 0, 0, 0);
+    if ((code = http_target(uri, name, sizeof(name))) != 0)
+        return http_reply(conn, code, NULL, NULL, 0, 0, 0);
+
+    ret = http_body_get(conn, name, &body);
+    if (ret == AVERROR(EINPROGRESS))
+        return HTTP_DEFERRED;
+    if (ret == AVERROR(ENOENT) || ret == AVERROR(ENOTDIR))
+        return http_reply(conn, 404, NULL, NULL, 0, 0, 0);
+    if (ret == AVERROR(EACCES))
+        return http_reply(conn, 403, NULL, NULL, 0, 0, 0);
+    if (ret == AVERROR(ENAMETOOLONG))
+        return http_reply(conn, 414, NULL, NULL, 0, 0, 0);
+    if (ret == AVERROR(ENOMEM) || ret == AVERROR(EAGAIN))
+        return http_reply(conn, 503, "Retry-After: 1\r\n", NULL, 0, 0, 0);
+    if (ret < 0)
+        return http_reply(conn, 500, NULL, NULL, 0, 0, 0);
+
+    type = http_content_type(name, &playlist);
+    snprintf(hdrs, sizeof(hdrs), "Content-Type: %s\r\nCache-Control: %s\r\nAccept-Ranges: bytes\r\n",
+             type, playlist ? "no-cache" : "max-age=3600");
+    code = 200;
+    if (http_header_value(req, "Range", val, sizeof(val)))
+        code = http_range(val, body->size, &first, &last);
+    if (code < 0) {
+        snprintf(hdrs, sizeof(hdrs), "Content-Range: bytes */%"PRIu64"\r\n", body->size);
+        http_body_put(body);
+        return http_reply(conn, 416, hdrs, NULL, 0, 0, 0);
+    }
+    if (code == 1) {
+        av_strlcatf(hdrs, sizeof(hdrs), "Content-Range: bytes %"PRIu64"-%"PRIu64"/%"PRIu64"\r\n",
+                    first, last, body->size);
+        return http_reply(conn, 206, hdrs, body, first, last - first + 1, head);
+    }
+    return http_reply(conn, 200, hdrs, body, 0, body->size, head);
+}
+
+static void http_conn_close(struct http_conn *conn)
+{
+    struct nspk_http_lcore *hl = conn->hl;
+
+    if (conn->hdr)
+        pkt_mag_put(&conn->fs->mag, conn->hdr);
+    if (conn->tx)
+        http_tx_put(conn->tx);
+    if (conn->load)
+        http_load_put(conn->load);
+    nspk_tldk_tcp_stream_close(conn->fs);
+    LIST_REMOVE(conn, link);
+    hl->nb_conn--;
+    av_free(conn);
+}
+
+/**
+ * Send the reply in progress, then serve the requests which came in
+ * meanwhile, one at a time.
+ * \return 0, or -1 if the connection was closed.
+ */
+static int http_conn_run(struct http_conn *conn)
+{
+    char *end;
+    uint32_t size;
+    int ret;
+
+    for (;;) {
+        if (http_conn_tx(conn))
+            return 0;
+        if (conn->close) {
+            // The FIN may only follow what the stream still queues.
+            if (conn->fs->pbuf.num == 0) {
+                http_conn_close(conn);
+                return -1;
+            }
+            return 0;
+        }
+        if (conn->load && !conn->load->done)
+            return 0;
+        // TLDK only raises the event again on the next arrival.
+        if (conn->rx_held) {
+            conn->rx_held = 0;
+            tle_event_raise(conn->fs->rxev);
+        }
+
+        conn->buf[conn->len] = 0;
+        if (!(end = strstr(conn->buf, "\r\n\r\n")))
+            return 0;
+        size = end + 4 - conn->buf;
+        end[2] = 0;
+        ret = http_request(conn, conn->buf);
+        // It stays in the buffer and sets close again once served.
+        if (ret == HTTP_DEFERRED) {
+            end[2] = '\r';
+            conn->close = 0;
+            return 0;
+        }
+        conn->hl->stat.req++;
+        if (ret < 0) {
+            http_conn_close(conn);
+            return -1;
+        }
+        // GET and HEAD have no body, whatever follows the headers is the next request.
+        conn->len -= size;
+        memmove(conn->buf, conn->buf + size, conn->len);
+    }
+}
+
+/**
+ * Move what TLDK received to the request buffer and serve it. Requests
+ * too large for the buffer close the connection. During a reply nothing
+ * is read: the buffer may still hold the next requests, and what the
+ * client pipelines behind them waits in the stream's receive window.
+ */
+static uint32_t http_conn_rx(struct netfe_stream *fs)
+{
+    struct http_conn *conn = fs->udata;
+    struct rte_mbuf *pkts[MAX_PKT_BURST];
+    uint32_t i, k, n, len;
+    const void *data;
+    int mss, over = 0;
+
+    if (conn->tx || conn->hdr || conn->load) {
+        conn->rx_held = 1;
+        return 0;
+    }
+    // As many segments as the buffer has room for, TLDK raises the event again for the rest.
+    mss = tle_tcp_stream_get_mss(fs->s);
+    k = mss > 0 ? (NSPK_HTTP_REQ_SIZE - conn->len) / mss : 1;
+    k = RTE_MIN(RTE_MAX(k, 1U), RTE_DIM(pkts));
+    n = tle_tcp_stream_recv(fs->s, pkts, k);
+    fs->stat.rxp += n;
+    for (i = 0; i != n; i++) {
+        len = pkts[i]->pkt_len;
+        fs->stat.rxb += len;
+        if (len > NSPK_HTTP_REQ_SIZE - conn->len) {
+            over = 1;
+        } else {
+            data = rte_pktmbuf_read(pkts[i], 0, len, conn->buf + conn->len);
+            if (data != conn->buf + conn->len)
+                memcpy(conn->buf + conn->len, data, len);
+            conn->len += len;
+        }
+        rte_pktmbuf_free(pkts[i]);
+    }
+    // Between replies the buffer only holds the start of a request.
+    if (over) {
+        conn->close = 1;
+        conn->len = 0;
+        if (http_reply(conn, 413, NULL, NULL, 0, 0, 0) < 0) {
+            http_conn_close(conn);
+            return n;
+        }
+    }
+    http_conn_run(conn);
+    return n;
+}
+
+/**
+ * Take back the bodies the loader read and serve the requests which
+ * waited for them.
+ */
+static void http_load_timer_cb(struct rte_timer *tim, void *arg)
+{
+    struct nspk_http_lcore *hl = arg;
+    struct http_conn *conn, *next;
+    struct http_load *ld;
+
+    while (rte_ring_sc_dequeue(hl->loaded, (void **)&ld) == 0) {
+        LIST_REMOVE(ld, link);
+        hl->nb_loading--;
+        ld->done = 1;
+        if (ld->ret >= 0)
+            http_cache_add(hl, ld->body);
+        else
+            av_log(NULL, AV_LOG_WARNING, "HTTP: cannot read '%s': %s\n", ld->path, av_err2str(ld->ret));
+        // The last request served must not free it under the loop.
+        ld->nb_wait++;
+        for (conn = LIST_FIRST(&hl->conn); conn; conn = next) {
+            next = LIST_NEXT(conn, link);
+            if (conn->load == ld)
+                http_conn_run(conn);
+        }
+        http_load_put(ld);
+    }
+}
+
+static int http_loader_start(struct nspk_http_lcore *hl)
+{
+    char name[RTE_RING_NAMESIZE];
+    rte_cpuset_t cpuset;
+    pthread_attr_t attr;
+    int ret;
+
+    snprintf(name, sizeof(name), "nspk_http_load_%u", rte_lcore_id());
+    hl->load = rte_ring_create(name, rte_align32pow2(NSPK_HTTP_MAX_LOAD + 1), rte_socket_id(),
+                               RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (!hl->load) {
+        av_log(NULL, AV_LOG_ERROR, "%s: Could not create ring %s\n", __func__, name);
+        return AVERROR(rte_errno);
+    }
+    snprintf(name, sizeof(name), "nspk_http_loaded_%u", rte_lcore_id());
+    hl->loaded = rte_ring_create(name, rte_align32pow2(NSPK_HTTP_MAX_LOAD + 1), rte_socket_id(),
+                                 RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (!hl->loaded) {
+        av_log(NULL, AV_LOG_ERROR, "%s: Could not create ring %s\n", __func__, name);
+        return AVERROR(rte_errno);
+    }
+
+    // A thread started from an lcore inherits its affinity.
+    pthread_attr_init(&attr);
+    nspk_cpu_worker_set(&cpuset);
+    if (CPU_COUNT(&cpuset))
+        pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+    else
+        av_log(NULL, AV_LOG_WARNING, "HTTP: no CPU left for the loader of lcore %u\n", rte_lcore_id());
+    ret = pthread_create(&hl->loader, &attr, http_loader, hl);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: pthread_create failed: %s\n", __func__, strerror(ret));
+        return AVERROR(ret);
+    }
+    hl->loader_started = 1;
+
+    snprintf(name, sizeof(name), "nspk-http-%u", rte_lcore_id());
+    name[15] = '\0';
+    pthread_setname_np(hl->loader, name);
+    return 0;
+}
+
+static void http_conn_send(struct netfe_stream *fs)
+{
+    http_conn_run(fs->udata);
+}
+
+static void http_conn_err(struct netfe_stream *fs)
+{
+    http_conn_close(fs->udata);
+}
+
+static uint32_t http_listen_rx(struct netfe_stream *ls)
+{
+    struct nspk_http_lcore *hl = ls->udata;
+    struct netfe_stream *fs[MAX_PKT_BURST];
+    struct http_conn *conn;
+    uint32_t i, n;
+
+    n = nspk_tldk_tcp_stream_accept(hl->lcore_prm, ls, fs, RTE_DIM(fs));
+    for (i = 0; i != n; i++) {
+        conn = hl->nb_conn < nspk_http_prm.max_conn ? av_mallocz(sizeof(*conn)) : NULL;
+        if (!conn) {
+            hl->stat.rej++;
+            nspk_tldk_tcp_stream_close(fs[i]);
+            continue;
+        }
+        conn->hl = hl;
+        conn->fs = fs[i];
+        fs[i]->udata = conn;
+        fs[i]->rx_cb = http_conn_rx;
+        fs[i]->err_cb = http_conn_err;
+        fs[i]->send_cb = http_conn_send;
+        LIST_INSERT_HEAD(&hl->conn, conn, link);
+        hl->nb_conn++;
+        hl->stat.acc++;
+    }
+    return n;
+}
+
+int nspk_http_lcore_init(struct lcore_prm *lcore_prm)
+{
+    struct netbe_lcore *lc = RTE_PER_LCORE(_be);
+    struct nspk_http_lcore *hl;
+    struct netfe_sprm sprm;
+    struct netfe_stream *ls;
+    uint32_t port, last = nspk_http_prm.port + nspk_http_prm.nb_port;
+    int ret;
+
+    hl = av_mallocz(sizeof(*hl));
+    if (!hl)
+        return AVERROR(ENOMEM);
+    hl->lcore_prm = lcore_prm;
+    hl->mp = mpool[rte_lcore_to_socket_id(rte_lcore_id()) + 1];
+    LIST_INIT(&hl->conn);
+    LIST_INIT(&hl->loading);
+    rte_timer_init(&hl->load_timer);
+    RTE_PER_LCORE(_http) = hl;
+
+    for (port = nspk_http_prm.port; port != last; port++) {
+        if (!nspk_tldk_port_owned(lc, port))
+            continue;
+
+        memset(&sprm, 0, sizeof(sprm));
+        nspk_tldk_sockaddr_fill(&sprm.local_addr, NULL, port);
+        nspk_tldk_sockaddr_fill(&sprm.remote_addr, NULL, 0);
+        ls = nspk_tldk_tcp_stream_listen(lcore_prm, &sprm);
+        if (!ls) {
+            ret = AVERROR(rte_errno);
+            av_log(NULL, AV_LOG_ERROR, "HTTP: cannot listen on port %u: %s\n", port, av_err2str(ret));
+            nspk_http_lcore_fini();
+            return ret;
+        }
+        ls->udata = hl;
+        ls->rx_cb = http_listen_rx;
+        hl->listen[hl->nb_listen++] = ls;
+        av_log(NULL, AV_LOG_INFO, "HTTP origin listening on port %u, lcore %u\n", port, rte_lcore_id());
+    }
+    // Lcores without a listening port never get a request.
+    if (!hl->nb_listen)
+        return 0;
+
+    if ((ret = http_loader_start(hl)) < 0) {
+        nspk_http_lcore_fini();
+        return ret;
+    }
+    rte_timer_reset(&hl->load_timer, rte_get_tsc_hz() * HTTP_LOAD_POLL_MS / MS_PER_S, PERIODICAL,
+                    rte_lcore_id(), http_load_timer_cb, hl);
+    return 0;
+}
+
+void nspk_http_lcore_fini(void)
+{
+    struct nspk_http_lcore *hl = RTE_PER_LCORE(_http);
+    struct http_load *ld;
+    uint32_t i;
+
+    if (!hl)
+        return;
+
+    rte_timer_stop(&hl->load_timer);
+    while (!LIST_EMPTY(&hl->conn))
+        http_conn_close(LIST_FIRST(&hl->conn));
+    for (i = 0; i != hl->nb_listen; i++)
+        nspk_tldk_tcp_stream_close(hl->listen[i]);
+    // No request waits any more, the loads in flight only have their body to free.
+    if (hl->loader_started) {
+        __atomic_store_n(&hl->loader_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(hl->loader, NULL);
+    }
+    while ((ld = LIST_FIRST(&hl->loading))) {
+        LIST_REMOVE(ld, link);
+        http_load_free(ld);
+    }
+    rte_ring_free(hl->load);
+    rte_ring_free(hl->loaded);
+    while (hl->nb_body)
+        http_cache_remove(hl, hl->nb_body - 1);
+
+    RTE_LOG(NOTICE, USER1, "%s(lcore=%u) HTTP connections: %"PRIu64" accepted, %"PRIu64" rejected; "
+            "requests: %"PRIu64", %"PRIu64" failed; cache: %"PRIu64" hits, %"PRIu64" misses; "
+            "%"PRIu64" segments, %"PRIu64" body bytes sent\n",
+            __func__, rte_lcore_id(), hl->stat.acc, hl->stat.rej, hl->stat.req, hl->stat.err,
+            hl->stat.hit, hl->stat.miss, hl->stat.segs, hl->stat.bytes);
+    av_free(hl);
+    RTE_PER_LCORE(_http) = NULL;
+}
@@ -0,0 +1,138 @@
+/**
+ * NSPK RTP reorder and jitter buffer.
+ * One per received SSRC: a ring of mbufs indexed by sequence number, played
+ * out in order a fixed delay after arrival.
+ */
+
+#include <rte_cycles.h>
+#include <nspk.h>
+#include <nspk_jitter.h>
+
+int nspk_jitter_init(struct nspk_jitter_t *jb, uint32_t ssrc, uint32_t size, uint32_t delay_us)
+{
+    memset(jb, 0, sizeof(*jb));
+
+    if (size == 0)
+        size = NSPK_JITTER_DEFAULT_SIZE;
+    if (!rte_is_power_of_2(size) || size > NSPK_JITTER_MAX_SIZE) {
+        av_log(NULL, AV_LOG_ERROR, "%s: size %u is not a power of 2 up to %u\n", __func__,
+               size, NSPK_JITTER_MAX_SIZE);
+        return AVERROR(EINVAL);
+    }
+
+    jb->slot = av_mallocz_array(size, sizeof(*jb->slot));
+    if (!jb->slot)
+        return AVERROR(ENOMEM);
+    jb->ssrc = ssrc;
+    jb->size = size;
+    jb->mask = size - 1;
+    jb->delay = rte_get_tsc_hz() * delay_us / US_PER_S;
+    return 0;
+}
+
+/**
+ * Drop everything held and start over at sequence number seq.
+ */
+static void jitter_reset(struct nspk_jitter_t *jb, uint16_t seq)
+{
+    struct nspk_jitter_slot_t *sl;
+    uint16_t i;
+
+    for (i = jb->head; jb->count != 0; i++) {
+        sl = &jb->slot[i & jb->mask];
+        if (sl->m != NULL) {
+            rte_pktmbuf_free(sl->m);
+            sl->m = NULL;
+            jb->count--;
+            jb->lost++;
+        }
+    }
+
+    jb->head = seq;
+    jb->max_seq = seq - 1;
+}
+
+void nspk_jitter_fini(struct nspk_jitter_t *jb)
+{
+    if (!jb->slot)
+        return;
+
+    jitter_reset(jb, 0);
+    av_freep(&jb->slot);
+}
+
+uint32_t nspk_jitter_insert(struct nspk_jitter_t *jb, struct rte_mbuf *m, uint16_t seq,
+                            uint64_t now, uint16_t *gap_first)
+{
+    struct nspk_jitter_slot_t *sl;
+    uint32_t i, gap = 0;
+    int32_t d;
+
+    jb->received++;
+    if (!jb->started) {
+        jb->started = 1;
+        jitter_reset(jb, seq);
+    }
+
+    d = (int16_t)(seq - jb->head);
+    if (d < 0 && d >= -(int32_t)jb->size) {
+        rte_pktmbuf_free(m);
+        jb->late++;
+        return 0;
+    }
+    // Far off either way: the source restarted or lost more than the ring holds.
+    if (d < 0 || d >= (int32_t)jb->size) {
+        jitter_reset(jb, seq);
+        jb->resyncs++;
+    }
+
+    sl = &jb->slot[seq & jb->mask];
+    if (sl->m != NULL) {
+        rte_pktmbuf_free(m);
+        jb->dups++;
+        return 0;
+    }
+    sl->m = m;
+    sl->tsc = now;
+    jb->count++;
+
+    if ((int16_t)(seq - jb->max_seq) > 0) {
+        gap = (uint16_t)(seq - jb->max_seq - 1);
+        if (gap != 0)
+            *gap_first = jb->max_seq + 1;
+        // The wait for the packets skipped starts with this one.
+        for (i = 0; i != gap; i++)
+            jb->slot[(uint16_t)(jb->max_seq + 1 + i) & jb->mask].tsc = now;
+        jb->max_seq = seq;
+    }
+
+    return gap;
+}
+
+struct rte_mbuf *nspk_jitter_pop(struct nspk_jitter_t *jb, uint64_t now)
+{
+    struct nspk_jitter_slot_t *sl;
+    struct rte_mbuf *m;
+
+    while (jb->count != 0) {
+        sl = &jb->slot[jb->head & jb->mask];
+        if (sl->m != NULL) {
+            if (now - sl->tsc < jb->delay)
+                return NULL;
+            m = sl->m;
+            sl->m = NULL;
+            jb->count--;
+            jb->head++;
+            jb->played++;
+            return m;
+        }
+
+        // The head is missing: wait for it a playout delay after the first packet behind it arrived.
+        if (now - sl->tsc < jb->delay)
+            return NULL;
+        jb->head++;
+        jb->lost++;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,89 @@
+/**
+ * NSPK ABR ladder.
+ * The renditions a session encodes from its decoded video, read from the
+ * file named by ?ladder=<file> in its destination URL.
+ */
+
+#include <libavutil/avstring.h>
+#include <libavutil/parseutils.h>
+
+#include <nspk.h>
+#include <nspk_ladder.h>
+
+static int ladder_rung_parse(struct nspk_ladder_rung_t *rung, char *s)
+{
+    char *size, *kbps, *url, *fps, *e, *save;
+    long n;
+
+    size = av_strtok(s, " \t", &save);
+    kbps = av_strtok(NULL, " \t", &save);
+    url = av_strtok(NULL, " \t", &save);
+    if (!size || !kbps || !url || av_strtok(NULL, " \t", &save))
+        return AVERROR(EINVAL);
+
+    rung->fps = (AVRational){ 0, 1 };
+    if ((fps = strchr(size, '@'))) {
+        *fps++ = '\0';
+        if (av_parse_video_rate(&rung->fps, fps) < 0)
+            return AVERROR(EINVAL);
+    }
+    // Even sizes, as 4:2:0 chroma takes them.
+    if (av_parse_video_size(&rung->width, &rung->height, size) < 0 ||
+        (rung->width & 1) || (rung->height & 1))
+        return AVERROR(EINVAL);
+
+    n = strtol(kbps, &e, 10);
+    if (e == kbps || *e || n <= 0 || n > INT32_MAX / 1000)
+        return AVERROR(EINVAL);
+    rung->kbps = n;
+
+    if (!av_strstart(url, "rtp://", NULL) || strlen(url) >= sizeof(rung->url))
+        return AVERROR(EINVAL);
+    av_strlcpy(rung->url, url, sizeof(rung->url));
+    return 0;
+}
+
+int nspk_ladder_load(struct nspk_ladder_t *ladder, const char *path)
+{
+    char line[FILENAME_MAX + 64];
+    char *s, *e;
+    FILE *fp;
+    int ln = 0;
+    int ret = 0;
+
+    memset(ladder, 0, sizeof(*ladder));
+    fp = fopen(path, "r");
+    if (!fp) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not open ladder '%s'\n", path);
+        return ret;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        ln++;
+        if ((e = strchr(line, '#')))
+            *e = '\0';
+        for (s = line; av_isspace(*s); s++)
+            ;
+        for (e = s + strlen(s); e > s && av_isspace(e[-1]); e--)
+            ;
+        *e = '\0';
+        if (*s == '\0')
+            continue;
+
+        if (ladder->nb_rungs == NSPK_LADDER_MAX_RUNGS) {
+            av_log(NULL, AV_LOG_ERROR, "%s:%d: more than %d rungs\n", path, ln, NSPK_LADDER_MAX_RUNGS);
+            ret = AVERROR(E2BIG);
+            break;
+        }
+        if ((ret = ladder_rung_parse(&ladder->rung[ladder->nb_rungs], s)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "%s:%d: expected \"<width>x<height>[@<fps>] <kbps> <rtp_url>\"\n",
+                   path, ln);
+            break;
+        }
+        ladder->nb_rungs++;
+    }
+
+    fclose(fp);
+    return ret < 0 ? ret : ladder->nb_rungs;
+}
@@ -0,0 +1,155 @@
+/**
+ * NSPK per stream RTP pacer.
+ * A token bucket clocked by rte_rdtsc() releases the packets of each stream
+ * spread over the frame interval, replacing bursts of whole frames.
+ */
+
+#include <rte_cycles.h>
+#include <nspk.h>
+#include <nspk_pacer.h>
+
+#define PACER_QUEUE_MASK    (NSPK_PACER_QUEUE_SIZE - 1)
+
+/* Pacers attached to this lcore. */
+static RTE_DEFINE_PER_LCORE(struct nspk_pacer_list, _pacers);
+
+static inline uint32_t pacer_count(const struct nspk_pacer_t *p)
+{
+    return p->tail - p->head;
+}
+
+static void pacer_send(struct nspk_pacer_t *p, struct rte_mbuf *m)
+{
+    uint32_t len = m->pkt_len;
+
+    if (nspk_tldk_udp_stream_send_mbuf(p->fs, m) < 0) {
+        pkt_mag_put(&p->fs->mag, m);
+        p->drops++;
+        return;
+    }
+    p->packets++;
+    p->octets += len;
+}
+
+static struct rte_mbuf *pacer_dequeue(struct nspk_pacer_t *p)
+{
+    struct rte_mbuf *m = p->q[p->head++ & PACER_QUEUE_MASK];
+
+    p->q_bytes -= m->pkt_len;
+    return m;
+}
+
+void nspk_pacer_init(struct nspk_pacer_t *p, struct netfe_stream *fs,
+                     uint64_t min_rate, uint64_t depth)
+{
+    uint64_t hz = rte_get_tsc_hz();
+
+    RTE_BUILD_BUG_ON(!rte_is_power_of_2(NSPK_PACER_QUEUE_SIZE));
+
+    memset(p, 0, sizeof(*p));
+    p->fs = fs;
+    p->min_rate = min_rate;
+    p->depth = depth ? depth : NSPK_PACER_BURST_PKTS * NSPK_PACER_MTU;
+    // The scaled bucket must fit in 64 bits.
+    p->depth = RTE_MIN(p->depth, UINT64_MAX / hz);
+    p->credit = p->depth * hz;
+    p->last_tsc = rte_rdtsc();
+
+    LIST_INSERT_HEAD(&RTE_PER_LCORE(_pacers), p, link);
+}
+
+void nspk_pacer_fini(struct nspk_pacer_t *p)
+{
+    LIST_REMOVE(p, link);
+
+    while (pacer_count(p) != 0) {
+        pkt_mag_put(&p->fs->mag, pacer_dequeue(p));
+        p->drops++;
+    }
+}
+
+int nspk_pacer_enqueue(struct nspk_pacer_t *p, struct rte_mbuf *m)
+{
+    if (pacer_count(p) == NSPK_PACER_QUEUE_SIZE) {
+        pacer_send(p, pacer_dequeue(p));
+        p->overflows++;
+    }
+
+    p->q[p->tail++ & PACER_QUEUE_MASK] = m;
+    p->q_bytes += m->pkt_len;
+    return m->pkt_len;
+}
+
+int nspk_pacer_sink(void *opaque, struct rte_mbuf *m)
+{
+    return nspk_pacer_enqueue((struct nspk_pacer_t *)opaque, m);
+}
+
+void nspk_pacer_spread(struct nspk_pacer_t *p, uint64_t interval)
+{
+    uint64_t hz = rte_get_tsc_hz();
+
+    if (interval == 0)
+        interval = hz * NSPK_PACER_DEFAULT_FRAME_US / US_PER_S;
+
+    // Never 0, which would leave the stream unpaced.
+    p->rate = RTE_MAX(p->q_bytes * hz / interval, 1);
+}
+
+uint32_t nspk_pacer_run(struct nspk_pacer_t *p, uint64_t now)
+{
+    uint64_t hz = rte_get_tsc_hz();
+    uint64_t cap = p->depth * hz;
+    uint64_t rate = RTE_MAX(p->rate, p->min_rate);
+    uint64_t elapsed, need;
+    struct rte_mbuf *m;
+    uint32_t n = 0;
+
+    if (rate == 0) {
+        while (pacer_count(p) != 0) {
+            pacer_send(p, pacer_dequeue(p));
+            n++;
+        }
+        return n;
+    }
+
+    elapsed = now - p->last_tsc;
+    p->last_tsc = now;
+    if (elapsed > (cap - p->credit) / rate)
+        p->credit = cap;
+    else
+        p->credit += elapsed * rate;
+
+    while (pacer_count(p) != 0) {
+        m = p->q[p->head & PACER_QUEUE_MASK];
+        need = (uint64_t)m->pkt_len * hz;
+        // A packet larger than the bucket goes once the bucket is full.
+        if (p->credit < need && p->credit < cap)
+            break;
+        p->credit = p->credit > need ? p->credit - need : 0;
+        pacer_send(p, pacer_dequeue(p));
+        n++;
+    }
+
+    return n;
+}
+
+void nspk_pacer_flush(struct nspk_pacer_t *p)
+{
+    while (pacer_count(p) != 0)
+        pacer_send(p, pacer_dequeue(p));
+    nspk_tldk_udp_stream_flush(p->fs);
+}
+
+uint32_t nspk_pacer_lcore_run(void)
+{
+    struct nspk_pacer_t *p;
+    uint64_t now = rte_rdtsc();
+    uint32_t n = 0;
+
+    LIST_FOREACH(p, &RTE_PER_LCORE(_pacers), link) {
+        if (pacer_count(p) != 0)
+            n += nspk_pacer_run(p, now);
+    }
+    return n;
+}
@@ -0,0 +1,307 @@
+/**
+ * NSPK in-lcore RTCP.
+ * Sender Reports go out through TLDK from an rte_timer of the lcore which
+ * runs the stream, Receiver Reports are parsed as they arrive on the same
+ * lcore. Nothing goes through the kernel or another thread.
+ */
+
+#include <rte_cycles.h>
+#include <rte_random.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/time.h>
+#include <libavformat/rtp.h>
+
+#include <nspk.h>
+#include <nspk_rtcp.h>
+#include <nspk_rtx.h>
+
+#define RTCP_SR_SIZE        28
+#define RTCP_RR_HDR_SIZE    8
+#define RTCP_BLOCK_SIZE     24
+#define RTCP_BYE_SIZE       8
+#define RTCP_SDES_CNAME     1
+#define RTCP_FB_HDR_SIZE    12
+#define RTCP_FMT_NACK       1
+
+/* Seconds from 1900, the NTP epoch, to 1970. */
+#define NTP_OFFSET          2208988800ULL
+
+/* Wall clock, in microseconds since 1900, read at TSC _tsc_base. */
+static RTE_DEFINE_PER_LCORE(uint64_t, _ntp_base_us);
+static RTE_DEFINE_PER_LCORE(uint64_t, _tsc_base);
+
+uint64_t nspk_rtcp_ntp_time(uint64_t tsc)
+{
+    uint64_t hz = rte_get_tsc_hz();
+    uint64_t d = tsc - RTE_PER_LCORE(_tsc_base);
+    uint64_t us;
+
+    us = RTE_PER_LCORE(_ntp_base_us) + d / hz * US_PER_S + d % hz * US_PER_S / hz;
+    return (us / US_PER_S) << 32 | ((us % US_PER_S) << 32) / US_PER_S;
+}
+
+/**
+ * RTP timestamp of the stream at a TSC, extrapolated from the last packet sent.
+ */
+static uint32_t rtcp_rtp_time(const struct nspk_rtp_pktzr_t *pz, uint64_t tsc)
+{
+    uint64_t hz = rte_get_tsc_hz();
+    uint64_t d;
+
+    if (pz->cur_tsc == 0 || tsc < pz->cur_tsc)
+        return pz->cur_ts;
+    d = tsc - pz->cur_tsc;
+    return pz->cur_ts + (uint32_t)(d / hz * pz->clock_rate + d % hz * pz->clock_rate / hz);
+}
+
+/**
+ * Write an SDES chunk with our CNAME, padded to 32 bits.
+ * \return Its length.
+ */
+static int rtcp_put_sdes(const struct nspk_rtcp_t *r, uint8_t *p)
+{
+    // Header, SSRC, CNAME item and the END item.
+    int len = (RTCP_RR_HDR_SIZE + 2 + r->cname_len + 1 + 3) & ~3;
+
+    memset(p, 0, len);
+    p[0] = (NSPK_RTP_VERSION << 6) | 1;
+    p[1] = RTCP_SDES;
+    AV_WB16(p + 2, len / 4 - 1);
+    AV_WB32(p + 4, r->pktzr->ssrc);
+    p[8] = RTCP_SDES_CNAME;
+    p[9] = r->cname_len;
+    memcpy(p + 10, r->cname, r->cname_len);
+    return len;
+}
+
+/**
+ * Queue a compound SR + SDES packet, followed by a BYE if bye is set.
+ */
+static void rtcp_send(struct nspk_rtcp_t *r, uint64_t now, int bye)
+{
+    const struct nspk_rtp_pktzr_t *pz = r->pktzr;
+    struct netfe_stream *fs = r->tcp ? r->tcp->tcp->fs : r->fs;
+    uint32_t packets, octets;
+    struct rte_mbuf *m;
+    uint8_t *p;
+    int len, ret;
+
+    m = fs ? pkt_mag_get(&fs->mag) : NULL;
+    if (m == NULL) {
+        r->drops++;
+        return;
+    }
+    p = rte_pktmbuf_mtod(m, uint8_t *);
+
+    if (r->tcp) {
+        packets = r->tcp_rtp->packets;
+        octets = r->tcp_rtp->octets;
+    } else {
+        packets = r->rtp_fs->stat.txp;
+        octets = r->rtp_fs->stat.txb - r->rtp_fs->stat.txp * NSPK_RTP_HDR_SIZE;
+    }
+
+    p[0] = NSPK_RTP_VERSION << 6;
+    p[1] = RTCP_SR;
+    AV_WB16(p + 2, RTCP_SR_SIZE / 4 - 1);
+    AV_WB32(p + 4, pz->ssrc);
+    AV_WB64(p + 8, nspk_rtcp_ntp_time(now));
+    AV_WB32(p + 16, rtcp_rtp_time(pz, now));
+    AV_WB32(p + 20, packets);
+    AV_WB32(p + 24, octets);
+    len = RTCP_SR_SIZE;
+    len += rtcp_put_sdes(r, p + len);
+    if (bye) {
+        p[len] = (NSPK_RTP_VERSION << 6) | 1;
+        p[len + 1] = RTCP_BYE;
+        AV_WB16(p + len + 2, RTCP_BYE_SIZE / 4 - 1);
+        AV_WB32(p + len + 4, pz->ssrc);
+        len += RTCP_BYE_SIZE;
+    }
+    m->data_len = len;
+    m->pkt_len = len;
+
+    ret = r->tcp ? nspk_rtp_tcp_send(r->tcp, m) : nspk_tldk_udp_stream_queue_mbuf(r->fs, m);
+    if (ret < 0) {
+        pkt_mag_put(&fs->mag, m);
+        r->drops++;
+        return;
+    }
+    r->srs++;
+}
+
+static void rtcp_timer_cb(struct rte_timer *tim, void *arg);
+
+static void rtcp_schedule(struct nspk_rtcp_t *r)
+{
+    uint64_t ticks = r->interval / 2 + rte_rand() % r->interval;
+
+    rte_timer_reset(&r->timer, ticks, SINGLE, rte_lcore_id(), rtcp_timer_cb, r);
+}
+
+static void rtcp_timer_cb(struct rte_timer *tim, void *arg)
+{
+    struct nspk_rtcp_t *r = arg;
+
+    RTE_SET_USED(tim);
+    rtcp_send(r, rte_rdtsc(), 0);
+    rtcp_schedule(r);
+}
+
+/**
+ * Take the report blocks about our SSRC out of an SR or RR.
+ */
+static void rtcp_parse_blocks(struct nspk_rtcp_t *r, uint32_t ssrc, const uint8_t *p,
+                              int count, int len, uint64_t now)
+{
+    struct nspk_rtcp_report_t *rr = &r->rr;
+    uint32_t lsr, dlsr, rtt;
+
+    for (; count > 0 && len >= RTCP_BLOCK_SIZE; count--, p += RTCP_BLOCK_SIZE, len -= RTCP_BLOCK_SIZE) {
+        if (AV_RB32(p) != r->pktzr->ssrc)
+            continue;
+
+        rr->ssrc = ssrc;
+        rr->fraction_lost = p[4];
+        rr->cum_lost = (int32_t)(AV_RB24(p + 5) << 8) >> 8;
+        rr->ext_max_seq = AV_RB32(p + 8);
+        rr->jitter_us = (uint64_t)AV_RB32(p + 12) * US_PER_S / r->pktzr->clock_rate;
+        // Round trip in 1/65536 s: now - LSR - DLSR, meaningful once an SR was seen.
+        lsr = AV_RB32(p + 16);
+        dlsr = AV_RB32(p + 20);
+        if (lsr != 0) {
+            rtt = (uint32_t)(nspk_rtcp_ntp_time(now) >> 16) - lsr - dlsr;
+            if ((int32_t)rtt >= 0)
+                rr->rtt_us = (uint64_t)rtt * US_PER_S >> 16;
+        }
+        rr->tsc = now;
+        r->rrs++;
+    }
+}
+
+/**
+ * Resend what a Generic NACK about our SSRC asks for.
+ */
+static void rtcp_parse_nack(struct nspk_rtcp_t *r, const uint8_t *p, int len)
+{
+    if (!r->rtx || AV_RB32(p + 8) != r->pktzr->ssrc)
+        return;
+
+    r->nacks++;
+    for (p += RTCP_FB_HDR_SIZE, len -= RTCP_FB_HDR_SIZE; len >= 4; p += 4, len -= 4)
+        nspk_rtx_nack(r->rtx, AV_RB16(p), AV_RB16(p + 2));
+}
+
+/**
+ * Walk a compound RTCP packet. Anything but SR, RR and Generic NACK is skipped.
+ */
+static void rtcp_parse(struct nspk_rtcp_t *r, const uint8_t *p, int len, uint64_t now)
+{
+    int plen;
+
+    while (len >= 4) {
+        plen = (AV_RB16(p + 2) + 1) * 4;
+        if ((p[0] & 0xc0) != (NSPK_RTP_VERSION << 6) || plen > len) {
+            r->invalid++;
+            return;
+        }
+
+        if (p[1] == RTCP_SR && plen >= RTCP_SR_SIZE)
+            rtcp_parse_blocks(r, AV_RB32(p + 4), p + RTCP_SR_SIZE, p[0] & 0x1f,
+                              plen - RTCP_SR_SIZE, now);
+        else if (p[1] == RTCP_RR && plen >= RTCP_RR_HDR_SIZE)
+            rtcp_parse_blocks(r, AV_RB32(p + 4), p + RTCP_RR_HDR_SIZE, p[0] & 0x1f,
+                              plen - RTCP_RR_HDR_SIZE, now);
+        else if (p[1] == RTCP_RTPFB && (p[0] & 0x1f) == RTCP_FMT_NACK && plen >= RTCP_FB_HDR_SIZE)
+            rtcp_parse_nack(r, p, plen);
+
+        p += plen;
+        len -= plen;
+    }
+}
+
+static uint32_t rtcp_rx_event(struct netfe_stream *fs)
+{
+    struct nspk_rtcp_t *r = fs->udata;
+    struct rte_mbuf *pkts[MAX_PKT_BURST];
+    uint64_t now = rte_rdtsc();
+    uint32_t i, n;
+
+    n = tle_udp_stream_recv(fs->s, pkts, RTE_DIM(pkts));
+    fs->stat.rxp += n;
+    for (i = 0; i != n; i++) {
+        if (rte_pktmbuf_is_contiguous(pkts[i]))
+            rtcp_parse(r, rte_pktmbuf_mtod(pkts[i], const uint8_t *), pkts[i]->data_len, now);
+        else
+            r->invalid++;
+        rte_pktmbuf_free(pkts[i]);
+    }
+    return n;
+}
+
+/**
+ * Common part of both transports, once the streams are set.
+ */
+static void rtcp_start(struct nspk_rtcp_t *r, const struct nspk_rtp_pktzr_t *pktzr)
+{
+    r->pktzr = pktzr;
+    r->interval = rte_get_tsc_hz() * NSPK_RTCP_INTERVAL_MS / MS_PER_S;
+    r->cname_len = snprintf((char *)r->cname, sizeof(r->cname), "nspk-%08x@%u",
+                            pktzr->ssrc, rte_lcore_id());
+
+    // One wall clock reading per lcore, the TSC does the rest.
+    if (RTE_PER_LCORE(_tsc_base) == 0) {
+        RTE_PER_LCORE(_tsc_base) = rte_rdtsc();
+        RTE_PER_LCORE(_ntp_base_us) = av_gettime() + NTP_OFFSET * US_PER_S;
+    }
+
+    rte_timer_init(&r->timer);
+    rtcp_schedule(r);
+}
+
+void nspk_rtcp_init(struct nspk_rtcp_t *r, struct netfe_stream *fs, struct netfe_stream *rtp_fs,
+                    const struct nspk_rtp_pktzr_t *pktzr)
+{
+    memset(r, 0, sizeof(*r));
+    r->fs = fs;
+    r->rtp_fs = rtp_fs;
+    fs->udata = r;
+    fs->rx_cb = rtcp_rx_event;
+    rtcp_start(r, pktzr);
+}
+
+void nspk_rtcp_init_tcp(struct nspk_rtcp_t *r, struct nspk_rtp_tcp_chan_t *rtcp_chan,
+                        const struct nspk_rtp_tcp_chan_t *rtp_chan, const struct nspk_rtp_pktzr_t *pktzr)
+{
+    memset(r, 0, sizeof(*r));
+    r->tcp = rtcp_chan;
+    r->tcp_rtp = rtp_chan;
+    rtcp_chan->rtcp = r;
+    rtcp_start(r, pktzr);
+}
+
+void nspk_rtcp_input(struct nspk_rtcp_t *r, const uint8_t *buf, int len)
+{
+    rtcp_parse(r, buf, len, rte_rdtsc());
+}
+
+void nspk_rtcp_fini(struct nspk_rtcp_t *r)
+{
+    rte_timer_stop(&r->timer);
+    if (r->tcp) {
+        r->tcp->rtcp = NULL;
+        // The BYE leaves with the next nspk_tldk_lcore_flush(), if the connection is still up.
+        rtcp_send(r, rte_rdtsc(), 1);
+        return;
+    }
+    r->fs->rx_cb = NULL;
+    r->fs->udata = NULL;
+
+    rtcp_send(r, rte_rdtsc(), 1);
+    nspk_tldk_udp_stream_flush(r->fs);
+}
+
+void nspk_rtcp_lcore_run(void)
+{
+    rte_timer_manage();
+}
@@ -18,13 +18,16 @@
 #include <libavutil/timestamp.h>
 #include <libavutil/avassert.h>
 #include <libavutil/avstring.h>
+#include <libavutil/bprint.h>
 #include <libavutil/internal.h>
 #include <libavutil/mathematics.h>
+#include <libavutil/time.h>
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
 #include <libavformat/url.h>
+#include <libavformat/rtp.h>
 
 // FIXME
 // TEST PURPOSE ONLY
@@ -33,31 +36,35 @@
 
 #define AV_PKT_FLAG_UNCODED_FRAME 0x2000
 
-static AVFormatContext *ifmt_ctx;
-static AVFormatContext *ofmt_ctx;
-static struct filtering_ctx_t *filter_ctx = NULL;
-static struct stream_ctx_t *stream_ctx = NULL;
-
 static int open_input_file(struct nspk_rtp_session_ctx_t *rtp_sess)
 {
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    struct stream_ctx_t *stream_ctx;
+    AVFormatContext *ifmt_ctx;
     int ret;
     unsigned int i;
     char *filename = rtp_sess->src_url; 
+    // Feeds received through TLDK, the other URLs go to libavformat.
+    AVInputFormat *ifmt = nspk_ingest_supported(filename) ? &nspk_ingest_demuxer : NULL;
 
-    ifmt_ctx = NULL;
-    if ((ret = avformat_open_input(&ifmt_ctx, filename, NULL, NULL)) < 0) {
+    av->ifmt_ctx = NULL;
+    if ((ret = avformat_open_input(&av->ifmt_ctx, filename, ifmt, NULL)) < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
         return ret;
     }
+    ifmt_ctx = av->ifmt_ctx;
 
     if ((ret = avformat_find_stream_info(ifmt_ctx, NULL)) < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
         return ret;
     }
+    // The session shares its lcore, av_read_frame() must not wait for input.
+    ifmt_ctx->flags |= AVFMT_FLAG_NONBLOCK;
 
-    stream_ctx = av_mallocz_array(ifmt_ctx->nb_streams, sizeof(*stream_ctx));
+    av->stream_ctx = stream_ctx = av_mallocz_array(ifmt_ctx->nb_streams, sizeof(*stream_ctx));
     if (!stream_ctx)
         return AVERROR(ENOMEM);
+    av->nb_out = ifmt_ctx->nb_streams;
 
     for (i = 0; i < ifmt_ctx->nb_streams; i++) {
         AVStream *stream = ifmt_ctx->streams[i];
@@ -83,8 +90,14 @@ static int open_input_file(struct nspk_rtp_session_ctx_t *rtp_sess)
                 || codec_ctx->codec_type == AVMEDIA_TYPE_AUDIO) {
             if (codec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
                 codec_ctx->framerate = av_guess_frame_rate(ifmt_ctx, stream, NULL);
+            // Frames on the lcore's node, for the codec threads planned there.
+            stream_ctx[i].dec_pool = nspk_bufpool_attach(codec_ctx, rte_socket_id());
+            if (!stream_ctx[i].dec_pool) {
+                avcodec_free_context(&codec_ctx);
+                return AVERROR(ENOMEM);
+            }
             /* Open decoder */
-            ret = avcodec_open2(codec_ctx, dec, NULL);
+            ret = nspk_cpu_codec_open(rtp_sess, codec_ctx, dec, NULL);
             if (ret < 0) {
                 av_log(NULL, AV_LOG_ERROR, "Failed to open decoder for stream #%u\n", i);
                 return ret;
@@ -101,70 +114,397 @@ static int open_input_file(struct nspk_rtp_session_ctx_t *rtp_sess)
     return 0;
 }
 
-static void print_sdp(void)
+/**
+ * Log the SDP receivers of the session can be started from. Native UDP
+ * outputs get a media section each, at their own address and port, with
+ * the parameter sets of the encoder's extradata: sprop-parameter-sets for
+ * H.264, sprop-vps/sps/pps for HEVC, and the NACK and RTX lines of their
+ * history if they keep one. RTSP sessions describe themselves.
+ */
+static void print_sdp(struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    struct stream_ctx_t *stream;
+    char sdp[16384], host[256];
+    AVBPrint bp;
+    unsigned int o;
+
+    if (rtp_sess->tcp_chan)
+        return;
+    if (rtp_sess->egress != NSPK_RTP_EGRESS_NATIVE) {
+        if (av_sdp_create(&av->ofmt_ctx, 1, sdp, sizeof(sdp)) >= 0)
+            av_log(NULL, AV_LOG_INFO, "RTP session %d SDP:\n%s\n", rtp_sess->session_id, sdp);
+        return;
+    }
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&bp, "v=0\r\no=- 0 0 IN IP4 127.0.0.1\r\ns=NSPK session %d\r\nt=0 0\r\n",
+               rtp_sess->session_id);
+    for (o = 0; o < av->nb_out; o++) {
+        stream = &av->stream_ctx[o];
+        if (!stream->sdp_url)
+            continue;
+        av_url_split(NULL, 0, NULL, 0, host, sizeof(host), NULL, NULL, 0, stream->sdp_url);
+        sdp[0] = 0;
+        if (ff_sdp_write_media(sdp, sizeof(sdp), stream->out_stream, stream->out_stream->index, host,
+                               strchr(host, ':') ? "IP6" : "IP4", stream->sdp_port, 0, av->ofmt_ctx) < 0)
+            continue;
+        if (stream->rtx)
+            nspk_rtx_sdp(&bp, sdp, stream->pktzr->payload_type, stream->rtx->rtx_pt, stream->pktzr->clock_rate);
+        else
+            av_bprintf(&bp, "%s", sdp);
+    }
+    if (av_bprint_is_complete(&bp))
+        av_log(NULL, AV_LOG_INFO, "RTP session %d SDP:\n%s\n", rtp_sess->session_id, bp.str);
+    av_bprint_finalize(&bp, NULL);
+}
+
+static enum AVCodecID output_codec(struct nspk_rtp_session_ctx_t *rtp_sess, enum AVMediaType type)
+{
+    enum AVCodecID codec_id = type == AVMEDIA_TYPE_VIDEO ? rtp_sess->video_codec : rtp_sess->audio_codec;
+
+    if (codec_id != AV_CODEC_ID_NONE)
+        return codec_id;
+    // TODO: Use NSPK's RTP codec.
+    av_log(NULL, AV_LOG_DEBUG, "Guessing codec for %s\n", rtp_sess->dst_url);
+    return av_guess_codec(rtp_sess->av_ctx->ofmt_ctx->oformat, NULL, rtp_sess->dst_url, NULL, type);
+}
+
+/**
+ * tx_cb of the native RTP streams: the packets about to be handed to TLDK
+ * are kept for retransmission, copied to the fan-out receivers and
+ * protected by FEC.
+ */
+static void stream_tx_event(struct netfe_stream *fs, struct rte_mbuf *pkt[], uint32_t num)
+{
+    struct stream_ctx_t *stream = fs->udata;
+    uint32_t i;
+
+    if (stream->rtx)
+        nspk_rtx_sent(stream->rtx, pkt, num);
+    if (stream->fanout)
+        nspk_fanout_sent(stream->fanout, pkt, num);
+    if (stream->fec) {
+        for (i = 0; i != num; i++) {
+            if (rte_pktmbuf_is_contiguous(pkt[i]))
+                nspk_fec_add(stream->fec, rte_pktmbuf_mtod(pkt[i], const uint8_t *), pkt[i]->data_len);
+        }
+    }
+}
+
+/**
+ * Native output on the TCP channels of the session: packetized straight
+ * onto the connection, whose congestion control does the pacing and whose
+ * retransmissions make FEC and NACKs moot.
+ */
+static int open_native_output_tcp(struct nspk_rtp_session_ctx_t *rtp_sess, struct stream_ctx_t *stream,
+                                  int pkt_size)
+{
+    AVStream *out_stream = stream->out_stream;
+    struct nspk_rtp_tcp_chan_t *chan = &rtp_sess->tcp_chan[2 * out_stream->index];
+    struct rte_mempool *mp = mpool[rte_lcore_to_socket_id(rte_lcore_id()) + 1];
+    int ret;
+
+    stream->pktzr = av_mallocz(sizeof(*stream->pktzr));
+    if (!stream->pktzr)
+        return AVERROR(ENOMEM);
+    ret = nspk_rtp_pktzr_init(stream->pktzr, out_stream->codecpar, out_stream->time_base,
+                              ff_rtp_get_payload_type(rtp_sess->av_ctx->ofmt_ctx, out_stream->codecpar,
+                                                      out_stream->index),
+                              pkt_size, mp, nspk_rtp_tcp_sink, &chan[0]);
+    if (ret < 0)
+        return ret;
+    if (stream->enc_ctx && (ret = nspk_rtp_pktzr_repeat_ps(stream->pktzr, out_stream->codecpar)) < 0)
+        return ret;
+    // The framing mbuf is chained in front anyway.
+    stream->pktzr->attach = 1;
+
+    if (!rtp_sess->rtcp)
+        return 0;
+    stream->rtcp = av_malloc(sizeof(*stream->rtcp));
+    if (!stream->rtcp)
+        return AVERROR(ENOMEM);
+    nspk_rtcp_init_tcp(stream->rtcp, &chan[1], &chan[0], stream->pktzr);
+
+    if (rtp_sess->cc && stream->enc_ctx && stream->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        stream->cc = av_malloc(sizeof(*stream->cc));
+        if (!stream->cc)
+            return AVERROR(ENOMEM);
+        nspk_cc_init(stream->cc, stream->rtcp, NULL, stream->enc_ctx->bit_rate);
+    }
+    return 0;
+}
+
+/**
+ * Native RTP output of output o to dst_url: the session's, or a rung's.
+ */
+static int open_native_output(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int o, const char *dst_url)
+{
+    struct stream_ctx_t *stream = &rtp_sess->av_ctx->stream_ctx[o];
+    AVStream *out_stream = stream->out_stream;
+    struct netfe_sprm sprm, rtcp_sprm;
+    struct rte_mempool *mp = mpool[rte_lcore_to_socket_id(rte_lcore_id()) + 1];
+    int pkt_size = NSPK_RTP_DEFAULT_PKT_SIZE;
+    int fec_l = 0, fec_d = 0;
+    char buf[16], fec[64], fanout[FILENAME_MAX];
+    const char *p;
+    int ret;
+
+    ret = nspk_rtp_url_parse(dst_url, &sprm, &rtcp_sprm, &pkt_size);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not parse RTP URL '%s'\n", dst_url);
+        return ret;
+    }
+    if (rtp_sess->tcp_chan)
+        return open_native_output_tcp(rtp_sess, stream, pkt_size);
+    p = strchr(dst_url, '?');
+    if (p && av_find_info_tag(fec, sizeof(fec), "fec", p)) {
+        if ((ret = nspk_fec_parse(fec, &fec_l, &fec_d)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Invalid FEC options '%s'\n", fec);
+            return ret;
+        }
+    }
+
+    // Audio goes to ?audioport=n, by default the next RTP/RTCP port pair after the FEC ports.
+    // Its RTCP port and local ports have audio* tags of their own, RTSP sets all of them.
+    if (out_stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+        int port = nspk_tldk_sockaddr_get_port(&sprm.remote_addr) +
+                   (fec_l ? NSPK_FEC_ROW_PORT_OFF + 2 : 2);
+        int rtcp_port;
+        if (p && av_find_info_tag(buf, sizeof(buf), "audioport", p))
+            port = strtol(buf, NULL, 10);
+        rtcp_port = port + 1;
+        if (p && av_find_info_tag(buf, sizeof(buf), "audiortcpport", p))
+            rtcp_port = strtol(buf, NULL, 10);
+        nspk_tldk_sockaddr_set_port(&sprm.remote_addr, port);
+        nspk_tldk_sockaddr_set_port(&rtcp_sprm.remote_addr, rtcp_port);
+
+        nspk_tldk_sockaddr_set_port(&sprm.local_addr, 0);
+        nspk_tldk_sockaddr_set_port(&rtcp_sprm.local_addr, 0);
+        if (p && av_find_info_tag(buf, sizeof(buf), "audiolocalport", p))
+            nspk_tldk_sockaddr_set_port(&sprm.local_addr, strtol(buf, NULL, 10));
+        if (p && av_find_info_tag(buf, sizeof(buf), "audiolocalrtcpport", p))
+            nspk_tldk_sockaddr_set_port(&rtcp_sprm.local_addr, strtol(buf, NULL, 10));
+    }
+
+    stream->rtp_fs = nspk_tldk_udp_stream_open(rtp_sess->lcore_prm, &sprm, TXONLY);
+    if (!stream->rtp_fs) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open TLDK stream for output stream #%d\n", out_stream->index);
+        return AVERROR(rte_errno);
+    }
+    stream->rtp_fs->udata = stream;
+    stream->rtp_fs->tx_cb = stream_tx_event;
+
+    stream->pktzr = av_mallocz(sizeof(*stream->pktzr));
+    if (!stream->pktzr)
+        return AVERROR(ENOMEM);
+
+    if (rtp_sess->pace) {
+        stream->pacer = av_malloc(sizeof(*stream->pacer));
+        if (!stream->pacer)
+            return AVERROR(ENOMEM);
+        nspk_pacer_init(stream->pacer, stream->rtp_fs, 0, 0);
+    }
+
+    ret = nspk_rtp_pktzr_init(stream->pktzr, out_stream->codecpar, out_stream->time_base,
+                              ff_rtp_get_payload_type(rtp_sess->av_ctx->ofmt_ctx, out_stream->codecpar,
+                                                      out_stream->index),
+                              pkt_size, mp,
+                              stream->pacer ? nspk_pacer_sink : nspk_rtp_pktzr_sink_udp,
+                              stream->pacer ? (void *)stream->pacer : (void *)stream->rtp_fs);
+    if (ret < 0)
+        return ret;
+    if (stream->enc_ctx && (ret = nspk_rtp_pktzr_repeat_ps(stream->pktzr, out_stream->codecpar)) < 0)
+        return ret;
+    stream->sdp_url = dst_url;
+    stream->sdp_port = nspk_tldk_sockaddr_get_port(&sprm.remote_addr);
+
+    // Only the video is protected, its FEC ports would clash with the audio's RTP and RTCP.
+    if (fec_l && out_stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+        stream->fec = av_malloc(sizeof(*stream->fec));
+        if (!stream->fec)
+            return AVERROR(ENOMEM);
+        if ((ret = nspk_fec_init(stream->fec, rtp_sess->lcore_prm, &sprm, fec_l, fec_d)) < 0) {
+            av_freep(&stream->fec);
+            return ret;
+        }
+    }
+
+    // Receivers listed in ?fanout=<file> get the audio on their port + 2, as the default audio port.
+    if (p && av_find_info_tag(fanout, sizeof(fanout), "fanout", p)) {
+        stream->fanout = av_malloc(sizeof(*stream->fanout));
+        if (!stream->fanout)
+            return AVERROR(ENOMEM);
+        nspk_fanout_init(stream->fanout, stream->pktzr->ssrc);
+        ret = nspk_fanout_load(stream->fanout, rtp_sess->lcore_prm, fanout,
+                               out_stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO ? 2 : 0);
+        if (ret < 0)
+            return ret;
+        av_log(NULL, AV_LOG_INFO, "Output stream #%d fans out to %d receivers\n", out_stream->index, ret);
+    }
+
+    // FEC, fan-out and RTX read each packet back as a single segment.
+    stream->pktzr->attach = !stream->fec && !stream->fanout && !(rtp_sess->rtcp && rtp_sess->rtx_ms > 0);
+
+    if (!rtp_sess->rtcp)
+        return 0;
+
+    // Receivers send their reports back to the port our SRs come from.
+    stream->rtcp_fs = nspk_tldk_udp_stream_open(rtp_sess->lcore_prm, &rtcp_sprm, RXTX);
+    if (!stream->rtcp_fs) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open TLDK RTCP stream for output stream #%d\n", out_stream->index);
+        return AVERROR(rte_errno);
+    }
+    stream->rtcp = av_malloc(sizeof(*stream->rtcp));
+    if (!stream->rtcp)
+        return AVERROR(ENOMEM);
+    nspk_rtcp_init(stream->rtcp, stream->rtcp_fs, stream->rtp_fs, stream->pktzr);
+
+    if (rtp_sess->rtx_ms > 0) {
+        if (rtp_sess->rtx_pt == stream->pktzr->payload_type) {
+            av_log(NULL, AV_LOG_ERROR, "RTX payload type %d of output stream #%d is its media payload type\n",
+                   rtp_sess->rtx_pt, out_stream->index);
+            return AVERROR(EINVAL);
+        }
+        stream->rtx = av_malloc(sizeof(*stream->rtx));
+        if (!stream->rtx)
+            return AVERROR(ENOMEM);
+        nspk_rtx_init(stream->rtx, stream->rtp_fs, stream->pktzr->ssrc, rtp_sess->rtx_ms, rtp_sess->rtx_pt);
+        stream->rtcp->rtx = stream->rtx;
+    }
+
+    if (rtp_sess->cc && stream->enc_ctx && stream->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        stream->cc = av_malloc(sizeof(*stream->cc));
+        if (!stream->cc)
+            return AVERROR(ENOMEM);
+        nspk_cc_init(stream->cc, stream->rtcp, stream->pacer, stream->enc_ctx->bit_rate);
+    }
+    return 0;
+}
+
+/**
+ * Pick the bitstream filter which makes the packets of a passthrough stream
+ * fit the RTP stage:
+ * - avcC/hvcC H.264/HEVC is converted to Annex B, with the parameter sets
+ *   inserted in front of every IDR.
+ * - Annex B H.264/HEVC gets the parameter sets of its extradata repeated on
+ *   every keyframe, so receivers can join mid-stream.
+ * - ADTS AAC is converted to raw AUs for the rtp muxer. The native
+ *   packetizer strips ADTS headers itself.
+ */
+static int open_bsf(struct nspk_rtp_session_ctx_t *rtp_sess, struct stream_ctx_t *stream, AVStream *in_stream)
+{
+    const AVCodecParameters *par = in_stream->codecpar;
+    const AVBitStreamFilter *filter;
+    const char *name = NULL;
+    int ret;
+
+    switch (par->codec_id) {
+    case AV_CODEC_ID_H264:
+    case AV_CODEC_ID_HEVC:
+        if (par->extradata_size > 0 && par->extradata[0] == 1)
+            name = par->codec_id == AV_CODEC_ID_H264 ? "h264_mp4toannexb" : "hevc_mp4toannexb";
+        else if (par->extradata_size > 0)
+            name = "dump_extra";
+        break;
+    case AV_CODEC_ID_AAC:
+        if (!par->extradata_size && rtp_sess->egress != NSPK_RTP_EGRESS_NATIVE)
+            name = "aac_adtstoasc";
+        break;
+    default:
+        break;
+    }
+    if (!name)
+        return 0;
+
+    filter = av_bsf_get_by_name(name);
+    if (!filter) {
+        av_log(NULL, AV_LOG_ERROR, "Bitstream filter %s not found\n", name);
+        return AVERROR_BSF_NOT_FOUND;
+    }
+    if ((ret = av_bsf_alloc(filter, &stream->bsf)) < 0)
+        return ret;
+    if ((ret = avcodec_parameters_copy(stream->bsf->par_in, par)) < 0)
+        return ret;
+    stream->bsf->time_base_in = in_stream->time_base;
+    if ((ret = av_bsf_init(stream->bsf)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot initialize bitstream filter %s\n", name);
+        return ret;
+    }
+    stream->bsf_pkt = av_packet_alloc();
+    if (!stream->bsf_pkt)
+        return AVERROR(ENOMEM);
+
+    av_log(NULL, AV_LOG_DEBUG, "Passthrough stream #%d through %s\n", in_stream->index, name);
+    return 0;
+}
+
+static int open_passthrough_stream(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int i, AVStream *out_stream)
 {
-//     char sdp[16384];
-//     int i;
-//     int j;
-//     int nb_output_files = 1;
-//     AVIOContext *sdp_pb;
-//     AVFormatContext **avc;
+    struct stream_ctx_t *stream = &rtp_sess->av_ctx->stream_ctx[i];
+    AVStream *in_stream = rtp_sess->av_ctx->ifmt_ctx->streams[i];
+    int ret;
 
-//     avc = av_malloc_array(1, sizeof(*avc));
-//     if (!avc)
-//         return;
-//     for (i = 0, j = 0; i < nb_output_files; i++) {
-//         if (!strcmp(ofmt_ctx->oformat->name, "rtp")) {
-//             avc[j] = ofmt_ctx;
-//             j++;
-//         }
-//     }
+    if ((ret = open_bsf(rtp_sess, stream, in_stream)) < 0)
+        return ret;
 
-//     if (!j)
-//         goto fail;
+    if (stream->bsf) {
+        ret = avcodec_parameters_copy(out_stream->codecpar, stream->bsf->par_out);
+        out_stream->time_base = stream->bsf->time_base_out;
+    } else {
+        ret = avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar);
+        out_stream->time_base = in_stream->time_base;
+    }
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Copying parameters for stream #%u failed\n", i);
+        return ret;
+    }
+    out_stream->codecpar->codec_tag = 0;
+    stream->out_stream = out_stream;
 
-//     av_sdp_create(avc, j, sdp, sizeof(sdp));
+    return 0;
+}
 
-//     av_log(NULL, AV_LOG_DEBUG, "SDP:\n%s\n", sdp);
-//     fflush(stdout);
+/**
+ * Whether the input stream can be sent without transcoding to out_codec.
+ * The source of a ladder is decoded for its rungs anyway.
+ */
+static int can_passthrough(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int i, enum AVCodecID out_codec)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
 
-// fail:
-//     av_freepp(&avc);
+    return rtp_sess->passthrough && !(av->ladder && i == av->ladder_src) &&
+           av->ifmt_ctx->streams[i]->codecpar->codec_id == out_codec;
 }
 
-static int open_output_file(struct nspk_rtp_session_ctx_t *rtp_sess, int target_input_stream)
+/**
+ * Open output o for input stream i: o is i itself, or the entry of a rung
+ * of the ladder encoded from it.
+ */
+static int open_output_stream(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int i, unsigned int o,
+                              enum AVCodecID out_codec, const struct nspk_ladder_rung_t *rung)
 {
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    struct stream_ctx_t *stream_ctx = av->stream_ctx;
+    AVFormatContext *ofmt_ctx = av->ofmt_ctx;
     AVStream *out_stream;
     AVStream *in_stream;
     AVCodecContext *dec_ctx, *enc_ctx;
     AVCodec *encoder;
     int ret;
-    unsigned int i = target_input_stream;
-    char *filename = rtp_sess->dst_url;
-
-    ofmt_ctx = NULL;
-    avformat_alloc_output_context2(&ofmt_ctx, NULL, "rtp", filename);
-    if (!ofmt_ctx) {
-        av_log(NULL, AV_LOG_ERROR, "Could not create output context\n");
-        return AVERROR_UNKNOWN;
-    }
 
-    // TODO: Use NSPK's RTP codec.
-    av_log(NULL, AV_LOG_DEBUG, "Guessing codec for %s\n", filename);
-    enum AVCodecID out_codec = av_guess_codec(ofmt_ctx->oformat, NULL, filename, NULL, AVMEDIA_TYPE_VIDEO);
-    if (out_codec == AV_CODEC_ID_NONE) {
-        av_log(NULL, AV_LOG_ERROR, "Could not guess codec\n");
-        return AVERROR_UNKNOWN;
-    }
-    av_log(NULL, AV_LOG_DEBUG, "Input codec: %d, Output codec: %d\n", stream_ctx[target_input_stream].dec_ctx->codec_id, out_codec);
+    av_log(NULL, AV_LOG_DEBUG, "Input codec: %d, Output codec: %d\n", stream_ctx[i].dec_ctx->codec_id, out_codec);
 
     out_stream = avformat_new_stream(ofmt_ctx, NULL);
     if (!out_stream) {
         av_log(NULL, AV_LOG_ERROR, "Failed allocating output stream\n");
         return AVERROR_UNKNOWN;
     }
-    in_stream = ifmt_ctx->streams[target_input_stream];
-    dec_ctx = stream_ctx[target_input_stream].dec_ctx;
+    if (!rung && can_passthrough(rtp_sess, i, out_codec))
+        return open_passthrough_stream(rtp_sess, i, out_stream);
+
+    in_stream = av->ifmt_ctx->streams[i];
+    dec_ctx = stream_ctx[i].dec_ctx;
     if (dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO
             || dec_ctx->codec_type == AVMEDIA_TYPE_AUDIO) {
         /* in this example, we choose transcoding to same codec */
@@ -186,40 +526,81 @@ static int open_output_file(struct nspk_rtp_session_ctx_t *rtp_sess, int target_
             enc_ctx->height = dec_ctx->height;
             enc_ctx->width = dec_ctx->width;
             enc_ctx->sample_aspect_ratio = dec_ctx->sample_aspect_ratio;
+            enc_ctx->framerate = dec_ctx->framerate;
+            if (rung) {
+                AVRational sar = dec_ctx->sample_aspect_ratio.num ? dec_ctx->sample_aspect_ratio :
+                                 (AVRational){ 1, 1 };
+                enc_ctx->height = rung->height;
+                enc_ctx->width = rung->width;
+                // The scale filter keeps the display aspect ratio of the source.
+                av_reduce(&enc_ctx->sample_aspect_ratio.num, &enc_ctx->sample_aspect_ratio.den,
+                          (int64_t)sar.num * rung->height * dec_ctx->width,
+                          (int64_t)sar.den * rung->width * dec_ctx->height, INT_MAX);
+                if (rung->fps.num)
+                    enc_ctx->framerate = rung->fps;
+            }
             /* take first format from list of supported formats */
             if (encoder->pix_fmts)
                 enc_ctx->pix_fmt = encoder->pix_fmts[0];
             else
                 enc_ctx->pix_fmt = dec_ctx->pix_fmt;
+            if (rung)
+                enc_ctx->bit_rate = (int64_t)rung->kbps * 1000;
+            else if (rtp_sess->video_kbps > 0)
+                enc_ctx->bit_rate = (int64_t)rtp_sess->video_kbps * 1000;
+            // A VBV from the start, so the rate control can retune it.
+            if (rtp_sess->egress == NSPK_RTP_EGRESS_NATIVE && rtp_sess->rtcp && rtp_sess->cc) {
+                enc_ctx->rc_max_rate = enc_ctx->bit_rate;
+                enc_ctx->rc_buffer_size = enc_ctx->bit_rate * NSPK_CC_VBV_MS / 1000;
+            }
             /* video time_base can be set to whatever is handy and supported by encoder */
             // av_log(NULL, AV_LOG_DEBUG, "framerate=%d/%d\n", enc_ctx->framerate.num, enc_ctx->framerate.den);
             // enc_ctx->time_base = (AVRational){1, 25};
-            enc_ctx->time_base = av_inv_q(dec_ctx->framerate);
+            enc_ctx->time_base = av_inv_q(enc_ctx->framerate);
             av_log(NULL, AV_LOG_DEBUG, "time_base=%d/%d\n", enc_ctx->time_base.num, enc_ctx->time_base.den);
         } else {
             av_log(NULL, AV_LOG_DEBUG, "AVMEDIA_TYPE_AUDIO\n");
             enc_ctx->sample_rate = dec_ctx->sample_rate;
-            enc_ctx->channel_layout = dec_ctx->channel_layout;
+            /* keep the input rate if the encoder takes it, e.g. Opus only runs at a few fixed rates */
+            if (encoder->supported_samplerates) {
+                const int *sr = encoder->supported_samplerates;
+                while (*sr && *sr != dec_ctx->sample_rate)
+                    sr++;
+                if (!*sr)
+                    enc_ctx->sample_rate = encoder->supported_samplerates[0];
+            }
+            enc_ctx->channel_layout = dec_ctx->channel_layout ? dec_ctx->channel_layout :
+                                      av_get_default_channel_layout(dec_ctx->channels);
             enc_ctx->channels = av_get_channel_layout_nb_channels(enc_ctx->channel_layout);
             /* take first format from list of supported formats */
             enc_ctx->sample_fmt = encoder->sample_fmts[0];
             enc_ctx->time_base = (AVRational){1, enc_ctx->sample_rate};
         }
-        if (ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+        // Native outputs take the parameter sets for the SDP from extradata,
+        // the packetizer repeats them in front of every keyframe.
+        if ((ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) ||
+            (rtp_sess->egress == NSPK_RTP_EGRESS_NATIVE &&
+             (out_codec == AV_CODEC_ID_H264 || out_codec == AV_CODEC_ID_HEVC)))
             enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        stream_ctx[o].enc_pool = nspk_bufpool_attach(enc_ctx, rte_socket_id());
+        if (!stream_ctx[o].enc_pool) {
+            avcodec_free_context(&enc_ctx);
+            return AVERROR(ENOMEM);
+        }
         /* Third parameter can be used to pass settings to encoder */
-        ret = avcodec_open2(enc_ctx, encoder, NULL);
+        ret = nspk_cpu_codec_open(rtp_sess, enc_ctx, encoder, NULL);
         if (ret < 0) {
-            av_log(NULL, AV_LOG_ERROR, "Cannot open video encoder for stream #%u\n", i);
+            av_log(NULL, AV_LOG_ERROR, "Cannot open encoder for stream #%u\n", i);
+            avcodec_free_context(&enc_ctx);
             return ret;
         }
+        stream_ctx[o].enc_ctx = enc_ctx;
         ret = avcodec_parameters_from_context(out_stream->codecpar, enc_ctx);
         if (ret < 0) {
             av_log(NULL, AV_LOG_ERROR, "Failed to copy encoder parameters to output stream #%u\n", i);
             return ret;
         }
         out_stream->time_base = enc_ctx->time_base;
-        stream_ctx[i].enc_ctx = enc_ctx;
     } else if (dec_ctx->codec_type == AVMEDIA_TYPE_UNKNOWN) {
         av_log(NULL, AV_LOG_FATAL, "Elementary stream #%d is of unknown type, cannot proceed\n", i);
         return AVERROR_INVALIDDATA;
@@ -232,12 +613,186 @@ static int open_output_file(struct nspk_rtp_session_ctx_t *rtp_sess, int target_
         }
         out_stream->time_base = in_stream->time_base;
     }
+    stream_ctx[o].out_stream = out_stream;
+
+    return 0;
+}
+
+/**
+ * Read the ladder of ?ladder=<file> and make room for its rungs in the
+ * stream contexts, before anything points into them.
+ */
+static int open_ladder(struct nspk_rtp_session_ctx_t *rtp_sess, const char *p)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    struct stream_ctx_t *stream_ctx;
+    char path[FILENAME_MAX];
+    int ret;
+
+    if (!p || !av_find_info_tag(path, sizeof(path), "ladder", p))
+        return 0;
+    // The interleaved channels only cover the session's own streams.
+    if (rtp_sess->tcp_chan) {
+        av_log(NULL, AV_LOG_ERROR, "A ladder cannot be sent over RTSP interleaved\n");
+        return AVERROR_PATCHWELCOME;
+    }
+
+    av->ladder = av_malloc(sizeof(*av->ladder));
+    if (!av->ladder)
+        return AVERROR(ENOMEM);
+    if ((ret = nspk_ladder_load(av->ladder, path)) <= 0) {
+        av_freep(&av->ladder);
+        return ret < 0 ? ret : AVERROR(EINVAL);
+    }
+
+    stream_ctx = av_realloc_array(av->stream_ctx, av->nb_out + ret, sizeof(*stream_ctx));
+    if (!stream_ctx)
+        return AVERROR(ENOMEM);
+    memset(stream_ctx + av->nb_out, 0, ret * sizeof(*stream_ctx));
+    av->stream_ctx = stream_ctx;
+    av->nb_out += ret;
+    return 0;
+}
+
+/**
+ * Rungs of the ladder: an encoder and a native RTP output each, fed from
+ * the frames decoded from input stream i.
+ */
+static int open_ladder_rungs(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int i, enum AVCodecID out_codec)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    const struct nspk_ladder_rung_t *rung;
+    unsigned int o;
+    int k, ret;
+
+    for (k = 0; k < av->ladder->nb_rungs; k++) {
+        rung = &av->ladder->rung[k];
+        o = av->ifmt_ctx->nb_streams + k;
+        if ((ret = open_output_stream(rtp_sess, i, o, out_codec, rung)) < 0)
+            return ret;
+        if ((ret = open_native_output(rtp_sess, o, rung->url)) < 0)
+            return ret;
+        av_log(NULL, AV_LOG_INFO, "Rung %d: %dx%d at %d/%d fps, %d kbps to %s\n", k, rung->width,
+               rung->height, av->stream_ctx[o].enc_ctx->framerate.num, av->stream_ctx[o].enc_ctx->framerate.den,
+               rung->kbps, rung->url);
+    }
+    return 0;
+}
+
+/**
+ * Native egress sends the best video and the best audio stream, each to
+ * its own RTP port, and the rungs of the ladder if any. The muxer paths
+ * carry TARGET_INPUT_STREAM only.
+ * Returns 1 if the native path could not be used.
+ */
+static int open_native_output_file(struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    static const enum AVMediaType types[] = { AVMEDIA_TYPE_VIDEO, AVMEDIA_TYPE_AUDIO };
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    enum AVCodecID out_codec;
+    char buf[16];
+    const char *p = strchr(rtp_sess->dst_url, '?');
+    int k, idx, related = -1, nb_out = 0;
+    int ret;
+
+    if ((ret = open_ladder(rtp_sess, p)) < 0)
+        return ret;
+
+    for (k = 0; k < FF_ARRAY_ELEMS(types); k++) {
+        idx = av_find_best_stream(av->ifmt_ctx, types[k], -1, related, NULL, 0);
+        if (idx < 0)
+            continue;
+        // ?audioport=0 leaves the audio out, e.g. when an RTSP client did not SETUP it.
+        if (types[k] == AVMEDIA_TYPE_AUDIO && p &&
+            av_find_info_tag(buf, sizeof(buf), "audioport", p) && strtol(buf, NULL, 10) == 0)
+            continue;
+        if (types[k] == AVMEDIA_TYPE_VIDEO) {
+            related = idx;
+            av->ladder_src = idx;
+        }
+
+        out_codec = output_codec(rtp_sess, types[k]);
+        if (!nspk_rtp_pktzr_supported(out_codec)) {
+            av_log(NULL, AV_LOG_WARNING, "No native packetizer for %s\n", avcodec_get_name(out_codec));
+            // Without its video the session is better served by the muxer.
+            if (types[k] == AVMEDIA_TYPE_VIDEO)
+                return av->ladder ? AVERROR_PATCHWELCOME : 1;
+            continue;
+        }
+
+        if ((ret = open_output_stream(rtp_sess, idx, idx, out_codec, NULL)) < 0)
+            return ret;
+        if ((ret = open_native_output(rtp_sess, idx, rtp_sess->dst_url)) < 0)
+            return ret;
+        if (types[k] == AVMEDIA_TYPE_VIDEO && av->ladder &&
+            (ret = open_ladder_rungs(rtp_sess, idx, out_codec)) < 0)
+            return ret;
+        nb_out++;
+    }
+
+    if (av->ladder && related < 0) {
+        av_log(NULL, AV_LOG_ERROR, "A ladder needs a video stream\n");
+        return AVERROR(EINVAL);
+    }
+    return nb_out ? 0 : 1;
+}
+
+static int open_output_file(struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    AVFormatContext *ofmt_ctx;
+    enum AVCodecID out_codec;
+    int ret;
+    unsigned int i = TARGET_INPUT_STREAM;
+    char *filename = rtp_sess->dst_url;
+
+    av->ofmt_ctx = NULL;
+    avformat_alloc_output_context2(&av->ofmt_ctx, NULL, "rtp", filename);
+    ofmt_ctx = av->ofmt_ctx;
+    if (!ofmt_ctx) {
+        av_log(NULL, AV_LOG_ERROR, "Could not create output context\n");
+        return AVERROR_UNKNOWN;
+    }
+
+    if (rtp_sess->egress == NSPK_RTP_EGRESS_NATIVE) {
+        // The muxer is never started, ofmt_ctx only describes the output.
+        ret = open_native_output_file(rtp_sess);
+        if (ret <= 0) {
+            if (ret == 0) {
+                av_dump_format(ofmt_ctx, 0, filename, 1);
+                print_sdp(rtp_sess);
+            }
+            return ret;
+        }
+        if (ofmt_ctx->nb_streams) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot fall back to the rtp muxer after opening streams\n");
+            return AVERROR(EINVAL);
+        }
+        // The muxer only knows UDP.
+        if (rtp_sess->tcp_chan) {
+            av_log(NULL, AV_LOG_ERROR, "RTP over TCP needs the native packetizer\n");
+            return AVERROR_PATCHWELCOME;
+        }
+        av_log(NULL, AV_LOG_WARNING, "Using the rtp muxer\n");
+        rtp_sess->egress = NSPK_RTP_EGRESS_MBUF;
+    }
+
+    out_codec = output_codec(rtp_sess, av->ifmt_ctx->streams[i]->codecpar->codec_type);
+    if (out_codec == AV_CODEC_ID_NONE) {
+        av_log(NULL, AV_LOG_ERROR, "Could not guess codec\n");
+        return AVERROR_UNKNOWN;
+    }
+    if ((ret = open_output_stream(rtp_sess, i, i, out_codec, NULL)) < 0)
+        return ret;
 
     av_dump_format(ofmt_ctx, 0, filename, 1);
 
     if (!(ofmt_ctx->oformat->flags & AVFMT_NOFILE)) {
         // ret = avio_open(&ofmt_ctx->pb, filename, AVIO_FLAG_WRITE);
-        ret = nspk_avio_open(rtp_sess, &ofmt_ctx->pb, filename, AVIO_FLAG_WRITE);
+        if (rtp_sess->egress == NSPK_RTP_EGRESS_MBUF)
+            ret = nspk_avio_open_mbuf(rtp_sess, &ofmt_ctx->pb, filename);
+        else
+            ret = nspk_avio_open(rtp_sess, &ofmt_ctx->pb, filename, AVIO_FLAG_WRITE);
         if (ret < 0) {
             av_log(NULL, AV_LOG_ERROR, "nspk_avio_open: Could not open output file '%s'", filename);
             return ret;
@@ -250,25 +805,48 @@ static int open_output_file(struct nspk_rtp_session_ctx_t *rtp_sess, int target_
         av_log(NULL, AV_LOG_ERROR, "Error occurred when opening output file\n");
         return ret;
     }
-    print_sdp();
+    print_sdp(rtp_sess);
 
     return 0;
 }
 
-static int init_filter(struct filtering_ctx_t* fctx, AVCodecContext *dec_ctx,
-        AVCodecContext *enc_ctx, const char *filter_spec)
+/**
+ * Name of the buffersink of output o in the filter graph of input stream i,
+ * the label filter_spec ends the branch of the output with.
+ */
+static void filter_sink_name(char *buf, size_t size, unsigned int i, unsigned int o)
+{
+    if (o == i)
+        av_strlcpy(buf, "out", size);
+    else
+        snprintf(buf, size, "out%u", o);
+}
+
+/**
+ * Filter graph of input stream i, with a buffersink for i itself and, for
+ * the source of the ladder, one per rung. The graph and its source belong
+ * to filter_ctx[i], the rungs only get their sink.
+ */
+static int init_filter(struct nspk_av_ctx_t *av, unsigned int i, const char *filter_spec)
 {
-    char args[512];
+    struct filtering_ctx_t *fctx = &av->filter_ctx[i];
+    AVCodecContext *dec_ctx = av->stream_ctx[i].dec_ctx;
+    AVCodecContext *enc_ctx;
+    char args[512], name[16];
     int ret = 0;
+    unsigned int o, last = i + 1;
     const AVFilter *buffersrc = NULL;
     const AVFilter *buffersink = NULL;
     AVFilterContext *buffersrc_ctx = NULL;
     AVFilterContext *buffersink_ctx = NULL;
     AVFilterInOut *outputs = avfilter_inout_alloc();
-    AVFilterInOut *inputs  = avfilter_inout_alloc();
+    AVFilterInOut *inputs = NULL, *in;
     AVFilterGraph *filter_graph = avfilter_graph_alloc();
 
-    if (!outputs || !inputs || !filter_graph) {
+    if (av->ladder && i == av->ladder_src)
+        last = av->nb_out;
+
+    if (!outputs || !filter_graph) {
         ret = AVERROR(ENOMEM);
         goto end;
     }
@@ -296,19 +874,39 @@ static int init_filter(struct filtering_ctx_t* fctx, AVCodecContext *dec_ctx,
             goto end;
         }
 
-        ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out",
-                NULL, NULL, filter_graph);
-        if (ret < 0) {
-            av_log(NULL, AV_LOG_ERROR, "Cannot create buffer sink\n");
-            goto end;
-        }
+        // Outputs i, then the rungs from ifmt_ctx->nb_streams on.
+        for (o = i; o < last; o = (o == i) ? av->ifmt_ctx->nb_streams : o + 1) {
+            enc_ctx = av->stream_ctx[o].enc_ctx;
+            filter_sink_name(name, sizeof(name), i, o);
+            ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, name,
+                    NULL, NULL, filter_graph);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_ERROR, "Cannot create buffer sink\n");
+                goto end;
+            }
 
-        ret = av_opt_set_bin(buffersink_ctx, "pix_fmts",
-                (uint8_t*)&enc_ctx->pix_fmt, sizeof(enc_ctx->pix_fmt),
-                AV_OPT_SEARCH_CHILDREN);
-        if (ret < 0) {
-            av_log(NULL, AV_LOG_ERROR, "Cannot set output pixel format\n");
-            goto end;
+            ret = av_opt_set_bin(buffersink_ctx, "pix_fmts",
+                    (uint8_t*)&enc_ctx->pix_fmt, sizeof(enc_ctx->pix_fmt),
+                    AV_OPT_SEARCH_CHILDREN);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_ERROR, "Cannot set output pixel format\n");
+                goto end;
+            }
+
+            av->filter_ctx[o].buffersink_ctx = buffersink_ctx;
+            if (!(in = avfilter_inout_alloc())) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            in->name       = av_strdup(name);
+            in->filter_ctx = buffersink_ctx;
+            in->pad_idx    = 0;
+            in->next       = inputs;
+            inputs = in;
+            if (!in->name) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
         }
     } else if (dec_ctx->codec_type == AVMEDIA_TYPE_AUDIO) {
         buffersrc = avfilter_get_by_name("abuffer");
@@ -334,6 +932,7 @@ static int init_filter(struct filtering_ctx_t* fctx, AVCodecContext *dec_ctx,
             goto end;
         }
 
+        enc_ctx = av->stream_ctx[i].enc_ctx;
         ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out",
                 NULL, NULL, filter_graph);
         if (ret < 0) {
@@ -364,6 +963,20 @@ static int init_filter(struct filtering_ctx_t* fctx, AVCodecContext *dec_ctx,
             av_log(NULL, AV_LOG_ERROR, "Cannot set output sample rate\n");
             goto end;
         }
+
+        fctx->buffersink_ctx = buffersink_ctx;
+        if (!(inputs = avfilter_inout_alloc())) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        inputs->name       = av_strdup("out");
+        inputs->filter_ctx = buffersink_ctx;
+        inputs->pad_idx    = 0;
+        inputs->next       = NULL;
+        if (!inputs->name) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
     } else {
         ret = AVERROR_UNKNOWN;
         goto end;
@@ -375,12 +988,7 @@ static int init_filter(struct filtering_ctx_t* fctx, AVCodecContext *dec_ctx,
     outputs->pad_idx    = 0;
     outputs->next       = NULL;
 
-    inputs->name       = av_strdup("out");
-    inputs->filter_ctx = buffersink_ctx;
-    inputs->pad_idx    = 0;
-    inputs->next       = NULL;
-
-    if (!outputs->name || !inputs->name) {
+    if (!outputs->name) {
         ret = AVERROR(ENOMEM);
         goto end;
     }
@@ -394,61 +1002,202 @@ static int init_filter(struct filtering_ctx_t* fctx, AVCodecContext *dec_ctx,
 
     /* Fill struct filtering_ctx_t */
     fctx->buffersrc_ctx = buffersrc_ctx;
-    fctx->buffersink_ctx = buffersink_ctx;
     fctx->filter_graph = filter_graph;
 
 end:
     avfilter_inout_free(&inputs);
     avfilter_inout_free(&outputs);
+    // The sinks went down with the graph.
+    if (ret < 0) {
+        avfilter_graph_free(&filter_graph);
+        for (o = i; o < last; o = (o == i) ? av->ifmt_ctx->nb_streams : o + 1)
+            av->filter_ctx[o].buffersink_ctx = NULL;
+    }
 
     return ret;
 }
 
-static int init_filters(int target_input_stream)
+/**
+ * Whether the filter graph would only pass frames through, so decoded frames
+ * can go to the encoder directly. The buffersink still has a job whenever it
+ * converts the format, or cuts audio to the encoder frame size.
+ */
+static int filter_is_noop(const char *filter_spec, AVCodecContext *dec_ctx, AVCodecContext *enc_ctx)
 {
-    const char *filter_spec;
-    unsigned int i = target_input_stream;
-    int ret;
-    filter_ctx = av_malloc_array(ifmt_ctx->nb_streams, sizeof(*filter_ctx));
+    uint64_t layout;
+
+    if (strcmp(filter_spec, "null") && strcmp(filter_spec, "anull"))
+        return 0;
+
+    if (dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        return dec_ctx->pix_fmt == enc_ctx->pix_fmt &&
+               dec_ctx->width == enc_ctx->width &&
+               dec_ctx->height == enc_ctx->height;
+
+    layout = dec_ctx->channel_layout ? dec_ctx->channel_layout :
+             av_get_default_channel_layout(dec_ctx->channels);
+    return dec_ctx->sample_fmt == enc_ctx->sample_fmt &&
+           dec_ctx->sample_rate == enc_ctx->sample_rate &&
+           layout == enc_ctx->channel_layout &&
+           (!enc_ctx->frame_size || (enc_ctx->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE));
+}
+
+/**
+ * Filter spec of the ladder source: the decoded frames split between the
+ * session's own video and a scaler per rung.
+ */
+static char *ladder_filter_spec(const struct nspk_av_ctx_t *av)
+{
+    const struct nspk_ladder_rung_t *rung;
+    unsigned int o = av->ifmt_ctx->nb_streams;
+    AVBPrint bp;
+    char *spec;
+    int k;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&bp, "split=%d[s%u]", av->ladder->nb_rungs + 1, av->ladder_src);
+    for (k = 0; k < av->ladder->nb_rungs; k++)
+        av_bprintf(&bp, "[s%u]", o + k);
+    av_bprintf(&bp, ";[s%u]null[out]", av->ladder_src);
+    for (k = 0; k < av->ladder->nb_rungs; k++) {
+        rung = &av->ladder->rung[k];
+        av_bprintf(&bp, ";[s%u]scale=%d:%d", o + k, rung->width, rung->height);
+        if (rung->fps.num)
+            av_bprintf(&bp, ",fps=fps=%d/%d", rung->fps.num, rung->fps.den);
+        av_bprintf(&bp, "[out%u]", o + k);
+    }
+    if (!av_bprint_is_complete(&bp)) {
+        av_bprint_finalize(&bp, NULL);
+        return NULL;
+    }
+    av_bprint_finalize(&bp, &spec);
+    return spec;
+}
+
+static int init_filters(struct nspk_av_ctx_t *av)
+{
+    struct stream_ctx_t *stream_ctx = av->stream_ctx;
+    struct filtering_ctx_t *filter_ctx;
+    AVFormatContext *ifmt_ctx = av->ifmt_ctx;
+    const char *filter_spec;
+    char *ladder_spec = NULL;
+    AVCodecContext *enc_ctx;
+    unsigned int i, o;
+    int ret;
+    av->filter_ctx = filter_ctx = av_mallocz_array(av->nb_out, sizeof(*filter_ctx));
     if (!filter_ctx)
         return AVERROR(ENOMEM);
 
-    i = target_input_stream;
-    filter_ctx[i].buffersrc_ctx  = NULL;
-    filter_ctx[i].buffersink_ctx = NULL;
-    filter_ctx[i].filter_graph   = NULL;
-    if (!(ifmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO
-            || ifmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO))
-        return AVERROR(EINVAL);
-    if (ifmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
-        filter_spec = "null"; /* passthrough (dummy) filter for video */
-    else
-        filter_spec = "anull"; /* passthrough (dummy) filter for audio */
-    ret = init_filter(&filter_ctx[i], stream_ctx[i].dec_ctx,
-            stream_ctx[i].enc_ctx, filter_spec);
-    if (ret)
-        return ret;
-    filter_ctx[i].enc_pkt = av_packet_alloc();
-    if (!filter_ctx[i].enc_pkt)
-        return AVERROR(ENOMEM);
-    filter_ctx[i].filtered_frame = av_frame_alloc();
-    if (!filter_ctx[i].filtered_frame)
+    for (i = 0; i < ifmt_ctx->nb_streams; i++) {
+        enc_ctx = stream_ctx[i].enc_ctx;
+        if (!stream_ctx[i].out_stream || !enc_ctx)
+            continue;
+        filter_ctx[i].enc_pkt = av_packet_alloc();
+        if (!filter_ctx[i].enc_pkt)
+            return AVERROR(ENOMEM);
+        if (av->ladder && i == av->ladder_src)
+            filter_spec = ladder_spec = ladder_filter_spec(av);
+        else if (ifmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            filter_spec = "null"; /* passthrough (dummy) filter for video */
+        else
+            filter_spec = "anull"; /* passthrough (dummy) filter for audio */
+        if (!filter_spec)
+            return AVERROR(ENOMEM);
+        if (filter_is_noop(filter_spec, stream_ctx[i].dec_ctx, enc_ctx)) {
+            av_log(NULL, AV_LOG_DEBUG, "Stream #%u goes to the encoder unfiltered\n", i);
+            continue;
+        }
+        ret = init_filter(av, i, filter_spec);
+        av_freep(&ladder_spec);
+        if (ret)
+            return ret;
+        /* audio encoders with a fixed frame size must be fed exactly that many samples */
+        if (enc_ctx->codec_type == AVMEDIA_TYPE_AUDIO && enc_ctx->frame_size &&
+            !(enc_ctx->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+            av_buffersink_set_frame_size(filter_ctx[i].buffersink_ctx, enc_ctx->frame_size);
+        filter_ctx[i].filtered_frame = av_frame_alloc();
+        if (!filter_ctx[i].filtered_frame)
+            return AVERROR(ENOMEM);
+    }
+
+    // The rungs drain the graph of the ladder source through their own sink.
+    for (o = ifmt_ctx->nb_streams; o < av->nb_out; o++) {
+        filter_ctx[o].enc_pkt = av_packet_alloc();
+        filter_ctx[o].filtered_frame = av_frame_alloc();
+        if (!filter_ctx[o].enc_pkt || !filter_ctx[o].filtered_frame)
+            return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
+/**
+ * Hand an encoded packet to the egress. Always runs on the lcore.
+ */
+static int send_packet(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int stream_index, AVPacket *pkt)
+{
+    struct stream_ctx_t *stream = &rtp_sess->av_ctx->stream_ctx[stream_index];
+    int ret;
+
+    if (rtp_sess->egress != NSPK_RTP_EGRESS_NATIVE)
+        return av_interleaved_write_frame(rtp_sess->av_ctx->ofmt_ctx, pkt);
+
+    ret = nspk_rtp_pktzr_send(stream->pktzr, pkt);
+    // Whatever the frame left queued goes out over the frame interval.
+    if (ret >= 0 && stream->pacer)
+        nspk_pacer_spread(stream->pacer, stream->pktzr->frame_ts * rte_get_tsc_hz() /
+                                         stream->pktzr->clock_rate);
+    return ret;
+}
+
+/**
+ * Pipelined sessions queue the packet for the lcore, waiting for room in
+ * the ring. While the session drains, the lcore keeps dequeuing until the
+ * worker is done, so the flushed packets are still queued; they are only
+ * dropped once the lcore aborts the worker. The AVPackets come back from
+ * the lcore through pkt_free, so the worker does not malloc() what another
+ * thread free()s.
+ */
+static int write_packet(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int stream_index, AVPacket *pkt)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    AVPacket *out;
+
+    if (!rtp_sess->pipeline)
+        return send_packet(rtp_sess, stream_index, pkt);
+
+    if (rte_ring_sc_dequeue(av->pkt_free, (void **)&out) != 0 && !(out = av_packet_alloc()))
         return AVERROR(ENOMEM);
+    av_packet_move_ref(out, pkt);
+    out->stream_index = stream_index;
 
+    while (rte_ring_sp_enqueue(av->ring, out) != 0) {
+        if (__atomic_load_n(&av->worker_stop, __ATOMIC_ACQUIRE) == NSPK_MEDIA_WORKER_ABORT) {
+            av_packet_free(&out);
+            return 0;
+        }
+        av_usleep(NSPK_MEDIA_WORKER_WAIT_US);
+    }
     return 0;
 }
 
-static int encode_write_frame(unsigned int stream_index, int flush)
+/**
+ * Encode a frame, NULL flushes the encoder, and write the packets out.
+ */
+static int encode_write_frame(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int stream_index, AVFrame *filt_frame)
 {
-    struct stream_ctx_t *stream = &stream_ctx[stream_index];
-    struct filtering_ctx_t *filter = &filter_ctx[stream_index];
-    AVFrame *filt_frame = flush ? NULL : filter->filtered_frame;
+    struct stream_ctx_t *stream = &rtp_sess->av_ctx->stream_ctx[stream_index];
+    struct filtering_ctx_t *filter = &rtp_sess->av_ctx->filter_ctx[stream_index];
     AVPacket *enc_pkt = filter->enc_pkt;
     int ret;
 
     /* encode filtered frame */
     av_packet_unref(enc_pkt);
 
+    // The path is congested: retune the encoder, or skip the frame altogether.
+    if (filt_frame && stream->cc && nspk_cc_apply(stream->cc, stream->enc_ctx))
+        return 0;
+
     ret = avcodec_send_frame(stream->enc_ctx, filt_frame);
 
     if (ret < 0)
@@ -461,35 +1210,29 @@ static int encode_write_frame(unsigned int stream_index, int flush)
             return 0;
 
         /* prepare packet for muxing */
-        enc_pkt->stream_index = stream_index;
+        enc_pkt->stream_index = stream->out_stream->index;
         av_packet_rescale_ts(enc_pkt,
                              stream->enc_ctx->time_base,
-                             ofmt_ctx->streams[stream_index]->time_base);
+                             stream->out_stream->time_base);
 
         /* mux encoded frame */
         // ret = av_interleaved_write_frame(ofmt_ctx, enc_pkt);
-        
-        // TODO... Create my own RTP muxer like function which
-        // sends the RTP payloads through the TLDK UDP streams.
-        ret = av_interleaved_write_frame(ofmt_ctx, enc_pkt);
+
+        ret = write_packet(rtp_sess, stream_index, enc_pkt);
     }
 
     return ret;
 }
 
-static int filter_encode_write_frame(AVFrame *frame, unsigned int stream_index)
+/**
+ * Encode what the buffersink of output o holds.
+ */
+static int filter_drain(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int o)
 {
-    struct filtering_ctx_t *filter = &filter_ctx[stream_index];
+    struct filtering_ctx_t *filter = &rtp_sess->av_ctx->filter_ctx[o];
+    AVRational enc_tb = rtp_sess->av_ctx->stream_ctx[o].enc_ctx->time_base;
     int ret;
 
-    /* push the decoded frame into the filtergraph */
-    ret = av_buffersrc_add_frame_flags(filter->buffersrc_ctx,
-            frame, 0);
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Error while feeding the filtergraph\n");
-        return ret;
-    }
-
     /* pull filtered frames from the filtergraph */
     while (1) {
         ret = av_buffersink_get_frame(filter->buffersink_ctx,
@@ -504,8 +1247,13 @@ static int filter_encode_write_frame(AVFrame *frame, unsigned int stream_index)
             break;
         }
 
+        // The sink hands frames in the time base of the graph, e.g. 1/fps after an fps filter.
+        if (filter->filtered_frame->pts != AV_NOPTS_VALUE)
+            filter->filtered_frame->pts = av_rescale_q(filter->filtered_frame->pts,
+                                                       av_buffersink_get_time_base(filter->buffersink_ctx),
+                                                       enc_tb);
         filter->filtered_frame->pict_type = AV_PICTURE_TYPE_NONE;
-        ret = encode_write_frame(stream_index, 0);
+        ret = encode_write_frame(rtp_sess, o, filter->filtered_frame);
         av_frame_unref(filter->filtered_frame);
         if (ret < 0)
             break;
@@ -514,39 +1262,493 @@ static int filter_encode_write_frame(AVFrame *frame, unsigned int stream_index)
     return ret;
 }
 
-static int flush_encoder(unsigned int stream_index)
+static int filter_encode_write_frame(struct nspk_rtp_session_ctx_t *rtp_sess, AVFrame *frame, unsigned int stream_index)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    struct filtering_ctx_t *filter = &av->filter_ctx[stream_index];
+    unsigned int o;
+    int ret;
+
+    /* push the decoded frame into the filtergraph */
+    ret = av_buffersrc_add_frame_flags(filter->buffersrc_ctx,
+            frame, 0);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Error while feeding the filtergraph\n");
+        return ret;
+    }
+
+    if ((ret = filter_drain(rtp_sess, stream_index)) < 0)
+        return ret;
+    // The same decoded frame, scaled for each rung.
+    if (av->ladder && stream_index == av->ladder_src) {
+        for (o = av->ifmt_ctx->nb_streams; o < av->nb_out; o++)
+            if ((ret = filter_drain(rtp_sess, o)) < 0)
+                return ret;
+    }
+
+    return 0;
+}
+
+static int flush_encoder(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int stream_index)
 {
-    if (!(stream_ctx[stream_index].enc_ctx->codec->capabilities &
+    if (!(rtp_sess->av_ctx->stream_ctx[stream_index].enc_ctx->codec->capabilities &
                 AV_CODEC_CAP_DELAY))
         return 0;
 
     av_log(NULL, AV_LOG_INFO, "Flushing stream #%u encoder\n", stream_index);
-    return encode_write_frame(stream_index, 1);
+    return encode_write_frame(rtp_sess, stream_index, NULL);
+}
+
+/**
+ * Remux a packet, through the stream's bitstream filter if it has one.
+ * A NULL packet drains the filter.
+ */
+static int remux_write_packet(struct nspk_rtp_session_ctx_t *rtp_sess, unsigned int stream_index, AVPacket *pkt)
+{
+    struct stream_ctx_t *stream = &rtp_sess->av_ctx->stream_ctx[stream_index];
+    int ret;
+
+    if (!stream->bsf)
+        return pkt ? write_packet(rtp_sess, stream_index, pkt) : 0;
+
+    if ((ret = av_bsf_send_packet(stream->bsf, pkt)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Bitstream filtering of stream #%u failed\n", stream_index);
+        return ret;
+    }
+
+    while ((ret = av_bsf_receive_packet(stream->bsf, stream->bsf_pkt)) >= 0) {
+        stream->bsf_pkt->stream_index = stream->out_stream->index;
+        ret = write_packet(rtp_sess, stream_index, stream->bsf_pkt);
+        av_packet_unref(stream->bsf_pkt);
+        if (ret < 0)
+            return ret;
+    }
+
+    return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+/**
+ * Whether a packet may be processed now. With readrate set, packets are held
+ * back until the wall clock since the first packet reaches their dts.
+ * Input packets are paced, or the encoded ones for pipelined sessions.
+ */
+static int packet_due(struct nspk_rtp_session_ctx_t *rtp_sess, const AVPacket *pkt, AVRational time_base)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    int64_t dts, now;
+
+    if (!rtp_sess->readrate || pkt->dts == AV_NOPTS_VALUE ||
+        __atomic_load_n(&av->worker_stop, __ATOMIC_RELAXED))
+        return 1;
+
+    dts = av_rescale_q(pkt->dts, time_base, AV_TIME_BASE_Q);
+    now = av_gettime_relative();
+    if (av->start_time == AV_NOPTS_VALUE) {
+        av->start_time = now;
+        av->start_dts = dts;
+        return 1;
+    }
+
+    return dts - av->start_dts <= now - av->start_time;
+}
+
+/**
+ * Decode, filter, encode and send one input packet, or remux it.
+ * Returns 1 if the decoder refused the packet and the session must be drained.
+ */
+static int process_packet(struct nspk_rtp_session_ctx_t *rtp_sess, AVPacket *packet)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    unsigned int stream_index = packet->stream_index;
+    struct stream_ctx_t *stream = &av->stream_ctx[stream_index];
+    int ret;
+
+    if (stream->enc_ctx) {
+        av_packet_rescale_ts(packet,
+                             av->ifmt_ctx->streams[stream_index]->time_base,
+                             stream->dec_ctx->time_base);
+        ret = avcodec_send_packet(stream->dec_ctx, packet);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Decoding failed\n");
+            return 1;
+        }
+
+        while (ret >= 0) {
+            ret = avcodec_receive_frame(stream->dec_ctx, stream->dec_frame);
+            if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN))
+                break;
+            else if (ret < 0) {
+                av_log(NULL, AV_LOG_ERROR, "avcodec_receive_frame(): ret=%d\n", ret);
+                return ret;
+            }
+
+            stream->dec_frame->pts = stream->dec_frame->best_effort_timestamp;
+            if (av->filter_ctx[stream_index].filter_graph) {
+                ret = filter_encode_write_frame(rtp_sess, stream->dec_frame, stream_index);
+            } else {
+                stream->dec_frame->pts = av_rescale_q(stream->dec_frame->pts, stream->dec_ctx->time_base,
+                                                      stream->enc_ctx->time_base);
+                stream->dec_frame->pict_type = AV_PICTURE_TYPE_NONE;
+                ret = encode_write_frame(rtp_sess, stream_index, stream->dec_frame);
+            }
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_ERROR, "filter_encode_write_frame(): ret=%d\n", ret);
+                return ret;
+            }
+        }
+    } else {
+        /* remux this frame without reencoding */
+        av_packet_rescale_ts(packet,
+                             av->ifmt_ctx->streams[stream_index]->time_base,
+                             stream->out_stream->time_base);
+        packet->stream_index = stream->out_stream->index;
+
+        ret = remux_write_packet(rtp_sess, stream_index, packet);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "av_write_frame(): ret=%d\n", ret);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int flush_encoders(struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    unsigned int i;
+    int ret;
+
+    av_log(NULL, AV_LOG_DEBUG, "%s: Stopping RTP session %d.\n", __func__, rtp_sess->session_id);
+
+    /* flush bitstream filters, filters and encoders */
+    for (i = 0; i < av->ifmt_ctx->nb_streams; i++) {
+        if (!av->stream_ctx[i].enc_ctx) {
+            if ((ret = remux_write_packet(rtp_sess, i, NULL)) < 0)
+                return ret;
+            continue;
+        }
+
+        /* flush filter */
+        if (av->filter_ctx[i].filter_graph) {
+            ret = filter_encode_write_frame(rtp_sess, NULL, i);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_ERROR, "Flushing filter failed\n");
+                return ret;
+            }
+        }
+
+        /* flush encoder */
+        ret = flush_encoder(rtp_sess, i);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Flushing encoder failed\n");
+            return ret;
+        }
+    }
+
+    /* the rungs' filters went with their source's graph */
+    for (i = av->ifmt_ctx->nb_streams; i < av->nb_out; i++) {
+        ret = flush_encoder(rtp_sess, i);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Flushing encoder failed\n");
+            return ret;
+        }
+    }
+
+    return 0;
 }
 
-static void nspk_av_cleanup()
+/**
+ * Send what the packetizers or the muxer still hold. Runs on the lcore.
+ */
+static int flush_output(struct nspk_rtp_session_ctx_t *rtp_sess)
 {
-	int i;
-	for (i = 0; i < ifmt_ctx->nb_streams; i++) {
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    unsigned int i;
+
+    if (rtp_sess->egress == NSPK_RTP_EGRESS_NATIVE) {
+        for (i = 0; i < av->nb_out; i++) {
+            if (!av->stream_ctx[i].pktzr)
+                continue;
+            nspk_rtp_pktzr_flush(av->stream_ctx[i].pktzr);
+            if (av->stream_ctx[i].pacer)
+                nspk_pacer_flush(av->stream_ctx[i].pacer);
+            else if (av->stream_ctx[i].rtp_fs)
+                nspk_tldk_udp_stream_flush(av->stream_ctx[i].rtp_fs);
+        }
+        return 0;
+    }
+
+    return av_write_trailer(av->ofmt_ctx);
+}
+
+/**
+ * Codec worker of a pipelined session: the former transcoder loop, with
+ * write_packet() queuing the encoded packets for the lcore.
+ */
+static void *media_worker(void *arg)
+{
+    struct nspk_rtp_session_ctx_t *rtp_sess = arg;
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    AVPacket *packet = av->in_pkt;
+    int ret = 0;
+
+    while (!__atomic_load_n(&av->worker_stop, __ATOMIC_ACQUIRE)) {
+        ret = av_read_frame(av->ifmt_ctx, packet);
+        if (ret == AVERROR(EAGAIN)) {
+            av_usleep(NSPK_MEDIA_WORKER_WAIT_US);
+            continue;
+        }
+        if (ret < 0) {
+            if (ret != AVERROR_EOF)
+                av_log(NULL, AV_LOG_ERROR, "RTP session %d: reading input failed: %s\n",
+                       rtp_sess->session_id, av_err2str(ret));
+            ret = 0;
+            break;
+        }
+        if (!av->stream_ctx[packet->stream_index].out_stream) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        ret = process_packet(rtp_sess, packet);
+        av_packet_unref(packet);
+        if (ret != 0)
+            break;
+    }
+
+    if (ret >= 0)
+        ret = flush_encoders(rtp_sess);
+
+    av->worker_ret = ret;
+    __atomic_store_n(&av->worker_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int media_worker_start(struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    char name[RTE_RING_NAMESIZE];
+    rte_cpuset_t cpuset;
+    pthread_attr_t attr;
+    int ret;
+
+    snprintf(name, sizeof(name), "nspk_media_%u_%d", rte_lcore_id(), rtp_sess->session_id);
+    av->ring = rte_ring_create(name, NSPK_MEDIA_RING_SIZE, rte_socket_id(),
+                               RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (!av->ring) {
+        av_log(NULL, AV_LOG_ERROR, "%s: Could not create ring %s\n", __func__, name);
+        return AVERROR(rte_errno);
+    }
+    snprintf(name, sizeof(name), "nspk_pkts_%u_%d", rte_lcore_id(), rtp_sess->session_id);
+    av->pkt_free = rte_ring_create(name, NSPK_MEDIA_RING_SIZE, rte_socket_id(),
+                                   RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (!av->pkt_free) {
+        av_log(NULL, AV_LOG_ERROR, "%s: Could not create ring %s\n", __func__, name);
+        return AVERROR(rte_errno);
+    }
+
+    // A thread started from an lcore inherits its affinity, so the worker would
+    // compete with the packet loop.
+    pthread_attr_init(&attr);
+    nspk_cpu_codec_set(rtp_sess, &cpuset);
+    if (CPU_COUNT(&cpuset))
+        pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+    else
+        av_log(NULL, AV_LOG_WARNING, "RTP session %d: no CPU left for the codec worker\n",
+               rtp_sess->session_id);
+    ret = pthread_create(&av->worker, &attr, media_worker, rtp_sess);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: pthread_create failed: %s\n", __func__, strerror(ret));
+        return AVERROR(ret);
+    }
+    av->worker_started = 1;
+
+    snprintf(name, sizeof(name), "nspk-codec-%d", rtp_sess->session_id);
+    name[15] = '\0';
+    pthread_setname_np(av->worker, name);
+    return 0;
+}
+
+static void media_worker_stop(struct nspk_av_ctx_t *av)
+{
+    if (!av->worker_started)
+        return;
+
+    __atomic_store_n(&av->worker_stop, NSPK_MEDIA_WORKER_ABORT, __ATOMIC_RELEASE);
+    pthread_join(av->worker, NULL);
+    av->worker_started = 0;
+}
+
+/**
+ * Lcore side of a pipelined session: send at most one encoded packet, once due.
+ */
+static int pipeline_step(struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    struct stream_ctx_t *stream;
+    AVPacket *pkt = av->out_pkt;
+    unsigned int stream_index;
+    int ret;
+
+    if (!pkt) {
+        if (rte_ring_sc_dequeue(av->ring, (void **)&pkt) != 0) {
+            // Nothing can follow the worker's last enqueue.
+            if (__atomic_load_n(&av->worker_done, __ATOMIC_ACQUIRE) && rte_ring_empty(av->ring)) {
+                rtp_sess->state = NSPK_RTP_SESS_DRAINING;
+                return 1;
+            }
+            return 0;
+        }
+        av->out_pkt = pkt;
+    }
+
+    stream_index = pkt->stream_index;
+    stream = &av->stream_ctx[stream_index];
+    if (!packet_due(rtp_sess, pkt, stream->out_stream->time_base))
+        return 0;
+
+    av->out_pkt = NULL;
+    pkt->stream_index = stream->out_stream->index;
+    ret = send_packet(rtp_sess, stream_index, pkt);
+    av_packet_unref(pkt);
+    if (rte_ring_sp_enqueue(av->pkt_free, pkt) != 0)
+        av_packet_free(&pkt);
+    if (ret < 0) {
+        rtp_sess->state = NSPK_RTP_SESS_DONE;
+        return ret;
+    }
+    return 1;
+}
+
+void nspk_media_close(struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    struct stream_ctx_t *stream_ctx;
+    unsigned int i;
+
+    if (!av)
+        return;
+
+    media_worker_stop(av);
+    if (av->ring) {
+        AVPacket *pkt;
+        while (rte_ring_sc_dequeue(av->ring, (void **)&pkt) == 0)
+            av_packet_free(&pkt);
+        rte_ring_free(av->ring);
+    }
+    if (av->pkt_free) {
+        AVPacket *pkt;
+        while (rte_ring_sc_dequeue(av->pkt_free, (void **)&pkt) == 0)
+            av_packet_free(&pkt);
+        rte_ring_free(av->pkt_free);
+    }
+    av_packet_free(&av->out_pkt);
+
+    stream_ctx = av->stream_ctx;
+    for (i = 0; stream_ctx && i < av->nb_out; i++) {
         avcodec_free_context(&stream_ctx[i].dec_ctx);
-        if (ofmt_ctx && ofmt_ctx->nb_streams > i && ofmt_ctx->streams[i] && stream_ctx[i].enc_ctx)
-            avcodec_free_context(&stream_ctx[i].enc_ctx);
-        if (filter_ctx && filter_ctx[i].filter_graph) {
-            avfilter_graph_free(&filter_ctx[i].filter_graph);
-            av_packet_free(&filter_ctx[i].enc_pkt);
-            av_frame_free(&filter_ctx[i].filtered_frame);
+        avcodec_free_context(&stream_ctx[i].enc_ctx);
+        // Frames the filters or the ring still hold return to the pools' memory once released.
+        if (stream_ctx[i].dec_pool && stream_ctx[i].dec_pool->fallbacks)
+            av_log(NULL, AV_LOG_WARNING, "RTP session %d stream #%u: %"PRIu64" of %"PRIu64" frames "
+                   "decoded outside the pool\n", rtp_sess->session_id, i, stream_ctx[i].dec_pool->fallbacks,
+                   stream_ctx[i].dec_pool->gets + stream_ctx[i].dec_pool->fallbacks);
+        if (stream_ctx[i].enc_pool && stream_ctx[i].enc_pool->fallbacks)
+            av_log(NULL, AV_LOG_WARNING, "RTP session %d stream #%u: %"PRIu64" of %"PRIu64" packets "
+                   "encoded outside the pool\n", rtp_sess->session_id, i, stream_ctx[i].enc_pool->fallbacks,
+                   stream_ctx[i].enc_pool->gets + stream_ctx[i].enc_pool->fallbacks);
+        nspk_bufpool_free(&stream_ctx[i].dec_pool);
+        nspk_bufpool_free(&stream_ctx[i].enc_pool);
+        if (av->filter_ctx) {
+            avfilter_graph_free(&av->filter_ctx[i].filter_graph);
+            av_packet_free(&av->filter_ctx[i].enc_pkt);
+            av_frame_free(&av->filter_ctx[i].filtered_frame);
+        }
+        av_bsf_free(&stream_ctx[i].bsf);
+        av_packet_free(&stream_ctx[i].bsf_pkt);
+        if (stream_ctx[i].cc) {
+            struct nspk_cc_t *cc = stream_ctx[i].cc;
+            av_log(NULL, AV_LOG_INFO, "RTP session %d stream #%u: rate control %"PRId64" kbps, %"PRIu64" up, "
+                   "%"PRIu64" down, %"PRIu64" retunes, %"PRIu64" holds, %"PRIu64" frames skipped\n",
+                   rtp_sess->session_id, i, cc->bps / 1000, cc->increases, cc->decreases, cc->retunes,
+                   cc->holds, cc->skipped);
+            av_freep(&stream_ctx[i].cc);
+        }
+        // The final SR reads the packetizer and the RTP stream counters.
+        if (stream_ctx[i].rtcp) {
+            struct nspk_rtcp_t *rtcp = stream_ctx[i].rtcp;
+            av_log(NULL, AV_LOG_INFO, "RTP session %d stream #%u: %"PRIu64" SRs, %"PRIu64" RRs, %"PRIu64" NACKs, "
+                   "%"PRIu64" invalid, %"PRIu64" drops, last RR lost %d jitter %"PRIu32"us rtt %"PRIu32"us\n",
+                   rtp_sess->session_id, i, rtcp->srs, rtcp->rrs, rtcp->nacks, rtcp->invalid, rtcp->drops,
+                   rtcp->rr.cum_lost, rtcp->rr.jitter_us, rtcp->rr.rtt_us);
+            nspk_rtcp_fini(rtcp);
+            av_freep(&stream_ctx[i].rtcp);
+        }
+        if (stream_ctx[i].rtp_fs) {
+            stream_ctx[i].rtp_fs->tx_cb = NULL;
+            stream_ctx[i].rtp_fs->udata = NULL;
+        }
+        if (stream_ctx[i].rtx) {
+            struct nspk_rtx_t *rtx = stream_ctx[i].rtx;
+            av_log(NULL, AV_LOG_INFO, "RTP session %d stream #%u: %"PRIu64" NACKed, %"PRIu64" resent, "
+                   "%"PRIu64" out of the window, %"PRIu64" in flight, %"PRIu64" drops\n",
+                   rtp_sess->session_id, i, rtx->nacked, rtx->resent, rtx->misses, rtx->busy, rtx->drops);
+            nspk_rtx_fini(rtx);
+            av_freep(&stream_ctx[i].rtx);
+        }
+        if (stream_ctx[i].fanout) {
+            struct nspk_fanout_t *fo = stream_ctx[i].fanout;
+            av_log(NULL, AV_LOG_INFO, "RTP session %d stream #%u: fan-out of %"PRIu64" packets to %u receivers, "
+                   "%"PRIu64" copies, %"PRIu64" drops\n",
+                   rtp_sess->session_id, i, fo->packets, fo->num, fo->copies, fo->drops);
+            nspk_fanout_fini(fo);
+            av_freep(&stream_ctx[i].fanout);
+        }
+        if (stream_ctx[i].fec) {
+            struct nspk_fec_t *fec = stream_ctx[i].fec;
+            av_log(NULL, AV_LOG_INFO, "RTP session %d stream #%u: FEC %dx%d over %"PRIu64" packets, "
+                   "%"PRIu64" column, %"PRIu64" row, %"PRIu64" resets, %"PRIu64" drops\n",
+                   rtp_sess->session_id, i, fec->l, fec->d, fec->packets, fec->col_sent, fec->row_sent,
+                   fec->resets, fec->drops);
+            nspk_fec_fini(fec);
+            av_freep(&stream_ctx[i].fec);
         }
+        if (stream_ctx[i].pktzr) {
+            av_log(NULL, AV_LOG_INFO, "RTP session %d stream #%u: %"PRIu64" packets, %"PRIu64" bytes "
+                   "(%"PRIu64" attached), %"PRIu64" drops\n",
+                   rtp_sess->session_id, i, stream_ctx[i].pktzr->packets, stream_ctx[i].pktzr->octets,
+                   stream_ctx[i].pktzr->attached, stream_ctx[i].pktzr->drops);
+            nspk_rtp_pktzr_uninit(stream_ctx[i].pktzr);
+            av_freep(&stream_ctx[i].pktzr);
+        }
+        if (stream_ctx[i].pacer) {
+            av_log(NULL, AV_LOG_INFO, "RTP session %d stream #%u: paced %"PRIu64" packets, %"PRIu64" overflows, %"PRIu64" drops\n",
+                   rtp_sess->session_id, i, stream_ctx[i].pacer->packets, stream_ctx[i].pacer->overflows,
+                   stream_ctx[i].pacer->drops);
+            nspk_pacer_fini(stream_ctx[i].pacer);
+            av_freep(&stream_ctx[i].pacer);
+        }
+        // Give the FE streams back to the lcore for the next session.
+        nspk_tldk_udp_stream_close(stream_ctx[i].rtcp_fs);
+        nspk_tldk_udp_stream_close(stream_ctx[i].rtp_fs);
 
         av_frame_free(&stream_ctx[i].dec_frame);
     }
-    if (filter_ctx)
-        av_freep(filter_ctx);
-    if (stream_ctx)
-        av_freep(stream_ctx);
-    avformat_close_input(&ifmt_ctx);
-    if (ofmt_ctx && !(ofmt_ctx->oformat->flags & AVFMT_NOFILE))
-        avio_closep(&ofmt_ctx->pb);
-    avformat_free_context(ofmt_ctx);
+    av_freep(&av->filter_ctx);
+    av_freep(&av->stream_ctx);
+    av_freep(&av->ladder);
+    avformat_close_input(&av->ifmt_ctx);
+    if (av->ofmt_ctx && !(av->ofmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+        if (rtp_sess->egress == NSPK_RTP_EGRESS_MBUF)
+            nspk_avio_close_mbuf(&av->ofmt_ctx->pb);
+        else
+            avio_closep(&av->ofmt_ctx->pb);
+    }
+    avformat_free_context(av->ofmt_ctx);
+    av_packet_free(&av->in_pkt);
+    av_freep(&rtp_sess->av_ctx);
 }
 
 int nspk_media_init(struct nspk_rtp_session_ctx_t *rtp_sess)
@@ -560,155 +1762,176 @@ int nspk_media_init(struct nspk_rtp_session_ctx_t *rtp_sess)
 #endif
     avformat_network_init();
 
+    rtp_sess->state = NSPK_RTP_SESS_INIT;
+    rtp_sess->av_ctx = av_mallocz(sizeof(*rtp_sess->av_ctx));
+    if (!rtp_sess->av_ctx)
+        return ENOMEM;
+    rtp_sess->av_ctx->start_time = AV_NOPTS_VALUE;
+    rtp_sess->av_ctx->in_pkt = av_packet_alloc();
+    if (!rtp_sess->av_ctx->in_pkt)
+        goto error;
+
     av_log(NULL, AV_LOG_INFO, "*** Opening input file %s ***\n", rtp_sess->src_url);
     if ((ret = open_input_file(rtp_sess)) < 0)
         goto error;
     av_log(NULL, AV_LOG_INFO, "*** Opened input file ***\n");
 
     av_log(NULL, AV_LOG_INFO, "*** Opening output file %s ***\n", rtp_sess->dst_url);
-    if ((ret = open_output_file(rtp_sess, TARGET_INPUT_STREAM)) < 0)
+    if ((ret = open_output_file(rtp_sess)) < 0)
         goto error;
     av_log(NULL, AV_LOG_INFO, "*** Opened output file ***\n");
 
     av_log(NULL, AV_LOG_INFO, "*** Intializing filters ***\n");
-    if ((ret = init_filters(TARGET_INPUT_STREAM)) < 0)
+    if ((ret = init_filters(rtp_sess->av_ctx)) < 0)
         goto error;
     av_log(NULL, AV_LOG_INFO, "*** Initialized filters ***\n");
 
+    if (rtp_sess->pipeline && (ret = media_worker_start(rtp_sess)) < 0)
+        goto error;
+
+    rtp_sess->state = NSPK_RTP_SESS_RUNNING;
 	return 0;
 error:
-	nspk_av_cleanup();
+	nspk_media_close(rtp_sess);
 	return EINVAL;
 }
 
-int nspk_media_start(struct nspk_rtp_session_ctx_t *rtp_sess)
+/**
+ * Move the target bitrates of the session's streams, on the lcore.
+ */
+static void rate_control(struct nspk_rtp_session_ctx_t *rtp_sess)
 {
-	AVPacket *packet = NULL;
-	unsigned int stream_index;
-	unsigned int i;
-	int ret;
-
-	if (!(packet = av_packet_alloc()))
-        goto end;
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    uint64_t now = rte_rdtsc();
+    unsigned int i;
 
-	/* read all packets */
-    while (!force_quit) {
-        if ((ret = av_read_frame(ifmt_ctx, packet)) < 0)
-            break;
-        stream_index = packet->stream_index;
-        if (stream_index != TARGET_INPUT_STREAM)
-            continue;
+    for (i = 0; i < av->nb_out; i++) {
+        if (av->stream_ctx[i].cc && nspk_cc_run(av->stream_ctx[i].cc, now))
+            av_log(NULL, AV_LOG_DEBUG, "RTP session %d stream #%u: target %"PRId64" kbps%s\n",
+                   rtp_sess->session_id, i, av->stream_ctx[i].cc->bps / 1000,
+                   av->stream_ctx[i].cc->lcore_hold ? ", holding frames" : "");
+    }
+}
 
-        if (filter_ctx[stream_index].filter_graph) {
-            struct stream_ctx_t *stream = &stream_ctx[stream_index];
+int nspk_media_step(struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    struct nspk_av_ctx_t *av = rtp_sess->av_ctx;
+    AVPacket *packet;
+    int ret;
 
-            av_packet_rescale_ts(packet,
-                                 ifmt_ctx->streams[stream_index]->time_base,
-                                 stream->dec_ctx->time_base);
-            ret = avcodec_send_packet(stream->dec_ctx, packet);
+    switch (rtp_sess->state) {
+    case NSPK_RTP_SESS_RUNNING:
+        if (rtp_sess->cc)
+            rate_control(rtp_sess);
+        if (rtp_sess->pipeline)
+            return pipeline_step(rtp_sess);
+
+        packet = av->in_pkt;
+        if (!av->in_pkt_pending) {
+            ret = av_read_frame(av->ifmt_ctx, packet);
+            if (ret == AVERROR(EAGAIN))
+                return 0;
             if (ret < 0) {
-                av_log(NULL, AV_LOG_ERROR, "Decoding failed\n");
-                break;
+                if (ret != AVERROR_EOF)
+                    av_log(NULL, AV_LOG_ERROR, "RTP session %d: reading input failed: %s\n",
+                           rtp_sess->session_id, av_err2str(ret));
+                rtp_sess->state = NSPK_RTP_SESS_DRAINING;
+                return 1;
             }
-
-            while (ret >= 0) {
-                ret = avcodec_receive_frame(stream->dec_ctx, stream->dec_frame);
-                if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN))
-                    break;
-                else if (ret < 0) {
-                    av_log(NULL, AV_LOG_ERROR, "avcodec_receive_frame(): ret=%d\n", ret);
-                    goto end;
-                }
-
-                stream->dec_frame->pts = stream->dec_frame->best_effort_timestamp;
-                ret = filter_encode_write_frame(stream->dec_frame, stream_index);
-                if (ret < 0) {
-                    av_log(NULL, AV_LOG_ERROR, "filter_encode_write_frame(): ret=%d\n", ret);
-                    goto end;
-                }
-            }
-        } else {
-            /* remux this frame without reencoding */
-            av_packet_rescale_ts(packet,
-                                 ifmt_ctx->streams[stream_index]->time_base,
-                                 ofmt_ctx->streams[stream_index]->time_base);
-
-            ret = av_interleaved_write_frame(ofmt_ctx, packet);
-            if (ret < 0) {
-                av_log(NULL, AV_LOG_ERROR, "av_write_frame(): ret=%d\n", ret);
-                goto end;
+            if (!av->stream_ctx[packet->stream_index].out_stream) {
+                av_packet_unref(packet);
+                return 1;
             }
+            av->in_pkt_pending = 1;
         }
-        av_packet_unref(packet);
-    } // while(1)
 
-    av_log(NULL, AV_LOG_DEBUG, "%s: Stopping stream.\n", __FUNCTION__);
+        if (!packet_due(rtp_sess, packet, av->ifmt_ctx->streams[packet->stream_index]->time_base))
+            return 0;
 
-	/* flush filters and encoders */
-    for (i = 0; i < ifmt_ctx->nb_streams; i++) {
-        /* flush filter */
-        if (!filter_ctx[i].filter_graph)
-            continue;
-        ret = filter_encode_write_frame(NULL, i);
+        av->in_pkt_pending = 0;
+        ret = process_packet(rtp_sess, packet);
+        av_packet_unref(packet);
         if (ret < 0) {
-            av_log(NULL, AV_LOG_ERROR, "Flushing filter failed\n");
-            goto end;
+            rtp_sess->state = NSPK_RTP_SESS_DONE;
+            return ret;
         }
-
-        /* flush encoder */
-        ret = flush_encoder(i);
-        if (ret < 0) {
-            av_log(NULL, AV_LOG_ERROR, "Flushing encoder failed\n");
-            goto end;
+        if (ret > 0)
+            rtp_sess->state = NSPK_RTP_SESS_DRAINING;
+        return 1;
+
+    case NSPK_RTP_SESS_DRAINING:
+        if (rtp_sess->pipeline) {
+            // The worker has flushed the encoders already.
+            media_worker_stop(av);
+            ret = av->worker_ret;
+        } else {
+            ret = flush_encoders(rtp_sess);
         }
+        if (ret >= 0)
+            ret = flush_output(rtp_sess);
+        rtp_sess->state = NSPK_RTP_SESS_DONE;
+        return ret < 0 ? ret : AVERROR_EOF;
+
+    default:
+        return AVERROR_EOF;
     }
+}
 
-    av_write_trailer(ofmt_ctx);
+void nspk_media_stop(struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    if (rtp_sess->state != NSPK_RTP_SESS_RUNNING)
+        return;
 
-end:
-	nspk_av_cleanup();
+    // The lcore keeps sending what the worker queues until it is done.
+    if (rtp_sess->pipeline) {
+        __atomic_store_n(&rtp_sess->av_ctx->worker_stop, NSPK_MEDIA_WORKER_DRAIN, __ATOMIC_RELEASE);
+        return;
+    }
 
-    if (ret < 0)
-        av_log(NULL, AV_LOG_ERROR, "Error occurred: %s\n", av_err2str(ret));
-	return ret ? 1 : 0;
+    if (rtp_sess->av_ctx->in_pkt_pending) {
+        av_packet_unref(rtp_sess->av_ctx->in_pkt);
+        rtp_sess->av_ctx->in_pkt_pending = 0;
+    }
+    rtp_sess->state = NSPK_RTP_SESS_DRAINING;
 }
 
-static int
-nspk_rtp_generate_rtp(struct nspk_rtp_session_ctx_t *rtp_sess)
+int nspk_media_start(struct nspk_rtp_session_ctx_t *rtp_sess)
 {
-	int num_pkts = 0;
+    int ret;
+
+    while ((ret = nspk_media_step(rtp_sess)) >= 0) {
+        if (force_quit)
+            nspk_media_stop(rtp_sess);
+        nspk_tldk_lcore_rx();
+        nspk_udp_lcore_run();
+        nspk_pacer_lcore_run();
+        nspk_rtcp_lcore_run();
+        nspk_tldk_lcore_flush();
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+
+    nspk_media_close(rtp_sess);
 
-	// TODO: Implement this function:
-	// - Read media file at rtp_sess->src through ffmpeg lib.
-	// - Parse the file and generate H264 RTP payload.
-	// - Append each payload in the mbuf at rtp_sess->fe_stream->pbuf.
-	pkt_buf_fill(rtp_sess->lcore_prm->be.lc->id, &rtp_sess->fe_stream->pbuf, 64);
-	num_pkts = 64;
-	return num_pkts;
+    if (ret < 0)
+        av_log(NULL, AV_LOG_ERROR, "Error occurred: %s\n", av_err2str(ret));
+	return ret ? 1 : 0;
 }
 
-struct nspk_rtp_session_ctx_t *g_rtp_sess = NULL;
 // TODO
-// This thread is run by the master lcore and is currently dedicated to sending RTP stream only.
-// Later we will change the design such that this thread will dedicate to the session control thread,
-// that is when this function will be moved elsewhere.
+// This thread is run by the slave lcores and is currently dedicated to sending RTP streams only.
+// Later we will change the design such that the sessions are handed over by the session control
+// thread instead of being fixed at launch.
 int
 nspk_lcore_main_rtp(void *arg)
 {
-    int i;
 	int rc = 0;
 	uint32_t lcore;
-	struct nspk_rtp_session_ctx_t *rtp_sess = (struct nspk_rtp_session_ctx_t*)arg;
-    g_rtp_sess = rtp_sess;
+	struct nspk_sched_t *sched = (struct nspk_sched_t *)arg;
 	struct lcore_prm *prm;
-    struct netfe_stream *fs;
-    struct netfe_sprm *sprm;
-    struct tle_udp_stream_param uprm;
-    struct sockaddr_in remote_addr;
-    char ip_addr[INET_ADDRSTRLEN];
-    struct netfe_lcore *fe;
-
-	prm = rtp_sess->lcore_prm;
+	struct netfe_lcore *fe;
+
+	prm = sched->lcore_prm;
 	lcore = rte_lcore_id();
 
 	RTE_LOG(NOTICE, USER1, "%s(lcore=%u) start\n",
@@ -722,23 +1945,6 @@ nspk_lcore_main_rtp(void *arg)
     if (fe == NULL)
 		return EINVAL;
 
-    rc = nspk_media_init(rtp_sess);
-	if (rc != 0) {
-		return rc;
-	}
-
-	// /* lcore FE init. */
-	// if (prm->fe.max_streams != 0) {
-	// 	fs = netfe_lcore_init_udp(&prm->fe);
-	// 	if (fs == NULL) {
-	// 		fprintf(stderr, "Error: failed to init UDP stream.\n");
-	// 		return EFAULT;
-	// 	}
-	// 	av_log(NULL, AV_LOG_DEBUG, "FE stream laddr=%s, raddr=%s\n",
-    //         format_addr((struct sockaddr_storage*)&fs->laddr, ip_addr, sizeof(fs->laddr)),
-	// 		format_addr((struct sockaddr_storage*)&fs->raddr, ip_addr, sizeof(fs->raddr)));
-	// }
-
 	/* lcore BE init. */
 	if (prm->be.lc != NULL)
 		rc = netbe_lcore_setup(prm->be.lc);
@@ -746,60 +1952,24 @@ nspk_lcore_main_rtp(void *arg)
 	if (rc != 0)
 		sig_handle(SIGQUIT);
 
-    // We will use only one FE stream for now.
-    // sprm = &prm->fe.stream[0].sprm;
-    // fs = netfe_stream_open_udp(fe, sprm, lcore, prm->fe.stream[0].op,
-	// 	sprm->bidx);
-	// if (fs == NULL) {
-	// 	rc = -rte_errno;
-	// 	return rc;
-	// }
-
-    // TODO: Find a stream using its remote address.
-    // inet_pton(AF_INET, "10.0.0.10", &(remote_addr.sin_addr));
-    // for (i = 0; i != fe->use.num; i++) {
-	// 	fs = netfe_get_stream(&fe->use);
-	// 	tle_udp_stream_get_param(fs->s, &uprm);
-	// 	netfe_stream_dump(fs, &uprm.local_addr, &uprm.remote_addr);
-    //     if (netfe_addr_eq(&uprm.remote_addr, &remote_addr, AF_INET)) {
-    //         av_log(NULL, AV_LOG_DEBUG, "Matched network address %s\n",
-    //             format_addr((struct sockaddr_storage*)&remote_addr, remote_ip, sizeof(remote_ip)));
-    //         break;
-    //     }
-	// 	// netfe_stream_close(fe, fs);
-	// }
-
-	RTE_LOG(NOTICE, USER1, "%s (lcore=%u) Starting RTP session %d\n",
-		__func__, lcore, rtp_sess->session_id);
-	rc = nspk_media_start(rtp_sess);
-
-	// while (force_quit == 0) {
-	// 	// TODO: Understand the event API.
-    //     // tle_event_raise(fs->txev);
-	// 	// fs->stat.txev[TLE_SEV_UP]++;
-
-    //     // TODO:
-    //     // Build a burst of RTP packets from the opened media file.
-    //     // Write a test RTP packet into the UDP TX queue.
-	// 	int num_pkt;
-	// 	if ((num_pkt = nspk_rtp_generate_rtp(rtp_sess)) <= 0) {
-	// 		fprintf(stderr, "Error: No RTP packets generated to mbuf.\n");
-	// 		continue;
-	// 	}
-	// 	av_log(NULL, AV_LOG_DEBUG, "Generated %d RTP packets to mbuf.\n", num_pkt);
-
-	// 	// FE send
-	// 	netfe_tx_process_udp(lcore, fs);
-
-	// 	// BE send
-	// 	netbe_lcore();
-
-	// 	rte_delay_ms(1000);
-	// }
-end:
+	/* RTSP and HTTP listeners on the ports the queues of this lcore own. */
+	if (nspk_rtsp_prm.enable && nspk_rtsp_lcore_init(prm) != 0)
+		sig_handle(SIGQUIT);
+	if (nspk_http_prm.enable && nspk_http_lcore_init(prm) != 0)
+		sig_handle(SIGQUIT);
+
+	RTE_LOG(NOTICE, USER1, "%s (lcore=%u) Starting %u RTP sessions\n",
+		__func__, lcore, sched->nb_sess);
+	rc = nspk_sched_run(sched);
+
 	RTE_LOG(NOTICE, USER1, "%s(lcore=%u) finish\n",
 		__func__, lcore);
 
+	/* TCP streams first, netfe_lcore_fini_udp() takes all as UDP. */
+	if (nspk_rtsp_prm.enable)
+		nspk_rtsp_lcore_fini();
+	if (nspk_http_prm.enable)
+		nspk_http_lcore_fini();
 	netfe_lcore_fini_udp();
 	netbe_lcore_clear();
 
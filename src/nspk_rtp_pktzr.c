@@ -0,0 +1,506 @@
+/**
+ * NSPK native RTP packetizers.
+ * H.264 (RFC 6184) and HEVC (RFC 7798): single NAL unit, aggregation
+ * (STAP-A / AP) and fragmentation (FU-A / FU) packets. Large payloads of
+ * packets encoded into an encoder pool are attached, not copied.
+ * Audio packetizers live in nspk_rtp_pktzr_audio.c.
+ */
+
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_malloc.h>
+#include <rte_memory.h>
+#include <nspk.h>
+#include <nspk_rtp_pktzr.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/random_seed.h>
+#include <libavformat/avc.h>
+
+#define H264_NAL_STAP_A     24
+#define H264_NAL_FU_A       28
+#define HEVC_NAL_AP         48
+#define HEVC_NAL_FU         49
+
+#define FU_START            0x80
+#define FU_END              0x40
+
+int nspk_rtp_pktzr_supported(enum AVCodecID codec_id)
+{
+    switch (codec_id) {
+    case AV_CODEC_ID_H264:
+    case AV_CODEC_ID_HEVC:
+    case AV_CODEC_ID_AAC:
+    case AV_CODEC_ID_OPUS:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int nspk_rtp_pktzr_sink_udp(void *opaque, struct rte_mbuf *m)
+{
+    return nspk_tldk_udp_stream_send_mbuf((struct netfe_stream *)opaque, m);
+}
+
+uint8_t *nspk_rtp_pktzr_begin(struct nspk_rtp_pktzr_t *p, struct rte_mbuf **pm)
+{
+    struct rte_mbuf *m = pkt_mag_get(&p->mag);
+
+    *pm = m;
+    if (!m) {
+        p->drops++;
+        return NULL;
+    }
+    return rte_pktmbuf_mtod(m, uint8_t *) + NSPK_RTP_HDR_SIZE;
+}
+
+int nspk_rtp_pktzr_commit(struct nspk_rtp_pktzr_t *p, struct rte_mbuf *m,
+                          int payload_len, int marker)
+{
+    uint8_t *hdr = rte_pktmbuf_mtod(m, uint8_t *);
+    int len = NSPK_RTP_HDR_SIZE + payload_len;
+
+    if (marker)
+        hdr[1] |= 0x80;
+    AV_WB16(hdr + 2, p->seq);
+    AV_WB32(hdr + 4, p->cur_ts);
+    if (!m->next) {
+        m->data_len = len;
+        m->pkt_len = len;
+    }
+
+    if (p->sink(p->sink_opaque, m) < 0) {
+        pkt_mag_put(&p->mag, m);
+        p->drops++;
+        return 0;
+    }
+
+    p->seq++;
+    p->packets++;
+    p->octets += payload_len;
+    return 0;
+}
+
+/**
+ * Chain mbufs attached to len bytes of the encoded packet at data to the
+ * header mbuf h, which holds hdr_len bytes of payload headers. Pool memory
+ * is only IOVA-contiguous within a hugepage in IOVA as PA mode, there a
+ * page boundary splits the bytes over two mbufs. Frees h on failure.
+ */
+static int pktzr_attach(struct nspk_rtp_pktzr_t *p, struct rte_mbuf *h, int hdr_len,
+                        const uint8_t *data, int len)
+{
+    const struct rte_memseg_list *msl;
+    uint64_t page_sz = 0;
+    struct rte_mbuf *m;
+    int off, n;
+
+    h->data_len = NSPK_RTP_HDR_SIZE + hdr_len;
+    h->pkt_len = h->data_len;
+    if (rte_eal_iova_mode() != RTE_IOVA_VA) {
+        msl = rte_mem_virt2memseg_list(data);
+        page_sz = msl ? msl->page_sz : RTE_PGSIZE_4K;
+    }
+
+    for (off = 0; off != len; off += n) {
+        n = len - off;
+        if (page_sz)
+            n = RTE_MIN((uint64_t)n, page_sz - ((uintptr_t)(data + off) & (page_sz - 1)));
+        m = rte_pktmbuf_alloc(p->mp);
+        if (!m)
+            goto fail;
+        rte_mbuf_ext_refcnt_update(&p->ext->shinfo, 1);
+        rte_pktmbuf_attach_extbuf(m, (void *)(uintptr_t)(data + off), rte_malloc_virt2iova(data + off),
+                                  n, &p->ext->shinfo);
+        m->data_len = n;
+        m->pkt_len = n;
+        if (rte_pktmbuf_chain(h, m) != 0) {
+            rte_pktmbuf_free(m);
+            goto fail;
+        }
+    }
+    p->attached += len;
+    return 0;
+
+fail:
+    pkt_mag_put(&p->mag, h);
+    p->drops++;
+    return -1;
+}
+
+static int pktzr_send_single(struct nspk_rtp_pktzr_t *p, const uint8_t *nal, int size, int marker)
+{
+    struct rte_mbuf *m;
+    uint8_t *dst = nspk_rtp_pktzr_begin(p, &m);
+
+    if (!dst)
+        return 0;
+    if (p->ext && size >= NSPK_RTP_PKTZR_ATTACH_MIN) {
+        if (pktzr_attach(p, m, 0, nal, size) < 0)
+            return 0;
+    } else {
+        memcpy(dst, nal, size);
+    }
+    return nspk_rtp_pktzr_commit(p, m, size, marker);
+}
+
+/**
+ * Emit the pending NAL units as one STAP-A/AP packet, or as a single NAL
+ * unit packet if only one is pending.
+ */
+static int pktzr_flush_agg(struct nspk_rtp_pktzr_t *p, int marker)
+{
+    int hevc = p->codec_id == AV_CODEC_ID_HEVC;
+    struct rte_mbuf *m;
+    uint8_t *dst, *pos;
+    int i, ret;
+
+    if (p->agg_num == 0)
+        return 0;
+
+    if (p->agg_num == 1) {
+        ret = pktzr_send_single(p, p->agg[0].data, p->agg[0].size, marker);
+        p->agg_num = 0;
+        return ret;
+    }
+
+    dst = nspk_rtp_pktzr_begin(p, &m);
+    if (!dst) {
+        p->agg_num = 0;
+        return 0;
+    }
+
+    pos = dst;
+    if (hevc) {
+        /* F is OR-ed, LayerId and TID are the lowest of the aggregated units (RFC 7798 4.4.2). */
+        uint8_t f = 0;
+        int layer_id = 0x3F, tid = 7;
+        for (i = 0; i < p->agg_num; i++) {
+            const uint8_t *nal = p->agg[i].data;
+            f |= nal[0] & 0x80;
+            layer_id = FFMIN(layer_id, ((nal[0] & 0x01) << 5) | (nal[1] >> 3));
+            tid = FFMIN(tid, nal[1] & 0x07);
+        }
+        *pos++ = f | (HEVC_NAL_AP << 1) | (layer_id >> 5);
+        *pos++ = ((layer_id & 0x1F) << 3) | tid;
+    } else {
+        /* F is OR-ed, NRI is the highest of the aggregated units. */
+        uint8_t f = 0, nri = 0;
+        for (i = 0; i < p->agg_num; i++) {
+            f |= p->agg[i].data[0] & 0x80;
+            nri = FFMAX(nri, p->agg[i].data[0] & 0x60);
+        }
+        *pos++ = f | nri | H264_NAL_STAP_A;
+    }
+
+    for (i = 0; i < p->agg_num; i++) {
+        AV_WB16(pos, p->agg[i].size);
+        memcpy(pos + 2, p->agg[i].data, p->agg[i].size);
+        pos += 2 + p->agg[i].size;
+    }
+
+    p->agg_num = 0;
+    return nspk_rtp_pktzr_commit(p, m, pos - dst, marker);
+}
+
+static int pktzr_send_fu(struct nspk_rtp_pktzr_t *p, const uint8_t *nal, int size, int marker)
+{
+    int hevc = p->codec_id == AV_CODEC_ID_HEVC;
+    int nal_hdr_len = hevc ? 2 : 1;
+    int fu_hdr_len = nal_hdr_len + 1;
+    int chunk = p->max_payload - fu_hdr_len;
+    uint8_t ind[2], type;
+    uint8_t flags = FU_START;
+    struct rte_mbuf *m;
+    uint8_t *dst;
+    int len, ret;
+
+    if (hevc) {
+        type = (nal[0] >> 1) & 0x3F;
+        ind[0] = (nal[0] & 0x81) | (HEVC_NAL_FU << 1);
+        ind[1] = nal[1];
+    } else {
+        type = nal[0] & 0x1F;
+        ind[0] = (nal[0] & 0xE0) | H264_NAL_FU_A;
+    }
+    nal += nal_hdr_len;
+    size -= nal_hdr_len;
+
+    while (size > 0) {
+        len = FFMIN(size, chunk);
+        if (len == size)
+            flags |= FU_END;
+
+        dst = nspk_rtp_pktzr_begin(p, &m);
+        if (!dst)
+            return 0;
+        memcpy(dst, ind, nal_hdr_len);
+        dst[nal_hdr_len] = flags | type;
+        // The FU header stays in front, the fragment follows in the encoded frame.
+        if (p->ext && len >= NSPK_RTP_PKTZR_ATTACH_MIN) {
+            if (pktzr_attach(p, m, fu_hdr_len, nal, len) < 0)
+                return 0;
+        } else {
+            memcpy(dst + fu_hdr_len, nal, len);
+        }
+        ret = nspk_rtp_pktzr_commit(p, m, fu_hdr_len + len,
+                                    marker && (flags & FU_END));
+        if (ret < 0)
+            return ret;
+
+        flags &= ~FU_START;
+        nal += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+/**
+ * Route one NAL unit. Units fitting in a packet are held back for
+ * aggregation, larger ones are fragmented. @last marks the final unit
+ * of the access unit, whose last packet carries the marker bit.
+ */
+static int pktzr_send_nal(struct nspk_rtp_pktzr_t *p, const uint8_t *nal, int size, int last)
+{
+    int agg_hdr_len = p->codec_id == AV_CODEC_ID_HEVC ? 2 : 1;
+    int ret;
+
+    if (size <= agg_hdr_len)
+        return last ? pktzr_flush_agg(p, 1) : 0;
+
+    if (size > p->max_payload) {
+        if ((ret = pktzr_flush_agg(p, 0)) < 0)
+            return ret;
+        return pktzr_send_fu(p, nal, size, last);
+    }
+
+    if (p->agg_num &&
+        (p->agg_num == NSPK_RTP_PKTZR_MAX_AGG ||
+         p->agg_len + 2 + size > p->max_payload)) {
+        if ((ret = pktzr_flush_agg(p, 0)) < 0)
+            return ret;
+    }
+    if (p->agg_num == 0)
+        p->agg_len = agg_hdr_len;
+
+    p->agg[p->agg_num].data = nal;
+    p->agg[p->agg_num].size = size;
+    p->agg_num++;
+    p->agg_len += 2 + size;
+
+    return last ? pktzr_flush_agg(p, 1) : 0;
+}
+
+static int pktzr_h26x(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size)
+{
+    const uint8_t *r, *r1, *end = buf + size;
+    uint32_t nal_size;
+    int i, ret = 0;
+
+    if (p->nal_length_size) {
+        r = buf;
+        while (end - r > p->nal_length_size && ret >= 0) {
+            for (nal_size = 0, i = 0; i < p->nal_length_size; i++)
+                nal_size = (nal_size << 8) | r[i];
+            r += p->nal_length_size;
+            if (nal_size > end - r) {
+                av_log(NULL, AV_LOG_ERROR, "%s: NAL size %u exceeds packet\n", __func__, nal_size);
+                ret = AVERROR_INVALIDDATA;
+                break;
+            }
+            ret = pktzr_send_nal(p, r, nal_size, r + nal_size == end);
+            r += nal_size;
+        }
+    } else {
+        r = ff_avc_find_startcode(buf, end);
+        while (r < end && ret >= 0) {
+            while (!*(r++));
+            r1 = ff_avc_find_startcode(r, end);
+            ret = pktzr_send_nal(p, r, r1 - r, r1 == end);
+            r = r1;
+        }
+    }
+
+    /* Pending units point into @buf, they must not outlive this call. */
+    if (ret < 0)
+        p->agg_num = 0;
+    else
+        ret = pktzr_flush_agg(p, 1);
+    return ret;
+}
+
+int nspk_rtp_pktzr_h264(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size)
+{
+    return pktzr_h26x(p, buf, size);
+}
+
+int nspk_rtp_pktzr_hevc(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size)
+{
+    return pktzr_h26x(p, buf, size);
+}
+
+int nspk_rtp_pktzr_init(struct nspk_rtp_pktzr_t *p, const AVCodecParameters *par,
+                        AVRational time_base, uint8_t payload_type, int pkt_size,
+                        struct rte_mempool *mp, nspk_rtp_pktzr_sink_fn sink, void *sink_opaque)
+{
+    const uint8_t *ed = par->extradata;
+    int max_size;
+
+    if (!p || !mp || !sink)
+        return AVERROR(EINVAL);
+
+    memset(p, 0, sizeof(*p));
+    p->codec_id = par->codec_id;
+    p->clock_rate = 90000;
+
+    switch (par->codec_id) {
+    case AV_CODEC_ID_H264:
+        p->packetize = nspk_rtp_pktzr_h264;
+        if (ed && par->extradata_size >= 7 && ed[0] == 1)
+            p->nal_length_size = (ed[4] & 0x03) + 1;
+        break;
+    case AV_CODEC_ID_HEVC:
+        p->packetize = nspk_rtp_pktzr_hevc;
+        if (ed && par->extradata_size >= 23 && (ed[0] || ed[1] || ed[2] > 1))
+            p->nal_length_size = (ed[21] & 0x03) + 1;
+        break;
+    case AV_CODEC_ID_AAC:
+        p->packetize = nspk_rtp_pktzr_aac;
+        p->clock_rate = par->sample_rate;
+        break;
+    case AV_CODEC_ID_OPUS:
+        /* RFC 7587: the RTP clock is 48 kHz whatever the input rate. */
+        p->packetize = nspk_rtp_pktzr_opus;
+        p->clock_rate = 48000;
+        break;
+    default:
+        av_log(NULL, AV_LOG_ERROR, "%s: No native packetizer for %s\n", __func__,
+               avcodec_get_name(par->codec_id));
+        return AVERROR_PATCHWELCOME;
+    }
+
+    if (!p->clock_rate)
+        return AVERROR(EINVAL);
+    p->max_agg_ts = p->clock_rate * NSPK_RTP_PKTZR_AUDIO_AGG_MS / 1000;
+
+    max_size = rte_pktmbuf_data_room_size(mp) - NSPK_MBUF_TX_HEADROOM;
+    /* Audio frames are staged behind room for the largest aggregation header. */
+    if (par->codec_type == AVMEDIA_TYPE_AUDIO)
+        max_size -= 2 + 2 * NSPK_RTP_PKTZR_MAX_AGG;
+    p->max_payload = FFMIN(pkt_size, max_size) - NSPK_RTP_HDR_SIZE;
+    /* Room for an aggregation header plus one length-prefixed unit or an FU header. */
+    if (p->max_payload <= 8)
+        return AVERROR(EINVAL);
+
+    p->time_base = time_base;
+    p->payload_type = payload_type & 0x7F;
+    p->ssrc = av_get_random_seed();
+    p->seq = av_get_random_seed() & 0xFFFF;
+    p->ts_offset = av_get_random_seed();
+    p->cur_ts = p->ts_offset;
+
+    p->hdr_tmpl[0] = NSPK_RTP_VERSION << 6;
+    p->hdr_tmpl[1] = p->payload_type;
+    AV_WB32(p->hdr_tmpl + 8, p->ssrc);
+
+    p->mp = mp;
+    pkt_mag_init(&p->mag, mp, NSPK_MBUF_TX_HEADROOM, p->hdr_tmpl, NSPK_RTP_HDR_SIZE);
+    p->sink = sink;
+    p->sink_opaque = sink_opaque;
+
+    av_log(NULL, AV_LOG_DEBUG, "%s: %s pt=%u ssrc=0x%08x max_payload=%d nal_length_size=%d\n",
+           __func__, avcodec_get_name(p->codec_id), p->payload_type, p->ssrc,
+           p->max_payload, p->nal_length_size);
+    return 0;
+}
+
+int nspk_rtp_pktzr_repeat_ps(struct nspk_rtp_pktzr_t *p, const AVCodecParameters *par)
+{
+    if (p->packetize != nspk_rtp_pktzr_h264 && p->packetize != nspk_rtp_pktzr_hevc)
+        return 0;
+    // avcC/hvcC extradata goes with length-prefixed packets, whose converter inserts them.
+    if (par->extradata_size < 4 || p->nal_length_size)
+        return 0;
+
+    p->ps = par->extradata;
+    p->ps_size = par->extradata_size;
+    return 0;
+}
+
+/**
+ * Send the parameter sets in packets of their own, aggregated, ahead of
+ * the access unit of a keyframe.
+ */
+static int pktzr_send_ps(struct nspk_rtp_pktzr_t *p)
+{
+    const uint8_t *r, *r1, *end = p->ps + p->ps_size;
+    int ret = 0;
+
+    r = ff_avc_find_startcode(p->ps, end);
+    while (r < end && ret >= 0) {
+        while (!*(r++));
+        r1 = ff_avc_find_startcode(r, end);
+        ret = pktzr_send_nal(p, r, r1 - r, 0);
+        r = r1;
+    }
+    if (ret < 0) {
+        p->agg_num = 0;
+        return ret;
+    }
+    return pktzr_flush_agg(p, 0);
+}
+
+int nspk_rtp_pktzr_send(struct nspk_rtp_pktzr_t *p, const AVPacket *pkt)
+{
+    int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    struct nspk_bufpool_ext_t *ext;
+    int ret;
+
+    if (!pkt->size)
+        return 0;
+
+    if (pts != AV_NOPTS_VALUE) {
+        uint32_t ts = p->ts_offset +
+                      (uint32_t)av_rescale_q(pts, p->time_base, (AVRational){1, p->clock_rate});
+        p->frame_ts = pkt->duration > 0 ?
+                      av_rescale_q(pkt->duration, p->time_base, (AVRational){1, p->clock_rate}) :
+                      ts - p->cur_ts;
+        p->cur_ts = ts;
+        p->cur_tsc = rte_rdtsc();
+    }
+
+    if (p->ps && (pkt->flags & AV_PKT_FLAG_KEY) && (ret = pktzr_send_ps(p)) < 0)
+        return ret;
+
+    // Video only, the audio packetizers stage their frames in an mbuf of their own.
+    if (p->attach && p->packetize != nspk_rtp_pktzr_aac && p->packetize != nspk_rtp_pktzr_opus &&
+        (ext = nspk_bufpool_ext(pkt)) && nspk_bufpool_ext_hold(ext, pkt) == 0) {
+        p->ext = ext;
+        ret = p->packetize(p, pkt->data, pkt->size);
+        p->ext = NULL;
+        nspk_bufpool_ext_release(ext);
+        return ret;
+    }
+
+    return p->packetize(p, pkt->data, pkt->size);
+}
+
+int nspk_rtp_pktzr_flush(struct nspk_rtp_pktzr_t *p)
+{
+    int ret = pktzr_flush_agg(p, 1);
+
+    if (ret < 0)
+        return ret;
+    return nspk_rtp_pktzr_audio_flush(p);
+}
+
+void nspk_rtp_pktzr_uninit(struct nspk_rtp_pktzr_t *p)
+{
+    if (p->pend)
+        pkt_mag_put(&p->mag, p->pend);
+    p->pend = NULL;
+    p->pend_num = 0;
+    p->agg_num = 0;
+    pkt_mag_fini(&p->mag);
+}
@@ -0,0 +1,279 @@
+/**
+ * NSPK native RTP packetizers for audio.
+ * AAC (RFC 3640, AAC-hbr mode) and Opus (RFC 7587). Consecutive frames are
+ * aggregated into one packet for up to NSPK_RTP_PKTZR_AUDIO_AGG_MS.
+ */
+
+#include <nspk.h>
+#include <nspk_rtp_pktzr.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/avassert.h>
+
+/* Largest per-frame header section: AAC AU-headers or Opus code 3 frame lengths. */
+#define AUDIO_AGG_HDR_MAX   (2 + 2 * NSPK_RTP_PKTZR_MAX_AGG)
+
+#define AAC_AU_SIZE_MAX     0x1FFF
+
+#define OPUS_FRAME_CODE(toc)    ((toc) & 0x03)
+#define OPUS_CODE_ARBITRARY     3
+#define OPUS_COUNT_VBR          0x80
+
+static inline int opus_len_bytes(int len)
+{
+    return len < 252 ? 1 : 2;
+}
+
+/**
+ * Copy one frame at the tail of the pending mbuf, allocating it first if
+ * needed. The mbuf data starts after room for the RTP header and the
+ * largest per-frame header section.
+ */
+static int pend_append(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size)
+{
+    uint8_t *dst;
+
+    if (!p->pend) {
+        p->pend = pkt_mag_get(&p->mag);
+        if (!p->pend) {
+            p->drops++;
+            return 0;
+        }
+        p->pend->data_off = NSPK_MBUF_TX_HEADROOM + NSPK_RTP_HDR_SIZE + AUDIO_AGG_HDR_MAX;
+        p->pend_num = 0;
+        p->pend_ts = p->cur_ts;
+    }
+
+    dst = (uint8_t *)rte_pktmbuf_append(p->pend, size);
+    av_assert1(dst);
+    memcpy(dst, buf, size);
+    p->pend_size[p->pend_num++] = size;
+    return 0;
+}
+
+/**
+ * Prepend the RTP header to a pending mbuf whose payload header has been
+ * prepended already, and send it with the timestamp of its first frame.
+ */
+static int pend_commit(struct nspk_rtp_pktzr_t *p, int marker)
+{
+    struct rte_mbuf *m = p->pend;
+    uint32_t ts = p->cur_ts;
+    uint8_t *hdr;
+    int ret;
+
+    p->pend = NULL;
+    p->pend_num = 0;
+
+    hdr = (uint8_t *)rte_pktmbuf_prepend(m, NSPK_RTP_HDR_SIZE);
+    memcpy(hdr, p->hdr_tmpl, NSPK_RTP_HDR_SIZE);
+
+    p->cur_ts = p->pend_ts;
+    ret = nspk_rtp_pktzr_commit(p, m, m->data_len - NSPK_RTP_HDR_SIZE, marker);
+    p->cur_ts = ts;
+    return ret;
+}
+
+/**
+ * Whether the pending frames must go out before one more frame is added,
+ * either because the packet is full or because it spans the window.
+ */
+static int pend_full(struct nspk_rtp_pktzr_t *p, int hdr_len, int size)
+{
+    return p->pend_num == NSPK_RTP_PKTZR_MAX_AGG ||
+           hdr_len + p->pend->data_len + size > p->max_payload ||
+           p->cur_ts - p->pend_ts >= p->max_agg_ts;
+}
+
+/**
+ * Whether the window would be exceeded by the next frame, so waiting for
+ * it only adds latency.
+ */
+static int pend_due(struct nspk_rtp_pktzr_t *p)
+{
+    return p->pend_num == NSPK_RTP_PKTZR_MAX_AGG ||
+           p->cur_ts + p->frame_ts - p->pend_ts >= p->max_agg_ts;
+}
+
+static int aac_flush(struct nspk_rtp_pktzr_t *p)
+{
+    uint8_t *hdr;
+    int i, n = p->pend_num;
+
+    /* AU-headers-length in bits, then one 16 bit AU-header per AU:
+     * 13 bit AU-size, 3 bit AU-Index(-delta) = 0. */
+    hdr = (uint8_t *)rte_pktmbuf_prepend(p->pend, 2 + 2 * n);
+    AV_WB16(hdr, 16 * n);
+    for (i = 0; i < n; i++)
+        AV_WB16(hdr + 2 + 2 * i, p->pend_size[i] << 3);
+
+    return pend_commit(p, 1);
+}
+
+/**
+ * Split an AU larger than one packet. Every fragment repeats the size of
+ * the whole AU, the marker bit is set on the last one only.
+ */
+static int aac_fragment(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size)
+{
+    int chunk = p->max_payload - 4;
+    int au_size = size;
+    struct rte_mbuf *m;
+    uint8_t *dst;
+    int len, ret;
+
+    while (size > 0) {
+        len = FFMIN(size, chunk);
+        dst = nspk_rtp_pktzr_begin(p, &m);
+        if (!dst)
+            return 0;
+        AV_WB16(dst, 16);
+        AV_WB16(dst + 2, au_size << 3);
+        memcpy(dst + 4, buf, len);
+        if ((ret = nspk_rtp_pktzr_commit(p, m, 4 + len, len == size)) < 0)
+            return ret;
+        buf += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+int nspk_rtp_pktzr_aac(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size)
+{
+    int ret;
+
+    /* Strip the ADTS header if the encoder emits one. */
+    if (size > 7 && (AV_RB16(buf) & 0xFFF0) == 0xFFF0) {
+        int hdr_len = (buf[1] & 0x01) ? 7 : 9;
+        buf += hdr_len;
+        size -= hdr_len;
+    }
+    if (size <= 0)
+        return 0;
+    if (size > AAC_AU_SIZE_MAX) {
+        av_log(NULL, AV_LOG_ERROR, "%s: AU of %d bytes does not fit AU-size\n", __func__, size);
+        return AVERROR_INVALIDDATA;
+    }
+
+    if (4 + size > p->max_payload) {
+        if ((ret = nspk_rtp_pktzr_audio_flush(p)) < 0)
+            return ret;
+        return aac_fragment(p, buf, size);
+    }
+
+    if (p->pend && pend_full(p, 2 + 2 * (p->pend_num + 1), size)) {
+        if ((ret = aac_flush(p)) < 0)
+            return ret;
+    }
+
+    if ((ret = pend_append(p, buf, size)) < 0)
+        return ret;
+
+    if (p->pend && pend_due(p))
+        return aac_flush(p);
+    return 0;
+}
+
+/**
+ * One frame goes out as is. Several frames sharing a TOC configuration
+ * are repacketized into a code 3 packet (RFC 6716, 3.2.5): TOC, frame
+ * count byte and, if VBR, the length of all but the last frame.
+ */
+static int opus_flush(struct nspk_rtp_pktzr_t *p)
+{
+    int i, n = p->pend_num;
+    int cbr = 1, len = 0;
+    uint8_t *hdr;
+
+    if (n == 1) {
+        hdr = (uint8_t *)rte_pktmbuf_prepend(p->pend, 1);
+        hdr[0] = p->opus_toc;
+        return pend_commit(p, 0);
+    }
+
+    for (i = 1; i < n; i++)
+        cbr &= p->pend_size[i] == p->pend_size[0];
+    if (!cbr)
+        for (i = 0; i < n - 1; i++)
+            len += opus_len_bytes(p->pend_size[i]);
+
+    hdr = (uint8_t *)rte_pktmbuf_prepend(p->pend, 2 + len);
+    *hdr++ = (p->opus_toc & ~0x03) | OPUS_CODE_ARBITRARY;
+    *hdr++ = (cbr ? 0 : OPUS_COUNT_VBR) | n;
+    if (!cbr) {
+        for (i = 0; i < n - 1; i++) {
+            int flen = p->pend_size[i];
+            if (flen < 252) {
+                *hdr++ = flen;
+            } else {
+                *hdr++ = 252 + (flen & 0x03);
+                *hdr++ = (flen - 252) >> 2;
+            }
+        }
+    }
+
+    return pend_commit(p, 0);
+}
+
+int nspk_rtp_pktzr_opus(struct nspk_rtp_pktzr_t *p, const uint8_t *buf, int size)
+{
+    struct rte_mbuf *m;
+    uint8_t *dst;
+    int i, hdr_len, ret;
+
+    if (size <= 0)
+        return 0;
+
+    /* Multi-frame packets from the encoder are sent unchanged. */
+    if (OPUS_FRAME_CODE(buf[0]) != 0 || 1 + size > p->max_payload) {
+        if ((ret = nspk_rtp_pktzr_audio_flush(p)) < 0)
+            return ret;
+        if (size > p->max_payload) {
+            av_log(NULL, AV_LOG_ERROR, "%s: Opus packet of %d bytes exceeds payload\n", __func__, size);
+            return AVERROR_INVALIDDATA;
+        }
+        dst = nspk_rtp_pktzr_begin(p, &m);
+        if (!dst)
+            return 0;
+        memcpy(dst, buf, size);
+        return nspk_rtp_pktzr_commit(p, m, size, 0);
+    }
+
+    if (p->pend) {
+        /* Frames in one code 3 packet must share mode, bandwidth, frame size and channels. */
+        hdr_len = 2;
+        for (i = 0; i < p->pend_num; i++)
+            hdr_len += opus_len_bytes(p->pend_size[i]);
+        if ((buf[0] & ~0x03) != (p->opus_toc & ~0x03) ||
+            pend_full(p, hdr_len, size - 1)) {
+            if ((ret = opus_flush(p)) < 0)
+                return ret;
+        }
+    }
+
+    p->opus_toc = buf[0];
+    if ((ret = pend_append(p, buf + 1, size - 1)) < 0)
+        return ret;
+
+    if (p->pend && pend_due(p))
+        return opus_flush(p);
+    return 0;
+}
+
+int nspk_rtp_pktzr_audio_flush(struct nspk_rtp_pktzr_t *p)
+{
+    if (!p->pend)
+        return 0;
+
+    switch (p->codec_id) {
+    case AV_CODEC_ID_AAC:
+        return aac_flush(p);
+    case AV_CODEC_ID_OPUS:
+        return opus_flush(p);
+    default:
+        pkt_mag_put(&p->mag, p->pend);
+        p->pend = NULL;
+        p->pend_num = 0;
+        return 0;
+    }
+}
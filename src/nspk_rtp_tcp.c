@@ -0,0 +1,76 @@
+/**
+ * NSPK RTP over TCP.
+ * RTP and RTCP packets framed onto a TLDK TCP stream, RTSP interleaved
+ * (RFC 2326 10.12) or RFC 4571. The framing header is a mbuf of its own
+ * chained in front of the packet, so the payload is never copied.
+ */
+
+#include <libavutil/intreadwrite.h>
+
+#include <nspk.h>
+#include <nspk_rtp_tcp.h>
+
+void nspk_rtp_tcp_chan_init(struct nspk_rtp_tcp_chan_t *chan, struct nspk_rtp_tcp_t *tcp, int channel)
+{
+    memset(chan, 0, sizeof(*chan));
+    chan->tcp = tcp;
+    chan->channel = channel;
+}
+
+int nspk_rtp_tcp_send(struct nspk_rtp_tcp_chan_t *chan, struct rte_mbuf *m)
+{
+    struct nspk_rtp_tcp_t *tcp = chan->tcp;
+    struct netfe_stream *fs = tcp->fs;
+    uint32_t len = m->pkt_len, hlen;
+    struct rte_mbuf *h;
+    uint8_t *p;
+
+    if (fs == NULL || len > UINT16_MAX) {
+        tcp->drops++;
+        return AVERROR(EPIPE);
+    }
+    h = pkt_mag_get(&fs->mag);
+    if (h == NULL) {
+        tcp->drops++;
+        return AVERROR(ENOMEM);
+    }
+
+    p = rte_pktmbuf_mtod(h, uint8_t *);
+    if (chan->channel == NSPK_RTP_TCP_RFC4571) {
+        AV_WB16(p, len);
+        h->data_len = 2;
+    } else {
+        p[0] = '$';
+        p[1] = chan->channel;
+        AV_WB16(p + 2, len);
+        h->data_len = NSPK_RTP_TCP_HDR_SIZE;
+    }
+    h->pkt_len = h->data_len;
+    hlen = h->data_len;
+
+    if (rte_pktmbuf_chain(h, m) != 0)
+        goto drop;
+    // The send buffer takes the whole frame or none of it, the byte stream stays in sync.
+    if (nspk_tldk_tcp_stream_send_mbuf(fs, h) < 0) {
+        h->next = NULL;
+        h->nb_segs = 1;
+        h->pkt_len = h->data_len;
+        goto drop;
+    }
+
+    chan->packets++;
+    chan->octets += len - RTE_MIN(len, (uint32_t)NSPK_RTP_HDR_SIZE);
+    tcp->packets++;
+    tcp->octets += hlen + len;
+    return 0;
+
+drop:
+    pkt_mag_put(&fs->mag, h);
+    tcp->drops++;
+    return AVERROR(ENOBUFS);
+}
+
+int nspk_rtp_tcp_sink(void *opaque, struct rte_mbuf *m)
+{
+    return nspk_rtp_tcp_send(opaque, m);
+}
@@ -0,0 +1,1258 @@
+/**
+ * NSPK RTSP server.
+ * RTSP/1.0 (RFC 2326) over the TLDK TCP context of each worker BE lcore.
+ * Requests are parsed from the lcore's RX events, PLAY spawns a native RTP
+ * session on the scheduler of the same lcore, sending from server ports
+ * that the lcore's queues own so that the receivers' RTCP comes back to it,
+ * or interleaved on the connection itself. Files are probed by a thread of
+ * the lcore's own, the requests for them wait meanwhile.
+ */
+
+#include <pthread.h>
+#include <sys/queue.h>
+#include <rte_random.h>
+#include <rte_ring.h>
+#include <rte_timer.h>
+#include <libavutil/avstring.h>
+#include <libavutil/bprint.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavformat/avformat.h>
+#include <libavformat/internal.h>
+#include <libavformat/rtp.h>
+
+#include <nspk.h>
+#include <nspk_rtsp.h>
+#include <tldk_utils/parse.h>
+
+#define RTSP_VERSION        "RTSP/1.0"
+#define RTSP_SERVER         "NSPKCore"
+#define RTSP_METHODS        "OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER"
+#define RTSP_MAX_TRACK      2
+#define RTSP_NAME_SIZE      256
+/* Period at which the lcore takes back the probed files. */
+#define RTSP_PROBE_POLL_MS  10
+/* Sleep of the prober when it has no file to probe. */
+#define RTSP_PROBE_WAIT_US  1000
+/* rtsp_request(): the request waits for the probe of its file. */
+#define RTSP_DEFERRED       1
+
+struct nspk_rtsp_prm nspk_rtsp_prm = {
+    .port = NSPK_RTSP_DEFAULT_PORT,
+    .nb_port = 1,
+    .max_conn = NSPK_RTSP_DEFAULT_MAX_CONN,
+    .rtp_port = NSPK_RTSP_DEFAULT_RTP_PORT,
+    .tmpl = {
+        .egress = NSPK_RTP_EGRESS_NATIVE,
+        .video_codec = AV_CODEC_ID_H264,
+        .audio_codec = AV_CODEC_ID_AAC,
+        .readrate = 1,
+        .codec_cpu = -1,
+        .pace = 1,
+        .rtcp = 1,
+    },
+};
+
+enum rtsp_mount_state
+{
+    RTSP_MOUNT_FREE,
+    /* Queued to the prober, which owns all of it but the name until it hands it back. */
+    RTSP_MOUNT_PROBING,
+    RTSP_MOUNT_READY,
+    /* Only while the requests which waited for it are answered, then free. */
+    RTSP_MOUNT_FAILED,
+};
+
+/**
+ * Tracks of a file as DESCRIBE announces them: the best video then the
+ * related best audio, as the native session sends them, so trackID=N is
+ * output stream N and its payload type 96 + N.
+ */
+struct rtsp_mount
+{
+    enum rtsp_mount_state state;
+    char name[RTSP_NAME_SIZE];
+    char path[PATH_MAX];
+    /* Result of the probe. */
+    int ret;
+    int nb_track;
+    enum AVMediaType type[RTSP_MAX_TRACK];
+    int64_t duration;
+    /* Media sections of the SDP, the session section is per reply. */
+    char *sdp;
+};
+
+struct rtsp_track
+{
+    int setup;
+    /* RTP/AVP/TCP: channels of the connection instead of ports. */
+    int interleaved;
+    int channel_rtp, channel_rtcp;
+    int client_rtp, client_rtcp;
+    int server_rtp, server_rtcp;
+};
+
+/**
+ * A spawned session. It outlives its connection, whose TEARDOWN or close
+ * only stops it: the server ports are released once the scheduler is done.
+ */
+struct rtsp_play
+{
+    struct nspk_rtsp_lcore *rl;
+    struct rtsp_conn *conn;
+    uint16_t port[2 * RTSP_MAX_TRACK];
+    uint32_t nb_port;
+    /* Interleaved sessions only, chan[2N] and chan[2N + 1] carry track N. */
+    int interleaved;
+    struct nspk_rtp_tcp_t tcp;
+    struct nspk_rtp_tcp_chan_t chan[2 * RTSP_MAX_TRACK];
+};
+
+struct rtsp_conn
+{
+    LIST_ENTRY(rtsp_conn) link;
+    struct nspk_rtsp_lcore *rl;
+    struct netfe_stream *fs;
+    char session[17];
+    char mount[RTSP_NAME_SIZE];
+    struct rtsp_track track[RTSP_MAX_TRACK];
+    struct rtsp_play *play;
+    /* TSC of the last bytes received, see rtsp_conn_heard(). */
+    uint64_t tsc;
+    /* Mount being probed for the request at the head of buf. */
+    struct rtsp_mount *wait;
+    uint32_t len;
+    char buf[NSPK_RTSP_REQ_SIZE + 1];
+};
+
+struct nspk_rtsp_lcore
+{
+    struct lcore_prm *lcore_prm;
+    uint32_t nb_listen;
+    struct netfe_stream *listen[NSPK_RTSP_MAX_LISTEN];
+    uint32_t nb_conn;
+    LIST_HEAD(, rtsp_conn) conn;
+    struct rtsp_mount mount[NSPK_RTSP_MAX_MOUNT];
+    /* Mounts to the prober and back, single producer and consumer each. */
+    struct rte_ring *probe;
+    struct rte_ring *probed;
+    pthread_t prober;
+    int prober_started;
+    int prober_stop;
+    struct rte_timer probe_timer;
+    struct rte_timer expire_timer;
+    uint32_t next_port;
+    uint32_t next_id;
+    uint64_t port_used[(UINT16_MAX + 1) / 64];
+    struct {
+        uint64_t acc;
+        uint64_t rej;
+        uint64_t req;
+        uint64_t err;
+        uint64_t play;
+        uint64_t expired;
+    } stat;
+};
+
+static RTE_DEFINE_PER_LCORE(struct nspk_rtsp_lcore *, _rtsp);
+
+static const char *rtsp_reason(int code)
+{
+    switch (code) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Request Entity Too Large";
+    case 415: return "Unsupported Media Type";
+    case 454: return "Session Not Found";
+    case 455: return "Method Not Valid in This State";
+    case 459: return "Aggregate Operation Not Allowed";
+    case 461: return "Unsupported Transport";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "RTSP Version Not Supported";
+    default:  return "Internal Server Error";
+    }
+}
+
+/**
+ * A free server port of the lcore, from rtp_port up to FIRST_PORT where
+ * TLDK starts taking the ephemeral ones.
+ * \return the port, 0 if none is left.
+ */
+static int rtsp_port_alloc(struct nspk_rtsp_lcore *rl)
+{
+    struct netbe_lcore *lc = RTE_PER_LCORE(_be);
+    uint32_t first = nspk_rtsp_prm.rtp_port;
+    uint32_t i, port, span;
+
+    // --rtsp rejects such a rtpport, this only keeps the span from wrapping.
+    if (first == 0 || first >= FIRST_PORT)
+        return 0;
+    span = FIRST_PORT - first;
+    if (rl->next_port < first || rl->next_port >= FIRST_PORT)
+        rl->next_port = first;
+
+    for (i = 0; i != span; i++) {
+        port = rl->next_port++;
+        if (rl->next_port >= FIRST_PORT)
+            rl->next_port = first;
+        if ((rl->port_used[port / 64] & (1ULL << (port % 64))) == 0 &&
+            nspk_tldk_port_owned(lc, port)) {
+            rl->port_used[port / 64] |= 1ULL << (port % 64);
+            return port;
+        }
+    }
+    return 0;
+}
+
+static void rtsp_port_free(struct nspk_rtsp_lcore *rl, uint16_t port)
+{
+    if (port != 0)
+        rl->port_used[port / 64] &= ~(1ULL << (port % 64));
+}
+
+static void rtsp_tracks_free(struct rtsp_conn *conn)
+{
+    int i;
+
+    for (i = 0; i < RTSP_MAX_TRACK; i++) {
+        rtsp_port_free(conn->rl, conn->track[i].server_rtp);
+        rtsp_port_free(conn->rl, conn->track[i].server_rtcp);
+    }
+    memset(conn->track, 0, sizeof(conn->track));
+}
+
+/**
+ * Hand a reply to the send buffer of the connection, in mbufs of the
+ * stream's magazine. TLDK cuts them to the MSS.
+ */
+static int rtsp_send(struct rtsp_conn *conn, const char *data, unsigned int len)
+{
+    struct netfe_stream *fs = conn->fs;
+    struct rte_mbuf *m;
+    unsigned int n;
+
+    while (len) {
+        m = pkt_mag_get(&fs->mag);
+        if (!m)
+            return AVERROR(ENOMEM);
+        n = FFMIN(len, rte_pktmbuf_tailroom(m));
+        memcpy(rte_pktmbuf_mtod(m, void *), data, n);
+        m->data_len = n;
+        m->pkt_len = n;
+        if (nspk_tldk_tcp_stream_send_mbuf(fs, m) < 0) {
+            pkt_mag_put(&fs->mag, m);
+            return AVERROR(ENOBUFS);
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Send a reply, hdrs holding the extra header lines, each ending with CRLF.
+ */
+static int rtsp_reply(struct rtsp_conn *conn, int code, int cseq, const char *hdrs,
+                      const char *body, int body_len)
+{
+    AVBPrint bp;
+    int ret;
+
+    if (code != 200)
+        conn->rl->stat.err++;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&bp, RTSP_VERSION " %d %s\r\nCSeq: %d\r\nServer: " RTSP_SERVER "\r\n",
+               code, rtsp_reason(code), cseq);
+    if (hdrs)
+        av_bprintf(&bp, "%s", hdrs);
+    if (body_len)
+        av_bprintf(&bp, "Content-Length: %d\r\n", body_len);
+    av_bprintf(&bp, "\r\n");
+    if (body_len)
+        av_bprint_append_data(&bp, body, body_len);
+    if (!av_bprint_is_complete(&bp)) {
+        av_bprint_finalize(&bp, NULL);
+        return AVERROR(ENOMEM);
+    }
+
+    ret = rtsp_send(conn, bp.str, bp.len);
+    av_bprint_finalize(&bp, NULL);
+    return ret;
+}
+
+/**
+ * Value of a header of a request, NUL terminated at CRLF.
+ */
+static int rtsp_header(const char *req, const char *name, char *val, size_t size)
+{
+    size_t nlen = strlen(name);
+    const char *p, *e;
+
+    for (p = strstr(req, "\r\n"); p; p = strstr(p, "\r\n")) {
+        p += 2;
+        if (av_strncasecmp(p, name, nlen) || p[nlen] != ':')
+            continue;
+        p += nlen + 1;
+        p += strspn(p, " \t");
+        e = strstr(p, "\r\n");
+        if (!e)
+            e = p + strlen(p);
+        av_strlcpy(val, p, FFMIN(size, (size_t)(e - p) + 1));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Split the path of a request URI into its file and the trackID=N of the
+ * aggregate control URL, -1 if none.
+ * \return 0, or -1 if the path cannot name a file under root.
+ */
+static int rtsp_uri_mount(const char *uri, char *mount, size_t size, int *track)
+{
+    const char *p = uri;
+    char *t;
+    size_t len;
+
+    if (av_strstart(p, "rtsp://", &p)) {
+        p = strchr(p, '/');
+        if (!p)
+            p = "";
+    }
+    p += strspn(p, "/");
+    len = strcspn(p, "?");
+    if (len >= size)
+        return -1;
+    memcpy(mount, p, len);
+    mount[len] = 0;
+
+    *track = -1;
+    t = strrchr(mount, '/');
+    if (t && av_strstart(t + 1, "trackID=", NULL)) {
+        *track = strtol(t + 1 + strlen("trackID="), NULL, 10);
+        *t = 0;
+    } else if (av_strstart(mount, "trackID=", NULL)) {
+        *track = strtol(mount + strlen("trackID="), NULL, 10);
+        mount[0] = 0;
+    }
+    len = strlen(mount);
+    while (len && mount[len - 1] == '/')
+        mount[--len] = 0;
+
+    if (!len || strstr(mount, ".."))
+        return -1;
+    return 0;
+}
+
+/**
+ * MPEG-4 AudioSpecificConfig of AAC-LC, as the SDP of an encoder without
+ * global headers or of an ADTS input needs it.
+ */
+static int rtsp_aac_config(AVCodecParameters *par)
+{
+    static const int rates[] = {
+        96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350,
+    };
+    int fi;
+
+    for (fi = 0; fi < FF_ARRAY_ELEMS(rates); fi++) {
+        if (rates[fi] == par->sample_rate)
+            break;
+    }
+    if (fi == FF_ARRAY_ELEMS(rates) || par->channels < 1 || par->channels > 7)
+        return AVERROR(EINVAL);
+
+    par->extradata = av_mallocz(2 + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!par->extradata)
+        return AVERROR(ENOMEM);
+    par->extradata_size = 2;
+    // Object type 2 (LC), sampling frequency index, channel configuration.
+    par->extradata[0] = (2 << 3) | (fi >> 1);
+    par->extradata[1] = ((fi & 1) << 7) | (par->channels << 3);
+    return 0;
+}
+
+/**
+ * Parameters of an output stream of the sessions of a file: those of the
+ * input when it passes through, what the encoder will be opened with
+ * otherwise, see open_output_stream().
+ */
+static int rtsp_track_par(AVCodecParameters *par, const AVStream *in, enum AVCodecID codec)
+{
+    const AVCodecParameters *ipar = in->codecpar;
+    const AVCodec *encoder;
+    int ret;
+
+    if (nspk_rtsp_prm.tmpl.passthrough && ipar->codec_id == codec) {
+        if ((ret = avcodec_parameters_copy(par, ipar)) < 0)
+            return ret;
+        par->codec_tag = 0;
+    } else {
+        par->codec_type = ipar->codec_type;
+        par->codec_id = codec;
+        par->width = ipar->width;
+        par->height = ipar->height;
+        if (ipar->codec_type == AVMEDIA_TYPE_AUDIO) {
+            encoder = avcodec_find_encoder(codec);
+            if (!encoder)
+                return AVERROR_ENCODER_NOT_FOUND;
+            par->sample_rate = ipar->sample_rate;
+            if (encoder->supported_samplerates) {
+                const int *sr = encoder->supported_samplerates;
+                while (*sr && *sr != ipar->sample_rate)
+                    sr++;
+                if (!*sr)
+                    par->sample_rate = encoder->supported_samplerates[0];
+            }
+            par->channel_layout = ipar->channel_layout ? ipar->channel_layout :
+                                  av_get_default_channel_layout(ipar->channels);
+            par->channels = av_get_channel_layout_nb_channels(par->channel_layout);
+        }
+    }
+
+    if (par->codec_id == AV_CODEC_ID_AAC && !par->extradata_size)
+        return rtsp_aac_config(par);
+    return 0;
+}
+
+static int rtsp_mount_probe(struct rtsp_mount *mt, const char *path)
+{
+    static const enum AVMediaType types[] = { AVMEDIA_TYPE_VIDEO, AVMEDIA_TYPE_AUDIO };
+    const struct nspk_rtp_session_ctx_t *tmpl = &nspk_rtsp_prm.tmpl;
+    AVFormatContext *ic = NULL, *oc = NULL;
+    enum AVCodecID codec;
+    AVStream *st;
+    AVBPrint bp;
+    char media[4096];
+    int k, idx, related = -1;
+    int ret;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    if ((ret = avformat_open_input(&ic, path, NULL, NULL)) < 0)
+        goto end;
+    if ((ret = avformat_find_stream_info(ic, NULL)) < 0)
+        goto end;
+    oc = avformat_alloc_context();
+    if (!oc) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    mt->nb_track = 0;
+    for (k = 0; k < FF_ARRAY_ELEMS(types); k++) {
+        idx = av_find_best_stream(ic, types[k], -1, related, NULL, 0);
+        if (idx < 0)
+            continue;
+        if (types[k] == AVMEDIA_TYPE_VIDEO)
+            related = idx;
+
+        codec = types[k] == AVMEDIA_TYPE_VIDEO ? tmpl->video_codec : tmpl->audio_codec;
+        if (!nspk_rtp_pktzr_supported(codec)) {
+            // The session would fall back to the muxer, with other ports and payload types.
+            if (types[k] == AVMEDIA_TYPE_VIDEO) {
+                ret = AVERROR_PATCHWELCOME;
+                goto end;
+            }
+            continue;
+        }
+
+        st = avformat_new_stream(oc, NULL);
+        if (!st) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if ((ret = rtsp_track_par(st->codecpar, ic->streams[idx], codec)) < 0)
+            goto end;
+        media[0] = 0;
+        if ((ret = ff_sdp_write_media(media, sizeof(media), st, mt->nb_track, NULL, NULL, 0, 0, NULL)) < 0)
+            goto end;
+        // UDP sessions keep a history, the clock as nspk_rtp_pktzr_init() picks it.
+        if (tmpl->rtcp && tmpl->rtx_ms > 0)
+            nspk_rtx_sdp(&bp, media, ff_rtp_get_payload_type(NULL, st->codecpar, mt->nb_track), tmpl->rtx_pt,
+                         types[k] == AVMEDIA_TYPE_VIDEO ? 90000 :
+                         codec == AV_CODEC_ID_OPUS ? 48000 : st->codecpar->sample_rate);
+        else
+            av_bprintf(&bp, "%s", media);
+        av_bprintf(&bp, "a=control:trackID=%d\r\n", mt->nb_track);
+        mt->type[mt->nb_track++] = types[k];
+    }
+    if (!mt->nb_track) {
+        ret = AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+    mt->duration = ic->duration;
+    ret = av_bprint_finalize(&bp, &mt->sdp);
+
+end:
+    if (ret < 0)
+        av_bprint_finalize(&bp, NULL);
+    avformat_free_context(oc);
+    avformat_close_input(&ic);
+    return ret;
+}
+
+/**
+ * Probe the files the lcore queues, until nspk_rtsp_lcore_fini() stops it.
+ * Opening a file and finding its stream info reads and decodes part of it,
+ * which would hold the lcore and all its sessions meanwhile.
+ */
+static void *rtsp_prober(void *arg)
+{
+    struct nspk_rtsp_lcore *rl = arg;
+    struct rtsp_mount *mt;
+
+    while (!__atomic_load_n(&rl->prober_stop, __ATOMIC_ACQUIRE)) {
+        if (rte_ring_sc_dequeue(rl->probe, (void **)&mt) != 0) {
+            av_usleep(RTSP_PROBE_WAIT_US);
+            continue;
+        }
+        mt->ret = rtsp_mount_probe(mt, mt->path);
+        if (mt->ret < 0)
+            av_log(NULL, AV_LOG_WARNING, "RTSP: cannot serve '%s': %s\n", mt->path, av_err2str(mt->ret));
+        // Both rings have room for all the mounts.
+        rte_ring_sp_enqueue(rl->probed, mt);
+    }
+    return NULL;
+}
+
+/**
+ * Tracks of a file, from the cache. On first use the file is queued to the
+ * prober and the request waits for it in conn->wait.
+ * \return 0, AVERROR(EAGAIN) while the file is probed, or the error of its probe.
+ */
+static int rtsp_mount_get(struct rtsp_conn *conn, const char *name, struct rtsp_mount **mtp)
+{
+    struct nspk_rtsp_lcore *rl = conn->rl;
+    struct rtsp_mount *mt, *slot = NULL;
+    uint32_t i;
+
+    for (i = 0; i != NSPK_RTSP_MAX_MOUNT; i++) {
+        mt = &rl->mount[i];
+        if (mt->state == RTSP_MOUNT_FREE) {
+            slot = slot ? slot : mt;
+            continue;
+        }
+        if (strcmp(mt->name, name))
+            continue;
+        *mtp = mt;
+        if (mt->state == RTSP_MOUNT_PROBING)
+            break;
+        return mt->state == RTSP_MOUNT_READY ? 0 : mt->ret;
+    }
+
+    if (i == NSPK_RTSP_MAX_MOUNT) {
+        if (!slot)
+            return AVERROR(ENOSPC);
+        mt = slot;
+        memset(mt, 0, sizeof(*mt));
+        if (snprintf(mt->path, sizeof(mt->path), "%s/%s", nspk_rtsp_prm.root, name) >= (int)sizeof(mt->path))
+            return AVERROR(ENAMETOOLONG);
+        av_strlcpy(mt->name, name, sizeof(mt->name));
+        mt->state = RTSP_MOUNT_PROBING;
+        rte_ring_sp_enqueue(rl->probe, mt);
+        *mtp = mt;
+    }
+    conn->wait = mt;
+    return AVERROR(EAGAIN);
+}
+
+static int rtsp_describe(struct rtsp_conn *conn, int cseq, const char *uri, const char *mount)
+{
+    struct rtsp_mount *mt;
+    char laddr[INET6_ADDRSTRLEN], hdrs[RTSP_NAME_SIZE + 128];
+    AVBPrint bp;
+    int ret;
+
+    ret = rtsp_mount_get(conn, mount, &mt);
+    if (ret == AVERROR(EAGAIN))
+        return RTSP_DEFERRED;
+    if (ret == AVERROR(ENOENT))
+        return rtsp_reply(conn, 404, cseq, NULL, NULL, 0);
+    if (ret == AVERROR(ENOSPC))
+        return rtsp_reply(conn, 503, cseq, NULL, NULL, 0);
+    if (ret < 0)
+        return rtsp_reply(conn, 415, cseq, NULL, NULL, 0);
+
+    if (!format_addr(&conn->fs->laddr, laddr, sizeof(laddr)))
+        av_strlcpy(laddr, "0.0.0.0", sizeof(laddr));
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&bp, "v=0\r\no=- %"PRIu64" 1 IN IP4 %s\r\ns=%s\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\n",
+               rte_rand() >> 1, laddr, mt->name);
+    if (mt->duration > 0)
+        av_bprintf(&bp, "a=range:npt=0-%.3f\r\n", mt->duration / (double)AV_TIME_BASE);
+    av_bprintf(&bp, "a=control:*\r\n%s", mt->sdp);
+    if (!av_bprint_is_complete(&bp)) {
+        av_bprint_finalize(&bp, NULL);
+        return AVERROR(ENOMEM);
+    }
+
+    snprintf(hdrs, sizeof(hdrs), "Content-Base: %s%s\r\nContent-Type: application/sdp\r\n",
+             uri, uri[0] && uri[strlen(uri) - 1] == '/' ? "" : "/");
+    ret = rtsp_reply(conn, 200, cseq, hdrs, bp.str, bp.len);
+    av_bprint_finalize(&bp, NULL);
+    return ret;
+}
+
+static int rtsp_setup(struct rtsp_conn *conn, int cseq, const char *req, const char *mount, int track)
+{
+    struct rtsp_mount *mt;
+    struct rtsp_track *t;
+    char transport[256], sess[64], hdrs[512];
+    const char *p;
+    int i, interleaved, ret;
+
+    if (!rtsp_header(req, "Transport", transport, sizeof(transport)))
+        return rtsp_reply(conn, 400, cseq, NULL, NULL, 0);
+    if (rtsp_header(req, "Session", sess, sizeof(sess)) && strncmp(sess, conn->session, strlen(conn->session)))
+        return rtsp_reply(conn, 454, cseq, NULL, NULL, 0);
+    if (conn->play)
+        return rtsp_reply(conn, 455, cseq, NULL, NULL, 0);
+    // One file per session, its tracks are sent by one RTP session.
+    if (conn->mount[0] && strcmp(conn->mount, mount))
+        return rtsp_reply(conn, 459, cseq, NULL, NULL, 0);
+
+    ret = rtsp_mount_get(conn, mount, &mt);
+    if (ret == AVERROR(EAGAIN))
+        return RTSP_DEFERRED;
+    if (ret < 0)
+        return rtsp_reply(conn, ret == AVERROR(ENOENT) ? 404 : 415, cseq, NULL, NULL, 0);
+    if (track < 0 && mt->nb_track == 1)
+        track = 0;
+    if (track < 0 || track >= mt->nb_track)
+        return rtsp_reply(conn, 404, cseq, NULL, NULL, 0);
+
+    // Unicast RTP over UDP, or interleaved on the connection.
+    if (!av_strstart(transport, "RTP/AVP", &p) || strstr(transport, "multicast"))
+        return rtsp_reply(conn, 461, cseq, NULL, NULL, 0);
+    interleaved = av_strstart(p, "/TCP", NULL);
+    if (!interleaved && ((*p && *p != ';' && strncmp(p, "/UDP", 4)) ||
+                         strstr(transport, "interleaved=") || !strstr(transport, "client_port=")))
+        return rtsp_reply(conn, 461, cseq, NULL, NULL, 0);
+    // All tracks of a session take the same way, the session sends them all.
+    for (i = 0; i < RTSP_MAX_TRACK; i++) {
+        if (conn->track[i].setup && conn->track[i].interleaved != interleaved)
+            return rtsp_reply(conn, 461, cseq, NULL, NULL, 0);
+    }
+
+    t = &conn->track[track];
+    if (interleaved) {
+        t->channel_rtp = 2 * track;
+        t->channel_rtcp = 2 * track + 1;
+        if ((p = strstr(transport, "interleaved="))) {
+            t->channel_rtp = strtol(p + strlen("interleaved="), (char **)&p, 10);
+            t->channel_rtcp = *p == '-' ? strtol(p + 1, NULL, 10) : t->channel_rtp + 1;
+        }
+        if (t->channel_rtp < 0 || t->channel_rtp > UINT8_MAX ||
+            t->channel_rtcp < 0 || t->channel_rtcp > UINT8_MAX || t->channel_rtp == t->channel_rtcp)
+            return rtsp_reply(conn, 400, cseq, NULL, NULL, 0);
+        for (i = 0; i < RTSP_MAX_TRACK; i++) {
+            if (i != track && conn->track[i].setup &&
+                (conn->track[i].channel_rtp == t->channel_rtp || conn->track[i].channel_rtp == t->channel_rtcp ||
+                 conn->track[i].channel_rtcp == t->channel_rtp || conn->track[i].channel_rtcp == t->channel_rtcp))
+                return rtsp_reply(conn, 400, cseq, NULL, NULL, 0);
+        }
+        t->setup = 1;
+        t->interleaved = 1;
+        av_strlcpy(conn->mount, mount, sizeof(conn->mount));
+
+        snprintf(hdrs, sizeof(hdrs),
+                 "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n"
+                 "Session: %s;timeout=%d\r\n",
+                 t->channel_rtp, t->channel_rtcp, conn->session, NSPK_RTSP_TIMEOUT_S);
+        return rtsp_reply(conn, 200, cseq, hdrs, NULL, 0);
+    }
+
+    p = strstr(transport, "client_port=");
+    t->client_rtp = strtol(p + strlen("client_port="), (char **)&p, 10);
+    t->client_rtcp = *p == '-' ? strtol(p + 1, NULL, 10) : t->client_rtp + 1;
+    if (t->client_rtp <= 0 || t->client_rtp > UINT16_MAX ||
+        t->client_rtcp <= 0 || t->client_rtcp > UINT16_MAX)
+        return rtsp_reply(conn, 400, cseq, NULL, NULL, 0);
+
+    if (!t->setup) {
+        // The pair need not be consecutive: only ports the lcore's queues own will do.
+        t->server_rtp = rtsp_port_alloc(conn->rl);
+        t->server_rtcp = rtsp_port_alloc(conn->rl);
+        if (!t->server_rtp || !t->server_rtcp) {
+            rtsp_port_free(conn->rl, t->server_rtp);
+            rtsp_port_free(conn->rl, t->server_rtcp);
+            memset(t, 0, sizeof(*t));
+            return rtsp_reply(conn, 503, cseq, NULL, NULL, 0);
+        }
+        t->setup = 1;
+    }
+    av_strlcpy(conn->mount, mount, sizeof(conn->mount));
+
+    snprintf(hdrs, sizeof(hdrs),
+             "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d\r\n"
+             "Session: %s;timeout=%d\r\n",
+             t->client_rtp, t->client_rtcp, t->server_rtp, t->server_rtcp,
+             conn->session, NSPK_RTSP_TIMEOUT_S);
+    return rtsp_reply(conn, 200, cseq, hdrs, NULL, 0);
+}
+
+/**
+ * done_cb of the spawned sessions, run by the scheduler.
+ */
+static void rtsp_play_done(struct nspk_rtp_session_ctx_t *rtp_sess, void *arg)
+{
+    struct rtsp_play *play = arg;
+    uint32_t i;
+
+    for (i = 0; i != play->nb_port; i++)
+        rtsp_port_free(play->rl, play->port[i]);
+    // Once a session ends the client can set up the next one on the connection.
+    if (play->conn) {
+        play->conn->play = NULL;
+        play->conn->mount[0] = 0;
+    }
+    av_free(play);
+}
+
+/**
+ * Stop the session of a connection, it drains on its own.
+ */
+static void rtsp_play_stop(struct rtsp_conn *conn)
+{
+    struct nspk_sched_t *sched = RTE_PER_LCORE(_sched);
+    uint32_t i;
+
+    if (!conn->play)
+        return;
+    for (i = 0; sched && i != sched->nb_sess; i++) {
+        if (sched->sess[i]->done_arg == conn->play) {
+            nspk_media_stop(sched->sess[i]);
+            break;
+        }
+    }
+    // What the session sends while it drains has nowhere to go.
+    conn->play->tcp.fs = NULL;
+    conn->play->conn = NULL;
+    conn->play = NULL;
+    conn->mount[0] = 0;
+}
+
+static int rtsp_play(struct rtsp_conn *conn, int cseq, const char *req, const char *mount)
+{
+    struct nspk_sched_t *sched = RTE_PER_LCORE(_sched);
+    struct nspk_rtp_session_ctx_t *rtp_sess;
+    struct rtsp_track *vt = NULL, *at = NULL;
+    struct rtsp_mount *mt;
+    struct rtsp_play *play;
+    char sess[64], raddr[INET6_ADDRSTRLEN], hdrs[128];
+    int i, ret;
+
+    if (!rtsp_header(req, "Session", sess, sizeof(sess)) || strncmp(sess, conn->session, strlen(conn->session)))
+        return rtsp_reply(conn, 454, cseq, NULL, NULL, 0);
+    if (conn->play) {
+        snprintf(hdrs, sizeof(hdrs), "Session: %s\r\n", conn->session);
+        return rtsp_reply(conn, 200, cseq, hdrs, NULL, 0);
+    }
+    // SETUP left the mount in the cache.
+    if (!conn->mount[0] || strcmp(conn->mount, mount) ||
+        rtsp_mount_get(conn, mount, &mt) < 0)
+        return rtsp_reply(conn, 455, cseq, NULL, NULL, 0);
+
+    for (i = 0; i < mt->nb_track; i++) {
+        if (mt->type[i] == AVMEDIA_TYPE_VIDEO)
+            vt = &conn->track[i];
+        else
+            at = &conn->track[i];
+    }
+    // Audio may be left out, not the video the session is built around.
+    if ((vt && !vt->setup) || (!vt && !at->setup))
+        return rtsp_reply(conn, 455, cseq, NULL, NULL, 0);
+    if (at && !at->setup)
+        at = NULL;
+    if (!sched)
+        return rtsp_reply(conn, 503, cseq, NULL, NULL, 0);
+    if (!format_addr(&conn->fs->raddr, raddr, sizeof(raddr)))
+        return rtsp_reply(conn, 500, cseq, NULL, NULL, 0);
+
+    rtp_sess = malloc(sizeof(*rtp_sess));
+    play = av_mallocz(sizeof(*play));
+    if (!rtp_sess || !play) {
+        free(rtp_sess);
+        av_free(play);
+        return rtsp_reply(conn, 503, cseq, NULL, NULL, 0);
+    }
+    *rtp_sess = nspk_rtsp_prm.tmpl;
+    rtp_sess->session_id = (rte_lcore_id() << 20) | (conn->rl->next_id++ & 0xfffff);
+    snprintf(rtp_sess->src_url, sizeof(rtp_sess->src_url), "%s/%s", nspk_rtsp_prm.root, mount);
+    // Interleaved sessions send on the connection, their URL only says whether the audio goes too.
+    if ((vt ? vt : at)->interleaved) {
+        snprintf(rtp_sess->dst_url, sizeof(rtp_sess->dst_url), "rtp://%s:%u%s", raddr,
+                 nspk_tldk_sockaddr_get_port(&conn->fs->raddr), at ? "" : "?audioport=0");
+    } else {
+        // Audio only files have the audio as output stream 0, it takes the audio* ports all the same.
+        if (vt)
+            snprintf(rtp_sess->dst_url, sizeof(rtp_sess->dst_url),
+                     "rtp://%s:%d?rtcpport=%d&localport=%d&localrtcpport=%d",
+                     raddr, vt->client_rtp, vt->client_rtcp, vt->server_rtp, vt->server_rtcp);
+        else
+            snprintf(rtp_sess->dst_url, sizeof(rtp_sess->dst_url), "rtp://%s:%d", raddr, at->client_rtp);
+        if (at)
+            av_strlcatf(rtp_sess->dst_url, sizeof(rtp_sess->dst_url),
+                        "%caudioport=%d&audiortcpport=%d&audiolocalport=%d&audiolocalrtcpport=%d",
+                        vt ? '&' : '?', at->client_rtp, at->client_rtcp, at->server_rtp, at->server_rtcp);
+        else
+            av_strlcat(rtp_sess->dst_url, "&audioport=0", sizeof(rtp_sess->dst_url));
+    }
+
+    // The server ports go with the session, it may outlive the connection.
+    play->rl = conn->rl;
+    play->conn = conn;
+    for (i = 0; i < RTSP_MAX_TRACK; i++) {
+        if (!conn->track[i].setup)
+            continue;
+        if (conn->track[i].interleaved) {
+            nspk_rtp_tcp_chan_init(&play->chan[2 * i], &play->tcp, conn->track[i].channel_rtp);
+            nspk_rtp_tcp_chan_init(&play->chan[2 * i + 1], &play->tcp, conn->track[i].channel_rtcp);
+            play->interleaved = 1;
+        } else {
+            play->port[play->nb_port++] = conn->track[i].server_rtp;
+            play->port[play->nb_port++] = conn->track[i].server_rtcp;
+        }
+    }
+    if (play->interleaved) {
+        play->tcp.fs = conn->fs;
+        rtp_sess->tcp_chan = play->chan;
+    }
+    memset(conn->track, 0, sizeof(conn->track));
+    rtp_sess->done_cb = rtsp_play_done;
+    rtp_sess->done_arg = play;
+
+    av_log(NULL, AV_LOG_INFO, "RTSP session %s: playing %s to %s\n", conn->session,
+           rtp_sess->src_url, rtp_sess->dst_url);
+    ret = nspk_sched_spawn(sched, rtp_sess);
+    if (ret != 0) {
+        play->conn = NULL;
+        rtsp_play_done(NULL, play);
+        conn->mount[0] = 0;
+        return rtsp_reply(conn, ret == -ENOSPC ? 503 : 500, cseq, NULL, NULL, 0);
+    }
+    conn->play = play;
+    conn->rl->stat.play++;
+
+    snprintf(hdrs, sizeof(hdrs), "Session: %s\r\nRange: npt=0.000-\r\n", conn->session);
+    return rtsp_reply(conn, 200, cseq, hdrs, NULL, 0);
+}
+
+static int rtsp_teardown(struct rtsp_conn *conn, int cseq, const char *req)
+{
+    char sess[64];
+
+    if (!rtsp_header(req, "Session", sess, sizeof(sess)) || strncmp(sess, conn->session, strlen(conn->session)))
+        return rtsp_reply(conn, 454, cseq, NULL, NULL, 0);
+    rtsp_play_stop(conn);
+    rtsp_tracks_free(conn);
+    conn->mount[0] = 0;
+    return rtsp_reply(conn, 200, cseq, NULL, NULL, 0);
+}
+
+/**
+ * Handle one request, NUL terminated after its headers.
+ * \return 0, RTSP_DEFERRED if it is to be handled again once conn->wait
+ *         is probed, negative if the connection is to be closed.
+ */
+static int rtsp_request(struct rtsp_conn *conn, const char *req)
+{
+    char method[32], uri[1024], version[16], mount[RTSP_NAME_SIZE], cseq_str[16];
+    int cseq = 0, track;
+
+    if (rtsp_header(req, "CSeq", cseq_str, sizeof(cseq_str)))
+        cseq = strtol(cseq_str, NULL, 10);
+    if (sscanf(req, "%31s %1023s %15s", method, uri, version) != 3)
+        return rtsp_reply(conn, 400, cseq, NULL, NULL, 0);
+    if (strcmp(version, RTSP_VERSION))
+        return rtsp_reply(conn, 505, cseq, NULL, NULL, 0);
+
+    av_log(NULL, AV_LOG_DEBUG, "RTSP session %s: %s %s\n", conn->session, method, uri);
+    if (!strcmp(method, "OPTIONS"))
+        return rtsp_reply(conn, 200, cseq, "Public: " RTSP_METHODS "\r\n", NULL, 0);
+    if (!strcmp(method, "GET_PARAMETER") || !strcmp(method, "SET_PARAMETER"))
+        return rtsp_reply(conn, 200, cseq, NULL, NULL, 0);
+    if (!strcmp(method, "TEARDOWN"))
+        return rtsp_teardown(conn, cseq, req);
+
+    if (rtsp_uri_mount(uri, mount, sizeof(mount), &track) < 0)
+        return rtsp_reply(conn, 404, cseq, NULL, NULL, 0);
+    if (!strcmp(method, "DESCRIBE"))
+        return rtsp_describe(conn, cseq, uri, mount);
+    if (!strcmp(method, "SETUP"))
+        return rtsp_setup(conn, cseq, req, mount, track);
+    if (!strcmp(method, "PLAY"))
+        return rtsp_play(conn, cseq, req, mount);
+    return rtsp_reply(conn, 501, cseq, "Public: " RTSP_METHODS "\r\n", NULL, 0);
+}
+
+static void rtsp_conn_close(struct rtsp_conn *conn)
+{
+    struct nspk_rtsp_lcore *rl = conn->rl;
+
+    rtsp_play_stop(conn);
+    rtsp_tracks_free(conn);
+    nspk_tldk_tcp_stream_close(conn->fs);
+    LIST_REMOVE(conn, link);
+    rl->nb_conn--;
+    av_free(conn);
+}
+
+/**
+ * Pass an interleaved frame to the RTCP of the track it belongs to.
+ * Anything else a client sends on its channels is dropped.
+ */
+static void rtsp_interleaved_rx(struct rtsp_conn *conn, int channel, const uint8_t *buf, int len)
+{
+    struct rtsp_play *play = conn->play;
+    int i;
+
+    if (!play || !play->interleaved)
+        return;
+    for (i = 0; i < 2 * RTSP_MAX_TRACK; i++) {
+        if (play->chan[i].tcp && play->chan[i].channel == channel) {
+            if (play->chan[i].rtcp)
+                nspk_rtcp_input(play->chan[i].rtcp, buf, len);
+            return;
+        }
+    }
+}
+
+/**
+ * Serve the complete requests and interleaved frames of the request buffer,
+ * in order, up to a request which waits for the probe of its file.
+ * \return 0, negative if the connection is to be closed.
+ */
+static int rtsp_conn_serve(struct rtsp_conn *conn)
+{
+    uint32_t size;
+    char *end, clen[16];
+    int ret;
+
+    while (conn->len && !conn->wait) {
+        if (conn->buf[0] == '$') {
+            // An interleaved frame between the requests, RTCP of the client.
+            if (conn->len < NSPK_RTP_TCP_HDR_SIZE)
+                break;
+            size = NSPK_RTP_TCP_HDR_SIZE + AV_RB16(conn->buf + 2);
+            if (size > NSPK_RTSP_REQ_SIZE)
+                return AVERROR_INVALIDDATA;
+            if (size > conn->len)
+                break;
+            rtsp_interleaved_rx(conn, (uint8_t)conn->buf[1], (const uint8_t *)conn->buf + NSPK_RTP_TCP_HDR_SIZE,
+                                size - NSPK_RTP_TCP_HDR_SIZE);
+        } else {
+            if (!(end = strstr(conn->buf, "\r\n\r\n")))
+                break;
+            size = end + 4 - conn->buf;
+            end[2] = 0;
+            if (rtsp_header(conn->buf, "Content-Length", clen, sizeof(clen)))
+                size += strtoul(clen, NULL, 10);
+            if (size > NSPK_RTSP_REQ_SIZE) {
+                rtsp_reply(conn, 413, 0, NULL, NULL, 0);
+                return AVERROR(EMSGSIZE);
+            }
+            // The body has yet to come.
+            if (size > conn->len) {
+                end[2] = '\r';
+                break;
+            }
+
+            ret = rtsp_request(conn, conn->buf);
+            if (ret < 0)
+                return ret;
+            // It stays in the buffer, the later ones behind it.
+            if (ret == RTSP_DEFERRED) {
+                end[2] = '\r';
+                break;
+            }
+            conn->rl->stat.req++;
+        }
+        conn->len -= size;
+        memmove(conn->buf, conn->buf + size, conn->len);
+        conn->buf[conn->len] = 0;
+    }
+    return 0;
+}
+
+/**
+ * Move what TLDK received to the request buffer, then serve it. Requests
+ * too large for the buffer close the connection.
+ */
+static uint32_t rtsp_conn_rx(struct netfe_stream *fs)
+{
+    struct rtsp_conn *conn = fs->udata;
+    struct rte_mbuf *pkts[MAX_PKT_BURST];
+    uint32_t i, n, len;
+    const void *data;
+    int ret = 0;
+
+    n = tle_tcp_stream_recv(fs->s, pkts, RTE_DIM(pkts));
+    fs->stat.rxp += n;
+    for (i = 0; i != n; i++) {
+        len = pkts[i]->pkt_len;
+        fs->stat.rxb += len;
+        if (len > NSPK_RTSP_REQ_SIZE - conn->len) {
+            ret = -1;
+        } else {
+            data = rte_pktmbuf_read(pkts[i], 0, len, conn->buf + conn->len);
+            if (data != conn->buf + conn->len)
+                memcpy(conn->buf + conn->len, data, len);
+            conn->len += len;
+        }
+        rte_pktmbuf_free(pkts[i]);
+    }
+    if (ret < 0) {
+        rtsp_reply(conn, 413, 0, NULL, NULL, 0);
+        rtsp_conn_close(conn);
+        return n;
+    }
+    if (n)
+        conn->tsc = rte_rdtsc();
+
+    conn->buf[conn->len] = 0;
+    if (rtsp_conn_serve(conn) < 0)
+        rtsp_conn_close(conn);
+    return n;
+}
+
+/**
+ * Take back the probed mounts and serve the requests which waited for them.
+ */
+static void rtsp_probe_timer_cb(struct rte_timer *tim, void *arg)
+{
+    struct nspk_rtsp_lcore *rl = arg;
+    struct rtsp_conn *conn, *next;
+    struct rtsp_mount *mt;
+
+    while (rte_ring_sc_dequeue(rl->probed, (void **)&mt) == 0) {
+        mt->state = mt->ret < 0 ? RTSP_MOUNT_FAILED : RTSP_MOUNT_READY;
+        for (conn = LIST_FIRST(&rl->conn); conn; conn = next) {
+            next = LIST_NEXT(conn, link);
+            if (conn->wait != mt)
+                continue;
+            conn->wait = NULL;
+            if (rtsp_conn_serve(conn) < 0)
+                rtsp_conn_close(conn);
+        }
+        // A failure is not kept, the file may be there by the next request.
+        if (mt->state == RTSP_MOUNT_FAILED)
+            mt->state = RTSP_MOUNT_FREE;
+    }
+}
+
+/**
+ * TSC the client was last heard from: its last request or interleaved
+ * frame, or the last RTCP receiver report of its session.
+ */
+static uint64_t rtsp_conn_heard(const struct rtsp_conn *conn)
+{
+    struct nspk_sched_t *sched = RTE_PER_LCORE(_sched);
+    struct nspk_av_ctx_t *av;
+    uint64_t tsc = conn->tsc;
+    uint32_t i, j;
+
+    for (i = 0; conn->play && sched && i != sched->nb_sess; i++) {
+        if (sched->sess[i]->done_arg != conn->play)
+            continue;
+        av = sched->sess[i]->av_ctx;
+        for (j = 0; av && av->stream_ctx && j < av->nb_out; j++) {
+            if (av->stream_ctx[j].rtcp)
+                tsc = RTE_MAX(tsc, av->stream_ctx[j].rtcp->rr.tsc);
+        }
+        break;
+    }
+    return tsc;
+}
+
+/**
+ * Close the connections whose client was not heard from within the
+ * timeout SETUP announces, which stops their sessions. RTCP receiver
+ * reports keep a session alive, RFC 2326 12.37.
+ */
+static void rtsp_expire_timer_cb(struct rte_timer *tim, void *arg)
+{
+    struct nspk_rtsp_lcore *rl = arg;
+    uint64_t now = rte_rdtsc(), timeout = rte_get_tsc_hz() * NSPK_RTSP_TIMEOUT_S;
+    struct rtsp_conn *conn, *next;
+
+    for (conn = LIST_FIRST(&rl->conn); conn; conn = next) {
+        next = LIST_NEXT(conn, link);
+        if (now - rtsp_conn_heard(conn) < timeout)
+            continue;
+        av_log(NULL, AV_LOG_INFO, "RTSP session %s: timed out\n", conn->session);
+        rl->stat.expired++;
+        rtsp_conn_close(conn);
+    }
+}
+
+static void rtsp_conn_err(struct netfe_stream *fs)
+{
+    struct rtsp_conn *conn = fs->udata;
+
+    av_log(NULL, AV_LOG_DEBUG, "RTSP session %s: connection closed\n", conn->session);
+    rtsp_conn_close(conn);
+}
+
+static uint32_t rtsp_listen_rx(struct netfe_stream *ls)
+{
+    struct nspk_rtsp_lcore *rl = ls->udata;
+    struct netfe_stream *fs[MAX_PKT_BURST];
+    struct rtsp_conn *conn;
+    uint32_t i, n;
+
+    n = nspk_tldk_tcp_stream_accept(rl->lcore_prm, ls, fs, RTE_DIM(fs));
+    for (i = 0; i != n; i++) {
+        conn = rl->nb_conn < nspk_rtsp_prm.max_conn ? av_mallocz(sizeof(*conn)) : NULL;
+        if (!conn) {
+            rl->stat.rej++;
+            nspk_tldk_tcp_stream_close(fs[i]);
+            continue;
+        }
+        conn->rl = rl;
+        conn->fs = fs[i];
+        conn->tsc = rte_rdtsc();
+        snprintf(conn->session, sizeof(conn->session), "%016"PRIx64, rte_rand());
+        fs[i]->udata = conn;
+        fs[i]->rx_cb = rtsp_conn_rx;
+        fs[i]->err_cb = rtsp_conn_err;
+        LIST_INSERT_HEAD(&rl->conn, conn, link);
+        rl->nb_conn++;
+        rl->stat.acc++;
+    }
+    return n;
+}
+
+static int rtsp_prober_start(struct nspk_rtsp_lcore *rl)
+{
+    char name[RTE_RING_NAMESIZE];
+    rte_cpuset_t cpuset;
+    pthread_attr_t attr;
+    int ret;
+
+    snprintf(name, sizeof(name), "nspk_rtsp_probe_%u", rte_lcore_id());
+    rl->probe = rte_ring_create(name, rte_align32pow2(NSPK_RTSP_MAX_MOUNT + 1), rte_socket_id(),
+                                RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (!rl->probe) {
+        av_log(NULL, AV_LOG_ERROR, "%s: Could not create ring %s\n", __func__, name);
+        return AVERROR(rte_errno);
+    }
+    snprintf(name, sizeof(name), "nspk_rtsp_probed_%u", rte_lcore_id());
+    rl->probed = rte_ring_create(name, rte_align32pow2(NSPK_RTSP_MAX_MOUNT + 1), rte_socket_id(),
+                                 RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (!rl->probed) {
+        av_log(NULL, AV_LOG_ERROR, "%s: Could not create ring %s\n", __func__, name);
+        return AVERROR(rte_errno);
+    }
+
+    // A thread started from an lcore inherits its affinity.
+    pthread_attr_init(&attr);
+    nspk_cpu_worker_set(&cpuset);
+    if (CPU_COUNT(&cpuset))
+        pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+    else
+        av_log(NULL, AV_LOG_WARNING, "RTSP: no CPU left for the prober of lcore %u\n", rte_lcore_id());
+    ret = pthread_create(&rl->prober, &attr, rtsp_prober, rl);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: pthread_create failed: %s\n", __func__, strerror(ret));
+        return AVERROR(ret);
+    }
+    rl->prober_started = 1;
+
+    snprintf(name, sizeof(name), "nspk-rtsp-%u", rte_lcore_id());
+    name[15] = '\0';
+    pthread_setname_np(rl->prober, name);
+    return 0;
+}
+
+int nspk_rtsp_lcore_init(struct lcore_prm *lcore_prm)
+{
+    struct netbe_lcore *lc = RTE_PER_LCORE(_be);
+    struct nspk_rtsp_lcore *rl;
+    struct netfe_sprm sprm;
+    struct netfe_stream *ls;
+    uint32_t port, last = nspk_rtsp_prm.port + nspk_rtsp_prm.nb_port;
+    uint64_t hz = rte_get_tsc_hz();
+    int ret;
+
+    rl = av_mallocz(sizeof(*rl));
+    if (!rl)
+        return AVERROR(ENOMEM);
+    rl->lcore_prm = lcore_prm;
+    rl->next_port = nspk_rtsp_prm.rtp_port;
+    LIST_INIT(&rl->conn);
+    rte_timer_init(&rl->probe_timer);
+    rte_timer_init(&rl->expire_timer);
+    RTE_PER_LCORE(_rtsp) = rl;
+
+    for (port = nspk_rtsp_prm.port; port != last; port++) {
+        if (!nspk_tldk_port_owned(lc, port))
+            continue;
+
+        memset(&sprm, 0, sizeof(sprm));
+        nspk_tldk_sockaddr_fill(&sprm.local_addr, NULL, port);
+        nspk_tldk_sockaddr_fill(&sprm.remote_addr, NULL, 0);
+        ls = nspk_tldk_tcp_stream_listen(lcore_prm, &sprm);
+        if (!ls) {
+            ret = AVERROR(rte_errno);
+            av_log(NULL, AV_LOG_ERROR, "RTSP: cannot listen on port %u: %s\n", port, av_err2str(ret));
+            nspk_rtsp_lcore_fini();
+            return ret;
+        }
+        ls->udata = rl;
+        ls->rx_cb = rtsp_listen_rx;
+        rl->listen[rl->nb_listen++] = ls;
+        av_log(NULL, AV_LOG_INFO, "RTSP server listening on port %u, lcore %u\n", port, rte_lcore_id());
+    }
+    // Lcores without a listening port never get a request.
+    if (!rl->nb_listen)
+        return 0;
+
+    if ((ret = rtsp_prober_start(rl)) < 0) {
+        nspk_rtsp_lcore_fini();
+        return ret;
+    }
+    rte_timer_reset(&rl->probe_timer, hz * RTSP_PROBE_POLL_MS / MS_PER_S, PERIODICAL, rte_lcore_id(),
+                    rtsp_probe_timer_cb, rl);
+    rte_timer_reset(&rl->expire_timer, hz, PERIODICAL, rte_lcore_id(), rtsp_expire_timer_cb, rl);
+    return 0;
+}
+
+void nspk_rtsp_lcore_fini(void)
+{
+    struct nspk_rtsp_lcore *rl = RTE_PER_LCORE(_rtsp);
+    uint32_t i;
+
+    if (!rl)
+        return;
+
+    rte_timer_stop(&rl->probe_timer);
+    rte_timer_stop(&rl->expire_timer);
+    while (!LIST_EMPTY(&rl->conn))
+        rtsp_conn_close(LIST_FIRST(&rl->conn));
+    for (i = 0; i != rl->nb_listen; i++)
+        nspk_tldk_tcp_stream_close(rl->listen[i]);
+    // The prober finishes the file it is on, those it did not get to have nothing to free.
+    if (rl->prober_started) {
+        __atomic_store_n(&rl->prober_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(rl->prober, NULL);
+    }
+    rte_ring_free(rl->probe);
+    rte_ring_free(rl->probed);
+    for (i = 0; i != NSPK_RTSP_MAX_MOUNT; i++)
+        av_freep(&rl->mount[i].sdp);
+
+    RTE_LOG(NOTICE, USER1, "%s(lcore=%u) RTSP connections: %"PRIu64" accepted, %"PRIu64" rejected, "
+            "%"PRIu64" timed out; requests: %"PRIu64", %"PRIu64" failed; %"PRIu64" sessions played\n",
+            __func__, rte_lcore_id(), rl->stat.acc, rl->stat.rej, rl->stat.expired, rl->stat.req,
+            rl->stat.err, rl->stat.play);
+    av_free(rl);
+    RTE_PER_LCORE(_rtsp) = NULL;
+}
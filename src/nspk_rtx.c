@@ -0,0 +1,211 @@
+/**
+ * NSPK RTP retransmission history.
+ * Sent packets are kept by reference count for a time window and resent
+ * on NACK, plainly or as RFC 4588 RTX, without copying their payload.
+ */
+
+#include <rte_cycles.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/random_seed.h>
+
+#include <nspk.h>
+#include <nspk_rtx.h>
+
+#define RTX_RING_MASK       (NSPK_RTX_RING_SIZE - 1)
+/* Original sequence number in front of the RTX payload. */
+#define RTX_OSN_SIZE        2
+
+static void rtx_release(struct nspk_rtx_t *rtx, struct nspk_rtx_slot_t *sl)
+{
+    rte_pktmbuf_free(sl->m);
+    sl->m = NULL;
+    rtx->held--;
+}
+
+/**
+ * Drop the packets older than the window.
+ */
+static void rtx_evict(struct nspk_rtx_t *rtx, uint64_t now)
+{
+    struct nspk_rtx_slot_t *sl;
+
+    for (; rtx->head != rtx->tail; rtx->head++) {
+        sl = &rtx->slot[rtx->head & RTX_RING_MASK];
+        if (sl->m == NULL)
+            continue;
+        if (now - sl->tsc < rtx->window)
+            break;
+        rtx_release(rtx, sl);
+    }
+}
+
+void nspk_rtx_sent(struct nspk_rtx_t *rtx, struct rte_mbuf *pkt[], uint32_t num)
+{
+    struct nspk_rtx_slot_t *sl;
+    const uint8_t *p;
+    uint64_t now = rte_rdtsc();
+    uint16_t seq;
+    uint32_t i;
+
+    rtx_evict(rtx, now);
+
+    for (i = 0; i != num; i++) {
+        p = rte_pktmbuf_mtod(pkt[i], const uint8_t *);
+        // Retransmissions in RTX format go out on the same stream.
+        if (pkt[i]->data_len < NSPK_RTP_HDR_SIZE || AV_RB32(p + 8) != rtx->ssrc)
+            continue;
+
+        seq = AV_RB16(p + 2);
+        sl = &rtx->slot[seq & RTX_RING_MASK];
+        if (sl->m == pkt[i])
+            continue;
+        if (sl->m != NULL)
+            rtx_release(rtx, sl);
+
+        rte_mbuf_refcnt_update(pkt[i], 1);
+        sl->m = pkt[i];
+        sl->tsc = now;
+        sl->len = pkt[i]->pkt_len;
+        sl->seq = seq;
+        rtx->held++;
+
+        if (!rtx->started) {
+            rtx->started = 1;
+            rtx->head = seq;
+            rtx->tail = seq + 1;
+        } else if ((int16_t)(seq - rtx->tail) >= 0) {
+            rtx->tail = seq + 1;
+            // Sequence numbers only move forward, keep the oldest within the ring.
+            if ((uint16_t)(rtx->tail - rtx->head) > NSPK_RTX_RING_SIZE)
+                rtx->head = rtx->tail - NSPK_RTX_RING_SIZE;
+        }
+    }
+}
+
+void nspk_rtx_init(struct nspk_rtx_t *rtx, struct netfe_stream *fs, uint32_t ssrc,
+                   uint32_t window_ms, uint8_t rtx_pt)
+{
+    memset(rtx, 0, sizeof(*rtx));
+    rtx->fs = fs;
+    rtx->ssrc = ssrc;
+    rtx->window = rte_get_tsc_hz() * window_ms / MS_PER_S;
+    rtx->rtx_pt = rtx_pt & 0x7f;
+    rtx->rtx_ssrc = av_get_random_seed();
+    rtx->rtx_seq = av_get_random_seed() & 0xffff;
+}
+
+void nspk_rtx_fini(struct nspk_rtx_t *rtx)
+{
+    uint32_t i;
+
+    for (i = 0; i != NSPK_RTX_RING_SIZE; i++) {
+        if (rtx->slot[i].m != NULL)
+            rtx_release(rtx, &rtx->slot[i]);
+    }
+}
+
+/**
+ * Build an RTX packet: a new RTP header and the OSN in a mbuf of their own,
+ * chained to an indirect mbuf on the payload of the original.
+ */
+static struct rte_mbuf *rtx_packet(struct nspk_rtx_t *rtx, struct rte_mbuf *m, uint16_t seq)
+{
+    struct rte_mbuf *h, *mi;
+    uint8_t *p;
+
+    h = pkt_mag_get(&rtx->fs->mag);
+    mi = pkt_mag_get(&rtx->fs->mag);
+    if (h == NULL || mi == NULL)
+        goto fail;
+
+    rte_pktmbuf_attach(mi, m);
+    rte_pktmbuf_adj(mi, NSPK_RTP_HDR_SIZE);
+
+    p = rte_pktmbuf_mtod(h, uint8_t *);
+    memcpy(p, rte_pktmbuf_mtod(m, const uint8_t *), NSPK_RTP_HDR_SIZE);
+    p[1] = (p[1] & 0x80) | rtx->rtx_pt;
+    AV_WB16(p + 2, rtx->rtx_seq);
+    AV_WB32(p + 8, rtx->rtx_ssrc);
+    AV_WB16(p + NSPK_RTP_HDR_SIZE, seq);
+    h->data_len = NSPK_RTP_HDR_SIZE + RTX_OSN_SIZE;
+    h->pkt_len = h->data_len;
+    if (rte_pktmbuf_chain(h, mi) != 0)
+        goto fail;
+
+    rtx->rtx_seq++;
+    return h;
+
+fail:
+    if (mi != NULL)
+        pkt_mag_put(&rtx->fs->mag, mi);
+    if (h != NULL)
+        pkt_mag_put(&rtx->fs->mag, h);
+    return NULL;
+}
+
+static int rtx_resend(struct nspk_rtx_t *rtx, uint16_t seq)
+{
+    struct nspk_rtx_slot_t *sl = &rtx->slot[seq & RTX_RING_MASK];
+    struct rte_mbuf *m = sl->m;
+
+    rtx->nacked++;
+    if (m == NULL || sl->seq != seq) {
+        rtx->misses++;
+        return 0;
+    }
+    // TLDK or the NIC still hold it: the original is not lost yet.
+    if (rte_mbuf_refcnt_read(m) != 1) {
+        rtx->busy++;
+        return 0;
+    }
+
+    // Strip the headers TLDK put in front, it prepends them again.
+    rte_pktmbuf_adj(m, m->pkt_len - sl->len);
+
+    if (rtx->rtx_pt != 0) {
+        m = rtx_packet(rtx, m, seq);
+        if (m == NULL) {
+            rtx->drops++;
+            return 0;
+        }
+    } else {
+        rte_mbuf_refcnt_update(m, 1);
+    }
+
+    if (nspk_tldk_udp_stream_queue_mbuf(rtx->fs, m) < 0) {
+        rte_pktmbuf_free(m);
+        rtx->drops++;
+        return 0;
+    }
+    rtx->resent++;
+    return 1;
+}
+
+uint32_t nspk_rtx_nack(struct nspk_rtx_t *rtx, uint16_t pid, uint16_t blp)
+{
+    uint32_t n;
+    int i;
+
+    rtx_evict(rtx, rte_rdtsc());
+
+    n = rtx_resend(rtx, pid);
+    for (i = 0; i < 16; i++) {
+        if (blp & (1 << i))
+            n += rtx_resend(rtx, pid + i + 1);
+    }
+    return n;
+}
+
+void nspk_rtx_sdp(AVBPrint *bp, const char *media, uint8_t pt, uint8_t rtx_pt, uint32_t clock_rate)
+{
+    const char *eol = strstr(media, "\r\n");
+
+    if (!eol || !rtx_pt) {
+        av_bprintf(bp, "%sa=rtcp-fb:%d nack\r\n", media, pt);
+        return;
+    }
+    // The m= line comes first, its format list takes the RTX payload type.
+    av_bprintf(bp, "%.*s %d%s", (int)(eol - media), media, rtx_pt, eol);
+    av_bprintf(bp, "a=rtcp-fb:%d nack\r\na=rtpmap:%d rtx/%u\r\na=fmtp:%d apt=%d\r\n",
+               pt, rtx_pt, clock_rate, rtx_pt, pt);
+}
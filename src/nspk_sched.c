@@ -0,0 +1,130 @@
+/**
+ * NSPK per lcore RTP session scheduler.
+ */
+
+#include <nspk.h>
+#include <nspk_sched.h>
+
+int nspk_sched_add(struct nspk_sched_t *sched, struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    if (sched->nb_sess == NSPK_SCHED_MAX_SESSIONS) {
+        av_log(NULL, AV_LOG_ERROR, "%s: lcore %u already runs %u sessions\n", __func__,
+               sched->lcore, sched->nb_sess);
+        return -ENOSPC;
+    }
+
+    rtp_sess->lcore_prm = sched->lcore_prm;
+    sched->sess[sched->nb_sess++] = rtp_sess;
+    return 0;
+}
+
+/**
+ * Drop session i. The last session takes its slot, so the caller must
+ * look at slot i again.
+ */
+static void sched_remove(struct nspk_sched_t *sched, uint32_t i)
+{
+    struct nspk_rtp_session_ctx_t *rtp_sess = sched->sess[i];
+
+    if (rtp_sess->done_cb != NULL)
+        rtp_sess->done_cb(rtp_sess, rtp_sess->done_arg);
+    free(rtp_sess);
+    sched->sess[i] = sched->sess[--sched->nb_sess];
+    sched->sess[sched->nb_sess] = NULL;
+}
+
+int nspk_sched_spawn(struct nspk_sched_t *sched, struct nspk_rtp_session_ctx_t *rtp_sess)
+{
+    struct nspk_rtp_session_ctx_t *prev = RTE_PER_LCORE(_rtp_sess);
+    int ret;
+
+    ret = nspk_sched_add(sched, rtp_sess);
+    if (ret != 0) {
+        free(rtp_sess);
+        return ret;
+    }
+
+    RTE_PER_LCORE(_rtp_sess) = rtp_sess;
+    ret = nspk_media_init(rtp_sess);
+    RTE_PER_LCORE(_rtp_sess) = prev;
+    if (ret != 0) {
+        RTE_LOG(ERR, USER1, "%s(lcore=%u) RTP session %d failed to start\n",
+                __func__, sched->lcore, rtp_sess->session_id);
+        // The caller learns it from the return value.
+        rtp_sess->done_cb = NULL;
+        sched_remove(sched, sched->nb_sess - 1);
+        return ret;
+    }
+    RTE_LOG(NOTICE, USER1, "%s(lcore=%u) RTP session %d started, %u running\n",
+            __func__, sched->lcore, rtp_sess->session_id, sched->nb_sess);
+    return 0;
+}
+
+int nspk_sched_run(struct nspk_sched_t *sched)
+{
+    struct nspk_rtp_session_ctx_t *rtp_sess;
+    uint32_t i;
+    int work, ret, failed = 0;
+
+    RTE_PER_LCORE(_sched) = sched;
+
+    // Opening inputs may block, it is done once before the sessions start sharing the lcore.
+    for (i = 0; i < sched->nb_sess; ) {
+        rtp_sess = sched->sess[i];
+        RTE_PER_LCORE(_rtp_sess) = rtp_sess;
+        ret = nspk_media_init(rtp_sess);
+        RTE_PER_LCORE(_rtp_sess) = NULL;
+        if (ret != 0) {
+            RTE_LOG(ERR, USER1, "%s(lcore=%u) RTP session %d failed to start\n",
+                    __func__, sched->lcore, rtp_sess->session_id);
+            sched_remove(sched, i);
+            failed++;
+            continue;
+        }
+        i++;
+    }
+
+    while (sched->nb_sess != 0 || (sched->persist && !force_quit)) {
+        work = 0;
+        for (i = 0; i < sched->nb_sess; ) {
+            rtp_sess = sched->sess[i];
+            if (force_quit)
+                nspk_media_stop(rtp_sess);
+
+            RTE_PER_LCORE(_rtp_sess) = rtp_sess;
+            ret = nspk_media_step(rtp_sess);
+            if (ret < 0) {
+                if (ret != AVERROR_EOF) {
+                    av_log(NULL, AV_LOG_ERROR, "RTP session %d failed: %s\n",
+                           rtp_sess->session_id, av_err2str(ret));
+                    failed++;
+                }
+                RTE_LOG(NOTICE, USER1, "%s(lcore=%u) RTP session %d done\n",
+                        __func__, sched->lcore, rtp_sess->session_id);
+                nspk_media_close(rtp_sess);
+                RTE_PER_LCORE(_rtp_sess) = NULL;
+                sched_remove(sched, i);
+                continue;
+            }
+            RTE_PER_LCORE(_rtp_sess) = NULL;
+            work += ret;
+            i++;
+        }
+
+        // Packets due on any stream of the lcore leave in one burst.
+        work += nspk_tldk_lcore_rx();
+        work += nspk_udp_lcore_run();
+        work += nspk_pacer_lcore_run();
+        nspk_rtcp_lcore_run();
+        nspk_tldk_lcore_flush();
+
+        sched->rounds++;
+        if (!work)
+            sched->idle_rounds++;
+    }
+
+    RTE_PER_LCORE(_sched) = NULL;
+    RTE_LOG(NOTICE, USER1, "%s(lcore=%u) %"PRIu64" rounds, %"PRIu64" idle\n",
+            __func__, sched->lcore, sched->rounds, sched->idle_rounds);
+    return failed;
+}
@@ -1,5 +1,13 @@
 #include <nspk.h>
 #include <tldk_utils/udp.h>
+#include <tldk_utils/lcore.h>
+#include <tldk_utils/mcast.h>
+
+struct nspk_tldk_flush_prm nspk_tldk_flush_prm = {
+    .hwm = NSPK_TLDK_FLUSH_HWM,
+    .delay_us = NSPK_TLDK_FLUSH_DELAY_US,
+    .marker = 1,
+};
 
 void print_stream_addresses(struct netfe_sprm *sprm)
 {
@@ -33,63 +41,580 @@ static int nspk_udp_av_to_tldk(UDPTldkContext *udp_ctx, struct netfe_sprm *sprm)
     return 0;
 }
 
+int nspk_tldk_sockaddr_fill(struct sockaddr_storage *ss, const char *host, int port)
+{
+    struct sockaddr_in *in4 = (struct sockaddr_in *)ss;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)ss;
+
+    memset(ss, 0, sizeof(*ss));
+    if (host == NULL || host[0] == '\0') {
+        in4->sin_family = AF_INET;
+        in4->sin_addr.s_addr = INADDR_ANY;
+        in4->sin_port = htons(port);
+        return 0;
+    }
+    if (inet_pton(AF_INET, host, &in4->sin_addr) == 1) {
+        in4->sin_family = AF_INET;
+        in4->sin_port = htons(port);
+        return 0;
+    }
+    if (inet_pton(AF_INET6, host, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        return 0;
+    }
+
+    av_log(NULL, AV_LOG_ERROR, "%s: '%s' is not a numeric IPv4/IPv6 address\n",
+           __func__, host);
+    return -EINVAL;
+}
+
+int nspk_tldk_sockaddr_get_port(const struct sockaddr_storage *ss)
+{
+    if (ss->ss_family == AF_INET6)
+        return ntohs(((const struct sockaddr_in6 *)ss)->sin6_port);
+    return ntohs(((const struct sockaddr_in *)ss)->sin_port);
+}
+
+void nspk_tldk_sockaddr_set_port(struct sockaddr_storage *ss, int port)
+{
+    if (ss->ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)ss)->sin6_port = htons(port);
+    else
+        ((struct sockaddr_in *)ss)->sin_port = htons(port);
+}
+
+int nspk_tldk_port_owned(const struct netbe_lcore *lc, uint16_t port)
+{
+    uint32_t i;
+
+    if (lc == NULL || lc->prtq_num == 0)
+        return 0;
+    for (i = 0; i != lc->prtq_num; i++) {
+        if (!verify_queue_for_port(lc->prtq + i, port))
+            return 0;
+    }
+    return 1;
+}
+
+struct netfe_stream *nspk_tldk_udp_stream_open(struct lcore_prm *lcore_prm,
+                                               struct netfe_sprm *sprm, uint16_t op)
+{
+    struct netfe_lcore *fe = RTE_PER_LCORE(_fe);
+    struct netfe_stream *fs;
+    uint32_t lcore = rte_lcore_id();
+    int bidx;
+
+    if (fe == NULL || lcore_prm == NULL || sprm == NULL) {
+        rte_errno = EINVAL;
+        return NULL;
+    }
+
+    if (fe->use.num >= lcore_prm->fe.max_streams) {
+        av_log(NULL, AV_LOG_ERROR, "%s: Number of streams has reached its max: %u/%u\n", __func__,
+               fe->use.num, lcore_prm->fe.max_streams);
+        rte_errno = ENOBUFS;
+        return NULL;
+    }
+
+    // The BE of this lcore serves every stream the lcore opens.
+    bidx = netbe_find(&sprm->local_addr, &sprm->remote_addr, lcore);
+    if (bidx < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: No BE found for lcore %u\n", __func__, lcore);
+        rte_errno = -bidx;
+        return NULL;
+    }
+    sprm->bidx = bidx;
+    print_stream_addresses(sprm);
+
+    fs = netfe_stream_open_udp(fe, sprm, lcore, op, sprm->bidx);
+    if (fs == NULL) {
+        av_log(NULL, AV_LOG_FATAL, "%s: netfe_stream_open_udp failed\n", __func__);
+        return NULL;
+    }
+    fs->raddr = sprm->remote_addr;
+    fs->laddr = sprm->local_addr;
+    pkt_mag_init(&fs->mag, mpool[rte_lcore_to_socket_id(lcore) + 1], NSPK_MBUF_TX_HEADROOM, NULL, 0);
+    netfe_put_stream(fe, &fe->use, fs);
+
+    return fs;
+}
+
 // TODO:
 // This function should create a new TLDK stream and add it to
 // stream list at `g_stream_list`.
 int nspk_tldk_udp_stream_new(UDPTldkContext *udp_ctx)
 {
-    struct netfe_lcore *fe = RTE_PER_LCORE(_fe);
-    struct lcore_prm *lcore_prm = g_rtp_sess->lcore_prm;
+    struct nspk_rtp_session_ctx_t *rtp_sess = RTE_PER_LCORE(_rtp_sess);
 
     if (!udp_ctx)
         return -EINVAL;
+    // Only sessions stepped by the lcore scheduler may open TLDK streams.
+    if (!rtp_sess)
+        return -EPERM;
 
     // Copy UDP connection info from UDPTldkContext to TLDK FE stream.
+    nspk_udp_av_to_tldk(udp_ctx, &udp_ctx->tldk_stream_prm);
+
+    av_log(NULL, AV_LOG_DEBUG, "%s: Calling nspk_tldk_udp_stream_open\n", __func__);
+    udp_ctx->tldk_udp_stream = nspk_tldk_udp_stream_open(rtp_sess->lcore_prm, &udp_ctx->tldk_stream_prm,
+                                                         udp_ctx->is_output ? TXONLY : RXONLY);
+    if (udp_ctx->tldk_udp_stream == NULL) {
+        av_log(NULL, AV_LOG_FATAL, "%s: nspk_tldk_udp_stream_open failed\n", __func__);
+        return -rte_errno;
+    }
+
+    return 0;
+}
+
+/**
+ * Run the TX side of the BE of the calling lcore only.
+ */
+static void be_tx(void)
+{
+    struct netbe_lcore *lc = RTE_PER_LCORE(_be);
+    uint32_t i;
+
+    if (lc == NULL)
+        return;
+
+    for (i = 0; i != lc->prtq_num; i++)
+        netbe_tx(lc, i);
+}
+
+void nspk_tldk_udp_stream_flush(struct netfe_stream *fs)
+{
+    // TODO: Implement return values for these function.
+    netfe_tx_process_udp(rte_lcore_id(), fs);
+    be_tx();
+}
+
+/**
+ * Apply the flush policy to a stream whose last queued packet is m.
+ */
+static void stream_tx_queued(struct netfe_stream *fs, const struct rte_mbuf *m)
+{
+    const struct nspk_tldk_flush_prm *prm = &nspk_tldk_flush_prm;
+    const uint8_t *rtp = rte_pktmbuf_mtod(m, const uint8_t *);
+    uint64_t now = rte_rdtsc();
+
+    if (fs->pbuf.num == 1)
+        fs->tx_deadline = now + (uint64_t)prm->delay_us * rte_get_tsc_hz() / US_PER_S;
+
+    // RTCP packets have the bit set as well, they are worth sending at once too.
+    if (fs->pbuf.num >= prm->hwm ||
+        (prm->marker && m->data_len >= 2 && (rtp[0] >> 6) == 2 && (rtp[1] & 0x80)) ||
+        (prm->delay_us && now >= fs->tx_deadline))
+        nspk_tldk_udp_stream_flush(fs);
+}
+
+/**
+ * Take a FE stream for TLDK TCP, its rxev on rxeq, its erev on the error queue
+ * and, unless txeq is NULL, its txev on txeq.
+ */
+static struct netfe_stream *tcp_stream_get(struct netfe_lcore *fe, struct tle_evq *rxeq,
+                                           struct tle_evq *txeq)
+{
+    struct netfe_stream *fs;
+    uint32_t lcore = rte_lcore_id();
+
+    fs = netfe_get_stream(&fe->free);
+    if (fs == NULL) {
+        rte_errno = ENOBUFS;
+        return NULL;
+    }
+
+    pkt_mag_init(&fs->mag, mpool[rte_lcore_to_socket_id(lcore) + 1], NSPK_MBUF_TX_HEADROOM, NULL, 0);
+    fs->rxev = tle_event_alloc(rxeq, fs);
+    fs->erev = tle_event_alloc(fe->ereq, fs);
+    fs->txev = txeq ? tle_event_alloc(txeq, fs) : NULL;
+    if (fs->rxev == NULL || fs->erev == NULL || (txeq && fs->txev == NULL)) {
+        tle_event_free(fs->rxev);
+        tle_event_free(fs->erev);
+        tle_event_free(fs->txev);
+        memset(fs, 0, sizeof(*fs));
+        netfe_put_stream(fe, &fe->free, fs);
+        rte_errno = ENOMEM;
+        return NULL;
+    }
+    tle_event_active(fs->rxev, TLE_SEV_DOWN);
+    tle_event_active(fs->erev, TLE_SEV_DOWN);
+    if (fs->txev)
+        tle_event_active(fs->txev, TLE_SEV_DOWN);
+
+    fs->op = RXTX;
+    fs->proto = TLE_PROTO_TCP;
+    return fs;
+}
+
+static void tcp_stream_put(struct netfe_lcore *fe, struct netfe_stream *fs)
+{
+    tle_event_free(fs->rxev);
+    tle_event_free(fs->erev);
+    tle_event_free(fs->txev);
+    pkt_mag_fini(&fs->mag);
+    memset(fs, 0, sizeof(*fs));
+    netfe_put_stream(fe, &fe->free, fs);
+}
+
+/**
+ * Hand the pending mbufs of a TCP stream to its send buffer, in order.
+ */
+static void tcp_stream_push(struct netfe_stream *fs)
+{
+    struct pkt_buf *pb = &fs->pbuf;
+    uint32_t i, k;
+
+    k = tle_tcp_stream_send(fs->s, pb->pkt, pb->num);
+    if (k == 0)
+        return;
+
+    fs->stat.txp += k;
+    for (i = k; i != pb->num; i++)
+        pb->pkt[i - k] = pb->pkt[i];
+    pb->num -= k;
+}
+
+struct netfe_stream *nspk_tldk_tcp_stream_listen(struct lcore_prm *lcore_prm, struct netfe_sprm *sprm)
+{
+    struct netfe_lcore *fe = RTE_PER_LCORE(_fe);
+    struct netbe_lcore *lc = RTE_PER_LCORE(_be);
+    struct tle_tcp_stream_param tprm;
+    struct netfe_stream *fs;
+    int rc;
+
+    if (fe == NULL || lcore_prm == NULL || sprm == NULL) {
+        rte_errno = EINVAL;
+        return NULL;
+    }
+    if (fe->syneq == NULL || lc == NULL || lc->tcp_ctx == NULL) {
+        rte_errno = ENOTSUP;
+        return NULL;
+    }
     if (fe->use.num >= lcore_prm->fe.max_streams) {
         av_log(NULL, AV_LOG_ERROR, "%s: Number of streams has reached its max: %u/%u\n", __func__,
                fe->use.num, lcore_prm->fe.max_streams);
-        return -ENOMEM;
+        rte_errno = ENOBUFS;
+        return NULL;
     }
-    udp_ctx->tldk_stream_prm = &lcore_prm->fe.stream[fe->use.num].sprm;
-    nspk_udp_av_to_tldk(udp_ctx, udp_ctx->tldk_stream_prm);
 
-    av_log(NULL, AV_LOG_DEBUG, "%s: Calling netfe_stream_open_udp\n", __func__);
-    udp_ctx->tldk_udp_stream = netfe_lcore_init_udp(&lcore_prm->fe);
-    if (udp_ctx->tldk_udp_stream == NULL) {
-        av_log(NULL, AV_LOG_FATAL, "%s: netfe_lcore_init_udp failed\n", __func__);
-        return -rte_errno;
+    fs = tcp_stream_get(fe, fe->syneq, NULL);
+    if (fs == NULL)
+        return NULL;
+
+    memset(&tprm, 0, sizeof(tprm));
+    tprm.addr.local = sprm->local_addr;
+    tprm.addr.remote = sprm->remote_addr;
+    tprm.cfg.recv_ev = fs->rxev;
+    tprm.cfg.err_ev = fs->erev;
+    fs->s = tle_tcp_stream_open(lc->tcp_ctx, &tprm);
+    if (fs->s == NULL) {
+        rc = rte_errno;
+        av_log(NULL, AV_LOG_ERROR, "%s: tle_tcp_stream_open failed on port %d: %s\n", __func__,
+               nspk_tldk_sockaddr_get_port(&sprm->local_addr), rte_strerror(rc));
+        tcp_stream_put(fe, fs);
+        rte_errno = rc;
+        return NULL;
+    }
+    rc = tle_tcp_stream_listen(fs->s);
+    if (rc != 0) {
+        tle_tcp_stream_close(fs->s);
+        tcp_stream_put(fe, fs);
+        rte_errno = -rc;
+        return NULL;
     }
 
-    return 0;
+    fs->family = sprm->local_addr.ss_family;
+    fs->laddr = sprm->local_addr;
+    fs->raddr = sprm->remote_addr;
+    netfe_put_stream(fe, &fe->use, fs);
+    return fs;
+}
+
+uint32_t nspk_tldk_tcp_stream_accept(struct lcore_prm *lcore_prm, struct netfe_stream *ls,
+                                     struct netfe_stream *fs[], uint32_t num)
+{
+    struct netfe_lcore *fe = RTE_PER_LCORE(_fe);
+    struct tle_stream *rs[MAX_PKT_BURST];
+    struct tle_tcp_stream_cfg prm[MAX_PKT_BURST];
+    struct tle_tcp_stream_addr addr;
+    uint32_t i, k, n;
+
+    n = tle_tcp_stream_accept(ls->s, rs, RTE_MIN(num, RTE_DIM(rs)));
+    for (k = 0; k != n; k++) {
+        if (fe->use.num >= lcore_prm->fe.max_streams)
+            break;
+        fs[k] = tcp_stream_get(fe, fe->rxeq, fe->tcp_txeq);
+        if (fs[k] == NULL)
+            break;
+
+        fs[k]->s = rs[k];
+        fs[k]->family = ls->family;
+        tle_tcp_stream_get_addr(rs[k], &addr);
+        fs[k]->laddr = addr.local;
+        fs[k]->raddr = addr.remote;
+        netfe_put_stream(fe, &fe->use, fs[k]);
+
+        memset(&prm[k], 0, sizeof(prm[k]));
+        prm[k].recv_ev = fs[k]->rxev;
+        prm[k].err_ev = fs[k]->erev;
+        prm[k].send_ev = fs[k]->txev;
+    }
+
+    // Events of data which came in with the handshake are raised here.
+    i = tle_tcp_stream_update_cfg(rs, prm, k);
+    if (i != k)
+        av_log(NULL, AV_LOG_ERROR, "%s: tle_tcp_stream_update_cfg failed for %u streams\n",
+               __func__, k - i);
+    tle_tcp_stream_close_bulk(rs + k, n - k);
+
+    fe->tcp_stat.acc += k;
+    fe->tcp_stat.rej += n - k;
+    return k;
+}
+
+int nspk_tldk_tcp_stream_send_mbuf(struct netfe_stream *fs, struct rte_mbuf *m)
+{
+    struct pkt_buf *pb = &fs->pbuf;
+    uint32_t len = m->pkt_len;
+
+    if (pb->num == RTE_DIM(pb->pkt)) {
+        tcp_stream_push(fs);
+        if (pb->num == RTE_DIM(pb->pkt))
+            return -ENOBUFS;
+    }
+
+    pb->pkt[pb->num++] = m;
+    fs->stat.txb += len;
+    tcp_stream_push(fs);
+    return len;
+}
+
+void nspk_tldk_tcp_stream_close(struct netfe_stream *fs)
+{
+    struct netfe_lcore *fe = RTE_PER_LCORE(_fe);
+    uint32_t i;
+
+    if (fe == NULL || fs == NULL)
+        return;
+
+    tcp_stream_push(fs);
+    for (i = 0; i != fs->pbuf.num; i++)
+        rte_pktmbuf_free(fs->pbuf.pkt[i]);
+    fs->stat.drops += fs->pbuf.num;
+    fs->pbuf.num = 0;
+
+    netfe_stream_dump(fs, &fs->laddr, &fs->raddr);
+    netfe_rem_stream(&fe->use, fs);
+    // No event of the stream may fire once it is back in the pool.
+    tle_event_idle(fs->rxev);
+    tle_event_idle(fs->erev);
+    if (fs->txev)
+        tle_event_idle(fs->txev);
+    tle_tcp_stream_close(fs->s);
+    tcp_stream_put(fe, fs);
+}
+
+void nspk_tldk_lcore_flush(void)
+{
+    struct netfe_lcore *fe = RTE_PER_LCORE(_fe);
+    struct netfe_stream *fs;
+    uint32_t lcore = rte_lcore_id();
+    uint64_t now;
+
+    if (fe == NULL)
+        return;
+
+    now = rte_rdtsc();
+    LIST_FOREACH(fs, &fe->use.head, link) {
+        if (fs->pbuf.num == 0)
+            continue;
+        // TCP streams only keep what their send buffer did not take.
+        if (fs->proto == TLE_PROTO_TCP)
+            tcp_stream_push(fs);
+        else if (now >= fs->tx_deadline)
+            netfe_tx_process_udp(lcore, fs);
+    }
+    netbe_lcore();
+}
+
+uint32_t nspk_tldk_lcore_rx(void)
+{
+    struct netfe_lcore *fe = RTE_PER_LCORE(_fe);
+    struct netfe_stream *fs[MAX_PKT_BURST];
+    uint32_t i, k, n = 0;
+
+    if (fe == NULL)
+        return 0;
+
+    k = tle_evq_get(fe->rxeq, (const void **)(uintptr_t)fs, RTE_DIM(fs));
+    for (i = 0; i != k; i++) {
+        if (fs[i]->rx_cb != NULL)
+            n += fs[i]->rx_cb(fs[i]);
+    }
+
+    if (fe->syneq == NULL)
+        return n;
+
+    // Listening streams have their rxev on the SYN queue.
+    k = tle_evq_get(fe->syneq, (const void **)(uintptr_t)fs, RTE_DIM(fs));
+    for (i = 0; i != k; i++) {
+        if (fs[i]->rx_cb != NULL)
+            n += fs[i]->rx_cb(fs[i]);
+    }
+
+    // Room in the send buffers: what is still queued goes first, then the owner may send more.
+    k = tle_evq_get(fe->tcp_txeq, (const void **)(uintptr_t)fs, RTE_DIM(fs));
+    for (i = 0; i != k; i++) {
+        if (fs[i]->pbuf.num != 0)
+            tcp_stream_push(fs[i]);
+        if (fs[i]->send_cb != NULL)
+            fs[i]->send_cb(fs[i]);
+    }
+
+    // Resets and FINs, the callback closes the stream.
+    k = tle_evq_get(fe->ereq, (const void **)(uintptr_t)fs, RTE_DIM(fs));
+    for (i = 0; i != k; i++) {
+        if (fs[i]->err_cb != NULL)
+            fs[i]->err_cb(fs[i]);
+        n++;
+    }
+    return n;
+}
+
+void nspk_tldk_udp_stream_close(struct netfe_stream *fs)
+{
+    struct netfe_lcore *fe = RTE_PER_LCORE(_fe);
+    uint32_t i;
+
+    if (fe == NULL || fs == NULL)
+        return;
+
+    nspk_tldk_udp_stream_flush(fs);
+
+    // Whatever TLDK did not take goes down with the stream.
+    for (i = 0; i != fs->pbuf.num; i++)
+        pkt_mag_put(&fs->mag, fs->pbuf.pkt[i]);
+    fs->stat.drops += fs->pbuf.num;
+    fs->pbuf.num = 0;
+
+    netfe_stream_dump(fs, &fs->laddr, &fs->raddr);
+    netfe_rem_stream(&fe->use, fs);
+    netfe_stream_close(fe, fs);
+}
+
+int nspk_tldk_mcast_join(const struct sockaddr_storage *group,
+                         const IPSourceFilters *filters)
+{
+    struct netbe_lcore *lc = RTE_PER_LCORE(_be);
+    struct in_addr src[NETBE_MCAST_MAX_SRC];
+    const struct sockaddr_storage *list;
+    uint32_t mode;
+    int i, n;
+
+    if (group->ss_family != AF_INET)
+        return -ENOSYS;
+
+    // One list only, the kernel does not mix them on a socket either.
+    if (filters && filters->nb_include_addrs) {
+        mode = NETBE_MCAST_INCLUDE;
+        list = filters->include_addrs;
+        n = filters->nb_include_addrs;
+    } else {
+        mode = NETBE_MCAST_EXCLUDE;
+        list = filters ? filters->exclude_addrs : NULL;
+        n = filters ? filters->nb_exclude_addrs : 0;
+    }
+    if (n > NETBE_MCAST_MAX_SRC)
+        return -E2BIG;
+    for (i = 0; i != n; i++) {
+        if (list[i].ss_family != AF_INET)
+            return -EINVAL;
+        src[i] = ((const struct sockaddr_in *)&list[i])->sin_addr;
+    }
+
+    return netbe_mcast_join(lc, &((const struct sockaddr_in *)group)->sin_addr,
+                            mode, src, n);
+}
+
+int nspk_tldk_mcast_leave(const struct sockaddr_storage *group)
+{
+    if (group->ss_family != AF_INET)
+        return -ENOSYS;
+    return netbe_mcast_leave(RTE_PER_LCORE(_be),
+                             &((const struct sockaddr_in *)group)->sin_addr);
+}
+
+int nspk_tldk_udp_stream_send_mbuf(struct netfe_stream *fs, struct rte_mbuf *m)
+{
+    struct pkt_buf *pb = &fs->pbuf;
+    uint32_t len = m->pkt_len;
+
+    // The pkt_buf must never overflow, push out what is queued first.
+    if (pb->num == RTE_DIM(pb->pkt)) {
+        nspk_tldk_udp_stream_flush(fs);
+        if (pb->num == RTE_DIM(pb->pkt))
+            return -ENOBUFS;
+    }
+
+    pb->pkt[pb->num++] = m;
+    // m belongs to TLDK once flushed.
+    stream_tx_queued(fs, m);
+
+    return len;
+}
+
+int nspk_tldk_udp_stream_queue_mbuf(struct netfe_stream *fs, struct rte_mbuf *m)
+{
+    struct pkt_buf *pb = &fs->pbuf;
+    uint32_t len = m->pkt_len;
+
+    if (pb->num == RTE_DIM(pb->pkt)) {
+        nspk_tldk_udp_stream_flush(fs);
+        if (pb->num == RTE_DIM(pb->pkt))
+            return -ENOBUFS;
+    }
+
+    pb->pkt[pb->num++] = m;
+    // Due at once, nspk_tldk_lcore_flush() pushes it with the rest of the round.
+    fs->tx_deadline = 0;
+
+    return len;
 }
 
 int nspk_tldk_udp_stream_send(UDPTldkContext *udp_ctx, void *data, int dlen)
 {
-    static const uint32_t FLUSH_THRESHOLD = 128;
+    struct netfe_stream *fs = udp_ctx->tldk_udp_stream;
     int ret = 0;
 
-    ret = pkt_buf_fill_data(rte_lcore_id(), &udp_ctx->tldk_udp_stream->pbuf, data, dlen);
+    if (fs->pbuf.num == RTE_DIM(fs->pbuf.pkt)) {
+        nspk_tldk_udp_stream_flush(fs);
+        if (fs->pbuf.num == RTE_DIM(fs->pbuf.pkt))
+            return -ENOBUFS;
+    }
+
+    ret = pkt_buf_fill_data(&fs->mag, &fs->pbuf, data, dlen);
     if (ret < 0) {
         av_log(NULL, AV_LOG_DEBUG, "%s: pkt_buf_fill_data failed, ret=%d\n", __func__, ret);
         return ret;
     }
 
-    // Flush
-    if (udp_ctx->tldk_udp_stream->pbuf.num >= FLUSH_THRESHOLD) {
-        // TODO: Implement return values for these function.
-        netfe_tx_process_udp(rte_lcore_id(), udp_ctx->tldk_udp_stream);
-	    netbe_lcore();
-    }
+    stream_tx_queued(fs, fs->pbuf.pkt[fs->pbuf.num - 1]);
 
     return ret;
 }
 
 int nspk_tldk_udp_stream_recv(UDPTldkContext *udp_ctx, void *data, int *dlen)
 {
-    return 0;    
+    return 0;
 }
 
 int nspk_tldk_udp_stream_delete(UDPTldkContext *udp_ctx)
 {
+    if (!udp_ctx)
+        return -EINVAL;
+
+    nspk_tldk_udp_stream_close(udp_ctx->tldk_udp_stream);
+    udp_ctx->tldk_udp_stream = NULL;
     return 0;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <nspk.h>
 #include <tldk_utils/parse.h>
+#include <tldk_utils/mcast.h>
+#include <tldk_utils/tcp.h>
 
 void
 sig_handle(int signum)
@@ -146,6 +148,7 @@ netfe_stream_close(struct netfe_lcore *fe, struct netfe_stream *fes)
 	tle_event_free(fes->txev);
 	tle_event_free(fes->rxev);
 	tle_event_free(fes->erev);
+	pkt_mag_fini(&fes->mag);
 	memset(fes, 0, sizeof(*fes));
 	netfe_put_stream(fe, &fe->free, fes);
 }
@@ -209,33 +212,106 @@ pkt_buf_fill(uint32_t lcore, struct pkt_buf *pb, uint32_t dlen)
 
 
 int
-pkt_buf_fill_data(uint32_t lcore, struct pkt_buf *pb, void *data, int dlen)
+pkt_buf_fill_data(struct pkt_mag *mg, struct pkt_buf *pb, void *data,
+	int dlen)
 {
-	// @dlen -> fe.cfg -> "txlen=xx"
-	uint32_t i;
-	int32_t sid;
-	static bool mbuf_init = false;
-	char *app_data = NULL;
+	struct rte_mbuf *m;
 
 	if (!data || !dlen)
-		return EINVAL;
+		return -EINVAL;
 
-	sid = rte_lcore_to_socket_id(lcore) + 1;
-	i = pb->num;
-	pb->pkt[i] = rte_pktmbuf_alloc(mpool[sid]);
-	if (pb->pkt[i] == NULL)
-		return ENOMEM;
-	// Appends dlen uninitialized bytes to the data section of the pkt[i] mbuf.
-	rte_pktmbuf_append(pb->pkt[i], dlen);
-	app_data = rte_pktmbuf_mtod(pb->pkt[i], char*);
-
-	// snprintf(app_data, dlen, "Hello from DPDK UDP.\r\n");
-	memcpy(app_data, data, dlen);
-
-	pb->num++;
+	m = pkt_mag_get(mg);
+	if (m == NULL)
+		return -ENOMEM;
+	if (dlen > rte_pktmbuf_tailroom(m)) {
+		pkt_mag_put(mg, m);
+		return -EINVAL;
+	}
+
+	memcpy(rte_pktmbuf_mtod(m, void *), data, dlen);
+	m->data_len = dlen;
+	m->pkt_len = dlen;
+
+	pb->pkt[pb->num++] = m;
 	return dlen;
 }
 
+static inline void
+pkt_mag_prep(struct pkt_mag *mg, struct rte_mbuf *m)
+{
+	m->data_off = mg->data_off;
+	if (mg->tmpl_len != 0)
+		memcpy(rte_pktmbuf_mtod(m, void *), mg->tmpl, mg->tmpl_len);
+}
+
+void
+pkt_mag_init(struct pkt_mag *mg, struct rte_mempool *mp, uint16_t data_off,
+	const void *tmpl, uint16_t tmpl_len)
+{
+	RTE_ASSERT(tmpl_len <= sizeof(mg->tmpl));
+
+	memset(mg, 0, sizeof(*mg));
+	mg->mp = mp;
+	mg->data_off = data_off;
+	mg->tmpl_len = RTE_MIN(tmpl_len, (uint16_t)sizeof(mg->tmpl));
+	if (tmpl != NULL)
+		memcpy(mg->tmpl, tmpl, mg->tmpl_len);
+	else
+		mg->tmpl_len = 0;
+}
+
+uint32_t
+pkt_mag_refill(struct pkt_mag *mg)
+{
+	uint32_t i, n;
+
+	n = RTE_MIN((uint32_t)PKT_MAG_BATCH, PKT_MAG_SIZE - mg->num);
+	if (mg->mp == NULL || n == 0 ||
+			rte_pktmbuf_alloc_bulk(mg->mp, mg->pkt + mg->num, n) != 0)
+		return 0;
+
+	for (i = mg->num; i != mg->num + n; i++)
+		pkt_mag_prep(mg, mg->pkt[i]);
+
+	mg->num += n;
+	return n;
+}
+
+/*
+ * Give back an mbuf the caller no longer needs. It is reset and kept
+ * for reuse, a full magazine returns a batch to the mempool first.
+ */
+void
+pkt_mag_put(struct pkt_mag *mg, struct rte_mbuf *m)
+{
+	if (m->next != NULL || m->pool != mg->mp) {
+		rte_pktmbuf_free(m);
+		return;
+	}
+
+	m = rte_pktmbuf_prefree_seg(m);
+	if (m == NULL)
+		return;
+
+	if (mg->num == PKT_MAG_SIZE) {
+		mg->num -= PKT_MAG_BATCH;
+		rte_mempool_put_bulk(mg->mp, (void **)(mg->pkt + mg->num),
+			PKT_MAG_BATCH);
+	}
+
+	rte_pktmbuf_reset(m);
+	pkt_mag_prep(mg, m);
+	mg->pkt[mg->num++] = m;
+}
+
+void
+pkt_mag_fini(struct pkt_mag *mg)
+{
+	if (mg->num != 0)
+		rte_mempool_put_bulk(mg->mp, (void **)mg->pkt, mg->num);
+	mg->num = 0;
+}
+
 int
 netbe_lcore_setup(struct netbe_lcore *lc)
 {
@@ -266,6 +342,10 @@ netbe_lcore_setup(struct netbe_lcore *lc)
 			becfg.arp);
 		if (rc < 0)
 			return rc;
+
+		if (lc->proto == TLE_PROTO_UDP)
+			rc = netbe_mcast_setup_rx_cb(&lc->prtq[i].port, lc,
+				lc->prtq[i].rxqid);
 	}
 
 	if (rc == 0)
@@ -310,6 +390,8 @@ netbe_lcore_clear(void)
 	}
 	RTE_LOG(NOTICE, USER1, "};\n");
 
+	netbe_mcast_fini(lc);
+
 	for (i = 0; i != lc->prtq_num; i++)
 		for (j = 0; j != lc->prtq[i].tx_buf.num; j++)
 			rte_pktmbuf_free(lc->prtq[i].tx_buf.pkt[j]);
@@ -537,6 +619,44 @@ send_arp_reply(struct netbe_dev *dev, struct pkt_buf *pb)
 	pb->num = 0;
 }
 
+/*
+ * Hand the packets the UDP context did not take to the TCP one.
+ * Returns the number of packets left in rp[].
+ */
+static uint32_t
+netbe_rx_tcp(struct netbe_lcore *lc, uint32_t pidx, struct rte_mbuf *rp[],
+	uint32_t num)
+{
+	uint32_t i, k, n, x;
+	struct rte_mbuf *pkt[MAX_PKT_BURST];
+	struct rte_mbuf *trp[MAX_PKT_BURST];
+	int32_t rc[MAX_PKT_BURST];
+
+	netbe_pkt_tcp_hdr_len(rp, num);
+
+	n = 0;
+	x = 0;
+	for (i = 0; i != num; i++) {
+		if ((rp[i]->packet_type & RTE_PTYPE_L4_MASK) ==
+				RTE_PTYPE_L4_TCP)
+			pkt[n++] = rp[i];
+		else
+			rp[x++] = rp[i];
+	}
+
+	if (n == 0)
+		return x;
+
+	k = tle_tcp_rx_bulk(lc->prtq[pidx].tcp_dev, pkt, trp, rc, n);
+	NETBE_TRACE("%s(%u): tle_tcp_rx_bulk(%p, %u) returns %u\n",
+		__func__, lc->id, lc->prtq[pidx].tcp_dev, n, k);
+
+	for (i = 0; i != n - k; i++)
+		rp[x++] = trp[i];
+
+	return x;
+}
+
 void
 netbe_rx(struct netbe_lcore *lc, uint32_t pidx)
 {
@@ -556,13 +676,16 @@ netbe_rx(struct netbe_lcore *lc, uint32_t pidx)
 			lc->prtq[pidx].rxqid, n);
 
 		k = tle_rx_bulk(lc->prtq[pidx].dev, pkt, rp, rc, n);
-
-		lc->prtq[pidx].rx_stat.up += k;
-		lc->prtq[pidx].rx_stat.drop += n - k;
 		NETBE_TRACE("%s(%u): tle_%s_rx_bulk(%p, %u) returns %u\n",
 			__func__, lc->id, proto_name[lc->proto],
 			lc->prtq[pidx].dev, n, k);
 
+		if (lc->tcp_ctx != NULL && k != n)
+			k = n - netbe_rx_tcp(lc, pidx, rp, n - k);
+
+		lc->prtq[pidx].rx_stat.up += k;
+		lc->prtq[pidx].rx_stat.drop += n - k;
+
 		for (j = 0; j != n - k; j++) {
 			NETBE_TRACE("%s:%d(port=%u) rp[%u]={%p, %d};\n",
 				__func__, __LINE__, lc->prtq[pidx].port.id,
@@ -594,6 +717,13 @@ netbe_tx(struct netbe_lcore *lc, uint32_t pidx)
 		j = tle_tx_bulk(lc->prtq[pidx].dev, mb + n, k);
 		n += j;
 		lc->prtq[pidx].tx_stat.down += j;
+
+		if (lc->tcp_ctx != NULL && k != j) {
+			j = tle_tcp_tx_bulk(lc->prtq[pidx].tcp_dev, mb + n,
+				k - j);
+			n += j;
+			lc->prtq[pidx].tx_stat.down += j;
+		}
 	}
 
 	if (n == 0)
@@ -637,6 +767,8 @@ netbe_lcore(void)
 		__func__, lc->prtq_num);
 	for (i = 0; i != lc->prtq_num; i++) {
 		netbe_rx(lc, i); // TODO: Need to understand why receive? Except ARP.
+		if (lc->tcp_ctx != NULL)
+			tle_tcp_process(lc->tcp_ctx, TCP_MAX_PROCESS);
 		netbe_tx(lc, i);
 	}
 }
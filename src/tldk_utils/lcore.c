@@ -1,4 +1,5 @@
 #include <tldk_utils/lcore.h>
+#include <tldk_utils/mcast.h>
 
 /*
  * IPv4 destination lookup callback.
@@ -19,6 +20,10 @@ lpm4_dst_lookup(void *data, __rte_unused uint64_t sdata,
 		dst = &lc->dst4[idx];
 		rte_memcpy(res, dst, dst->l2_len + dst->l3_len +
 			offsetof(struct tle_dest, hdr));
+		/* groups go out to their own MAC, over the route to them. */
+		if (RTE_IS_IPV4_MCAST(rte_be_to_cpu_32(addr->s_addr)))
+			netbe_mcast_ether_addr(addr->s_addr,
+				&((struct rte_ether_hdr *)res->hdr)->dst_addr);
 	}
 	return rc;
 }
@@ -48,6 +53,63 @@ lpm6_dst_lookup(void *data, __rte_unused uint64_t sdata,
 	return rc;
 }
 
+/*
+ * The routes of the lcore are set up for its UDP context: the TCP one
+ * takes their header template with its own protocol and device.
+ */
+static void
+tcp_dst_fixup(struct netbe_lcore *lc, struct tle_dest *res)
+{
+	uint32_t i;
+	struct rte_ipv4_hdr *ip4h;
+	struct rte_ipv6_hdr *ip6h;
+
+	for (i = 0; i != lc->prtq_num; i++) {
+		if (lc->prtq[i].dev == res->dev) {
+			res->dev = lc->prtq[i].tcp_dev;
+			break;
+		}
+	}
+
+	if (res->l3_len == sizeof(*ip4h)) {
+		ip4h = (struct rte_ipv4_hdr *)(res->hdr + res->l2_len);
+		ip4h->next_proto_id = IPPROTO_TCP;
+	} else {
+		ip6h = (struct rte_ipv6_hdr *)(res->hdr + res->l2_len);
+		ip6h->proto = IPPROTO_TCP;
+	}
+}
+
+/*
+ * IPv4 destination lookup callback of the TCP context of a UDP lcore.
+ */
+static int
+lpm4_tcp_dst_lookup(void *data, uint64_t sdata,
+	const struct in_addr *addr, struct tle_dest *res)
+{
+	int32_t rc;
+
+	rc = lpm4_dst_lookup(data, sdata, addr, res);
+	if (rc == 0)
+		tcp_dst_fixup(data, res);
+	return rc;
+}
+
+/*
+ * IPv6 destination lookup callback of the TCP context of a UDP lcore.
+ */
+static int
+lpm6_tcp_dst_lookup(void *data, uint64_t sdata,
+	const struct in6_addr *addr, struct tle_dest *res)
+{
+	int32_t rc;
+
+	rc = lpm6_dst_lookup(data, sdata, addr, res);
+	if (rc == 0)
+		tcp_dst_fixup(data, res);
+	return rc;
+}
+
 int
 lcore_lpm_init(struct netbe_lcore *lc)
 {
@@ -261,6 +323,24 @@ create_context(struct netbe_lcore *lc, const struct tle_ctx_param *ctx_prm)
 
 		if (lc->ctx == NULL || lc->ftbl == NULL)
 			rc = ENOMEM;
+
+		/* TCP streams on the same queues, e.g. for RTSP. */
+		if (rc == 0 && lc->proto == TLE_PROTO_UDP &&
+				becfg.tcp_max_streams != 0) {
+			cprm.proto = TLE_PROTO_TCP;
+			cprm.max_streams = becfg.tcp_max_streams;
+			cprm.lookup4 = lpm4_tcp_dst_lookup;
+			cprm.lookup6 = lpm6_tcp_dst_lookup;
+			lc->tcp_ctx = tle_ctx_create(&cprm);
+
+			RTE_LOG(NOTICE, USER1,
+				"%s(lcore=%u): proto=%s, tcp_ctx=%p;\n",
+				__func__, lc->id, proto_name[TLE_PROTO_TCP],
+				lc->tcp_ctx);
+
+			if (lc->tcp_ctx == NULL)
+				rc = ENOMEM;
+		}
 	}
 
 	return rc;
@@ -300,11 +380,26 @@ lcore_init(struct netbe_lcore *lc, const struct tle_ctx_param *ctx_prm,
 		if (lc->prtq[prtqid].dev == NULL)
 			rc = -rte_errno;
 
+		/* same blocklist, so the queue owns the same TCP ports. */
+		if (rc == 0 && lc->tcp_ctx != NULL) {
+			lc->prtq[prtqid].tcp_dev = tle_add_dev(lc->tcp_ctx,
+				&dprm);
+			RTE_LOG(NOTICE, USER1,
+				"%s(lcore=%u, port=%u, qid=%u), tcp_dev: %p\n",
+				__func__, lc->id, lc->prtq[prtqid].port.id,
+				lc->prtq[prtqid].rxqid,
+				lc->prtq[prtqid].tcp_dev);
+			if (lc->prtq[prtqid].tcp_dev == NULL)
+				rc = -rte_errno;
+		}
+
 		if (rc != 0) {
 			RTE_LOG(ERR, USER1,
 				"%s(lcore=%u) failed with error code: %d\n",
 				__func__, lc->id, rc);
 			tle_ctx_destroy(lc->ctx);
+			if (lc->tcp_ctx != NULL)
+				tle_ctx_destroy(lc->tcp_ctx);
 			rte_ip_frag_table_destroy(lc->ftbl);
 			rte_lpm_free(lc->lpm4);
 			rte_lpm6_free(lc->lpm6);
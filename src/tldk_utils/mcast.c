@@ -0,0 +1,597 @@
+#include <rte_random.h>
+#include <rte_spinlock.h>
+
+#include <nspk.h>
+#include <tldk_utils/dpdk_legacy.h>
+#include <tldk_utils/mcast.h>
+
+#define	IGMP_MIN_LEN		8
+#define	IGMP_V3_QUERY_LEN	12
+#define	IGMP_V3_REC_LEN		8
+
+#define	IGMP_QUERY		0x11
+#define	IGMP_V2_REPORT		0x16
+#define	IGMP_V2_LEAVE		0x17
+#define	IGMP_V3_REPORT		0x22
+
+#define	IGMP_MODE_IS_INCLUDE	1
+#define	IGMP_MODE_IS_EXCLUDE	2
+#define	IGMP_CHANGE_TO_INCLUDE	3
+#define	IGMP_CHANGE_TO_EXCLUDE	4
+#define	IGMP_BLOCK_OLD_SOURCES	6
+
+/* 224.0.0.2 and 224.0.0.22, host order. */
+#define	IGMP_ALL_ROUTERS	0xe0000002
+#define	IGMP_V3_ROUTERS		0xe0000016
+
+/* IPv4 header with the Router Alert option (RFC 2113). */
+#define	IGMP_IP_HDR_LEN		(sizeof(struct rte_ipv4_hdr) + 4)
+
+/* Response delay when a query does not give one, in 1/10 s. */
+#define	IGMP_DEF_MAX_RESP	100
+
+#define	MCAST_IDX_MASK		(2 * NETBE_MCAST_MAX_GROUP - 1)
+#define	MCAST_IDX_FREE		UINT16_MAX
+
+enum {
+	MCAST_SEND_CHANGE,
+	MCAST_SEND_CURRENT,
+	MCAST_SEND_LEAVE,
+};
+
+/*
+ * Multicast MAC list of a port, shared by the BE lcores of its queues.
+ * Several groups may map to one MAC, each entry is reference counted.
+ */
+static struct mcast_port {
+	rte_spinlock_t lock;
+	uint32_t num;
+	/* The list could not be set, all multicast is received. */
+	uint32_t fallback;
+	uint32_t ref[NETBE_MCAST_MAX_GROUP];
+	struct rte_ether_addr mac[NETBE_MCAST_MAX_GROUP];
+} mcast_port[RTE_MAX_ETHPORTS];
+
+void
+netbe_mcast_ether_addr(uint32_t addr, struct rte_ether_addr *mac)
+{
+	uint32_t a;
+
+	a = rte_be_to_cpu_32(addr);
+	mac->addr_bytes[0] = 0x01;
+	mac->addr_bytes[1] = 0x00;
+	mac->addr_bytes[2] = 0x5e;
+	mac->addr_bytes[3] = (a >> 16) & 0x7f;
+	mac->addr_bytes[4] = (a >> 8) & 0xff;
+	mac->addr_bytes[5] = a & 0xff;
+}
+
+static void
+mcast_port_update(uint32_t port, struct mcast_port *mp)
+{
+	int32_t rc;
+
+	if (mp->fallback != 0)
+		return;
+
+	rc = rte_eth_dev_set_mc_addr_list(port, mp->mac, mp->num);
+	if (rc == 0)
+		return;
+
+	/* no MAC filter (e.g. net_ring, net_pcap) or too many groups. */
+	mp->fallback = 1;
+	rc = rte_eth_allmulticast_enable(port);
+	if (rc != 0)
+		rc = rte_eth_promiscuous_enable(port);
+	RTE_LOG(NOTICE, USER1,
+		"%s(port=%u): multicast MAC list not supported, "
+		"%s mode returns %d;\n",
+		__func__, port,
+		(rte_eth_allmulticast_get(port) == 1) ? "allmulticast" :
+		"promiscuous", rc);
+}
+
+static void
+mcast_port_add(uint32_t port, const struct rte_ether_addr *mac)
+{
+	uint32_t i;
+	struct mcast_port *mp;
+
+	mp = mcast_port + port;
+	rte_spinlock_lock(&mp->lock);
+
+	for (i = 0; i != mp->num; i++) {
+		if (rte_is_same_ether_addr(mp->mac + i, mac))
+			break;
+	}
+
+	if (i != mp->num)
+		mp->ref[i]++;
+	else if (mp->num != RTE_DIM(mp->mac)) {
+		rte_ether_addr_copy(mac, mp->mac + mp->num);
+		mp->ref[mp->num++] = 1;
+		mcast_port_update(port, mp);
+	}
+
+	rte_spinlock_unlock(&mp->lock);
+}
+
+static void
+mcast_port_del(uint32_t port, const struct rte_ether_addr *mac)
+{
+	uint32_t i;
+	struct mcast_port *mp;
+
+	mp = mcast_port + port;
+	rte_spinlock_lock(&mp->lock);
+
+	for (i = 0; i != mp->num; i++) {
+		if (rte_is_same_ether_addr(mp->mac + i, mac))
+			break;
+	}
+
+	if (i != mp->num && --mp->ref[i] == 0) {
+		mp->num--;
+		mp->mac[i] = mp->mac[mp->num];
+		mp->ref[i] = mp->ref[mp->num];
+		mcast_port_update(port, mp);
+	}
+
+	rte_spinlock_unlock(&mp->lock);
+}
+
+static uint32_t
+mcast_hash(uint32_t addr)
+{
+	return (rte_be_to_cpu_32(addr) * 2654435761u) & MCAST_IDX_MASK;
+}
+
+static struct netbe_mcast_group *
+mcast_find(struct netbe_mcast *mc, uint32_t addr)
+{
+	uint32_t h, i, j;
+
+	h = mcast_hash(addr);
+	for (i = 0; i != RTE_DIM(mc->idx); i++, h = (h + 1) & MCAST_IDX_MASK) {
+		j = mc->idx[h];
+		if (j == MCAST_IDX_FREE)
+			return NULL;
+		if (mc->group[j].addr.s_addr == addr)
+			return mc->group + j;
+	}
+	return NULL;
+}
+
+static void
+mcast_idx_add(struct netbe_mcast *mc, uint32_t j)
+{
+	uint32_t h;
+
+	h = mcast_hash(mc->group[j].addr.s_addr);
+	while (mc->idx[h] != MCAST_IDX_FREE)
+		h = (h + 1) & MCAST_IDX_MASK;
+	mc->idx[h] = j;
+}
+
+static void
+mcast_idx_rebuild(struct netbe_mcast *mc)
+{
+	uint32_t j;
+
+	memset(mc->idx, 0xff, sizeof(mc->idx));
+	for (j = 0; j != mc->nb_group; j++)
+		mcast_idx_add(mc, j);
+}
+
+/*
+ * Build and send one IGMP message about a group from a port.
+ */
+static void
+mcast_send(struct netbe_lcore *lc, struct netbe_dev *bed,
+	const struct netbe_mcast_group *g, uint32_t what)
+{
+	uint32_t dst, i, len, with_src;
+	uint8_t *igmp;
+	struct rte_mbuf *m;
+	struct rte_ether_hdr *eth;
+	struct rte_ipv4_hdr *iph;
+
+	/*
+	 * Leaving an INCLUDE filter blocks its sources, leaving an EXCLUDE
+	 * one changes it to INCLUDE {} (RFC 3376 6.1).
+	 */
+	with_src = (what != MCAST_SEND_LEAVE ||
+		g->mode == NETBE_MCAST_INCLUDE);
+	if (g->nb_src == 0) {
+		dst = (what == MCAST_SEND_LEAVE) ?
+			rte_cpu_to_be_32(IGMP_ALL_ROUTERS) : g->addr.s_addr;
+		len = IGMP_MIN_LEN;
+	} else {
+		dst = rte_cpu_to_be_32(IGMP_V3_ROUTERS);
+		len = IGMP_MIN_LEN + IGMP_V3_REC_LEN;
+		if (with_src)
+			len += g->nb_src * sizeof(g->src[0]);
+	}
+
+	m = rte_pktmbuf_alloc(mpool[rte_lcore_to_socket_id(lc->id) + 1]);
+	if (m == NULL)
+		return;
+	eth = (struct rte_ether_hdr *)rte_pktmbuf_append(m,
+		sizeof(*eth) + IGMP_IP_HDR_LEN + len);
+	if (eth == NULL) {
+		rte_pktmbuf_free(m);
+		return;
+	}
+
+	rte_ether_addr_copy(&bed->port.mac, &eth->src_addr);
+	netbe_mcast_ether_addr(dst, &eth->dst_addr);
+	eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+	iph = (struct rte_ipv4_hdr *)(eth + 1);
+	memset(iph, 0, IGMP_IP_HDR_LEN);
+	iph->version_ihl = 4 << 4 | IGMP_IP_HDR_LEN / RTE_IPV4_IHL_MULTIPLIER;
+	iph->type_of_service = 0xc0;
+	iph->total_length = rte_cpu_to_be_16(IGMP_IP_HDR_LEN + len);
+	iph->fragment_offset = rte_cpu_to_be_16(RTE_IPV4_HDR_DF_FLAG);
+	iph->time_to_live = 1;
+	iph->next_proto_id = IPPROTO_IGMP;
+	iph->src_addr = bed->port.ipv4;
+	iph->dst_addr = dst;
+	((uint8_t *)(iph + 1))[0] = 0x94;
+	((uint8_t *)(iph + 1))[1] = 4;
+
+	igmp = (uint8_t *)iph + IGMP_IP_HDR_LEN;
+	memset(igmp, 0, len);
+	if (g->nb_src == 0) {
+		igmp[0] = (what == MCAST_SEND_LEAVE) ?
+			IGMP_V2_LEAVE : IGMP_V2_REPORT;
+		memcpy(igmp + 4, &g->addr.s_addr, sizeof(g->addr.s_addr));
+	} else {
+		igmp[0] = IGMP_V3_REPORT;
+		igmp[7] = 1;
+		if (what == MCAST_SEND_LEAVE)
+			igmp[8] = (g->mode == NETBE_MCAST_INCLUDE) ?
+				IGMP_BLOCK_OLD_SOURCES : IGMP_CHANGE_TO_INCLUDE;
+		else if (what == MCAST_SEND_CHANGE)
+			igmp[8] = (g->mode == NETBE_MCAST_INCLUDE) ?
+				IGMP_CHANGE_TO_INCLUDE : IGMP_CHANGE_TO_EXCLUDE;
+		else
+			igmp[8] = (g->mode == NETBE_MCAST_INCLUDE) ?
+				IGMP_MODE_IS_INCLUDE : IGMP_MODE_IS_EXCLUDE;
+		memcpy(igmp + 12, &g->addr.s_addr, sizeof(g->addr.s_addr));
+		if (with_src) {
+			igmp[11] = g->nb_src;
+			for (i = 0; i != g->nb_src; i++)
+				memcpy(igmp + 16 + 4 * i, &g->src[i].s_addr,
+					sizeof(g->src[i].s_addr));
+		}
+	}
+
+	*(uint16_t *)(igmp + 2) = ~rte_raw_cksum(igmp, len);
+	iph->hdr_checksum = ~rte_raw_cksum(iph, IGMP_IP_HDR_LEN);
+
+	m->l2_len = sizeof(*eth);
+	m->l3_len = IGMP_IP_HDR_LEN;
+
+	NETBE_PKT_DUMP(m);
+	if (rte_eth_tx_burst(bed->port.id, bed->txqid, &m, 1) == 0) {
+		rte_pktmbuf_free(m);
+		return;
+	}
+
+	if (what == MCAST_SEND_LEAVE)
+		lc->mcast->stat.leave++;
+	else
+		lc->mcast->stat.report++;
+}
+
+static void
+mcast_send_all(struct netbe_lcore *lc, const struct netbe_mcast_group *g,
+	uint32_t what)
+{
+	uint32_t i;
+
+	for (i = 0; i != lc->prtq_num; i++)
+		mcast_send(lc, lc->prtq + i, g, what);
+}
+
+static void mcast_timer_cb(struct rte_timer *tim, void *arg);
+
+static void
+mcast_schedule(struct netbe_lcore *lc, uint64_t ticks)
+{
+	struct netbe_mcast *mc;
+
+	mc = lc->mcast;
+	mc->next_report = rte_get_timer_cycles() + ticks;
+	rte_timer_reset(&mc->timer, ticks, SINGLE, lc->id, mcast_timer_cb, lc);
+}
+
+/*
+ * Report every group, periodically or in answer to a query.
+ */
+static void
+mcast_timer_cb(struct rte_timer *tim, void *arg)
+{
+	uint32_t j;
+	struct netbe_lcore *lc;
+	struct netbe_mcast *mc;
+
+	RTE_SET_USED(tim);
+
+	lc = arg;
+	mc = lc->mcast;
+	for (j = 0; j != mc->nb_group; j++)
+		mcast_send_all(lc, mc->group + j, MCAST_SEND_CURRENT);
+
+	mcast_schedule(lc, rte_get_timer_hz() * NETBE_MCAST_REPORT_MS /
+		MS_PER_S);
+}
+
+/*
+ * Answer a query within its max response time, one for all groups.
+ */
+static void
+mcast_igmp_input(struct netbe_lcore *lc, struct netbe_mcast *mc,
+	const uint8_t *igmp, uint32_t len)
+{
+	uint32_t code, resp;
+	uint64_t ticks;
+
+	if (igmp[0] != IGMP_QUERY)
+		return;
+	mc->stat.query++;
+
+	code = igmp[1];
+	if (code == 0)
+		resp = IGMP_DEF_MAX_RESP;
+	else if (code < 128 || len < IGMP_V3_QUERY_LEN)
+		resp = code;
+	else
+		resp = ((code & 0xf) | 0x10) << (((code >> 4) & 0x7) + 3);
+
+	ticks = rte_get_timer_hz() * resp / 10;
+	ticks = rte_rand() % (ticks + 1);
+	if (rte_get_timer_cycles() + ticks < mc->next_report)
+		mcast_schedule(lc, ticks);
+}
+
+static int
+mcast_src_pass(const struct netbe_mcast_group *g, uint32_t src)
+{
+	uint32_t i;
+
+	for (i = 0; i != g->nb_src; i++) {
+		if (g->src[i].s_addr == src)
+			return g->mode == NETBE_MCAST_INCLUDE;
+	}
+	return g->mode == NETBE_MCAST_EXCLUDE;
+}
+
+/*
+ * Whether a packet goes on to TLDK: multicast datagrams only for a group
+ * joined and from a source it accepts, IGMP never.
+ */
+static int
+mcast_rx_pass(struct netbe_lcore *lc, struct netbe_mcast *mc,
+	const struct rte_mbuf *m)
+{
+	uint32_t l3;
+	const struct rte_ether_hdr *eth;
+	const struct rte_ipv4_hdr *iph;
+	struct netbe_mcast_group *g;
+
+	if (m->data_len < sizeof(*eth) + sizeof(*iph))
+		return 1;
+
+	eth = rte_pktmbuf_mtod(m, const struct rte_ether_hdr *);
+	if (eth->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+		return 1;
+
+	iph = (const struct rte_ipv4_hdr *)(eth + 1);
+	if (iph->next_proto_id == IPPROTO_IGMP) {
+		l3 = (iph->version_ihl & RTE_IPV4_HDR_IHL_MASK) *
+			RTE_IPV4_IHL_MULTIPLIER;
+		if (m->data_len >= sizeof(*eth) + l3 + IGMP_MIN_LEN)
+			mcast_igmp_input(lc, mc, (const uint8_t *)iph + l3,
+				m->data_len - sizeof(*eth) - l3);
+		return 0;
+	}
+
+	if (!RTE_IS_IPV4_MCAST(rte_be_to_cpu_32(iph->dst_addr)))
+		return 1;
+
+	g = mcast_find(mc, iph->dst_addr);
+	if (g == NULL) {
+		mc->stat.drop++;
+		return 0;
+	}
+	if (!mcast_src_pass(g, iph->src_addr)) {
+		g->drop++;
+		mc->stat.drop++;
+		return 0;
+	}
+	g->rx++;
+	return 1;
+}
+
+static uint16_t
+mcast_rx_callback(__rte_unused dpdk_port_t port, __rte_unused uint16_t queue,
+	struct rte_mbuf *pkt[], uint16_t nb_pkts,
+	__rte_unused uint16_t max_pkts, void *user_param)
+{
+	uint32_t j, k;
+	struct netbe_lcore *lc;
+	struct netbe_mcast *mc;
+
+	lc = user_param;
+	mc = lc->mcast;
+
+	/* nothing joined, multicast is left to TLDK as before. */
+	if (mc == NULL || mc->nb_group == 0)
+		return nb_pkts;
+
+	k = 0;
+	for (j = 0; j != nb_pkts; j++) {
+		if (mcast_rx_pass(lc, mc, pkt[j]))
+			pkt[k++] = pkt[j];
+		else
+			rte_pktmbuf_free(pkt[j]);
+	}
+	return k;
+}
+
+static struct netbe_mcast *
+mcast_get(struct netbe_lcore *lc)
+{
+	struct netbe_mcast *mc;
+
+	if (lc->mcast != NULL)
+		return lc->mcast;
+
+	mc = rte_zmalloc_socket(NULL, sizeof(*mc), RTE_CACHE_LINE_SIZE,
+		rte_lcore_to_socket_id(lc->id));
+	if (mc == NULL)
+		return NULL;
+
+	memset(mc->idx, 0xff, sizeof(mc->idx));
+	rte_timer_init(&mc->timer);
+	lc->mcast = mc;
+	mcast_schedule(lc, rte_get_timer_hz() * NETBE_MCAST_REPORT_MS /
+		MS_PER_S);
+	return mc;
+}
+
+int
+netbe_mcast_join(struct netbe_lcore *lc, const struct in_addr *grp,
+	uint32_t mode, const struct in_addr *src, uint32_t nb_src)
+{
+	uint32_t i;
+	char str[INET_ADDRSTRLEN];
+	struct rte_ether_addr mac;
+	struct netbe_mcast *mc;
+	struct netbe_mcast_group *g;
+
+	if (lc == NULL)
+		return -EINVAL;
+	if (!RTE_IS_IPV4_MCAST(rte_be_to_cpu_32(grp->s_addr)))
+		return -EINVAL;
+	if (nb_src > NETBE_MCAST_MAX_SRC)
+		return -E2BIG;
+
+	mc = mcast_get(lc);
+	if (mc == NULL)
+		return -ENOMEM;
+
+	g = mcast_find(mc, grp->s_addr);
+	if (g != NULL) {
+		g->ref++;
+		return 0;
+	}
+	if (mc->nb_group == RTE_DIM(mc->group))
+		return -ENOSPC;
+
+	g = mc->group + mc->nb_group;
+	memset(g, 0, sizeof(*g));
+	g->addr = *grp;
+	g->ref = 1;
+	g->mode = mode;
+	g->nb_src = nb_src;
+	for (i = 0; i != nb_src; i++)
+		g->src[i] = src[i];
+
+	netbe_mcast_ether_addr(grp->s_addr, &mac);
+	for (i = 0; i != lc->prtq_num; i++)
+		mcast_port_add(lc->prtq[i].port.id, &mac);
+
+	mcast_idx_add(mc, mc->nb_group);
+	mc->nb_group++;
+	mcast_send_all(lc, g, MCAST_SEND_CHANGE);
+
+	inet_ntop(AF_INET, grp, str, sizeof(str));
+	RTE_LOG(NOTICE, USER1, "%s(lcore=%u): joined %s, %s %u sources "
+		"(IGMPv%u);\n",
+		__func__, lc->id, str,
+		(mode == NETBE_MCAST_INCLUDE) ? "include" : "exclude",
+		nb_src, (nb_src == 0) ? 2 : 3);
+	return 0;
+}
+
+int
+netbe_mcast_leave(struct netbe_lcore *lc, const struct in_addr *grp)
+{
+	uint32_t i, j;
+	char str[INET_ADDRSTRLEN];
+	struct rte_ether_addr mac;
+	struct netbe_mcast *mc;
+	struct netbe_mcast_group *g;
+
+	if (lc == NULL || lc->mcast == NULL)
+		return -ENOENT;
+
+	mc = lc->mcast;
+	g = mcast_find(mc, grp->s_addr);
+	if (g == NULL)
+		return -ENOENT;
+	if (--g->ref != 0)
+		return 0;
+
+	mcast_send_all(lc, g, MCAST_SEND_LEAVE);
+	netbe_mcast_ether_addr(grp->s_addr, &mac);
+	for (i = 0; i != lc->prtq_num; i++)
+		mcast_port_del(lc->prtq[i].port.id, &mac);
+
+	inet_ntop(AF_INET, grp, str, sizeof(str));
+	RTE_LOG(NOTICE, USER1, "%s(lcore=%u): left %s, "
+		"rx=%" PRIu64 ", drop=%" PRIu64 ";\n",
+		__func__, lc->id, str, g->rx, g->drop);
+
+	j = g - mc->group;
+	mc->nb_group--;
+	if (j != mc->nb_group)
+		mc->group[j] = mc->group[mc->nb_group];
+	mcast_idx_rebuild(mc);
+	return 0;
+}
+
+int
+netbe_mcast_setup_rx_cb(const struct netbe_port *uprt,
+	struct netbe_lcore *lc, uint16_t qid)
+{
+	const void *cb;
+
+	cb = rte_eth_add_rx_callback(uprt->id, qid, mcast_rx_callback, lc);
+	if (cb == NULL) {
+		RTE_LOG(ERR, USER1,
+			"%s(port=%u): setup multicast RX callback failed;\n",
+			__func__, uprt->id);
+		return -rte_errno;
+	}
+	return 0;
+}
+
+void
+netbe_mcast_fini(struct netbe_lcore *lc)
+{
+	struct netbe_mcast *mc;
+	struct in_addr grp;
+
+	mc = lc->mcast;
+	if (mc == NULL)
+		return;
+
+	rte_timer_stop(&mc->timer);
+	while (mc->nb_group != 0) {
+		grp = mc->group[0].addr;
+		mc->group[0].ref = 1;
+		netbe_mcast_leave(lc, &grp);
+	}
+
+	RTE_LOG(NOTICE, USER1, "%s(lcore=%u): mcast_stats={report=%" PRIu64
+		",leave=%" PRIu64 ",query=%" PRIu64 ",drop=%" PRIu64 "};\n",
+		__func__, lc->id, mc->stat.report, mc->stat.leave,
+		mc->stat.query, mc->stat.drop);
+
+	lc->mcast = NULL;
+	rte_free(mc);
+}
@@ -13,6 +13,24 @@ static const struct {
 	{ .name = "fwd", .op = FWD,},
 };
 
+static const struct {
+	const char *name;
+	enum nspk_rtp_egress egress;
+} name2egress[] = {
+	{ .name = "url", .egress = NSPK_RTP_EGRESS_URL,},
+	{ .name = "mbuf", .egress = NSPK_RTP_EGRESS_MBUF,},
+	{ .name = "native", .egress = NSPK_RTP_EGRESS_NATIVE,},
+};
+
+static const struct {
+	const char *name;
+	int type;
+} name2thread_type[] = {
+	{ .name = "slice", .type = FF_THREAD_SLICE,},
+	{ .name = "frame", .type = FF_THREAD_FRAME,},
+	{ .name = "auto", .type = FF_THREAD_SLICE | FF_THREAD_FRAME,},
+};
+
 #define	OPT_SHORT_SBULK		'B'
 #define	OPT_LONG_SBULK		"sburst"
 
@@ -43,6 +61,18 @@ static const struct {
 #define	OPT_SHORT_FECFG	'f'
 #define	OPT_LONG_FECFG	"fecfg"
 
+#define	OPT_SHORT_RTPCFG	'r'
+#define	OPT_LONG_RTPCFG	"rtpcfg"
+
+#define	OPT_SHORT_TXFLUSH	'F'
+#define	OPT_LONG_TXFLUSH	"txflush"
+
+#define	OPT_SHORT_RTSP	't'
+#define	OPT_LONG_RTSP	"rtsp"
+
+#define	OPT_SHORT_HTTP	'h'
+#define	OPT_LONG_HTTP	"http"
+
 #define	OPT_SHORT_STREAMS	's'
 #define	OPT_LONG_STREAMS	"streams"
 
@@ -80,6 +110,10 @@ static const struct option long_opt[] = {
 	{OPT_LONG_SBUFS, 1, 0, OPT_SHORT_SBUFS},
 	{OPT_LONG_BECFG, 1, 0, OPT_SHORT_BECFG},
 	{OPT_LONG_FECFG, 1, 0, OPT_SHORT_FECFG},
+	{OPT_LONG_RTPCFG, 1, 0, OPT_SHORT_RTPCFG},
+	{OPT_LONG_TXFLUSH, 1, 0, OPT_SHORT_TXFLUSH},
+	{OPT_LONG_RTSP, 1, 0, OPT_SHORT_RTSP},
+	{OPT_LONG_HTTP, 1, 0, OPT_SHORT_HTTP},
 	{OPT_LONG_STREAMS, 1, 0, OPT_SHORT_STREAMS},
 	{OPT_LONG_UDP, 0, 0, OPT_SHORT_UDP},
 	{OPT_LONG_TCP, 0, 0, OPT_SHORT_TCP},
@@ -210,6 +244,60 @@ parse_feop_val(__rte_unused const char *key, const char *val, void *prm)
 	return -EINVAL;
 }
 
+static int
+parse_egress_val(__rte_unused const char *key, const char *val, void *prm)
+{
+	uint32_t i;
+	union parse_val *rv;
+
+	rv = prm;
+	for (i = 0; i != RTE_DIM(name2egress); i++) {
+		if (strcmp(val, name2egress[i].name) == 0) {
+			rv->u64 = name2egress[i].egress;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int
+parse_thread_type_val(__rte_unused const char *key, const char *val,
+	void *prm)
+{
+	uint32_t i;
+	union parse_val *rv;
+
+	rv = prm;
+	for (i = 0; i != RTE_DIM(name2thread_type); i++) {
+		if (strcmp(val, name2thread_type[i].name) == 0) {
+			rv->u64 = name2thread_type[i].type;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int
+parse_codec_val(__rte_unused const char *key, const char *val, void *prm)
+{
+	union parse_val *rv;
+	const AVCodecDescriptor *desc;
+
+	rv = prm;
+	if (strcmp(val, "auto") == 0) {
+		rv->u64 = AV_CODEC_ID_NONE;
+		return 0;
+	}
+
+	desc = avcodec_descriptor_get_by_name(val);
+	if (desc == NULL)
+		return -EINVAL;
+	rv->u64 = desc->id;
+	return 0;
+}
+
 static int
 parse_lcore_list_val(__rte_unused const char *key, const char *val, void *prm)
 {
@@ -758,6 +846,211 @@ netfe_parse_cfg(const char *fname, struct netfe_lcore_prm *lp)
 	return rc;
 }
 
+/*
+ * RFC 4588 takes a dynamic payload type, other than those of the media:
+ * the video and audio of a session take 96 and 97. The rungs of a ladder
+ * are checked when their outputs open.
+ */
+#define	RTX_PT_MIN	96
+#define	RTX_PT_MAX	127
+#define	RTX_PT_MEDIA	2
+
+static int
+check_rtx_pt(const char *func, uint64_t pt)
+{
+	if (pt == 0)
+		return 0;
+	if (pt < RTX_PT_MIN || pt > RTX_PT_MAX) {
+		RTE_LOG(ERR, USER1, "%s: rtxpt must be within %u-%u\n",
+			func, RTX_PT_MIN, RTX_PT_MAX);
+		return -EINVAL;
+	}
+	if (pt < RTX_PT_MIN + RTX_PT_MEDIA) {
+		RTE_LOG(ERR, USER1, "%s: rtxpt %u is the payload type "
+			"of a media stream\n", func, (uint32_t)pt);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int
+parse_nspk_rtp_arg(struct nspk_rtp_sess_prm *sp, char *line)
+{
+	int32_t rc;
+	char *arg, *src, *dst, *end;
+
+	static const char *keys_man[] = {
+		"lcore",
+	};
+
+	static const char *keys_opt[] = {
+		"egress",
+		"vcodec",
+		"acodec",
+		"readrate",
+		"pipeline",
+		"ccpu",
+		"passthrough",
+		"pace",
+		"rtcp",
+		"cc",
+		"vbitrate",
+		"rtx",
+		"rtxpt",
+		"cthreads",
+		"ctype",
+	};
+
+	static const arg_handler_t hndl[] = {
+		parse_uint_val,
+		parse_egress_val,
+		parse_codec_val,
+		parse_codec_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_thread_type_val,
+	};
+
+	union parse_val val[RTE_DIM(hndl)];
+
+	/* URLs may hold ',' and '=', so they follow the key-value list. */
+	arg = strtok_r(line, " \t", &end);
+	src = strtok_r(NULL, " \t", &end);
+	dst = strtok_r(NULL, " \t", &end);
+	if (arg == NULL || src == NULL || dst == NULL ||
+			strtok_r(NULL, " \t", &end) != NULL) {
+		RTE_LOG(ERR, USER1, "%s: expected \"<key=val,...> "
+			"<src_url> <dst_url>\"\n", __func__);
+		return -EINVAL;
+	}
+
+	memset(val, 0, sizeof(val));
+	val[1].u64 = NSPK_RTP_EGRESS_NATIVE;
+	val[2].u64 = AV_CODEC_ID_H264;
+	val[3].u64 = AV_CODEC_ID_AAC;
+	val[4].u64 = 1;
+	val[6].u64 = UINT64_MAX;
+	val[8].u64 = 1;
+	val[9].u64 = 1;
+	rc = parse_kvargs(arg, keys_man, RTE_DIM(keys_man),
+		keys_opt, RTE_DIM(keys_opt), hndl, val);
+	if (rc != 0)
+		return rc;
+
+	rc = check_rtx_pt(__func__, val[13].u64);
+	if (rc != 0)
+		return rc;
+
+	if (strlen(src) >= sizeof(sp->sess.src_url) ||
+			strlen(dst) >= sizeof(sp->sess.dst_url))
+		return -ENAMETOOLONG;
+
+	sp->lcore = val[0].u64;
+	sp->sess.egress = val[1].u64;
+	sp->sess.video_codec = val[2].u64;
+	sp->sess.audio_codec = val[3].u64;
+	sp->sess.readrate = val[4].u64 != 0;
+	sp->sess.pipeline = val[5].u64 != 0;
+	sp->sess.codec_cpu = (val[6].u64 < CPU_SETSIZE) ? (int)val[6].u64 : -1;
+	sp->sess.passthrough = val[7].u64 != 0;
+	sp->sess.pace = val[8].u64 != 0;
+	sp->sess.rtcp = val[9].u64 != 0;
+	sp->sess.cc = val[10].u64 != 0;
+	sp->sess.video_kbps = RTE_MIN(val[11].u64, (uint64_t)INT32_MAX);
+	sp->sess.rtx_ms = RTE_MIN(val[12].u64, (uint64_t)INT32_MAX);
+	sp->sess.rtx_pt = val[13].u64;
+	sp->sess.codec_threads = RTE_MIN(val[14].u64, (uint64_t)INT32_MAX);
+	sp->sess.codec_thread_type = val[15].u64;
+	strcpy(sp->sess.src_url, src);
+	strcpy(sp->sess.dst_url, dst);
+
+	return 0;
+}
+
+int
+nspk_parse_rtp_cfg(const char *fname, struct nspk_rtp_cfg *cfg)
+{
+	uint32_t i, ln, n, num;
+	int32_t rc;
+	size_t sz;
+	char *s;
+	FILE *f;
+	struct nspk_rtp_sess_prm *sp;
+	char line[LINE_MAX];
+
+	f = fopen(fname, "r");
+	if (f == NULL) {
+		RTE_LOG(ERR, USER1, "%s failed to open file \"%s\"\n",
+			__func__, fname);
+		return -EINVAL;
+	}
+
+	n = 0;
+	num = 0;
+	sp = NULL;
+	rc = 0;
+	for (ln = 0; fgets(line, sizeof(line), f) != NULL; ln++) {
+
+		/* skip spaces at the start. */
+		for (s = line; isspace(s[0]); s++)
+			;
+
+		/* skip comment line. */
+		if (s[0] == '#' || s[0] == 0)
+			continue;
+
+		/* skip spaces at the end. */
+		for (i = strlen(s); i-- != 0 && isspace(s[i]); s[i] = 0)
+			;
+
+		if (n == num) {
+			num += DEF_LINE_NUM;
+			sz = sizeof(sp[0]) * num;
+			sp = realloc(sp, sizeof(sp[0]) * num);
+			if (sp == NULL) {
+				RTE_LOG(ERR, USER1,
+					"%s(%s) allocation of %zu bytes "
+					"failed\n",
+					__func__, fname, sz);
+				rc = -ENOMEM;
+				break;
+			}
+			memset(&sp[n], 0, sizeof(sp[0]) * (num - n));
+		}
+
+		sp[n].line = ln + 1;
+		sp[n].sess.session_id = n;
+		rc = parse_nspk_rtp_arg(sp + n, s);
+		if (rc != 0) {
+			RTE_LOG(ERR, USER1, "%s(%s) failed to parse line %u\n",
+				__func__, fname, sp[n].line);
+			break;
+		}
+		n++;
+	}
+
+	fclose(f);
+
+	if (rc != 0) {
+		free(sp);
+		sp = NULL;
+		n = 0;
+	}
+
+	cfg->sess = sp;
+	cfg->nb_sess = n;
+	return rc;
+}
+
 static uint32_t
 parse_hash_alg(const char *val)
 {
@@ -805,10 +1098,259 @@ read_tx_content(const char *fname, struct tx_content *tx)
 	return rc;
 }
 
+int
+nspk_parse_txflush(const char *arg, struct nspk_tldk_flush_prm *prm)
+{
+	int32_t rc;
+
+	static const char *keys_opt[] = {
+		"hwm",
+		"delay",
+		"marker",
+	};
+
+	static const arg_handler_t hndl[] = {
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+	};
+
+	union parse_val val[RTE_DIM(hndl)];
+
+	memset(val, 0, sizeof(val));
+	val[0].u64 = prm->hwm;
+	val[1].u64 = prm->delay_us;
+	val[2].u64 = prm->marker;
+	rc = parse_kvargs(arg, NULL, 0, keys_opt, RTE_DIM(keys_opt),
+		hndl, val);
+	if (rc != 0)
+		return rc;
+
+	if (val[0].u64 == 0 || val[0].u64 > NSPK_TLDK_FLUSH_HWM_MAX ||
+			val[1].u64 > UINT32_MAX) {
+		RTE_LOG(ERR, USER1, "%s: hwm must be 1-%u, delay at most "
+			"%u us\n", __func__, NSPK_TLDK_FLUSH_HWM_MAX,
+			UINT32_MAX);
+		return -EINVAL;
+	}
+
+	prm->hwm = val[0].u64;
+	prm->delay_us = val[1].u64;
+	prm->marker = val[2].u64 != 0;
+	return 0;
+}
+
+int
+nspk_parse_rtsp(const char *arg, struct nspk_rtsp_prm *prm)
+{
+	int32_t rc;
+	char *line, *kv, *root, *end;
+	struct stat st;
+
+	static const char *keys_opt[] = {
+		"port",
+		"ports",
+		"conn",
+		"rtpport",
+		"vcodec",
+		"acodec",
+		"passthrough",
+		"vbitrate",
+		"cc",
+		"rtx",
+		"rtxpt",
+	};
+
+	static const arg_handler_t hndl[] = {
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_codec_val,
+		parse_codec_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+	};
+
+	union parse_val val[RTE_DIM(hndl)];
+
+	/* the root may hold ',' and '=', so it follows the key-value list. */
+	line = strdup(arg);
+	if (line == NULL)
+		return -ENOMEM;
+	kv = strtok_r(line, " \t", &end);
+	root = strtok_r(NULL, " \t", &end);
+	if (root == NULL) {
+		root = kv;
+		kv = NULL;
+	}
+	if (root == NULL || strtok_r(NULL, " \t", &end) != NULL) {
+		RTE_LOG(ERR, USER1, "%s: expected \"[<key=val,...>] "
+			"<root>\"\n", __func__);
+		free(line);
+		return -EINVAL;
+	}
+
+	memset(val, 0, sizeof(val));
+	val[0].u64 = prm->port;
+	val[1].u64 = prm->nb_port;
+	val[2].u64 = prm->max_conn;
+	val[3].u64 = prm->rtp_port;
+	val[4].u64 = prm->tmpl.video_codec;
+	val[5].u64 = prm->tmpl.audio_codec;
+	val[6].u64 = prm->tmpl.passthrough;
+	val[7].u64 = prm->tmpl.video_kbps;
+	val[8].u64 = prm->tmpl.cc;
+	val[9].u64 = prm->tmpl.rtx_ms;
+	val[10].u64 = prm->tmpl.rtx_pt;
+	rc = (kv == NULL) ? 0 : parse_kvargs(kv, NULL, 0, keys_opt,
+		RTE_DIM(keys_opt), hndl, val);
+	if (rc != 0) {
+		free(line);
+		return rc;
+	}
+
+	if (val[0].u64 == 0 || val[1].u64 == 0 ||
+			val[1].u64 > NSPK_RTSP_MAX_LISTEN ||
+			val[0].u64 + val[1].u64 - 1 > UINT16_MAX ||
+			val[2].u64 == 0 || val[2].u64 > UINT16_MAX ||
+			val[3].u64 == 0 || val[3].u64 >= FIRST_PORT) {
+		RTE_LOG(ERR, USER1, "%s: ports must be 1-%u, conn 1-%u "
+			"and rtpport below %u\n", __func__,
+			NSPK_RTSP_MAX_LISTEN, UINT16_MAX, FIRST_PORT);
+		free(line);
+		return -EINVAL;
+	}
+
+	rc = check_rtx_pt(__func__, val[10].u64);
+	if (rc != 0) {
+		free(line);
+		return rc;
+	}
+
+	/* DESCRIBE announces the tracks before any session is opened. */
+	if (!nspk_rtp_pktzr_supported(val[4].u64) ||
+			!nspk_rtp_pktzr_supported(val[5].u64)) {
+		RTE_LOG(ERR, USER1, "%s: vcodec and acodec must be codecs "
+			"of the native packetizer\n", __func__);
+		free(line);
+		return -EINVAL;
+	}
+
+	if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode) ||
+			strlen(root) >= sizeof(prm->root)) {
+		RTE_LOG(ERR, USER1, "%s: \"%s\" is not a directory\n",
+			__func__, root);
+		free(line);
+		return -EINVAL;
+	}
+
+	prm->enable = 1;
+	prm->port = val[0].u64;
+	prm->nb_port = val[1].u64;
+	prm->max_conn = val[2].u64;
+	prm->rtp_port = val[3].u64;
+	prm->tmpl.video_codec = val[4].u64;
+	prm->tmpl.audio_codec = val[5].u64;
+	prm->tmpl.passthrough = val[6].u64 != 0;
+	prm->tmpl.video_kbps = RTE_MIN(val[7].u64, (uint64_t)INT32_MAX);
+	prm->tmpl.cc = val[8].u64 != 0;
+	prm->tmpl.rtx_ms = RTE_MIN(val[9].u64, (uint64_t)INT32_MAX);
+	prm->tmpl.rtx_pt = val[10].u64;
+	strcpy(prm->root, root);
+	free(line);
+	return 0;
+}
+
+int
+nspk_parse_http(const char *arg, struct nspk_http_prm *prm)
+{
+	int32_t rc;
+	char *line, *kv, *root, *end;
+	struct stat st;
+
+	static const char *keys_opt[] = {
+		"port",
+		"ports",
+		"conn",
+		"cache",
+	};
+
+	static const arg_handler_t hndl[] = {
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+		parse_uint_val,
+	};
+
+	union parse_val val[RTE_DIM(hndl)];
+
+	/* the root may hold ',' and '=', so it follows the key-value list. */
+	line = strdup(arg);
+	if (line == NULL)
+		return -ENOMEM;
+	kv = strtok_r(line, " \t", &end);
+	root = strtok_r(NULL, " \t", &end);
+	if (root == NULL) {
+		root = kv;
+		kv = NULL;
+	}
+	if (root == NULL || strtok_r(NULL, " \t", &end) != NULL) {
+		RTE_LOG(ERR, USER1, "%s: expected \"[<key=val,...>] "
+			"<root>\"\n", __func__);
+		free(line);
+		return -EINVAL;
+	}
+
+	memset(val, 0, sizeof(val));
+	val[0].u64 = prm->port;
+	val[1].u64 = prm->nb_port;
+	val[2].u64 = prm->max_conn;
+	val[3].u64 = prm->cache_size >> 20;
+	rc = (kv == NULL) ? 0 : parse_kvargs(kv, NULL, 0, keys_opt,
+		RTE_DIM(keys_opt), hndl, val);
+	if (rc != 0) {
+		free(line);
+		return rc;
+	}
+
+	if (val[0].u64 == 0 || val[1].u64 == 0 ||
+			val[1].u64 > NSPK_HTTP_MAX_LISTEN ||
+			val[0].u64 + val[1].u64 - 1 > UINT16_MAX ||
+			val[2].u64 == 0 || val[2].u64 > UINT16_MAX ||
+			val[3].u64 == 0 || val[3].u64 > (UINT64_MAX >> 20)) {
+		RTE_LOG(ERR, USER1, "%s: ports must be 1-%u, conn 1-%u "
+			"and cache (MiB) above 0\n", __func__,
+			NSPK_HTTP_MAX_LISTEN, UINT16_MAX);
+		free(line);
+		return -EINVAL;
+	}
+
+	if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode) ||
+			strlen(root) >= sizeof(prm->root)) {
+		RTE_LOG(ERR, USER1, "%s: \"%s\" is not a directory\n",
+			__func__, root);
+		free(line);
+		return -EINVAL;
+	}
+
+	prm->enable = 1;
+	prm->port = val[0].u64;
+	prm->nb_port = val[1].u64;
+	prm->max_conn = val[2].u64;
+	prm->cache_size = val[3].u64 << 20;
+	strcpy(prm->root, root);
+	free(line);
+	return 0;
+}
+
 int
 parse_app_options(int argc, char **argv, struct netbe_cfg *cfg,
 	struct tle_ctx_param *ctx_prm,
-	char *fecfg_fname, char *becfg_fname)
+	char *fecfg_fname, char *becfg_fname, char *rtpcfg_fname)
 {
 	int32_t opt, opt_idx, rc;
 	uint64_t v;
@@ -818,7 +1360,7 @@ parse_app_options(int argc, char **argv, struct netbe_cfg *cfg,
 
 	optind = 0;
 	optarg = NULL;
-	while ((opt = getopt_long(argc, argv, "aB:C:c:LPR:S:M:TUb:f:s:v:H:K:W:w:",
+	while ((opt = getopt_long(argc, argv, "aB:C:c:F:LPR:S:M:TUb:f:h:r:s:t:v:H:K:W:w:",
 			long_opt, &opt_idx)) != EOF) {
 		if (opt == OPT_SHORT_ARP) {
 			cfg->arp = 1;
@@ -879,6 +1421,27 @@ parse_app_options(int argc, char **argv, struct netbe_cfg *cfg,
 		} else if (opt == OPT_SHORT_FECFG) {
 			snprintf(fecfg_fname, PATH_MAX, "%s",
 				optarg);
+		} else if (opt == OPT_SHORT_RTPCFG) {
+			snprintf(rtpcfg_fname, PATH_MAX, "%s",
+				optarg);
+		} else if (opt == OPT_SHORT_TXFLUSH) {
+			rc = nspk_parse_txflush(optarg, &nspk_tldk_flush_prm);
+			if (rc < 0)
+				rte_exit(EXIT_FAILURE, "%s: invalid value: %s "
+					"for option: \'%c\'\n",
+					__func__, optarg, opt);
+		} else if (opt == OPT_SHORT_RTSP) {
+			rc = nspk_parse_rtsp(optarg, &nspk_rtsp_prm);
+			if (rc < 0)
+				rte_exit(EXIT_FAILURE, "%s: invalid value: %s "
+					"for option: \'%c\'\n",
+					__func__, optarg, opt);
+		} else if (opt == OPT_SHORT_HTTP) {
+			rc = nspk_parse_http(optarg, &nspk_http_prm);
+			if (rc < 0)
+				rte_exit(EXIT_FAILURE, "%s: invalid value: %s "
+					"for option: \'%c\'\n",
+					__func__, optarg, opt);
 		} else if (opt == OPT_SHORT_UDP) {
 			udp = 1;
 			cfg->proto = TLE_PROTO_UDP;
@@ -948,6 +1511,24 @@ parse_app_options(int argc, char **argv, struct netbe_cfg *cfg,
 			"%s: listen mode cannot be opened with UDP\n",
 			__func__);
 
+	if (tcp && nspk_rtsp_prm.enable)
+		rte_exit(EXIT_FAILURE,
+			"%s: the RTSP server runs next to UDP only\n",
+			__func__);
+
+	if (tcp && nspk_http_prm.enable)
+		rte_exit(EXIT_FAILURE,
+			"%s: the HTTP origin runs next to UDP only\n",
+			__func__);
+
+	/* the listening streams and a connection each, of both servers. */
+	if (nspk_rtsp_prm.enable)
+		cfg->tcp_max_streams += nspk_rtsp_prm.max_conn +
+			nspk_rtsp_prm.nb_port;
+	if (nspk_http_prm.enable)
+		cfg->tcp_max_streams += nspk_http_prm.max_conn +
+			nspk_http_prm.nb_port;
+
 	if (udp && cfg->arp)
 		rte_exit(EXIT_FAILURE,
 			"%s: arp cannot be enabled with UDP\n",
@@ -878,6 +878,15 @@ typen_udp_rx_callback(dpdk_port_t port, __rte_unused uint16_t queue,
 	return compress_pkt_list(pkt, nb_pkts, x);
 }
 
+void
+netbe_pkt_tcp_hdr_len(struct rte_mbuf *pkt[], uint32_t num)
+{
+	uint32_t j;
+
+	for (j = 0; j != num; j++)
+		fill_eth_tcp_hdr_len(pkt[j]);
+}
+
 static uint32_t
 get_ptypes(const struct netbe_port *uprt)
 {
@@ -54,6 +54,9 @@ update_rss_conf(struct netbe_port *uprt,
 			port_conf->rx_adv_conf.rss_conf.rss_hf = ETH_RSS_TCP;
 		else
 			port_conf->rx_adv_conf.rss_conf.rss_hf = ETH_RSS_UDP;
+		/* the key only covers the destination port, as for UDP. */
+		if (becfg.tcp_max_streams != 0)
+			port_conf->rx_adv_conf.rss_conf.rss_hf |= ETH_RSS_TCP;
 		port_conf->rx_adv_conf.rss_conf.rss_key_len = hash_key_size;
 		port_conf->rx_adv_conf.rss_conf.rss_key = uprt->hash_key;
 	}
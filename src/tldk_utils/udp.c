@@ -233,6 +233,19 @@ int netfe_init_per_lcore_fe(const struct netfe_lcore_prm *prm)
 			__func__, lcore, fe->rxeq, fe->txeq);
 		if (fe->rxeq == NULL || fe->txeq == NULL)
 			return ENOMEM;
+
+		/* TCP streams of the BE's tcp_ctx also need these. */
+		if (becfg.tcp_max_streams != 0) {
+			fe->syneq = tle_evq_create(&eprm);
+			fe->ereq = tle_evq_create(&eprm);
+			fe->tcp_txeq = tle_evq_create(&eprm);
+			RTE_LOG(INFO, USER1, "%s(%u) syn evq=%p, err evq=%p, "
+				"tcp tx evq=%p\n", __func__, lcore, fe->syneq,
+				fe->ereq, fe->tcp_txeq);
+			if (fe->syneq == NULL || fe->ereq == NULL ||
+					fe->tcp_txeq == NULL)
+				return ENOMEM;
+		}
 	
 		rc = fwd_tbl_init(fe, AF_INET, lcore);
 		RTE_LOG(ERR, USER1, "%s(%u) fwd_tbl_init(%u) returns %d\n",
@@ -303,7 +316,7 @@ netfe_lcore_init_udp(const struct netfe_lcore_prm *prm)
 		fes->txlen = prm->stream[i].txlen;
 		fes->raddr = prm->stream[i].sprm.remote_addr;
 	}
-	netfe_put_stream(fe, &fe->use, fes + i);
+	netfe_put_stream(fe, &fe->use, fes);
 	i = fe->use.num;
 	RTE_LOG(INFO, USER1, "%s: Streams free=%u, used=%u(AFTER)\n",
 			__func__, fe->free.num, fe->use.num);
@@ -576,6 +589,7 @@ void
 netfe_tx_process_udp(uint32_t lcore, struct netfe_stream *fes)
 {
 	uint32_t i, k, n;
+	uint64_t len;
 
 	/* refill with new mbufs. */
 	// This is where we build the UDP packets.
@@ -589,6 +603,12 @@ netfe_tx_process_udp(uint32_t lcore, struct netfe_stream *fes)
 	 * TODO: cannot use function pointers for unequal param num.
 	 */
 	// Builds the UDP packet out of pkt and sends it to logical TLDK queue.
+	/* payload bytes, TLDK prepends the headers to what it takes. */
+	for (i = 0, len = 0; i != n; i++)
+		len += fes->pbuf.pkt[i]->pkt_len;
+	if (fes->tx_cb != NULL)
+		fes->tx_cb(fes, fes->pbuf.pkt, n);
+
 	k = tle_udp_stream_send(fes->s, fes->pbuf.pkt, n, NULL);
 	NETFE_TRACE("%s(%u): tle_%s_stream_send(%p, %u) returns %u\n",
 		__func__, lcore, proto_name[fes->proto], fes->s, n, k);
@@ -598,6 +618,10 @@ netfe_tx_process_udp(uint32_t lcore, struct netfe_stream *fes)
 	if (k == 0)
 		return;
 
+	for (i = k; i != n; i++)
+		len -= fes->pbuf.pkt[i]->pkt_len;
+	fes->stat.txb += len;
+
 	/* adjust pbuf array. */
 	fes->pbuf.num = n - k;
 	for (i = k; i != n; i++)
@@ -654,7 +678,6 @@ void
 netfe_lcore_fini_udp(void)
 {
 	struct netfe_lcore *fe;
-	uint32_t i;
 	struct tle_udp_stream_param uprm;
 	struct netfe_stream *fes;
 
@@ -662,7 +685,7 @@ netfe_lcore_fini_udp(void)
 	if (fe == NULL)
 		return;
 
-	for (i = 0; i != fe->use.num; i++) {
+	while (fe->use.num != 0) {
 		fes = netfe_get_stream(&fe->use);
 		tle_udp_stream_get_param(fes->s, &uprm);
 		netfe_stream_dump(fes, &uprm.local_addr, &uprm.remote_addr);
@@ -671,6 +694,12 @@ netfe_lcore_fini_udp(void)
 
 	tle_evq_destroy(fe->txeq);
 	tle_evq_destroy(fe->rxeq);
+	if (fe->syneq != NULL)
+		tle_evq_destroy(fe->syneq);
+	if (fe->ereq != NULL)
+		tle_evq_destroy(fe->ereq);
+	if (fe->tcp_txeq != NULL)
+		tle_evq_destroy(fe->tcp_txeq);
 	RTE_PER_LCORE(_fe) = NULL;
 	rte_free(fe);
 }